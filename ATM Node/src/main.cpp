@@ -2,11 +2,41 @@
  * ATM NODE (SLAVE) - ESP32
  * Chức năng: Trạm khí tượng (Nhiệt, Ẩm, Áp suất, Mưa, Gió, Ánh sáng)
  * Giao tiếp: NRF24L01 với Master Node
+ * Push Mode: Tự gửi AtmPayload theo chu kỳ Master cấu hình qua gói CFG
+ * ACK Payload: Master gửi "GETA" thì nạp sẵn [addr][AtmPayload] vào ACK, GET kế
+ *              tiếp lấy dữ liệu ngay trong ACK thay vì GET -> dữ liệu -> OK
+ * Lấy mẫu nền: task FreeRTOS trên core 0 đọc cảm biến mỗi SAMPLE_PERIOD_MS và
+ *              công bố snapshot hai ô; GET/Push/ACK chỉ chép snapshot mới nhất
+ *              nên thời gian trả lời không phụ thuộc DHT11/BMP280.
+ * Compact Payload: snapshot lưu sẵn dạng số nguyên có byte schema (13 byte thay
+ *              cho 21 byte float, xem Shared/NodeProtocol).
+ * Delta Report: Master cấu hình heartbeat và deadband (gói RPT); snapshot chưa
+ *              đổi quá deadband thì ACK payload chỉ mang [addr], push bị bỏ.
+ * Batch: Master cấu hình chu kỳ lấy mẫu (gói BAT), loop() xếp hàng snapshot cần
+ *              gửi kèm mốc giây; ACK payload/push mang khung batch nhiều mẫu,
+ *              còn mẫu thì đặt BATCH_MORE để Master hỏi tiếp.
+ * Relay: Master giao node con (gói RTE) cho node này khi chúng ngoài tầm Master.
+ *              Mỗi RELAY_POLL_MS relay tự hỏi từng node con bằng GETA, xếp hàng
+ *              số đo có tuổi rồi gửi lên Master trong khung relay (ACK payload
+ *              hoặc push) trước số đo của chính nó. Gói FWD của Master được phát
+ *              lại nguyên vẹn tới node con (cấu hình CFG/RPT/BAT/RTE).
+ * Channel: đăng ký ở CHANNEL_DEFAULT, gói CHN (phát chung ở pipe 0 hoặc gửi
+ *              riêng) đổi kênh làm việc; relay báo CHN cho từng node con trước
+ *              khi tự đổi. Push hỏng hết số lần thử thì dò lại kênh của Master.
+ * Link Rate: gói LNK chọn tốc độ/công suất nghe Master (không lưu Flash). Gói
+ *              tự phát (push, hỏi node con, FWD) luôn ở 250kbps/PA_HIGH, quá
+ *              lease không có GET thì quay về 250kbps.
+ * Gió: ISR chỉ ghi mốc xung vào vòng không khóa; task lấy mẫu chia xung vào ô
+ *              1 giây, Wind là trung bình 60 giây, gió giật (3 giây lớn nhất)
+ *              gửi trong trường gust của AtmPayload (SCHEMA_ATM_V2).
  */
 
 #include <SPI.h>
 #include <RF24.h>
 #include <EEPROM.h>
+#include <NodeProtocol.h>
+#include <SampleQueue.h>
+#include <RelayQueue.h>
 #include <Wire.h>
 #include <Adafruit_Sensor.h>
 #include <Adafruit_BMP280.h>
@@ -36,44 +66,174 @@ DHT dht(PIN_DHT, DHTTYPE);
 Adafruit_BMP280 bmp; // I2C (SDA=21, SCL=22)
 
 // --- BIẾN ĐO GIÓ ---
-volatile unsigned long windPulseCount = 0;
-unsigned long lastWindTime = 0;
+// ISR ghi mốc micros() của từng xung vào vòng windEdges rồi mới tăng windHead
+// (một bên ghi, không khóa); task lấy mẫu đọc từ windTail, chia xung vào các ô
+// 1 giây theo đúng mốc của chúng. Ngắt không bao giờ bị tắt hay gắn lại.
+#define WIND_RING         256      // Lũy thừa của 2; đủ cho 128 xung/giây giữa hai lần lấy mẫu
+#define WIND_DEBOUNCE_US  2000     // Công tắc lưỡi gà dội, bỏ cạnh sát cạnh trước
+#define WIND_BIN_US       1000000UL
+#define WIND_AVG_BINS     60       // Tốc độ gió: trung bình 60 giây gần nhất
+#define WIND_GUST_BINS    3        // Gió giật: trung bình 3 giây lớn nhất trong cửa sổ đó
+volatile uint32_t windEdges[WIND_RING];
+volatile uint32_t windHead = 0;
+uint32_t windTail = 0;             // Từ đây trở xuống chỉ task lấy mẫu dùng
+uint32_t windBinStart = 0;
+uint16_t windCurrent = 0;          // Xung của ô đang đếm
+uint16_t windBins[WIND_AVG_BINS];  // Các ô đã đủ 1 giây, vòng theo windBinNext
+uint8_t windBinNext = 0;
+uint8_t windBinsFilled = 0;
+uint32_t windWindowPulses = 0;     // Tổng windBins
 const float WIND_CUP_CIRCUMFERENCE = 0.565; // Chu vi quay (m)
 
 // --- CẤU HÌNH RADIO ---
 RF24 radio(PIN_CE, PIN_CSN);
 const uint64_t REGISTER_PIPE = 0xF0F0F0F0E1LL;
+const uint64_t REGISTER_REPLY_PIPE = 0xF0F0F0F0D2LL; // Master trả REG_OK tại đây
+const uint64_t PUSH_PIPE = 0xF0F0F0F0C3LL;           // Đích của gói Push Mode
 const uint64_t BASE_ADDR_PREFIX = 0xF0F0F0F000LL;
 const int EEPROM_ADDR_FLAG = 0; 
-#define EEPROM_SIZE 4 // Cần khai báo size cho ESP32
-
-// --- STRUCT DỮ LIỆU (PACKED - KHỚP 100% VỚI MASTER) ---
-struct __attribute__((packed)) AtmData {
-  float air_temp;
-  float air_humid;
-  uint8_t rain;       // Master nhận 0-100
-  float wind;
-  float light;
-  float pressure;
-};
+const int EEPROM_ADDR_NODE = 1; // Byte thấp địa chỉ pipe do Master cấp
+#define REG_LEGACY    1         // Cờ của FW cũ: địa chỉ tính bằng hash ID
+#define REG_ASSIGNED  2
+const int EEPROM_ADDR_PUSH = 2; // uint16_t chu kỳ Push (giây)
+const int EEPROM_ADDR_REPORT = 4; // ReportConfig (14 byte)
+const int EEPROM_ADDR_SAMPLE = 18; // uint16_t chu kỳ lấy mẫu (giây), 0 = không xếp hàng
+const int EEPROM_ADDR_CHILDREN = 20; // RELAY_CHILDREN byte địa chỉ node con, NO_CHILD = trống
+const int EEPROM_ADDR_CHANNEL = 28; // Kênh làm việc, 0xFF (Flash trắng) = CHANNEL_DEFAULT
+#define EEPROM_SIZE 32 // Cần khai báo size cho ESP32
+#define REPORT_FIELDS nodeproto::DEADBAND_FIELDS  // Gió giật theo deadband của gió
+#define PUSH_MAX_RETRIES 3
+#define SEARCH_RETRIES 5 // Số lần phát lại mỗi kênh khi dò kênh của Master
+#define SAMPLE_PERIOD_MS 2000 // DHT11 không đọc nhanh hơn 2s
+#define SAMPLER_STACK 4096
+#define SAMPLE_QUEUE 24 // Mẫu chờ gửi, 2 mẫu mỗi khung batch
+
+// --- RELAY ---
+#define RELAY_CHILDREN    8
+#define NO_CHILD          0xFF   // Ô trống (Master không cấp địa chỉ này), cũng là giá trị Flash đã xóa
+#define RELAY_QUEUE       32     // Số đo node con chờ gửi, 3 bản Soil mỗi khung relay
+#define RELAY_POLL_MS     10000  // Chu kỳ hỏi các node con
+#define RELAY_RX_PIPE     2      // Node con trả lời kiểu cũ (chưa nhận GETA lần nào) tới địa chỉ của nó
+#define RELAY_ATTEMPTS    3      // Số lần gửi GET cho mỗi khung của node con
+#define RELAY_REPLY_MS    100    // Chờ node con trả lời kiểu cũ, như POLL_MIN_TIMEOUT của Master
+#define RELAY_MAX_FRAMES  8      // Khung tối đa mỗi node con mỗi lượt (batch/relay con còn tiếp)
+#define RELAY_FRAME_GAP   3      // ms cho node con nạp khung kế tiếp, như BATCH_FRAME_GAP
+
+// --- STRUCT DỮ LIỆU (DÙNG CHUNG VỚI MASTER) ---
+using nodeproto::AtmPayload;
+using nodeproto::ChannelPacket;
+using nodeproto::LinkPacket;
 
 struct __attribute__((packed)) RegisterPacket {
   char cmd[4];
   char id[11];
 };
 
+struct __attribute__((packed)) ConfigPacket {
+  char cmd[4];            // "CFG"
+  uint16_t pushInterval;  // Giây, 0 = tắt Push Mode
+};
+
+struct __attribute__((packed)) ReportPacket {
+  char cmd[4];                       // "RPT"
+  uint16_t heartbeat;                // Giây, 0 = luôn gửi đủ
+  uint16_t deadband[REPORT_FIELDS];  // Phần mười đơn vị, theo thứ tự trường của AtmPayload
+};
+
+struct __attribute__((packed)) SamplePacket {
+  char cmd[4];              // "BAT"
+  uint16_t sampleInterval;  // Giây, 0 = tắt xếp hàng
+};
+
+struct __attribute__((packed)) RoutePacket {
+  char cmd[4];    // "RTE"
+  uint8_t child;  // Byte thấp địa chỉ node con
+  uint8_t add;    // 1 = nhận node con, 0 = trả về cho Master hỏi trực tiếp
+};
+
+// Gói Master gửi cho node con qua relay: header + nguyên gói gốc
+struct __attribute__((packed)) ForwardHeader {
+  char cmd[4];    // "FWD"
+  uint8_t addr;   // Node nhận gói gốc (node con hoặc relay kế tiếp)
+};
+
+struct __attribute__((packed)) RegisterAck {
+  char cmd[7];      // "REG_OK"
+  char id[11];
+  uint8_t addr;
+};
+
+struct ReportConfig {
+  uint16_t heartbeat;
+  uint16_t deadband[REPORT_FIELDS];
+};
+
 // --- BIẾN HỆ THỐNG ---
 bool isRegistered = false;
 uint64_t myAddress;
 unsigned long lastBlink = 0;
 
+// --- RADIO ---
+uint8_t radioChannel = nodeproto::CHANNEL_DEFAULT;
+uint8_t linkRate = nodeproto::RATE_BASE;  // Tốc độ nghe do Master chọn, khởi động lại là về gốc
+uint8_t linkPa = RF24_PA_HIGH;
+uint16_t linkLease = 0;          // Giây
+unsigned long linkHeard = 0;     // millis() lần nhận GET gần nhất
+
+// --- PUSH MODE ---
+uint16_t pushInterval = 0;
+unsigned long nextPush = 0;
+uint8_t pushFails = 0;
+
+// --- ACK PAYLOAD ---
+bool ackMode = false;    // Master đã gửi "GETA"
+bool ackLoaded = false;  // FIFO TX đang giữ số đo cho ACK kế tiếp
+uint32_t preloadSeq = 0; // Snapshot đang nằm trong ACK payload
+bool preloadFull = false; // ACK payload là bản đủ, không phải gói "không đổi"
+AtmPayload preloaded;
+uint8_t preloadTaken = 0; // Số mẫu của hàng đợi nằm trong ACK payload đang nạp
+uint8_t relayTaken = 0;   // Số mục của hàng relay nằm trong ACK payload đang nạp
+
+// --- DELTA REPORT ---
+ReportConfig report;      // heartbeat 0 = mọi lần gửi đều đủ số đo
+AtmPayload lastSent;         // Bản đủ gần nhất Master đã nhận, mốc cho deadband
+unsigned long lastSentAt = 0;
+bool hasSent = false;
+
+// --- BATCH ---
+// Chỉ loop() (core 1) đụng tới hàng đợi, task lấy mẫu vẫn chỉ ghi snapshot
+nodeproto::SampleQueue<AtmPayload, SAMPLE_QUEUE> samples;
+uint16_t sampleInterval = 0;
+unsigned long lastQueued = 0;
+uint32_t queuedSeq = 0;   // Snapshot đã xếp hàng gần nhất, không xếp một snapshot hai lần
+
+// --- RELAY ---
+uint8_t children[RELAY_CHILDREN];
+nodeproto::RelayQueue<RELAY_QUEUE> relayed;
+unsigned long lastRelayPoll = 0;
+uint8_t relayCursor = RELAY_CHILDREN;  // Node con kế tiếp của lượt hỏi, RELAY_CHILDREN = không có lượt dở
+
+// --- SNAPSHOT CẢM BIẾN ---
+// Task lấy mẫu ghi vào ô chưa công bố rồi mới tăng snapshotSeq, ô đang công bố là
+// snapshotSeq & 1. Bên đọc chép lại nếu seq đổi trong lúc chép (task đã công bố
+// hai lần và ghi đè đúng ô đang đọc), không cần khóa chặn loop().
+AtmPayload snapshots[2];
+volatile uint32_t snapshotSeq = 0;
+
 // --- HÀM NGẮT ĐẾM GIÓ ---
 void IRAM_ATTR countWindPulse() {
-  windPulseCount++;
+  static uint32_t lastEdge = 0;
+  uint32_t now = micros();
+  if (now - lastEdge < WIND_DEBOUNCE_US) return;
+  lastEdge = now;
+  uint32_t head = windHead;
+  windEdges[head & (WIND_RING - 1)] = now;
+  __sync_synchronize(); // Mốc ghi xong rồi mới công bố
+  windHead = head + 1;
 }
 
-// --- HÀM HASH ĐỊA CHỈ ---
-uint64_t generateNodeAddress(const char* str) {
+// --- HÀM HASH ĐỊA CHỈ (CHỈ CÒN DÙNG CHO NODE ĐĂNG KÝ TỪ FW CŨ) ---
+uint64_t legacyNodeAddress(const char* str) {
     unsigned long hash = 5381;
     int c;
     while ((c = *str++)) hash = ((hash << 5) + hash) + c;
@@ -82,8 +242,20 @@ uint64_t generateNodeAddress(const char* str) {
 
 // Forward declaration
 void registerToMaster();
+void resumeListening();
+void beginUplink();
+void checkLinkLease();
+void preloadReading();
 void listenAndReply();
-void readSensors(AtmData &data);
+void pushReading();
+void takeSample();
+void serviceRelay();
+void readSensors(AtmPayload &data);
+float windSpeed(float &gust);
+void sampleSensors();
+uint32_t latestReading(AtmPayload &data);
+void startSampler();
+void serviceSampler();
 void handleButton();
 
 void setup() {
@@ -107,7 +279,9 @@ void setup() {
         Serial.println(F("BMP280 Error!"));
     }
   }
-  lastWindTime = millis();
+  windBinStart = micros();
+  sampleSensors(); // Snapshot đầu tiên có trước khi trả lời GET nào
+  startSampler();
 
   // 4. Khởi động Radio
   if (!radio.begin()) {
@@ -118,22 +292,36 @@ void setup() {
   // Cấu hình NRF (Giống Soil Node & Master)
   radio.setPALevel(RF24_PA_HIGH); 
   radio.setDataRate(RF24_250KBPS);
-  radio.setRetries(5, 15);
+  radio.setRetries(15, 15); // Master có thể đang bận phát GET cho node khác, thử lại lâu hơn
   radio.enableDynamicPayloads();
-  
-  // Tính địa chỉ
-  myAddress = generateNodeAddress(MY_NODE_ID);
+  radio.enableAckPayload(); // Payload chỉ được nạp khi Master hỗ trợ
   
   Serial.print("Node ID: "); Serial.println(MY_NODE_ID);
-  Serial.printf("Address: %08X%08X\n", (uint32_t)(myAddress >> 32), (uint32_t)myAddress);
-  Serial.print("Struct Size AtmData: "); Serial.println(sizeof(AtmData));
+  Serial.print("Struct Size AtmPayload: "); Serial.println(sizeof(AtmPayload));
+
+  EEPROM.get(EEPROM_ADDR_PUSH, pushInterval);
+  if (pushInterval == 0xFFFF) pushInterval = 0; // Flash chưa ghi
+  EEPROM.get(EEPROM_ADDR_REPORT, report);
+  if (report.heartbeat == 0xFFFF) memset(&report, 0, sizeof(report));
+  EEPROM.get(EEPROM_ADDR_SAMPLE, sampleInterval);
+  if (sampleInterval == 0xFFFF) sampleInterval = 0;
+  EEPROM.get(EEPROM_ADDR_CHILDREN, children);
+  radioChannel = EEPROM.read(EEPROM_ADDR_CHANNEL);
+  if (!nodeproto::validChannel(radioChannel)) radioChannel = nodeproto::CHANNEL_DEFAULT;
+  radio.setChannel(radioChannel);
 
   // Kiểm tra trạng thái đăng ký cũ
-  if (EEPROM.read(EEPROM_ADDR_FLAG) == 1) {
+  uint8_t regFlag = EEPROM.read(EEPROM_ADDR_FLAG);
+  if (regFlag == REG_ASSIGNED || regFlag == REG_LEGACY) {
     isRegistered = true;
+    // Tính địa chỉ
+    myAddress = (regFlag == REG_ASSIGNED) ? (BASE_ADDR_PREFIX | EEPROM.read(EEPROM_ADDR_NODE))
+                                          : legacyNodeAddress(MY_NODE_ID);
+    Serial.printf("Address: %08X%08X\n", (uint32_t)(myAddress >> 32), (uint32_t)myAddress);
     Serial.println("RECOVERED: Already REGISTERED.");
     // Nháy LED 2 lần
     for(int i=0; i<2; i++) { digitalWrite(PIN_LED, HIGH); delay(200); digitalWrite(PIN_LED, LOW); delay(200); }
+    resumeListening();
   } else {
     Serial.println("System Ready. Waiting to register...");
   }
@@ -141,6 +329,7 @@ void setup() {
 
 void loop() {
   handleButton(); 
+  serviceSampler();
 
   if (!isRegistered) {
     // Nháy đèn chậm chờ đăng ký
@@ -150,6 +339,10 @@ void loop() {
     }
     registerToMaster();
   } else {
+    if (sampleInterval && millis() - lastQueued >= sampleInterval * 1000UL) takeSample();
+    if (pushInterval && (long)(millis() - nextPush) >= 0) pushReading();
+    serviceRelay();
+    checkLinkLease();
     listenAndReply();
   }
 }
@@ -170,50 +363,136 @@ void handleButton() {
   }
 }
 
+// --- TÍNH GIÓ ---
+void closeWindBin() {
+  if (windBinsFilled == WIND_AVG_BINS) windWindowPulses -= windBins[windBinNext];
+  else windBinsFilled++;
+  windBins[windBinNext] = windCurrent;
+  windWindowPulses += windCurrent;
+  windBinNext = (windBinNext + 1) % WIND_AVG_BINS;
+  windCurrent = 0;
+  windBinStart += WIND_BIN_US;
+}
+
+// Chia xung mới vào ô 1 giây, đóng các ô đã qua; trả về tốc độ trung bình (m/s)
+float windSpeed(float &gust) {
+  uint32_t now = micros();
+  __sync_synchronize();
+  uint32_t head = windHead;
+  __sync_synchronize();
+  if (head - windTail > WIND_RING) {
+    // Vòng bị ghi đè: mất mốc của các xung cũ nhất nhưng vẫn đếm vào ô đang đếm
+    windCurrent += head - WIND_RING - windTail;
+    windTail = head - WIND_RING;
+  }
+  // Lâu không lấy mẫu (hoặc lần đầu) thì các ô trống cũ không cần đóng từng ô
+  if (now - windBinStart > WIND_AVG_BINS * WIND_BIN_US) {
+    windBinStart = now - (WIND_AVG_BINS + 1) * WIND_BIN_US;
+  }
+  for (; windTail != head; windTail++) {
+    uint32_t edge = windEdges[windTail & (WIND_RING - 1)];
+    if ((int32_t)(edge - windBinStart) < 0) edge = windBinStart; // ISR ghi mốc trước ô hiện tại nhưng công bố muộn
+    while (edge - windBinStart >= WIND_BIN_US) closeWindBin();
+    windCurrent++;
+  }
+  while (now - windBinStart >= WIND_BIN_US) closeWindBin();
+
+  gust = 0;
+  if (!windBinsFilled) return 0;
+  uint32_t run = 0, best = 0;
+  for (uint8_t i = 0; i < windBinsFilled; i++) {
+    // Đi từ ô cũ nhất tới ô mới nhất
+    uint8_t at = (windBinNext + WIND_AVG_BINS - windBinsFilled + i) % WIND_AVG_BINS;
+    run += windBins[at];
+    if (i >= WIND_GUST_BINS) run -= windBins[(at + WIND_AVG_BINS - WIND_GUST_BINS) % WIND_AVG_BINS];
+    if (run > best) best = run;
+  }
+  uint8_t gustBins = windBinsFilled < WIND_GUST_BINS ? windBinsFilled : WIND_GUST_BINS;
+  gust = (float)best / gustBins * WIND_CUP_CIRCUMFERENCE;
+  return (float)windWindowPulses / windBinsFilled * WIND_CUP_CIRCUMFERENCE;
+}
+
 // --- ĐỌC CẢM BIẾN ---
-void readSensors(AtmData &data) {
-  // 1. Tính toán Gió (Dựa trên thời gian từ lần đọc trước đến nay)
-  unsigned long currentTime = millis();
-  float deltaTime = (currentTime - lastWindTime) / 1000.0;
-  if (deltaTime <= 0) deltaTime = 1.0; // Tránh chia 0
-  
-  // Đọc xung an toàn
-  detachInterrupt(digitalPinToInterrupt(PIN_WIND_SENSOR));
-  unsigned long pulses = windPulseCount;
-  windPulseCount = 0; // Reset xung cho chu kỳ tiếp theo
-  attachInterrupt(digitalPinToInterrupt(PIN_WIND_SENSOR), countWindPulse, FALLING);
-  
-  data.wind = (pulses / deltaTime) * WIND_CUP_CIRCUMFERENCE;
-  lastWindTime = currentTime; // Cập nhật thời gian mốc
+// Cảm biến trả số thực (ESP32 có FPU), đổi sang đơn vị thô của AtmPayload ở cuối
+void readSensors(AtmPayload &data) {
+  // 1. Gió: trung bình và giật trên cửa sổ cố định, không phụ thuộc nhịp GET
+  float gust;
+  float wind = windSpeed(gust);
 
   // 2. DHT11
   float h = dht.readHumidity();
   float t = dht.readTemperature();
   if (isnan(h) || isnan(t)) { h = 0; t = 0; }
-  data.air_humid = h;
-  data.air_temp = t;
 
   // 3. BMP280
-  data.pressure = bmp.readPressure() / 100.0F; // hPa
+  float pressure = bmp.readPressure() / 100.0F; // hPa
 
   // 4. Ánh sáng
-  data.light = analogRead(PIN_LIGHT_SENSOR);
+  int light = analogRead(PIN_LIGHT_SENSOR);
 
   // 5. Mưa (Chuyển đổi sang thang 0-100)
   int rainRaw = analogRead(PIN_RAIN_SENSOR);
   int rainIntensity = map(rainRaw, 0, 4095, 100, 0); // ESP32 ADC 12bit (0-4095)
   if (rainIntensity < 0) rainIntensity = 0;
   if (rainIntensity < 5) rainIntensity = 0; // Lọc nhiễu
-  data.rain = (uint8_t)rainIntensity;
+
+  const uint16_t* scale = nodeproto::ATM_SCALE;
+  int32_t raw[nodeproto::FIELDS_MAX] = { nodeproto::toRaw(t, scale[0]), nodeproto::toRaw(h, scale[1]), rainIntensity,
+                                         nodeproto::toRaw(wind, scale[3]), light, nodeproto::toRaw(pressure, scale[5]),
+                                         nodeproto::toRaw(gust, scale[6]) };
+  data = nodeproto::makeAtm(raw);
 
   // Debug
-  Serial.printf("Sensors -> T:%.1f H:%.1f P:%.1f Rain:%d Wind:%.1f Light:%.0f\n", 
-                data.air_temp, data.air_humid, data.pressure, data.rain, data.wind, data.light);
+  Serial.printf("Sensors -> T:%.1f H:%.1f P:%.1f Rain:%d Wind:%.1f Gust:%.1f Light:%d\n", 
+                t, h, pressure, rainIntensity, wind, gust, light);
+}
+
+// --- LẤY MẪU NỀN ---
+void sampleSensors() {
+  readSensors(snapshots[(snapshotSeq + 1) & 1]);
+  __sync_synchronize(); // Ghi xong dữ liệu rồi mới công bố
+  snapshotSeq++;
+}
+
+// Chép snapshot mới nhất, trả về seq của nó
+uint32_t latestReading(AtmPayload &data) {
+  uint32_t seq;
+  do {
+    seq = snapshotSeq;
+    __sync_synchronize();
+    memcpy(&data, &snapshots[seq & 1], sizeof(data));
+    __sync_synchronize();
+  } while (seq != snapshotSeq);
+  return seq;
+}
+
+#ifdef SIM_NODE_FIRMWARE
+// Bản giả lập không có FreeRTOS: lấy mẫu ngay trong loop(), cảm biến ảo không tốn thời gian
+unsigned long lastSample = 0;
+void startSampler() { lastSample = millis(); }
+void serviceSampler() {
+  if (millis() - lastSample < SAMPLE_PERIOD_MS) return;
+  lastSample = millis();
+  sampleSensors();
+}
+#else
+// Core 0 (loop() và radio ở core 1), DHT11 khóa ngắt ~20ms chỉ ảnh hưởng core này
+void samplerTask(void*) {
+  TickType_t last = xTaskGetTickCount();
+  for (;;) {
+    vTaskDelayUntil(&last, pdMS_TO_TICKS(SAMPLE_PERIOD_MS));
+    sampleSensors();
+  }
 }
 
+void startSampler() { xTaskCreatePinnedToCore(samplerTask, "sampler", SAMPLER_STACK, nullptr, 1, nullptr, 0); }
+void serviceSampler() {}
+#endif
+
 // --- ĐĂNG KÝ VỚI MASTER ---
 void registerToMaster() {
-  radio.stopListening();
+  beginUplink();
+  radio.setChannel(nodeproto::CHANNEL_DEFAULT); // Master chỉ nghe REG ở kênh mặc định
   radio.openWritingPipe(REGISTER_PIPE);
   
   RegisterPacket pkt;
@@ -226,24 +505,41 @@ void registerToMaster() {
     Serial.println("Sent OK.");
     
     // Mở kênh nghe phản hồi
-    radio.openReadingPipe(1, myAddress);
+    radio.openReadingPipe(1, REGISTER_REPLY_PIPE);
     radio.startListening();
     
     unsigned long startWait = millis();
     while (millis() - startWait < 1000) { 
       if (radio.available()) {
-        char ack[10] = {0};
+        RegisterAck ack;
         uint8_t len = radio.getDynamicPayloadSize();
-        if (len > 0 && len < 10) {
+        if (len == sizeof(RegisterAck)) {
             radio.read(&ack, len);
-            if (strcmp(ack, "REG_OK") == 0) {
+            ack.cmd[6] = '\0'; ack.id[10] = '\0';
+            // REG_OK của node khác đang đăng ký cùng lúc thì bỏ qua
+            if (strcmp(ack.cmd, "REG_OK") == 0 && strcmp(ack.id, MY_NODE_ID) == 0) {
               isRegistered = true;
-              EEPROM.write(EEPROM_ADDR_FLAG, 1);
+              myAddress = BASE_ADDR_PREFIX | ack.addr;
+              memset(&report, 0, sizeof(report)); // Master xóa cấu hình RPT khi đăng ký lại
+              sampleInterval = 0;
+              samples.clear();
+              memset(children, NO_CHILD, sizeof(children)); // Master cũng xóa tuyến qua relay này
+              relayed.clear();
+              radioChannel = nodeproto::CHANNEL_DEFAULT; // Master báo kênh làm việc ở lượt quét kế tiếp
+              linkRate = nodeproto::RATE_BASE;
+              linkPa = RF24_PA_HIGH;
+              EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+              EEPROM.write(EEPROM_ADDR_NODE, ack.addr);
+              EEPROM.write(EEPROM_ADDR_FLAG, REG_ASSIGNED);
+              EEPROM.put(EEPROM_ADDR_REPORT, report);
+              EEPROM.put(EEPROM_ADDR_SAMPLE, sampleInterval);
+              EEPROM.put(EEPROM_ADDR_CHILDREN, children);
               EEPROM.commit();
               digitalWrite(PIN_LED, LOW);
-              Serial.println("REGISTER SUCCESS!");
+              Serial.printf("REGISTER SUCCESS! Addr: %02X\n", ack.addr);
               // Nháy 3 lần
               for(int i=0; i<3; i++) { digitalWrite(PIN_LED, HIGH); delay(100); digitalWrite(PIN_LED, LOW); delay(100); }
+              resumeListening();
               return;
             }
         } else {
@@ -258,30 +554,378 @@ void registerToMaster() {
   delay(random(1500, 3000));
 }
 
-// --- LẮNG NGHE LỆNH GET ---
-void listenAndReply() {
+// --- DELTA REPORT ---
+// true: phải gửi đủ số đo (chưa cấu hình, tới heartbeat hoặc có trường vượt deadband)
+bool needsFull(const AtmPayload& data) {
+  if (!report.heartbeat || !hasSent || millis() - lastSentAt >= report.heartbeat * 1000UL) return true;
+  int32_t now[nodeproto::FIELDS_MAX], last[nodeproto::FIELDS_MAX];
+  nodeproto::fields(data, now);
+  nodeproto::fields(lastSent, last);
+  return nodeproto::anyBeyond(nodeproto::KIND_ATM, now, last, report.deadband);
+}
+
+void markSent(const AtmPayload& data) {
+  lastSent = data;
+  lastSentAt = millis();
+  hasSent = true;
+}
+
+// --- BATCH ---
+uint16_t nodeSeconds() { return millis() / 1000; }
+
+// Chu kỳ BAT ngắn hơn SAMPLE_PERIOD_MS vẫn chỉ xếp mỗi snapshot một lần
+void takeSample() {
+  lastQueued = millis();
+  AtmPayload data;
+  uint32_t seq = latestReading(data);
+  if (seq == queuedSeq || !needsFull(data)) return;
+  queuedSeq = seq;
+  markSent(data); // Mẫu trong hàng tới Master theo thứ tự, làm mốc deadband luôn
+  samples.push(nodeSeconds(), data);
+  if (ackMode && ackLoaded) preloadReading(); // ACK kế tiếp mang luôn mẫu mới
+}
+
+// Gửi liên tiếp các khung (batch hoặc relay) tới khi hết hàng, khung lỗi giữ lại cho lần sau
+template <typename Queue>
+bool sendFrames(Queue& queue) {
+  uint8_t frame[32];
+  frame[0] = (uint8_t)myAddress;
+  bool ok = true;
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  while (ok && !queue.empty()) {
+    uint8_t taken;
+    uint8_t len = 1 + queue.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), taken);
+    ok = radio.write(frame, len);
+    if (ok) queue.drop(taken);
+  }
+  resumeListening();
+  return ok;
+}
+
+// --- PUSH MODE: TỰ GỬI DỮ LIỆU ---
+// true nếu Master đã nhận hoặc không cần gửi (không đổi quá deadband, Master không cần mốc lịch).
+// Số đo của node con đi trước, số đo của relay vẫn gửi như node thường.
+bool sendPush() {
+  if (!relayed.empty() && !sendFrames(relayed)) return false;
+  if (!samples.empty()) return sendFrames(samples);
+  uint8_t frame[1 + sizeof(AtmPayload)];
+  AtmPayload data;
+  latestReading(data);
+  if (!needsFull(data)) return true;
+  frame[0] = (uint8_t)myAddress; // Byte địa chỉ để Master biết node nào gửi
+  memcpy(frame + 1, &data, sizeof(data));
+
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  bool ok = radio.write(frame, sizeof(frame));
+  resumeListening();
+  if (ok) markSent(data);
+  return ok;
+}
+
+// --- KÊNH RADIO ---
+
+// Push hỏng hết số lần thử: Master có thể đã đổi kênh khi node bận phát. Gửi [addr] trên
+// từng kênh còn lại như Soil Node, kênh nào có ACK thì ở lại.
+bool searchChannel() {
+  uint8_t frame = (uint8_t)myAddress;
+  bool ok = false;
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  radio.setRetries(15, SEARCH_RETRIES);
+  for (uint8_t i = 0; i < nodeproto::CHANNEL_COUNT && !ok; i++) {
+    if (nodeproto::CHANNELS[i] == radioChannel) continue;
+    radio.setChannel(nodeproto::CHANNELS[i]);
+    ok = radio.write(&frame, sizeof(frame));
+    if (ok) radioChannel = nodeproto::CHANNELS[i];
+  }
+  radio.setRetries(15, 15);
+  radio.setChannel(radioChannel);
+  resumeListening();
+  if (!ok) return false;
+  EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+  EEPROM.commit();
+  Serial.printf("Channel found: %u\n", radioChannel);
+  return true;
+}
+
+// Node con chỉ nghe relay nên được báo trên kênh cũ trước khi relay rời đi.
+// Node con lỡ gói này bị relay báo mất (RELAY_LOST) tới khi được đăng ký lại.
+void applyChannel(const ChannelPacket& chn) {
+  if (!nodeproto::validChannel(chn.channel) || chn.channel == radioChannel) return; // Bản lặp của gói phát chung
+  for (uint8_t i = 0; i < RELAY_CHILDREN; i++) {
+    if (children[i] == NO_CHILD) continue;
+    beginUplink();
+    radio.openWritingPipe(BASE_ADDR_PREFIX | children[i]);
+    bool ok = radio.write(&chn, sizeof(chn));
+    Serial.printf("CHN: child %02X %s\n", children[i], ok ? "OK" : "FAILED");
+  }
+  radioChannel = chn.channel;
+  radio.stopListening();
+  radio.setChannel(radioChannel);
+  EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+  EEPROM.commit();
+  resumeListening();
+  Serial.printf("CHN: channel = %u\n", radioChannel);
+}
+
+bool isChannelPacket(const uint8_t* buf, uint8_t len) {
+  return len == sizeof(ChannelPacket) && strncmp((const char*)buf, "CHN", 3) == 0;
+}
+
+// --- TỐC ĐỘ LIÊN KẾT ---
+
+// Master và node con chỉ nghe ở tốc độ gốc: gói tự phát dừng nghe qua đây thay cho stopListening()
+void beginUplink() {
+  radio.stopListening();
+  radio.setDataRate(RF24_250KBPS);
+  radio.setPALevel(RF24_PA_HIGH);
+}
+
+// ACK của chính gói LNK đã đi ở tốc độ cũ, từ gói sau mới nghe ở tốc độ mới
+void applyLink(const LinkPacket& lnk) {
+  if (lnk.rate >= nodeproto::RATE_COUNT || lnk.pa > RF24_PA_MAX) return;
+  linkRate = lnk.rate;
+  linkPa = lnk.pa;
+  linkLease = lnk.lease;
+  linkHeard = millis();
+  radio.stopListening();
+  resumeListening();
+  Serial.printf("LNK: %u kbps\n", nodeproto::rateKbps(linkRate));
+}
+
+// Quá lease không có GET: Master không còn hỏi được ở tốc độ này và sẽ thử lại ở tốc độ gốc
+void checkLinkLease() {
+  if (linkRate == nodeproto::RATE_BASE || millis() - linkHeard < linkLease * 1000UL) return;
+  linkRate = nodeproto::RATE_BASE;
+  linkPa = RF24_PA_HIGH;
+  radio.stopListening();
+  resumeListening();
+  Serial.println("LNK: lease expired");
+}
+
+void pushReading() {
+  bool ok = sendPush();
+
+  // Không có ACK thường do Master đang phát, lùi ngẫu nhiên rồi thử lại
+  if (!ok && ++pushFails <= PUSH_MAX_RETRIES) {
+    nextPush = millis() + random(50, 300);
+    return;
+  }
+  if (!ok && searchChannel()) ok = sendPush();
+  Serial.println(ok ? "Push OK." : "Push FAILED.");
+  pushFails = 0;
+  nextPush = millis() + pushInterval * 1000UL;
+}
+
+void applyConfig(const ConfigPacket& cfg) {
+  pushInterval = cfg.pushInterval;
+  EEPROM.put(EEPROM_ADDR_PUSH, pushInterval);
+  EEPROM.commit();
+  nextPush = millis();
+  Serial.printf("CFG: push interval = %u s\n", pushInterval);
+}
+
+void applyReport(const ReportPacket& rpt) {
+  report.heartbeat = rpt.heartbeat;
+  memcpy(report.deadband, rpt.deadband, sizeof(report.deadband));
+  EEPROM.put(EEPROM_ADDR_REPORT, report);
+  EEPROM.commit();
+  hasSent = false; // Master cũng chờ một bản đủ làm mốc
+  Serial.printf("RPT: heartbeat = %u s\n", report.heartbeat);
+}
+
+// Tắt (0) vẫn gửi nốt các mẫu đang xếp hàng
+void applySample(const SamplePacket& bat) {
+  sampleInterval = bat.sampleInterval;
+  EEPROM.put(EEPROM_ADDR_SAMPLE, sampleInterval);
+  EEPROM.commit();
+  lastQueued = millis() - sampleInterval * 1000UL; // Mẫu đầu tiên lấy ngay
+  Serial.printf("BAT: sample interval = %u s\n", sampleInterval);
+}
+
+// --- RELAY ---
+
+void applyRoute(const RoutePacket& rte) {
+  if (rte.child == NO_CHILD || rte.child == (uint8_t)myAddress) return;
+  for (uint8_t i = 0; i < RELAY_CHILDREN; i++) {
+    if (children[i] == rte.child) children[i] = NO_CHILD;
+  }
+  if (rte.add) {
+    uint8_t i = 0;
+    while (i < RELAY_CHILDREN && children[i] != NO_CHILD) i++;
+    if (i == RELAY_CHILDREN) { Serial.println("RTE: child table full"); return; }
+    children[i] = rte.child;
+    lastRelayPoll = millis() - RELAY_POLL_MS; // Hỏi node con mới ngay
+  }
+  EEPROM.put(EEPROM_ADDR_CHILDREN, children);
+  EEPROM.commit();
+  Serial.printf("RTE: %s child %02X\n", rte.add ? "add" : "remove", rte.child);
+}
+
+// Phát lại nguyên gói gốc tới node đích. Master chỉ biết relay đã nhận gói FWD.
+void forwardPacket(const uint8_t* buf, uint8_t len) {
+  ForwardHeader fwd;
+  memcpy(&fwd, buf, sizeof(fwd));
+  beginUplink();
+  radio.openWritingPipe(BASE_ADDR_PREFIX | fwd.addr);
+  bool ok = radio.write(buf + sizeof(fwd), len - sizeof(fwd));
+  resumeListening();
+  Serial.printf("FWD: %02X %s\n", fwd.addr, ok ? "OK" : "FAILED");
+}
+
+enum ChildReply { CHILD_NONE, CHILD_DATA, CHILD_MASTER, CHILD_CHANNEL };
+
+// Sau GETA: ACK payload [addr][dữ liệu] nằm sẵn ở pipe 0, không có thì node con đang trả lời
+// kiểu cũ qua RELAY_RX_PIPE và chờ OK. Gói Master gửi tới relay (pipe 1) được để lại trong
+// FIFO cho listenAndReply(). Gói CHN phát chung cũng tới pipe 0, trả về trong buf.
+ChildReply childReply(uint8_t addr, uint8_t* buf, uint8_t& size) {
+  unsigned long start = millis();
+  do {
+    uint8_t pipe;
+    while (radio.available(&pipe)) {
+      if (pipe == 1) return CHILD_MASTER;
+      size = radio.getDynamicPayloadSize();
+      radio.read(buf, size);
+      if (pipe == 0 && isChannelPacket(buf, size)) return CHILD_CHANNEL; // ACK payload không bắt đầu bằng "CHN"
+      if (pipe == 0 && size >= 1 && buf[0] == addr) {
+        memmove(buf, buf + 1, --size);
+        return CHILD_DATA;
+      }
+      if (pipe == RELAY_RX_PIPE) {
+        char ok[] = "OK";
+        radio.stopListening();
+        radio.write(&ok, sizeof(ok)); // Ống ghi vẫn là địa chỉ node con
+        radio.startListening();
+        return CHILD_DATA;
+      }
+    }
+  } while (millis() - start < RELAY_REPLY_MS);
+  return CHILD_NONE;
+}
+
+// Hỏi một node con như Master hỏi node. false nếu gói của Master chen vào giữa chừng:
+// phần đã nhận vẫn ở trong hàng, lượt sau hỏi tiếp node con này.
+bool pollChild(uint8_t addr) {
+  uint64_t childAddress = BASE_ADDR_PREFIX | addr;
+  char req[] = "GETA";
+  uint8_t frames = 0, attempts = 0;
+  bool interrupted = false;
+  ChannelPacket chn;
+  chn.channel = radioChannel;
+  radio.setRetries(5, 15); // Node con luôn nghe, không cần chờ lâu như khi gửi cho Master
+  radio.openReadingPipe(RELAY_RX_PIPE, childAddress);
+  while (frames < RELAY_MAX_FRAMES && attempts < RELAY_ATTEMPTS) {
+    beginUplink(); // startListening() ngay sau vẫn ở tốc độ gốc để nghe node con
+    radio.openWritingPipe(childAddress);
+    bool acked = radio.write(&req, sizeof(req));
+    radio.startListening();
+
+    uint8_t buf[32];
+    uint8_t size = 0;
+    ChildReply reply = acked ? childReply(addr, buf, size) : CHILD_NONE;
+    if (reply == CHILD_CHANNEL) memcpy(&chn, buf, sizeof(chn));
+    if (reply == CHILD_MASTER || reply == CHILD_CHANNEL) { interrupted = true; break; }
+    if (reply == CHILD_NONE) { attempts++; continue; }
+    attempts = 0;
+    frames++;
+    relayed.add(addr, nodeSeconds(), buf, size);
+    if (!nodeproto::moreFrames(buf, size)) break;
+    delay(RELAY_FRAME_GAP);
+  }
+  radio.closeReadingPipe(RELAY_RX_PIPE);
+  radio.setRetries(15, 15);
+  if (attempts >= RELAY_ATTEMPTS && !frames) relayed.lost(addr, nodeSeconds());
+  applyChannel(chn); // Không có gói CHN thì chn.channel là kênh hiện tại, không làm gì
+  return !interrupted;
+}
+
+// Mỗi vòng loop() chỉ hỏi một node con để gói của Master không phải chờ cả lượt
+void serviceRelay() {
+  if (relayCursor >= RELAY_CHILDREN) {
+    if (millis() - lastRelayPoll < RELAY_POLL_MS) return;
+    lastRelayPoll = millis();
+    relayCursor = 0;
+  }
+  while (relayCursor < RELAY_CHILDREN && children[relayCursor] == NO_CHILD) relayCursor++;
+  if (relayCursor >= RELAY_CHILDREN) return;
+  if (pollChild(children[relayCursor])) relayCursor++;
+  resumeListening();
+}
+
+// Chỉ mở lại pipe sau khi phát: startListening() xóa FIFO TX, gồm cả ACK payload đang nạp.
+// Pipe 0 nghe gói CHN phát chung, RF24 tự trả lại địa chỉ này sau mỗi lần phát.
+void resumeListening() {
+  radio.setDataRate((rf24_datarate_e)nodeproto::rf24DataRate(linkRate));
+  radio.setPALevel(linkPa);
+  radio.openReadingPipe(0, nodeproto::CHANNEL_PIPE);
   radio.openReadingPipe(1, myAddress);
   radio.startListening();
+  ackLoaded = false;
+}
+
+// Thứ tự: khung relay (số đo node con), khung batch, rồi mới tới snapshot hiện tại
+void preloadReading() {
+  uint8_t frame[32];
+  uint8_t len;
+  preloadSeq = latestReading(preloaded);
+  frame[0] = (uint8_t)myAddress; // Master bỏ payload không mang addr của node đang hỏi
+  preloadTaken = relayTaken = 0;
+  if (!relayed.empty()) {
+    len = 1 + relayed.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), relayTaken);
+    preloadFull = false;
+  } else if (!samples.empty()) {
+    len = 1 + samples.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), preloadTaken);
+    preloadFull = false;
+  } else {
+    preloadFull = needsFull(preloaded);
+    memcpy(frame + 1, &preloaded, sizeof(preloaded));
+    len = preloadFull ? 1 + sizeof(preloaded) : 1; // Chỉ addr: không đổi
+  }
+
+  radio.flush_tx();
+  ackLoaded = radio.writeAckPayload(1, frame, len);
+}
+
+// --- LẮNG NGHE LỆNH GET ---
+void listenAndReply() {
+  if (ackMode && (!ackLoaded || snapshotSeq != preloadSeq)) preloadReading(); // Có snapshot mới thì nạp lại
   
   if (radio.available()) {
-    char req[5] = {0};
-    radio.read(&req, sizeof(req)); 
+    char req[32] = {0};
+    uint8_t len = radio.getDynamicPayloadSize();
+    radio.read(&req, len); 
+    bool hadPreload = ackLoaded;
+    ackLoaded = false; // Gói vừa nhận đã mang payload đi
     
     if (strncmp(req, "GET", 3) == 0) {
+      linkHeard = millis();
+      bool wantAck = req[3] == 'A';
+      if (wantAck && hadPreload) {
+        Serial.println("CMD: GET answered in ACK.");
+        if (relayTaken) relayed.drop(relayTaken);
+        else if (preloadTaken) samples.drop(preloadTaken);
+        else if (preloadFull) markSent(preloaded);
+        preloadReading();
+        return;
+      }
+      if (ackMode && !wantAck) radio.flush_tx();
+      ackMode = wantAck;
+
       digitalWrite(PIN_LED, HIGH); // Bật đèn khi đang xử lý
       Serial.println("CMD: GET received.");
       
-      AtmData data;
-      readSensors(data); // Đọc cảm biến ngay tức thì
+      AtmPayload data;
+      latestReading(data); // Snapshot có sẵn, không chờ cảm biến
       
-      radio.stopListening();
+      beginUplink();
       radio.openWritingPipe(myAddress);
       
       if (radio.write(&data, sizeof(data))) {
           Serial.println("Data Sent. Waiting for OK...");
-          
-          radio.openReadingPipe(1, myAddress);
-          radio.startListening();
+          markSent(data); // Trả lời GET luôn đủ số đo
+          resumeListening();
           
           unsigned long waitAck = millis();
           while(millis() - waitAck < 200) { 
@@ -296,10 +940,35 @@ void listenAndReply() {
           }
       } else {
           Serial.println("Data Send Failed.");
+          resumeListening();
       }
       digitalWrite(PIN_LED, LOW);
-    } else {
-        char trash[32]; radio.read(&trash, sizeof(trash)); 
+    } else if (len == sizeof(ConfigPacket) && strncmp(req, "CFG", 3) == 0) {
+      ConfigPacket cfg;
+      memcpy(&cfg, req, sizeof(cfg));
+      applyConfig(cfg);
+    } else if (len == sizeof(ReportPacket) && strncmp(req, "RPT", 3) == 0) {
+      ReportPacket rpt;
+      memcpy(&rpt, req, sizeof(rpt));
+      applyReport(rpt);
+    } else if (len == sizeof(SamplePacket) && strncmp(req, "BAT", 3) == 0) {
+      SamplePacket bat;
+      memcpy(&bat, req, sizeof(bat));
+      applySample(bat);
+    } else if (len == sizeof(RoutePacket) && strncmp(req, "RTE", 3) == 0) {
+      RoutePacket rte;
+      memcpy(&rte, req, sizeof(rte));
+      applyRoute(rte);
+    } else if (len > sizeof(ForwardHeader) && strncmp(req, "FWD", 3) == 0) {
+      forwardPacket((const uint8_t*)req, len);
+    } else if (isChannelPacket((const uint8_t*)req, len)) {
+      ChannelPacket chn;
+      memcpy(&chn, req, sizeof(chn));
+      applyChannel(chn);
+    } else if (len == sizeof(LinkPacket) && strncmp(req, "LNK", 3) == 0) {
+      LinkPacket lnk;
+      memcpy(&lnk, req, sizeof(lnk));
+      applyLink(lnk);
     }
   }
 }
\ No newline at end of file
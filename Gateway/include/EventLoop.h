@@ -0,0 +1,44 @@
+/**
+ * EventLoop - Vỏ mỏng quanh epoll cho gateway
+ *
+ * Mỗi fd đăng ký kèm loại (Tag) và một số id (chỉ số hub, fd client...) gói
+ * trong epoll_event.data.u64, vòng chính tách lại bằng tag()/id() để biết gọi
+ * ai mà không cần bảng tra fd.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+class EventLoop {
+ public:
+  enum Tag : uint32_t { HUB = 1, SIGNAL, LISTEN, CLIENT };
+
+  EventLoop() : fd_(epoll_create1(EPOLL_CLOEXEC)) {}
+  ~EventLoop() { if (fd_ >= 0) close(fd_); }
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  bool ok() const { return fd_ >= 0; }
+
+  bool add(int fd, uint32_t events, Tag tag, uint32_t id) { return ctl(EPOLL_CTL_ADD, fd, events, tag, id); }
+  bool modify(int fd, uint32_t events, Tag tag, uint32_t id) { return ctl(EPOLL_CTL_MOD, fd, events, tag, id); }
+  void remove(int fd) { epoll_ctl(fd_, EPOLL_CTL_DEL, fd, nullptr); }
+
+  int wait(epoll_event* events, int max, int timeoutMs) { return epoll_wait(fd_, events, max, timeoutMs); }
+
+  static Tag tag(const epoll_event& e) { return (Tag)(e.data.u64 >> 32); }
+  static uint32_t id(const epoll_event& e) { return (uint32_t)e.data.u64; }
+
+ private:
+  int fd_;
+
+  bool ctl(int op, int fd, uint32_t events, Tag tag, uint32_t id) {
+    epoll_event e;
+    e.events = events;
+    e.data.u64 = ((uint64_t)tag << 32) | id;
+    return epoll_ctl(fd_, op, fd, &e) == 0;
+  }
+};
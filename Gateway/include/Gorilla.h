@@ -0,0 +1,279 @@
+/**
+ * Gorilla - Nén một khối điểm (time, value) của một chuỗi theo kiểu Gorilla
+ *
+ * Cột time: delta-of-delta, zigzag rồi ghi theo bậc (0 -> 1 bit '0'; bản đo
+ * đều nhịp mỗi phút, lệch vài ms chỉ tốn 9 bit). Delta tính theo đơn vị lớn
+ * nhất trong TIME_UNITS chia hết mọi time của khối: time đã làm tròn tới giây
+ * (SeriesStore) hay mốc ô rollup thì lệch pha vài ms biến mất, đa số điểm còn 1 bit.
+ *
+ * Cột value chọn một trong hai cách cho cả khối (encode() thử cách thứ nhất trước):
+ *  - Thập phân: mọi giá trị đúng bằng số nguyên / 10^d (d <= MAX_DECIMALS, như
+ *    Master in "86.58") thì ghi delta của số nguyên đó theo bậc. Độ ẩm, áp suất
+ *    đổi chậm nên delta nhỏ; giải mã ra đúng double như strtod() của chuỗi gốc.
+ *  - XOR: double XOR giá trị trước, bỏ các bit 0 đầu/cuối, dùng lại cửa sổ
+ *    bit có nghĩa của giá trị trước khi vừa (bài báo Gorilla, VLDB 2015).
+ *
+ * Không lưu count/độ dài: khối mang header riêng (xem SeriesStore.h).
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+namespace gorilla {
+
+struct Point {
+  int64_t time;   // ms Unix
+  double value;
+};
+
+const uint8_t ENCODING_XOR = 0;
+const uint8_t MAX_DECIMALS = 3;   // ENCODING_XOR + 1 + d: thập phân d chữ số
+const uint8_t TIME_UNIT_COUNT = 3;
+const int64_t TIME_UNITS[TIME_UNIT_COUNT] = { 1, 1000, 60000 };  // Chỉ số 0 (ms) là khối ghi trước khi có đơn vị
+
+class BitWriter {
+ public:
+  std::vector<uint8_t> bytes;
+
+  // bits <= 64, ghi từ bit cao xuống
+  void write(uint64_t v, uint8_t bits) {
+    while (bits) {
+      if (!free_) { bytes.push_back(0); free_ = 8; }
+      uint8_t n = bits < free_ ? bits : free_;
+      uint8_t chunk = (v >> (bits - n)) & ((1u << n) - 1);
+      bytes.back() |= chunk << (free_ - n);
+      free_ -= n;
+      bits -= n;
+    }
+  }
+
+  void bit(bool b) { write(b, 1); }
+
+ private:
+  uint8_t free_ = 0;  // Bit còn trống trong byte cuối
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t len) : data_(data), bits_(len * 8) {}
+
+  // false nếu đọc quá cuối (khối hỏng)
+  bool read(uint8_t bits, uint64_t& v) {
+    if (pos_ + bits > bits_) return false;
+    v = 0;
+    while (bits) {
+      uint8_t used = pos_ & 7;
+      uint8_t n = 8 - used < bits ? 8 - used : bits;
+      uint8_t chunk = (data_[pos_ >> 3] >> (8 - used - n)) & ((1u << n) - 1);
+      v = (v << n) | chunk;
+      pos_ += n;
+      bits -= n;
+    }
+    return true;
+  }
+
+  bool bit(bool& b) {
+    uint64_t v;
+    if (!read(1, v)) return false;
+    b = v;
+    return true;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t bits_;
+  size_t pos_ = 0;
+};
+
+inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+// Bậc độ dài: tiền tố k bit '1' + '0' rồi WIDTHS[k] bit; bậc cuối không có '0'
+struct Buckets {
+  uint8_t count;
+  uint8_t widths[5];
+};
+
+const Buckets TIME_BUCKETS = { 5, { 7, 9, 12, 32, 64 } };
+const Buckets DECIMAL_BUCKETS = { 4, { 6, 10, 16, 64 } };
+
+inline void writeBucketed(BitWriter& w, uint64_t zz, const Buckets& b) {
+  if (!zz) { w.bit(0); return; }
+  for (uint8_t k = 0; k < b.count; k++) {
+    bool last = k + 1 == b.count;
+    if (!last && zz >> b.widths[k]) continue;
+    w.write(last ? (1u << (k + 1)) - 1 : ((1u << (k + 1)) - 1) << 1, last ? k + 1 : k + 2);
+    w.write(zz, b.widths[k]);
+    return;
+  }
+}
+
+inline bool readBucketed(BitReader& r, uint64_t& zz, const Buckets& b) {
+  uint8_t k = 0;
+  for (;; k++) {
+    bool one;
+    if (!r.bit(one)) return false;
+    if (!one) break;
+    if (k + 1 == b.count) { k++; break; }
+  }
+  if (!k) { zz = 0; return true; }
+  return r.read(b.widths[k - 1], zz);
+}
+
+// Số chữ số thập phân nhỏ nhất biểu diễn đúng mọi giá trị, -1 nếu không có
+inline int decimalsFor(const Point* points, size_t n) {
+  for (int d = 0; d <= MAX_DECIMALS; d++) {
+    double scale = pow(10, d);
+    bool exact = true;
+    for (size_t i = 0; i < n && exact; i++) {
+      double s = points[i].value * scale;
+      exact = fabs(s) < 1e15 && (double)llround(s) / scale == points[i].value;
+    }
+    if (exact) return d;
+  }
+  return -1;
+}
+
+// Chỉ số đơn vị time lớn nhất chia hết mọi time của khối
+inline uint8_t timeUnitFor(const Point* points, size_t n) {
+  for (uint8_t u = TIME_UNIT_COUNT - 1; u > 0; u--) {
+    bool exact = true;
+    for (size_t i = 0; i < n && exact; i++) exact = points[i].time % TIME_UNITS[u] == 0;
+    if (exact) return u;
+  }
+  return 0;
+}
+
+inline void encodeTimes(BitWriter& w, const Point* points, size_t n, int64_t unit) {
+  int64_t prev = 0, prevDelta = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!i) {
+      w.write((uint64_t)points[0].time, 64);
+    } else {
+      int64_t delta = (points[i].time - prev) / unit;
+      writeBucketed(w, zigzag(delta - prevDelta), TIME_BUCKETS);
+      prevDelta = delta;
+    }
+    prev = points[i].time;
+  }
+}
+
+inline void encodeXor(BitWriter& w, const Point* points, size_t n) {
+  uint64_t prev = 0;
+  uint8_t prevLead = 0xFF, prevTrail = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t bits;
+    memcpy(&bits, &points[i].value, 8);
+    if (!i) { w.write(bits, 64); prev = bits; continue; }
+    uint64_t x = bits ^ prev;
+    prev = bits;
+    if (!x) { w.bit(0); continue; }
+    w.bit(1);
+    uint8_t lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+    if (lead > 31) lead = 31;
+    if (prevLead != 0xFF && lead >= prevLead && trail >= prevTrail) {
+      w.bit(0);
+      w.write(x >> prevTrail, 64 - prevLead - prevTrail);
+      continue;
+    }
+    uint8_t width = 64 - lead - trail;
+    w.bit(1);
+    w.write(lead, 5);
+    w.write(width & 63, 6);  // 64 ghi thành 0
+    w.write(x >> trail, width);
+    prevLead = lead;
+    prevTrail = trail;
+  }
+}
+
+inline void encodeDecimal(BitWriter& w, const Point* points, size_t n, int decimals) {
+  double scale = pow(10, decimals);
+  int64_t prev = 0;
+  for (size_t i = 0; i < n; i++) {
+    int64_t v = llround(points[i].value * scale);
+    if (!i) w.write(zigzag(v), 64);
+    else writeBucketed(w, zigzag(v - prev), DECIMAL_BUCKETS);
+    prev = v;
+  }
+}
+
+// Nén n điểm (theo thứ tự tới, time không cần tăng dần), trả về encoding; timeUnit: chỉ số trong TIME_UNITS
+inline uint8_t encode(const Point* points, size_t n, BitWriter& w, uint8_t& timeUnit) {
+  timeUnit = timeUnitFor(points, n);
+  encodeTimes(w, points, n, TIME_UNITS[timeUnit]);
+  int decimals = decimalsFor(points, n);
+  if (decimals < 0) {
+    encodeXor(w, points, n);
+    return ENCODING_XOR;
+  }
+  encodeDecimal(w, points, n, decimals);
+  return ENCODING_XOR + 1 + decimals;
+}
+
+// Giải nén n điểm nối vào out; false nếu khối hỏng hoặc encoding/đơn vị time lạ
+inline bool decode(const uint8_t* data, size_t len, size_t n, uint8_t encoding, uint8_t timeUnit, std::vector<Point>& out) {
+  if (encoding > ENCODING_XOR + 1 + MAX_DECIMALS || timeUnit >= TIME_UNIT_COUNT) return false;
+  int64_t unit = TIME_UNITS[timeUnit];
+  BitReader r(data, len);
+  size_t base = out.size();
+  out.resize(base + n);
+  Point* p = out.data() + base;
+
+  uint64_t v;
+  int64_t prevDelta = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!i) {
+      if (!r.read(64, v)) return false;
+      p[0].time = (int64_t)v;
+      continue;
+    }
+    if (!readBucketed(r, v, TIME_BUCKETS)) return false;
+    prevDelta += unzigzag(v);
+    p[i].time = p[i - 1].time + prevDelta * unit;
+  }
+
+  if (encoding != ENCODING_XOR) {
+    double scale = pow(10, encoding - ENCODING_XOR - 1);
+    int64_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (!(i ? readBucketed(r, v, DECIMAL_BUCKETS) : r.read(64, v))) return false;
+      prev = i ? prev + unzigzag(v) : unzigzag(v);
+      p[i].value = (double)prev / scale;
+    }
+    return true;
+  }
+
+  uint64_t prev = 0;
+  uint8_t lead = 0, width = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!i) {
+      if (!r.read(64, prev)) return false;
+    } else {
+      bool changed, fresh;
+      if (!r.bit(changed)) return false;
+      if (changed) {
+        if (!r.bit(fresh)) return false;
+        if (fresh) {
+          uint64_t l, w;
+          if (!r.read(5, l) || !r.read(6, w)) return false;
+          lead = l;
+          width = w ? w : 64;
+          if (lead + width > 64) return false;
+        } else if (!width) {
+          return false;  // Dùng lại cửa sổ khi chưa có cửa sổ nào
+        }
+        if (!r.read(width, v)) return false;
+        prev ^= v << (64 - lead - width);
+      }
+    }
+    memcpy(&p[i].value, &prev, 8);
+  }
+  return true;
+}
+
+} // namespace gorilla
@@ -0,0 +1,445 @@
+/**
+ * HubPort - Một MainHub nối vào gateway qua tty (USB-serial hoặc pty của SimHub)
+ *
+ * Đọc không chặn: service() lấy hết byte đang có rồi trả về, gateway gọi khi
+ * epoll báo cổng có dữ liệu. Byte qua hublink::Decoder nên cổng ở chế độ JSON
+ * hay khung nhị phân (--bin) đều được; mỗi dòng JSON được đọc thẳng trên bộ
+ * đệm của Decoder bằng JsonScan, bản đo giao cho HubListener dưới dạng Slice
+ * trỏ vào bộ đệm đó (chỉ hợp lệ trong lúc gọi).
+ *
+ * Bản đo mang seq của nhật ký Master: bản có seq đã giao thì bỏ (trùng giữa bản
+ * trực tiếp và bản phát lại). Mở lại cổng sau khi mất kết nối thì gửi
+ * dumpSince để lấy phần bị lỡ; Master xen bản đo trực tiếp (seq mới hơn) vào
+ * giữa các bản phát lại, nên trong khoảng đang phát lại (từ seq xin tới "to" của
+ * dump_begin) từng seq được đánh dấu riêng, ngoài khoảng đó chỉ cần so với seq
+ * lớn nhất đã giao. Master khởi động lại (nhật ký đếm lại từ đầu) được nhận ra
+ * qua dump_begin/log_info có "to"/"next" nhỏ hơn seq đã giao.
+ *
+ * Kênh radio của hub (channel_scan/channel_changed/channel_configured) và chuỗi
+ * phiên bản (trả lời helloMaster) được giữ lại cho bộ lập lịch quét; Master
+ * khởi động lại thì cả hai bị xóa và helloMaster được gửi lại.
+ *
+ * Thời gian ra ngoài là ms Unix của máy gateway. Mốc millis() của Master (khung
+ * nhị phân, "ts" của dump/batch) được đổi qua độ lệch đồng hồ học từ các mốc
+ * đi kèm "now" hoặc khung trực tiếp.
+ */
+
+#pragma once
+
+#include <HubLink.h>
+#include <NodeProtocol.h>
+
+#include "JsonScan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+struct SensorField {
+  jsonscan::Slice name;
+  jsonscan::Slice text;   // Số nguyên văn như Master in ra
+
+  double value() const { return strtod(text.ptr, nullptr); }
+};
+
+const uint8_t NO_CHANNEL = 0xFF;  // Hub chưa báo kênh (hoặc FW không có scanChannels)
+
+struct Reading {
+  jsonscan::Slice id;
+  uint32_t seq = 0;       // 0: Master không gửi seq
+  int64_t time = 0;       // ms Unix
+  bool delta = false;     // Chỉ có các trường đã đổi (deadband)
+  bool replay = false;    // Phát lại từ nhật ký (dumpSince)
+  uint8_t count = 0;
+  SensorField fields[nodeproto::FIELDS_MAX];
+};
+
+class HubPort;
+
+class HubListener {
+ public:
+  virtual ~HubListener() {}
+  virtual void onReading(HubPort& hub, const Reading& reading) = 0;
+  virtual void onOffline(HubPort& hub, jsonscan::Slice id, int64_t time) = 0;
+  virtual void onUnpolled(HubPort& hub, jsonscan::Slice id, int64_t time) = 0;  // Lượt quét hết hạn trước khi hỏi node
+  virtual void onSweepDone(HubPort& hub, int64_t time) = 0;
+  // Dòng JSON khác (event/status/error, danh sách thiết bị), nguyên văn
+  virtual void onMessage(HubPort& hub, jsonscan::Slice line) = 0;
+};
+
+class HubPort {
+ public:
+  static const size_t REPLAY_WINDOW = 4096;  // Số seq tối đa theo dõi riêng trong lúc chờ dump_begin
+
+  struct Device {
+    std::string id;
+    uint8_t kind;
+  };
+
+  // Thống kê từ lúc khởi động gateway
+  uint32_t lines = 0, frames = 0, readings = 0, duplicates = 0, reconnects = 0;
+  uint32_t boots = 0;  // Số lần Master báo system_ready (khởi động lại, mất kênh đã biết)
+
+  HubPort(const std::string& name, const std::string& path, bool binary)
+      : name_(name), path_(path), binary_(binary) {}
+  ~HubPort() { close(); }
+
+  const std::string& name() const { return name_; }
+  const std::string& path() const { return path_; }
+  const std::string& firmware() const { return firmware_; }
+  uint8_t channel() const { return channel_; }
+  const std::vector<Device>& devices() const { return devices_; }
+  uint32_t crcErrors() const { return decoder_.crcErrors; }
+  int fd() const { return fd_; }
+  bool isOpen() const { return fd_ >= 0; }
+
+  // Mở tty ở chế độ raw 115200, hỏi phiên bản + danh sách thiết bị, lấy lại phần lỡ
+  bool open() {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) return false;
+    termios tio;
+    if (tcgetattr(fd_, &tio) == 0) {
+      cfmakeraw(&tio);
+      cfsetispeed(&tio, B115200);
+      cfsetospeed(&tio, B115200);
+      tcsetattr(fd_, TCSANOW, &tio);
+    }
+    tcflush(fd_, TCIFLUSH);  // Như cổng USB-serial thật: byte tới lúc cổng đóng coi như mất
+    decoder_ = hublink::Decoder<>();
+    firmware_.clear();
+    channel_ = NO_CHANNEL;
+    if (opened_) reconnects++;
+    opened_ = true;
+
+    send("helloMaster");
+    send("getListDevice");
+    if (binary_) send("setOutput bin");
+    if (nextSeq_) requestReplay();
+    return true;
+  }
+
+  void close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+  // Lệnh Serial của Master, thêm '\n'. Lệnh ngắn nên không xếp hàng khi tty đầy.
+  bool send(const char* cmd) {
+    if (fd_ < 0) return false;
+    std::string line(cmd);
+    line += '\n';
+    return ::write(fd_, line.data(), line.size()) == (ssize_t)line.size();
+  }
+
+  // Xử lý mọi byte đang có, now: ms Unix. false khi thiết bị đã đóng/bị rút.
+  bool service(HubListener& listener, int64_t now) {
+    uint8_t buf[4096];
+    while (true) {
+      ssize_t n = ::read(fd_, buf, sizeof(buf));
+      if (n == 0) return false;
+      if (n < 0) return errno == EAGAIN || errno == EINTR;
+      for (ssize_t i = 0; i < n; i++) {
+        switch (decoder_.feed(buf[i])) {
+          case hublink::Decoder<>::LINE:
+            lines++;
+            handleLine(listener, decoder_.line(), decoder_.lineLen(), now);
+            break;
+          case hublink::Decoder<>::FRAME:
+            frames++;
+            handleFrame(listener, decoder_.body(), decoder_.bodyLen(), now);
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+
+ private:
+  std::string name_, path_;
+  bool binary_;
+  int fd_ = -1;
+  bool opened_ = false;
+  hublink::Decoder<> decoder_;
+  std::vector<Device> devices_;  // Chỉ số node trong khung nhị phân -> ID
+  std::string firmware_;
+  uint8_t channel_ = NO_CHANNEL;
+  uint32_t nextSeq_ = 0;         // seq lớn nhất đã giao + 1, 0 = chưa biết
+  bool replaying_ = false;       // Đã gửi dumpSince, chưa nhận dump_end
+  uint32_t replayFrom_ = 0;      // Khoảng phát lại [replayFrom_, replayTo_)
+  uint32_t replayTo_ = 0;        // UINT32_MAX tới khi dump_begin báo "to"
+  std::vector<bool> replaySeen_; // seq đã giao trong khoảng, chỉ số seq - replayFrom_
+  int64_t clockOffset_ = 0;      // ms Unix - millis() của Master
+  bool clockKnown_ = false;
+  char numbers_[nodeproto::FIELDS_MAX][16];  // Số của khung nhị phân đổi ra văn bản
+
+  void learnClock(uint32_t hubMillis, int64_t now) {
+    clockOffset_ = now - hubMillis;
+    clockKnown_ = true;
+  }
+
+  int64_t hubTime(uint32_t hubMillis, int64_t now) const { return clockKnown_ ? clockOffset_ + hubMillis : now; }
+
+  // Master khởi động lại mà không giữ nhật ký: seq đếm lại từ 1
+  void checkLogRestart(uint32_t next) {
+    if (nextSeq_ && next < nextSeq_) {
+      nextSeq_ = 0;
+      endReplay();
+    }
+  }
+
+  // Xin lại từ seq chưa giao đầu tiên. Đứt giữa lúc đang phát lại thì giữ dấu các seq
+  // đã giao; bản trực tiếp sau khoảng cũ tới nextSeq_ đã tới liền mạch trước khi đứt.
+  void requestReplay() {
+    if (replaying_) {
+      if (replayTo_ != UINT32_MAX && nextSeq_ > replayTo_) {
+        replaySeen_.resize(replayTo_ - replayFrom_, false);
+        replaySeen_.resize(nextSeq_ - replayFrom_, true);
+      }
+      size_t skip = 0;
+      while (skip < replaySeen_.size() && replaySeen_[skip]) skip++;
+      replaySeen_.erase(replaySeen_.begin(), replaySeen_.begin() + skip);
+      replayFrom_ += skip;
+    } else {
+      replaySeen_.clear();
+      replayFrom_ = nextSeq_;
+    }
+    replaying_ = true;
+    replayTo_ = UINT32_MAX;
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "dumpSince %u", replayFrom_);
+    send(cmd);
+  }
+
+  void endReplay() {
+    replaying_ = false;
+    replaySeen_.clear();
+  }
+
+  // false: seq đã giao
+  bool firstDelivery(uint32_t seq) {
+    if (replaying_ && seq >= replayFrom_ && seq < replayTo_) {
+      size_t i = seq - replayFrom_;
+      if (i < REPLAY_WINDOW) {
+        if (i >= replaySeen_.size()) replaySeen_.resize(i + 1, false);
+        if (replaySeen_[i]) return false;
+        replaySeen_[i] = true;
+        if (seq >= nextSeq_) nextSeq_ = seq + 1;
+        return true;
+      }
+      endReplay();  // Master không trả lời dumpSince (FW cũ): chỉ còn so với seq lớn nhất
+    }
+    if (nextSeq_ && seq < nextSeq_) return false;
+    nextSeq_ = seq + 1;
+    return true;
+  }
+
+  void deliver(HubListener& listener, const Reading& r) {
+    if (r.seq && !firstDelivery(r.seq)) { duplicates++; return; }
+    readings++;
+    listener.onReading(*this, r);
+  }
+
+  void handleLine(HubListener& listener, const char* line, size_t len, int64_t now) {
+    if (line[0] != '{' && line[0] != '[') {
+      // "Hi!" rồi chuỗi phiên bản, trả lời helloMaster
+      if (strncmp(line, "FW_", 3) == 0) firmware_.assign(line, len);
+      return;
+    }
+    jsonscan::Value doc = jsonscan::Value::parse(line, len);
+    if (!doc) return;
+    if (doc.isArray()) {
+      learnDevices(doc);
+      listener.onMessage(*this, doc.raw());
+      return;
+    }
+
+    jsonscan::Value sensors = doc["sensors"];
+    if (sensors) {
+      Reading r;
+      r.id = doc["id"].string();
+      r.seq = doc["seq"].uint();
+      r.delta = doc["delta"].boolean();
+      jsonscan::Value ts = doc["ts"];
+      r.replay = (bool)ts;
+      r.time = ts ? hubTime(ts.uint(), now) : now;
+      readFields(sensors, r);
+      deliver(listener, r);
+      return;
+    }
+
+    jsonscan::Value batch = doc["batch"];
+    if (batch) {
+      learnClock(doc["now"].uint(), now);
+      jsonscan::Slice id = doc["id"].string();
+      jsonscan::Value::Cursor c = batch.items();
+      jsonscan::Value item;
+      while (c.next(item)) {
+        Reading r;
+        r.id = id;
+        r.seq = item["seq"].uint();
+        r.time = hubTime(item["ts"].uint(), now);
+        readFields(item["sensors"], r);
+        deliver(listener, r);
+      }
+      return;
+    }
+
+    jsonscan::Value status = doc["status"];
+    if (status.string() == "offline") {
+      listener.onOffline(*this, doc["id"].string(), now);
+      return;
+    }
+    if (status.string() == "unpolled") {
+      listener.onUnpolled(*this, doc["id"].string(), now);
+      return;
+    }
+    if (status.string() == "system_ready") {
+      boots++;
+      firmware_.clear();
+      channel_ = NO_CHANNEL;
+      send("helloMaster");
+      send("logInfo");  // Hub vừa khởi động lại: xem nhật ký còn hay đã đếm lại
+      send("getListDevice");
+      if (binary_) send("setOutput bin");
+    }
+
+    jsonscan::Value event = doc["event"];
+    if (event.string() == "data_collection_finished") {
+      listener.onSweepDone(*this, now);
+      return;
+    }
+    if (event.string() == "dump_begin") {
+      learnClock(doc["now"].uint(), now);
+      uint32_t to = doc["to"].uint();
+      checkLogRestart(to);
+      if (replaying_) {
+        replayTo_ = to > replayFrom_ ? to : replayFrom_;
+        if (replaySeen_.size() > replayTo_ - replayFrom_) replaySeen_.resize(replayTo_ - replayFrom_);
+      }
+    } else if (event.string() == "dump_end") {
+      uint32_t next = doc["next"].uint();
+      if (replaying_ && next > nextSeq_) nextSeq_ = next;  // Seq trước "next" không còn trong nhật ký thì đã mất hẳn
+      endReplay();
+    } else if (event.string() == "log_info") {
+      checkLogRestart(doc["next"].uint());
+    } else if (event.string() == "channel_scan" || event.string() == "channel_changed" ||
+               event.string() == "channel_configured") {
+      channel_ = doc["channel"].uint(NO_CHANNEL);
+    } else if (event.string() == "registered" || event.string() == "deleted" ||
+               event.string() == "all_nodes_deleted") {
+      send("getListDevice");  // Chỉ số node trong khung nhị phân đổi theo danh sách
+    }
+    listener.onMessage(*this, doc.raw());
+  }
+
+  void readFields(jsonscan::Value sensors, Reading& r) {
+    jsonscan::Value::Cursor c = sensors.items();
+    jsonscan::Slice key;
+    jsonscan::Value v;
+    while (r.count < nodeproto::FIELDS_MAX && c.next(key, v)) {
+      if (v.type() != jsonscan::Value::NUMBER) continue;
+      r.fields[r.count].name = key;
+      r.fields[r.count].text = v.raw();
+      r.count++;
+    }
+  }
+
+  void learnDevices(jsonscan::Value list) {
+    devices_.clear();
+    jsonscan::Value::Cursor c = list.items();
+    jsonscan::Value item;
+    while (c.next(item)) {
+      jsonscan::Value type = item["type"];
+      uint8_t kind = type.string() == "soil" ? hublink::KIND_SOIL : (type.string() == "atm" ? hublink::KIND_ATM : hublink::KIND_UNKNOWN);
+      devices_.push_back({ item["id"].string().str(), kind });
+    }
+  }
+
+  jsonscan::Slice nodeId(uint8_t node) const {
+    if (node >= devices_.size()) return jsonscan::Slice();
+    return jsonscan::Slice(devices_[node].id.data(), devices_[node].id.size());
+  }
+
+  void setNumber(Reading& r, const char* name, double value) {
+    char* text = numbers_[r.count];
+    int n = snprintf(text, sizeof(numbers_[0]), "%.7g", value);
+    r.fields[r.count].name = jsonscan::Slice(name, strlen(name));
+    r.fields[r.count].text = jsonscan::Slice(text, n);
+    r.count++;
+  }
+
+  void handleFrame(HubListener& listener, const uint8_t* body, uint8_t len, int64_t now) {
+    switch (body[0]) {
+      case hublink::FRAME_READING:
+      case hublink::FRAME_REPLAY: {
+        hublink::ReadingHeader h;
+        if (len < sizeof(h)) return;
+        memcpy(&h, body, sizeof(h));
+        if (body[0] == hublink::FRAME_READING) learnClock(h.timestamp, now);
+        Reading r;
+        r.id = nodeId(h.node);
+        if (r.id.empty()) return;  // Chưa có danh sách thiết bị hoặc danh sách cũ
+        r.seq = h.seq;
+        r.replay = body[0] == hublink::FRAME_REPLAY;
+        r.time = hubTime(h.timestamp, now);
+        const uint8_t* payload = body + sizeof(h);
+        uint8_t size = len - sizeof(h);
+        if (h.nodeType == hublink::KIND_SOIL && size == sizeof(nodeproto::SoilData)) {
+          nodeproto::SoilData d;
+          memcpy(&d, payload, sizeof(d));
+          setNumber(r, "soil_moisture", d.moisture);
+          setNumber(r, "soil_temperature", d.temperature);
+        } else if (h.nodeType == hublink::KIND_ATM && size == sizeof(nodeproto::AtmData)) {
+          nodeproto::AtmData d;
+          memcpy(&d, payload, sizeof(d));
+          setNumber(r, "air_temperature", d.air_temp);
+          setNumber(r, "air_humidity", d.air_humid);
+          setNumber(r, "rain_intensity", d.rain);
+          setNumber(r, "wind_speed", d.wind);
+          setNumber(r, "light_intensity", d.light);
+          setNumber(r, "barometric_pressure", d.pressure);
+        } else if (h.nodeType == hublink::KIND_ATM && size == sizeof(nodeproto::AtmDataV2)) {
+          nodeproto::AtmDataV2 d;
+          memcpy(&d, payload, sizeof(d));
+          setNumber(r, "air_temperature", d.air_temp);
+          setNumber(r, "air_humidity", d.air_humid);
+          setNumber(r, "rain_intensity", d.rain);
+          setNumber(r, "wind_speed", d.wind);
+          setNumber(r, "light_intensity", d.light);
+          setNumber(r, "barometric_pressure", d.pressure);
+          setNumber(r, "wind_gust", d.gust);
+        } else {
+          return;
+        }
+        deliver(listener, r);
+        return;
+      }
+      case hublink::FRAME_OFFLINE:
+      case hublink::FRAME_UNPOLLED: {
+        hublink::NodeHeader h;
+        if (len < sizeof(h)) return;
+        memcpy(&h, body, sizeof(h));
+        learnClock(h.timestamp, now);
+        jsonscan::Slice id = nodeId(h.node);
+        if (id.empty()) return;
+        if (body[0] == hublink::FRAME_OFFLINE) listener.onOffline(*this, id, now);
+        else listener.onUnpolled(*this, id, now);
+        return;
+      }
+      case hublink::FRAME_SWEEP_DONE: {
+        hublink::EventHeader h;
+        if (len < sizeof(h)) return;
+        memcpy(&h, body, sizeof(h));
+        learnClock(h.timestamp, now);
+        listener.onSweepDone(*this, now);
+        return;
+      }
+    }
+  }
+};
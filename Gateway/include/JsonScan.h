@@ -0,0 +1,188 @@
+/**
+ * JsonScan - Đọc JSON ngay trên bộ đệm dòng, không cấp phát, không chép chuỗi
+ *
+ * Value::parse() kiểm tra cú pháp cả dòng một lượt rồi trả về Value trỏ vào
+ * văn bản gốc. Tra khóa hay duyệt mảng chỉ quét lại phần văn bản đó; chuỗi và
+ * số trả về dạng Slice nguyên văn, chỉ đổi sang số khi phía gọi cần giá trị.
+ * Dòng của MainHub ngắn (vài trăm byte) nên quét lại rẻ hơn dựng cây.
+ *
+ * string() không giải mã escape: JSON của Master và SimHub chỉ có ASCII, không
+ * có ký tự cần escape. Slice chỉ hợp lệ khi bộ đệm gốc còn nguyên.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+namespace jsonscan {
+
+struct Slice {
+  const char* ptr = nullptr;
+  size_t len = 0;
+
+  Slice() = default;
+  Slice(const char* p, size_t n) : ptr(p), len(n) {}
+
+  bool empty() const { return len == 0; }
+  bool operator==(const char* s) const { return strncmp(ptr ? ptr : "", s, len) == 0 && s[len] == '\0'; }
+  bool operator!=(const char* s) const { return !(*this == s); }
+  std::string str() const { return std::string(ptr ? ptr : "", len); }
+};
+
+const uint8_t MAX_DEPTH = 32;
+
+inline const char* skipSpace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+  return p;
+}
+
+// Con trỏ ngay sau giá trị bắt đầu tại p, nullptr nếu sai cú pháp
+inline const char* skipValue(const char* p, const char* end, uint8_t depth = 0) {
+  if (p >= end || depth > MAX_DEPTH) return nullptr;
+  switch (*p) {
+    case '"':
+      for (p++; p < end; p++) {
+        if (*p == '\\') { p++; continue; }
+        if (*p == '"') return p + 1;
+      }
+      return nullptr;
+
+    case '{':
+    case '[': {
+      bool object = *p == '{';
+      char close = object ? '}' : ']';
+      p = skipSpace(p + 1, end);
+      if (p < end && *p == close) return p + 1;
+      while (p < end) {
+        if (object) {
+          if (*p != '"' || !(p = skipValue(p, end, depth + 1))) return nullptr;
+          p = skipSpace(p, end);
+          if (p >= end || *p != ':') return nullptr;
+          p = skipSpace(p + 1, end);
+        }
+        if (!(p = skipValue(p, end, depth + 1))) return nullptr;
+        p = skipSpace(p, end);
+        if (p < end && *p == close) return p + 1;
+        if (p >= end || *p != ',') return nullptr;
+        p = skipSpace(p + 1, end);
+      }
+      return nullptr;
+    }
+
+    case 't': return end - p >= 4 && memcmp(p, "true", 4) == 0 ? p + 4 : nullptr;
+    case 'f': return end - p >= 5 && memcmp(p, "false", 5) == 0 ? p + 5 : nullptr;
+    case 'n': return end - p >= 4 && memcmp(p, "null", 4) == 0 ? p + 4 : nullptr;
+
+    default: {
+      const char* start = p;
+      if (*p == '-') p++;
+      while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-')) p++;
+      return p > start && (p[-1] >= '0' && p[-1] <= '9') ? p : nullptr;
+    }
+  }
+}
+
+class Value {
+ public:
+  enum Type : uint8_t { INVALID, OBJECT, ARRAY, STRING, NUMBER, BOOL, NUL };
+
+  Value() = default;
+
+  // Cả văn bản phải là đúng một giá trị JSON (cho phép khoảng trắng hai đầu)
+  static Value parse(const char* text, size_t len) {
+    const char* end = text + len;
+    const char* p = skipSpace(text, end);
+    const char* after = skipValue(p, end);
+    if (!after || skipSpace(after, end) != end) return Value();
+    return Value(p, after);
+  }
+
+  Type type() const {
+    if (!begin_) return INVALID;
+    switch (*begin_) {
+      case '{': return OBJECT;
+      case '[': return ARRAY;
+      case '"': return STRING;
+      case 't': case 'f': return BOOL;
+      case 'n': return NUL;
+      default: return NUMBER;
+    }
+  }
+
+  explicit operator bool() const { return begin_ != nullptr; }
+  bool isObject() const { return type() == OBJECT; }
+  bool isArray() const { return type() == ARRAY; }
+
+  // Văn bản nguyên văn của giá trị, kể cả ngoặc
+  Slice raw() const { return Slice(begin_, end_ - begin_); }
+
+  // Nội dung chuỗi không có ngoặc kép; rỗng nếu không phải chuỗi
+  Slice string() const { return type() == STRING ? Slice(begin_ + 1, end_ - begin_ - 2) : Slice(); }
+
+  // Số đứng trước ',' ']' '}' hoặc cuối dòng nên strtod dừng đúng chỗ
+  double number(double def = 0) const { return type() == NUMBER ? strtod(begin_, nullptr) : def; }
+  uint32_t uint(uint32_t def = 0) const { return type() == NUMBER ? (uint32_t)strtoul(begin_, nullptr, 10) : def; }
+  int64_t int64(int64_t def = 0) const { return type() == NUMBER ? strtoll(begin_, nullptr, 10) : def; }
+  bool boolean(bool def = false) const { return type() == BOOL ? *begin_ == 't' : def; }
+
+  // Duyệt phần tử mảng hoặc cặp khóa/giá trị của object, theo đúng thứ tự trong văn bản
+  class Cursor {
+   public:
+    bool next(Value& value) { Slice key; return next(key, value); }
+    bool next(Slice& key, Value& value) {
+      p_ = skipSpace(p_, end_);
+      if (p_ >= end_ || *p_ == '}' || *p_ == ']') return false;
+      if (object_) {
+        const char* k = p_;
+        p_ = skipValue(p_, end_);
+        key = Slice(k + 1, p_ - k - 2);
+        p_ = skipSpace(p_, end_) + 1;  // ':'
+        p_ = skipSpace(p_, end_);
+      }
+      const char* v = p_;
+      p_ = skipValue(p_, end_);
+      value = Value(v, p_);
+      p_ = skipSpace(p_, end_);
+      if (p_ < end_ && *p_ == ',') p_++;
+      return true;
+    }
+
+   private:
+    friend class Value;
+    Cursor(const char* p, const char* end, bool object) : p_(p), end_(end), object_(object) {}
+    const char* p_;
+    const char* end_;
+    bool object_;
+  };
+
+  // Giá trị đã qua parse() nên cấu trúc đúng; Value không phải object/mảng cho cursor rỗng
+  Cursor items() const {
+    Type t = type();
+    if (t != OBJECT && t != ARRAY) return Cursor(end_, end_, false);
+    return Cursor(begin_ + 1, end_ - 1, t == OBJECT);
+  }
+
+  // Value rỗng (INVALID) nếu không có khóa hoặc không phải object
+  Value operator[](const char* key) const {
+    if (type() != OBJECT) return Value();
+    Cursor c = items();
+    Slice k;
+    Value v;
+    while (c.next(k, v)) {
+      if (k == key) return v;
+    }
+    return Value();
+  }
+
+ private:
+  Value(const char* begin, const char* end) : begin_(begin), end_(end) {}
+  const char* begin_ = nullptr;
+  const char* end_ = nullptr;
+};
+
+} // namespace jsonscan
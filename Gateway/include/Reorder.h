@@ -0,0 +1,66 @@
+/**
+ * Reorder - Gộp dòng của nhiều hub thành một luồng theo thứ tự "time"
+ *
+ * Mỗi dòng đã định dạng được giữ tối đa window ms rồi mới nhả, dòng nào có
+ * time nhỏ hơn nhả trước; cùng time thì giữ thứ tự tới. Bản đo lùi giờ (batch,
+ * khung nhị phân tới trễ) trong cửa sổ vì vậy vẫn vào đúng chỗ. Dòng tới khi
+ * đã nhả qua mốc time của nó (phát lại dumpSince cũ hơn cửa sổ) vẫn được ghi
+ * ngay và được đếm vào late.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <queue>
+#include <string>
+#include <vector>
+
+class ReorderBuffer {
+ public:
+  uint64_t late = 0;
+
+  explicit ReorderBuffer(int64_t windowMs) : window_(windowMs) {}
+
+  void add(int64_t time, std::string&& line) {
+    if (time < released_) late++;
+    heap_.push({ time, order_++, std::move(line) });
+  }
+
+  size_t size() const { return heap_.size(); }
+
+  // Nối vào out các dòng có time <= now - window, theo thứ tự time
+  void release(int64_t now, std::string& out) { releaseUntil(now - window_, out); }
+
+  void releaseAll(std::string& out) { releaseUntil(INT64_MAX, out); }
+
+  // Lúc dòng cũ nhất tới hạn nhả, INT64_MAX nếu rỗng
+  int64_t nextDue() const { return heap_.empty() ? INT64_MAX : heap_.top().time + window_; }
+
+ private:
+  struct Item {
+    int64_t time;
+    uint64_t order;
+    std::string line;
+  };
+
+  struct Later {
+    bool operator()(const Item& a, const Item& b) const {
+      return a.time != b.time ? a.time > b.time : a.order > b.order;
+    }
+  };
+
+  int64_t window_;
+  int64_t released_ = INT64_MIN;
+  uint64_t order_ = 0;
+  std::priority_queue<Item, std::vector<Item>, Later> heap_;
+
+  void releaseUntil(int64_t limit, std::string& out) {
+    while (!heap_.empty() && heap_.top().time <= limit) {
+      const Item& top = heap_.top();
+      if (top.time > released_) released_ = top.time;
+      out += top.line;
+      heap_.pop();
+    }
+  }
+};
@@ -0,0 +1,271 @@
+/**
+ * Rollup - Gộp min/max/mean/count theo 1 phút, 1 giờ, 1 ngày ngay khi nhận bản đo
+ *
+ * Mỗi chuỗi thô (node, field) có ROLLUP_TIERS tầng; mỗi tầng là bốn chuỗi đi
+ * kèm trong cùng SeriesStore, "field@1h.min", "field@1h.max", "field@1h.mean",
+ * "field@1h.count", một điểm mỗi ô tại mốc đầu ô (ô căn theo UTC). Mốc đều nhau
+ * nên cột time của chúng gần như không tốn chỗ. Ô chỉ có một điểm (tầng 1m khi
+ * hub quét mỗi phút trở lên) chỉ ghi cột count: min/max/mean chính là điểm thô,
+ * ghi lại thì tầng 1m tốn gấp ba chuỗi thô. Khi đọc, các ô đó được dựng lại từ
+ * điểm thô ghi trước nhất của ô (SeriesStore::scan, theo thứ tự ghi).
+ *
+ * Ô đang gộp nằm trên RAM; điểm thô rơi sang ô sau, hoặc ô đã hết hạn quá
+ * ROLLUP_GRACE_MS (tick), thì ô được ghi. Điểm tới trễ hơn ô đã ghi chỉ vào
+ * chuỗi thô và được đếm vào late: ô đã ghi không đổi nữa, kể cả ô một điểm
+ * (điểm trễ được ghi sau điểm của ô). Mở store thì ô đang gộp được dựng lại từ
+ * chuỗi thô kể từ ô cuối đã ghi, nên chuỗi thô chưa có rollup (store ghi trước
+ * khi có Rollup) được gộp bù toàn bộ ở lần mở đầu tiên.
+ *
+ * query() dùng tầng thô nhất có độ rộng ô <= step yêu cầu (step < 1 phút thì
+ * đọc chuỗi thô) rồi gộp tiếp thành ô step (làm tròn lên bội số độ rộng tầng,
+ * căn theo epoch, để ô của tầng không bị cắt đôi). Số điểm phải giải nén tỉ lệ với
+ * (to - from) / độ rộng tầng, không phụ thuộc lịch sử dài bao nhiêu.
+ */
+
+#pragma once
+
+#include "SeriesStore.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+const uint8_t ROLLUP_TIERS = 3;
+const int64_t ROLLUP_MS[ROLLUP_TIERS] = { 60000, 3600000, 86400000 };
+const char* const ROLLUP_NAMES[ROLLUP_TIERS] = { "1m", "1h", "1d" };
+const uint16_t ROLLUP_BLOCK_POINTS[ROLLUP_TIERS] = { 1440, 256, 256 };  // Mỗi khối: một ngày ô 1m, ~10 ngày ô 1h, ~8 tháng ô 1d
+const int64_t ROLLUP_GRACE_MS = 10000;     // Chờ điểm tới trễ (cửa sổ xếp thứ tự của gateway) trước khi ghi ô
+
+struct Bucket {
+  int64_t start = 0;
+  double min = 0, max = 0, sum = 0;
+  uint32_t count = 0;
+
+  double mean() const { return count ? sum / count : 0; }
+
+  void add(double v) {
+    min = count ? std::min(min, v) : v;
+    max = count ? std::max(max, v) : v;
+    sum += v;
+    count++;
+  }
+
+  void merge(const Bucket& b) {
+    if (!b.count) return;
+    min = count ? std::min(min, b.min) : b.min;
+    max = count ? std::max(max, b.max) : b.max;
+    sum += b.sum;
+    count += b.count;
+  }
+};
+
+class Rollups {
+ public:
+  enum Column : uint8_t { MIN, MAX, MEAN, COUNT, COLUMNS };
+
+  uint64_t late = 0;
+
+  explicit Rollups(SeriesStore& store) : store_(store) {}
+
+  SeriesStore& store() const { return store_; }
+
+  // Sau SeriesStore::open: gắn các chuỗi rollup vào chuỗi thô, dựng lại ô đang gộp
+  void open() {
+    uint32_t n = store_.series().size();  // Chuỗi rollup tạo thêm trong lúc này đều có id >= n
+    bool emitted = false;
+    for (uint32_t id = 0; id < n; id++) {
+      if (isRaw(id)) emitted |= track(id);
+    }
+    if (emitted) store_.compact();  // Ô gộp bù được ghi không qua WAL
+  }
+
+  bool append(const char* node, size_t nodeLen, const char* field, size_t fieldLen, int64_t time, double value) {
+    uint32_t id = store_.intern(node, nodeLen, field, fieldLen);
+    if (id == SeriesStore::NONE) return false;
+    if (id >= tracks_.size() || !tracks_[id].raw) track(id);
+    store_.append(id, time, value);
+    feed(tracks_[id], time, value, true, true);
+    return true;
+  }
+
+  // Ghi các ô đã hết hạn dù chưa có điểm của ô sau (node im lặng)
+  void tick(int64_t now) {
+    for (Track& t : tracks_) {
+      if (!t.raw) continue;
+      for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+        if (t.open[tier].count && now >= t.open[tier].start + ROLLUP_MS[tier] + ROLLUP_GRACE_MS) emit(t, tier, true);
+      }
+    }
+  }
+
+  // Ô step ms trong [from, to] của chuỗi thô id, theo thứ tự time; trả về tầng đã đọc (-1: chuỗi thô).
+  // step trả về độ rộng ô thực dùng.
+  int query(uint32_t id, int64_t from, int64_t to, int64_t& step, std::vector<Bucket>& out) const {
+    int tier = -1;
+    if (id < tracks_.size() && tracks_[id].raw) {
+      for (uint8_t i = 0; i < ROLLUP_TIERS; i++) {
+        if (ROLLUP_MS[i] <= step && tracks_[id].ids[i][COUNT] != SeriesStore::NONE) tier = i;
+      }
+    }
+    std::vector<Bucket> cells;
+    if (tier < 0) readRaw(id, from, to, cells);
+    else readTier(id, tracks_[id], tier, from, to, cells);
+
+    int64_t width = tier < 0 ? 1 : ROLLUP_MS[tier];
+    step = (step + width - 1) / width * width;
+    if (step <= width) {
+      out.insert(out.end(), cells.begin(), cells.end());
+      return tier;
+    }
+    for (const Bucket& c : cells) {
+      int64_t start = alignDown(c.start, step);
+      if (out.empty() || out.back().start != start) {
+        out.emplace_back();
+        out.back().start = start;
+      }
+      out.back().merge(c);
+    }
+    return tier;
+  }
+
+ private:
+  struct Track {
+    bool raw = false;
+    uint32_t ids[ROLLUP_TIERS][COLUMNS];
+    Bucket open[ROLLUP_TIERS];
+    int64_t done[ROLLUP_TIERS];   // Hết ô cuối đã ghi: điểm có time < done là trễ
+  };
+
+  SeriesStore& store_;
+  std::vector<Track> tracks_;     // Theo id chuỗi thô
+  std::vector<gorilla::Point> points_;
+
+  static int64_t alignDown(int64_t t, int64_t width) { return t - ((t % width) + width) % width; }
+
+  bool isRaw(uint32_t id) const { return !strchr(store_.series()[id].field.c_str(), '@'); }
+
+  // Tìm/tạo chuỗi rollup của chuỗi thô id rồi gộp lại phần chuỗi thô chưa vào ô đã ghi.
+  // true nếu có ô được ghi (không qua WAL).
+  bool track(uint32_t id) {
+    if (tracks_.size() <= id) tracks_.resize(id + 1);
+    std::string node = store_.series()[id].node, field = store_.series()[id].field;
+    static const char* const COLUMN_NAMES[COLUMNS] = { "min", "max", "mean", "count" };
+    Track t;
+    t.raw = true;
+    int64_t since = INT64_MAX;
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+      for (uint8_t c = 0; c < COLUMNS; c++) {
+        std::string name = field + '@' + ROLLUP_NAMES[tier] + '.' + COLUMN_NAMES[c];
+        uint32_t rid = store_.intern(node.data(), node.size(), name.data(), name.size());
+        if (rid != SeriesStore::NONE) store_.setBlockLimit(rid, ROLLUP_BLOCK_POINTS[tier], ROLLUP_BLOCK_POINTS[tier] * ROLLUP_MS[tier]);
+        t.ids[tier][c] = rid;
+      }
+      uint32_t count = t.ids[tier][COUNT];
+      int64_t last = count == SeriesStore::NONE ? INT64_MIN : store_.lastTime(count);
+      t.done[tier] = last == INT64_MIN ? INT64_MIN : last + ROLLUP_MS[tier];
+      since = std::min(since, t.done[tier]);
+    }
+
+    bool emitted = false;
+    points_.clear();
+    store_.query(id, since, INT64_MAX, points_);
+    for (const gorilla::Point& p : points_) emitted |= feed(t, p.time, p.value, false, false);
+    tracks_[id] = t;
+    return emitted;
+  }
+
+  // Đưa một điểm thô vào ô của mọi tầng; true nếu có ô được ghi
+  bool feed(Track& t, int64_t time, double value, bool live, bool log) {
+    bool emitted = false;
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+      Bucket& b = t.open[tier];
+      int64_t start = alignDown(time, ROLLUP_MS[tier]);
+      if (start < t.done[tier] || (b.count && start < b.start)) {
+        late += live;  // Dựng lại lúc mở: điểm đã nằm trong ô đã ghi, không phải trễ
+        continue;
+      }
+      if (b.count && start != b.start) {
+        emit(t, tier, log);
+        emitted = true;
+      }
+      if (!b.count) b.start = start;
+      b.add(value);
+    }
+    return emitted;
+  }
+
+  void emit(Track& t, uint8_t tier, bool log) {
+    Bucket& b = t.open[tier];
+    const double values[COLUMNS] = { b.min, b.max, b.mean(), (double)b.count };
+    for (uint8_t c = b.count == 1 ? COUNT : 0; c < COLUMNS; c++) {
+      if (t.ids[tier][c] != SeriesStore::NONE) store_.append(t.ids[tier][c], b.start, values[c], log);
+    }
+    t.done[tier] = b.start + ROLLUP_MS[tier];
+    b = Bucket();
+  }
+
+  void readRaw(uint32_t id, int64_t from, int64_t to, std::vector<Bucket>& out) const {
+    std::vector<gorilla::Point> points;
+    store_.query(id, from, to, points);
+    out.reserve(points.size());
+    for (const gorilla::Point& p : points) {
+      out.emplace_back();
+      out.back().start = p.time;
+      out.back().add(p.value);
+    }
+  }
+
+  // Ô đã ghi của tầng (bốn cột ghép theo time, ô một điểm lấy từ chuỗi thô id) cộng ô đang gộp
+  void readTier(uint32_t id, const Track& t, uint8_t tier, int64_t from, int64_t to, std::vector<Bucket>& out) const {
+    int64_t first = from < INT64_MIN + ROLLUP_MS[tier] ? INT64_MIN : alignDown(from, ROLLUP_MS[tier]);
+    std::vector<gorilla::Point> cols[COLUMNS];
+    for (uint8_t c = 0; c < COLUMNS; c++) store_.query(t.ids[tier][c], first, to, cols[c]);
+    size_t at[COLUMNS] = {};
+    size_t base = out.size();
+    std::vector<int64_t> single;  // Ô một điểm không có min/max/mean
+    for (const gorilla::Point& count : cols[COUNT]) {
+      Bucket b;
+      b.start = count.time;
+      b.count = (uint32_t)count.value;
+      bool complete = true;
+      double v[COUNT];
+      // Bốn cột được ghi cùng nhau; thiếu một cột (khối cuối hỏng) thì bỏ ô đó
+      for (uint8_t c = 0; c < COUNT; c++) {
+        while (at[c] < cols[c].size() && cols[c][at[c]].time < b.start) at[c]++;
+        complete &= at[c] < cols[c].size() && cols[c][at[c]].time == b.start;
+        if (complete) v[c] = cols[c][at[c]].value;
+      }
+      if (!complete && b.count == 1) single.push_back(b.start);
+      if (!complete || !b.count) continue;
+      b.min = v[MIN];
+      b.max = v[MAX];
+      b.sum = v[MEAN] * b.count;
+      out.push_back(b);
+    }
+    if (!single.empty()) {
+      // Điểm đầu tiên của ô theo thứ tự ghi là điểm đã gộp; điểm tới trễ sau khi ô đã ghi bị bỏ qua
+      std::vector<gorilla::Point> points;
+      store_.scan(id, single.front(), single.back() + ROLLUP_MS[tier] - 1, points);
+      std::vector<Bucket> cells(single.size());
+      for (const gorilla::Point& p : points) {
+        int64_t start = alignDown(p.time, ROLLUP_MS[tier]);
+        size_t i = std::lower_bound(single.begin(), single.end(), start) - single.begin();
+        if (i < single.size() && single[i] == start && !cells[i].count) {
+          cells[i].start = start;
+          cells[i].add(p.value);
+        }
+      }
+      size_t mid = out.size();
+      for (const Bucket& b : cells) {
+        if (b.count) out.push_back(b);
+      }
+      auto earlier = [](const Bucket& x, const Bucket& y) { return x.start < y.start; };
+      std::inplace_merge(out.begin() + base, out.begin() + mid, out.end(), earlier);
+    }
+    const Bucket& open = t.open[tier];
+    if (open.count && open.start >= first && open.start <= to) out.push_back(open);
+  }
+};
@@ -0,0 +1,200 @@
+/**
+ * Scheduler - Lập lịch quét cho nhiều MainHub trên cùng một gateway
+ *
+ * Mỗi hub có một HubWorker (máy trạng thái chạy trên epoll chung, không phải
+ * luồng riêng: tty đọc không chặn, phần chậm là lượt quét radio bên trong hub):
+ *   CLOSED -> HELLO (helloMaster, chờ chuỗi FW_V1.x) -> CHANNEL (scanChannels,
+ *   chờ channel_scan) -> IDLE <-> SWEEPING (getDataNow, chờ data_collection_finished)
+ * Hub không trả lời helloMaster sau HELLO_TIMEOUT_MS thì gửi lại; FW không có
+ * scanChannels thì sau CHANNEL_TIMEOUT_MS coi như chưa biết kênh. Master báo
+ * system_ready (HubPort::boots đổi) thì worker về HELLO ở bất kỳ trạng thái nào.
+ *
+ * Lượt quét của N hub lệch pha nhau period/N trong mỗi chu kỳ. Hai hub cùng
+ * kênh hoặc kênh sát nhau (cách <= CHANNEL_GUARD MHz, băng thông 2Mbps) không
+ * bao giờ quét cùng lúc: hub tới lượt mà hub xung đột đang quét thì chờ hub đó
+ * xong, nhiều hub cùng chờ thì hub tới lượt sớm nhất đi trước. Hub chưa biết
+ * kênh coi như xung đột với mọi hub. Hub khác kênh quét song song. Trễ mỗi
+ * lượt (từ lúc gửi getDataNow tới data_collection_finished) được ghi vào
+ * SweepStats.
+ */
+
+#pragma once
+
+#include "HubPort.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+const int64_t HELLO_TIMEOUT_MS = 2000;
+const int64_t CHANNEL_TIMEOUT_MS = 2000;
+const int64_t SWEEP_GIVE_UP_MS = 60000;  // Không thấy data_collection_finished thì bỏ lượt
+const uint8_t CHANNEL_GUARD = 2;
+
+struct SweepStats {
+  static const size_t SAMPLE_CAP = 4096;  // Giữ các lượt gần nhất để tính phân vị
+
+  uint32_t count = 0, timeouts = 0, waits = 0;  // waits: lượt phải chờ hub xung đột
+  int64_t minMs = INT64_MAX, maxMs = 0, totalMs = 0;
+  std::vector<uint32_t> samples;
+
+  void add(int64_t ms) {
+    count++;
+    totalMs += ms;
+    minMs = std::min(minMs, ms);
+    maxMs = std::max(maxMs, ms);
+    if (samples.size() == SAMPLE_CAP) samples.erase(samples.begin());
+    samples.push_back((uint32_t)ms);
+  }
+
+  int64_t percentile(uint8_t p) const {
+    if (samples.empty()) return 0;
+    std::vector<uint32_t> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[(sorted.size() - 1) * p / 100];
+  }
+};
+
+struct HubWorker {
+  enum State : uint8_t { CLOSED, HELLO, CHANNEL, IDLE, SWEEPING };
+
+  std::unique_ptr<HubPort> port;
+  State state = CLOSED;
+  int64_t stateAt = 0;     // Lúc vào trạng thái hiện tại (SWEEPING: lúc gửi getDataNow)
+  int64_t due = 0;         // Lượt quét kế tiếp, 0 = chưa xếp
+  int64_t retryAt = 0;     // CLOSED: lúc thử mở lại tty
+  bool waiting = false;    // Đã tới lượt nhưng đang chờ hub xung đột
+  uint32_t boots = 0;      // HubPort::boots lần cuối worker thấy
+  uint32_t sweepReadings = 0, sweepOffline = 0, sweepUnpolled = 0;
+  SweepStats sweeps;
+
+  static const char* stateName(State s) {
+    static const char* const NAMES[] = { "closed", "hello", "channel", "idle", "sweeping" };
+    return NAMES[s];
+  }
+};
+
+class SweepScheduler {
+ public:
+  SweepScheduler(std::vector<HubWorker>& workers, int64_t periodMs) : workers_(workers), period_(periodMs) {}
+
+  // Cổng vừa mở: HubPort::open() đã gửi helloMaster
+  void opened(HubWorker& w, int64_t now) {
+    w.boots = w.port->boots;
+    enter(w, HubWorker::HELLO, now);
+  }
+
+  void closed(HubWorker& w, int64_t now) { enter(w, HubWorker::CLOSED, now); }
+
+  // data_collection_finished, trả về trễ (ms) hoặc -1 nếu lượt không do gateway gửi
+  int64_t sweepDone(HubWorker& w, int64_t now) {
+    if (w.state != HubWorker::SWEEPING) return -1;
+    int64_t latency = now - w.stateAt;
+    w.sweeps.add(latency);
+    enter(w, HubWorker::IDLE, now);
+    return latency;
+  }
+
+  // Gọi mỗi vòng epoll: chuyển trạng thái theo phản hồi của hub và bắt đầu các lượt tới hạn
+  void tick(int64_t now) {
+    if (!origin_) origin_ = now;
+    for (size_t i = 0; i < workers_.size(); i++) {
+      HubWorker& w = workers_[i];
+      HubPort& port = *w.port;
+      // Master khởi động lại giữa chừng: kênh có thể đã đổi, lượt đang quét bị bỏ
+      if (w.state != HubWorker::CLOSED && w.boots != port.boots) {
+        w.boots = port.boots;
+        enter(w, HubWorker::HELLO, now);
+      }
+      switch (w.state) {
+        case HubWorker::CLOSED:
+          break;
+
+        case HubWorker::HELLO:
+          if (!port.firmware().empty()) {
+            port.send("scanChannels");
+            enter(w, HubWorker::CHANNEL, now);
+          } else if (now - w.stateAt >= HELLO_TIMEOUT_MS) {
+            port.send("helloMaster");
+            w.stateAt = now;
+          }
+          break;
+
+        case HubWorker::CHANNEL:
+          if (port.channel() != NO_CHANNEL || now - w.stateAt >= CHANNEL_TIMEOUT_MS) enter(w, HubWorker::IDLE, now);
+          break;
+
+        case HubWorker::IDLE:
+          if (!period_) break;
+          if (!w.due) w.due = phase(i, now);
+          if (now < w.due) break;
+          if (conflicting(w, now)) {
+            if (!w.waiting) w.sweeps.waits++;
+            w.waiting = true;
+            break;
+          }
+          if (!port.send("getDataNow")) break;
+          w.waiting = false;
+          w.sweepReadings = w.sweepOffline = w.sweepUnpolled = 0;
+          // Giữ nhịp; trễ quá một chu kỳ (hub chậm, chờ xung đột lâu) thì về lại pha của hub
+          w.due = now - w.due < period_ ? w.due + period_ : phase(i, now + 1);
+          enter(w, HubWorker::SWEEPING, now);
+          break;
+
+        case HubWorker::SWEEPING:
+          if (now - w.stateAt >= SWEEP_GIVE_UP_MS) {
+            w.sweeps.timeouts++;
+            enter(w, HubWorker::IDLE, now);
+          }
+          break;
+      }
+    }
+  }
+
+  // Mốc sớm nhất cần tick() lại (để epoll_wait không ngủ quá)
+  int64_t nextWake(int64_t now) const {
+    int64_t next = INT64_MAX;
+    for (const HubWorker& w : workers_) {
+      if (w.state == HubWorker::IDLE && period_ && w.due && !w.waiting) next = std::min(next, w.due);
+    }
+    return std::max(next, now);
+  }
+
+  static bool channelsConflict(uint8_t a, uint8_t b) {
+    if (a == NO_CHANNEL || b == NO_CHANNEL) return true;
+    return abs((int)a - (int)b) <= CHANNEL_GUARD;
+  }
+
+ private:
+  std::vector<HubWorker>& workers_;
+  int64_t period_;
+  int64_t origin_ = 0;
+
+  void enter(HubWorker& w, HubWorker::State state, int64_t now) {
+    w.state = state;
+    w.stateAt = now;
+    if (state != HubWorker::IDLE) w.waiting = false;
+  }
+
+  // Mốc >= now đầu tiên của hub i: origin + i*period/N + k*period
+  int64_t phase(size_t i, int64_t now) const {
+    int64_t offset = origin_ + period_ * (int64_t)i / (int64_t)workers_.size();
+    if (now <= offset) return offset;
+    return offset + (now - offset + period_ - 1) / period_ * period_;
+  }
+
+  // Có hub xung đột đang quét, hoặc cũng đã tới lượt mà tới trước w
+  bool conflicting(const HubWorker& w, int64_t now) const {
+    for (const HubWorker& other : workers_) {
+      if (&other == &w) continue;
+      bool ahead = other.state == HubWorker::IDLE && other.due && other.due <= now &&
+                   (other.due < w.due || (other.due == w.due && &other < &w));
+      if (other.state != HubWorker::SWEEPING && !ahead) continue;
+      if (channelsConflict(w.port->channel(), other.port->channel())) return true;
+    }
+    return false;
+  }
+};
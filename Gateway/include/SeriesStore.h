@@ -0,0 +1,457 @@
+/**
+ * SeriesStore - Lịch sử bản đo trên đĩa của gateway: chỉ ghi nối, nén theo cột,
+ * đọc qua mmap
+ *
+ * Một chuỗi (series) = một (node id, trường), ví dụ ("soil00001", "soil_moisture").
+ * Thư mục store gồm:
+ *   series.tsv    "node<TAB>field" mỗi dòng, số dòng = id chuỗi
+ *   NNNNNN.seg    Segment SEGMENT_BYTES byte, map MAP_SHARED; chuỗi các khối
+ *                 BlockHeader + dữ liệu nén (Gorilla.h), mỗi khối một chuỗi
+ *   open.wal      Điểm chưa vào khối (WalRecord), đọc lại khi mở store
+ *
+ * Điểm mới nằm trong khối mở trên RAM của chuỗi (kèm một bản ghi WAL) tới khi
+ * đủ blockPoints điểm hoặc trải quá blockSpan (mặc định BLOCK_POINTS và
+ * BLOCK_SPAN_MS, chuỗi thưa như rollup đặt nhỏ hơn), rồi được nén thành một khối
+ * ghi thẳng vào vùng map của segment đang mở. Segment đầy thì mở segment mới;
+ * segment cũ không bao giờ bị sửa. Mở lại store thì quét header các khối (bỏ
+ * qua dữ liệu nén) để dựng chỉ mục: mỗi chuỗi một danh sách khối xếp theo tMin
+ * kèm max(tMax) tích lũy, truy vấn [from, to] tìm nhị phân khối đầu tiên có thể
+ * chạm from rồi chỉ giải nén các khối giao với khoảng.
+ *
+ * Khối có CRC-16 (hublink::crc16), được kiểm khi mở store với segment cuối:
+ * khối ghi dở lúc mất điện bị bỏ và bị ghi đè. Segment trước đó đã đầy và được
+ * msync trước khi mở segment mới nên chỉ cần đọc header (mở nhanh dù store
+ * lớn). WAL bỏ qua điểm có time <= tMax của khối mới nhất đã ghi của chuỗi
+ * (điểm đó đã nằm trong khối); điểm tới trễ cũ hơn khối đã ghi chỉ an toàn khi
+ * khối chứa nó đã ghi xong.
+ *
+ * time được làm tròn xuống STORE_TIME_MS khi lưu (NDJSON vẫn giữ ms): điểm lệch
+ * nhịp quét vài chục ms thì cột time không còn tốn ~9 bit/điểm (xem Gorilla.h).
+ *
+ * Một luồng; readOnly cho phép đọc trong lúc gateway đang ghi (khối mới của
+ * gateway thấy được sau khi mở lại), append() khi đó chỉ thêm vào RAM.
+ */
+
+#pragma once
+
+#include "Gorilla.h"
+
+#include <HubLink.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const size_t SEGMENT_BYTES = 4 << 20;
+const uint16_t BLOCK_POINTS = 2048;
+const int64_t BLOCK_SPAN_MS = 24 * 3600 * 1000LL;  // Một ngày bản đo mỗi phút = 1440 điểm
+const size_t WAL_COMPACT_BYTES = 1 << 20;
+const int64_t STORE_TIME_MS = 1000;
+
+struct __attribute__((packed)) BlockHeader {
+  char magic[2];            // "TB"
+  uint8_t encoding;         // gorilla::ENCODING_*
+  uint8_t timeUnit;         // Chỉ số gorilla::TIME_UNITS (0 = ms, khối ghi trước khi có trường này)
+  uint32_t series;
+  int64_t tMin, tMax;
+  uint32_t bytes;           // Độ dài dữ liệu nén theo sau
+  uint16_t count;
+  uint16_t crc;             // CRC-16 của các trường trên (trừ crc) và dữ liệu nén
+};
+
+struct __attribute__((packed)) WalRecord {
+  uint32_t series;
+  int64_t time;
+  double value;
+};
+
+static_assert(sizeof(BlockHeader) == 32, "Đổi BlockHeader làm hỏng segment đã ghi");
+
+class SeriesStore {
+ public:
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+  struct Series {
+    std::string node, field;
+    std::vector<gorilla::Point> open;   // Khối mở, theo thứ tự tới
+    int64_t openSince = 0;              // time của điểm đầu khối mở
+    int64_t sealedMax = INT64_MIN;      // tMax của khối mới nhất đã ghi
+    uint16_t blockPoints = BLOCK_POINTS;
+    int64_t blockSpan = BLOCK_SPAN_MS;
+    uint64_t sealedPoints = 0, sealedBytes = 0;
+
+    struct Block {
+      int64_t tMin, tMax;
+      uint32_t segment, offset;
+    };
+    std::vector<Block> blocks;          // Theo tMin
+    std::vector<int64_t> maxEnd;        // maxEnd[i] = max(tMax của blocks[0..i]), không giảm
+  };
+
+  ~SeriesStore() { close(); }
+
+  bool open(const std::string& dir, bool readOnly) {
+    dir_ = dir;
+    readOnly_ = readOnly;
+    if (!readOnly && mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) return false;
+    // Chỉ một gateway ghi vào một store
+    lockFd_ = ::open((dir + "/series.tsv").c_str(), (readOnly ? O_RDONLY : O_RDWR | O_CREAT | O_APPEND) | O_CLOEXEC, 0644);
+    if (lockFd_ < 0) return false;
+    if (!readOnly && flock(lockFd_, LOCK_EX | LOCK_NB) < 0) return false;
+    if (!loadSeries() || !loadSegments()) return false;
+    loadWal();
+    if (readOnly) return true;
+    walFd_ = ::open((dir + "/open.wal").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return walFd_ >= 0;
+  }
+
+  // Ghi WAL còn trong bộ đệm; khối mở vẫn mở (đọc lại từ WAL lần sau)
+  void close() {
+    flush();
+    for (Segment& s : segments_) munmap(s.base, SEGMENT_BYTES);
+    segments_.clear();
+    if (walFd_ >= 0) ::close(walFd_);
+    if (lockFd_ >= 0) ::close(lockFd_);
+    walFd_ = lockFd_ = -1;
+  }
+
+  const std::vector<Series>& series() const { return series_; }
+
+  uint32_t find(const std::string& node, const std::string& field) const {
+    auto it = ids_.find(key(node.data(), node.size(), field.data(), field.size()));
+    return it == ids_.end() ? NONE : it->second;
+  }
+
+  // id của chuỗi, tạo mới nếu chưa có; NONE nếu không tạo được (readOnly, tên có tab/xuống dòng)
+  uint32_t intern(const char* node, size_t nodeLen, const char* field, size_t fieldLen) {
+    key_.assign(node, nodeLen);
+    key_ += '\t';
+    key_.append(field, fieldLen);
+    auto it = ids_.find(key_);
+    return it == ids_.end() ? addSeries(std::string(node, nodeLen), std::string(field, fieldLen)) : it->second;
+  }
+
+  // log = false: không ghi WAL (nạp hàng loạt, gọi compact() khi xong)
+  void append(uint32_t id, int64_t time, double value, bool log = true) {
+    time -= (time % STORE_TIME_MS + STORE_TIME_MS) % STORE_TIME_MS;
+    Series& s = series_[id];
+    if (s.open.empty()) s.openSince = time;
+    s.open.push_back({ time, value });
+    if (readOnly_) return;
+    if (log) {
+      WalRecord r = { id, time, value };
+      wal_.append((const char*)&r, sizeof(r));
+      walBytes_ += sizeof(r);
+    }
+    if (s.open.size() >= s.blockPoints || time - s.openSince >= s.blockSpan) seal(id);
+  }
+
+  // Khối nhỏ hơn mặc định cho chuỗi thưa (không lưu, đặt lại mỗi lần mở)
+  void setBlockLimit(uint32_t id, uint16_t points, int64_t spanMs) {
+    series_[id].blockPoints = std::min(points, BLOCK_POINTS);
+    series_[id].blockSpan = spanMs;
+  }
+
+  // time lớn nhất đã có của chuỗi, INT64_MIN nếu rỗng
+  int64_t lastTime(uint32_t id) const {
+    const Series& s = series_[id];
+    int64_t t = s.sealedMax;
+    for (const gorilla::Point& p : s.open) t = std::max(t, p.time);
+    return t;
+  }
+
+  // Mỗi vòng của gateway: ghi WAL, đóng khối của chuỗi đã im quá blockSpan, gọn WAL
+  void tick(int64_t now) {
+    flush();
+    if (now - lastSweep_ < 60000) return;
+    lastSweep_ = now;
+    for (uint32_t id = 0; id < series_.size(); id++) {
+      if (!series_[id].open.empty() && now - series_[id].openSince >= series_[id].blockSpan) seal(id);
+    }
+    if (walBytes_ > WAL_COMPACT_BYTES && walBytes_ > 2 * openPoints() * sizeof(WalRecord)) compact();
+  }
+
+  void flush() {
+    if (wal_.empty() || walFd_ < 0) return;
+    if (::write(walFd_, wal_.data(), wal_.size()) != (ssize_t)wal_.size()) perror("store wal");
+    wal_.clear();
+  }
+
+  // Nối vào out các điểm có from <= time <= to, xếp theo time (cùng time thì theo thứ tự ghi)
+  void query(uint32_t id, int64_t from, int64_t to, std::vector<gorilla::Point>& out) const {
+    size_t base = out.size();
+    scan(id, from, to, out);
+    auto earlier = [](const gorilla::Point& a, const gorilla::Point& b) { return a.time < b.time; };
+    if (!std::is_sorted(out.begin() + base, out.end(), earlier)) std::stable_sort(out.begin() + base, out.end(), earlier);
+  }
+
+  // Như query nhưng theo thứ tự ghi: các khối theo vị trí trong segment rồi tới khối mở
+  void scan(uint32_t id, int64_t from, int64_t to, std::vector<gorilla::Point>& out) const {
+    if (id >= series_.size()) return;
+    const Series& s = series_[id];
+    std::vector<const Series::Block*> hits;
+    size_t i = std::lower_bound(s.maxEnd.begin(), s.maxEnd.end(), from) - s.maxEnd.begin();
+    for (; i < s.blocks.size() && s.blocks[i].tMin <= to; i++) {
+      if (s.blocks[i].tMax >= from) hits.push_back(&s.blocks[i]);
+    }
+    // Khối của một chuỗi ghi liên tiếp thì thứ tự tMin cũng là thứ tự ghi (thường gặp)
+    auto written = [](const Series::Block* a, const Series::Block* b) {
+      return a->segment != b->segment ? a->segment < b->segment : a->offset < b->offset;
+    };
+    if (!std::is_sorted(hits.begin(), hits.end(), written)) std::sort(hits.begin(), hits.end(), written);
+    std::vector<gorilla::Point> block;
+    for (const Series::Block* b : hits) {
+      block.clear();
+      readBlock(*b, block);
+      for (const gorilla::Point& p : block) {
+        if (p.time >= from && p.time <= to) out.push_back(p);
+      }
+    }
+    for (const gorilla::Point& p : s.open) {
+      if (p.time >= from && p.time <= to) out.push_back(p);
+    }
+  }
+
+  size_t openPoints() const {
+    size_t n = 0;
+    for (const Series& s : series_) n += s.open.size();
+    return n;
+  }
+
+  size_t segmentCount() const { return segments_.size(); }
+
+  // Byte đã dùng của các segment (khối + header)
+  uint64_t bytesUsed() const {
+    uint64_t n = 0;
+    for (const Segment& s : segments_) n += s.end;
+    return n;
+  }
+
+  // Ghi lại WAL chỉ với các điểm còn mở (tệp tạm rồi rename)
+  void compact() {
+    if (readOnly_) return;
+    flush();
+    // Điểm sắp bị bỏ khỏi WAL phải nằm trên đĩa trước
+    for (Segment& seg : segments_) msync(seg.base, SEGMENT_BYTES, MS_SYNC);
+    std::string path = dir_ + "/open.wal";
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    std::string out;
+    for (uint32_t id = 0; id < series_.size(); id++) {
+      for (const gorilla::Point& p : series_[id].open) {
+        WalRecord r = { id, p.time, p.value };
+        out.append((const char*)&r, sizeof(r));
+      }
+    }
+    bool ok = ::write(fd, out.data(), out.size()) == (ssize_t)out.size() && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) < 0) { unlink(tmp.c_str()); return; }
+    ::close(walFd_);
+    walFd_ = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    walBytes_ = out.size();
+  }
+
+ private:
+  struct Segment {
+    uint8_t* base;
+    uint32_t end;   // Byte đầu tiên chưa dùng
+  };
+
+  std::string dir_;
+  bool readOnly_ = false;
+  int lockFd_ = -1, walFd_ = -1;
+  std::vector<Series> series_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  std::vector<Segment> segments_;
+  std::string wal_, key_;
+  uint64_t walBytes_ = 0;
+  int64_t lastSweep_ = 0;
+
+  static std::string key(const char* node, size_t nodeLen, const char* field, size_t fieldLen) {
+    std::string k(node, nodeLen);
+    k += '\t';
+    k.append(field, fieldLen);
+    return k;
+  }
+
+  std::string segmentPath(uint32_t index) const {
+    char name[16];
+    snprintf(name, sizeof(name), "/%06u.seg", index);
+    return dir_ + name;
+  }
+
+  uint32_t addSeries(const std::string& node, const std::string& field) {
+    if (readOnly_ || node.find_first_of("\t\n") != std::string::npos || field.find_first_of("\t\n") != std::string::npos) {
+      return NONE;
+    }
+    std::string line = node + '\t' + field + '\n';
+    if (::write(lockFd_, line.data(), line.size()) != (ssize_t)line.size()) return NONE;
+    return insertSeries(node, field);
+  }
+
+  uint32_t insertSeries(const std::string& node, const std::string& field) {
+    uint32_t id = series_.size();
+    series_.emplace_back();
+    series_.back().node = node;
+    series_.back().field = field;
+    ids_[key(node.data(), node.size(), field.data(), field.size())] = id;
+    return id;
+  }
+
+  bool loadSeries() {
+    std::string text;
+    char buf[4096];
+    ssize_t n;
+    while ((n = pread(lockFd_, buf, sizeof(buf), text.size())) > 0) text.append(buf, n);
+    size_t start = 0, end;
+    while ((end = text.find('\n', start)) != std::string::npos) {
+      size_t tab = text.find('\t', start);
+      if (tab == std::string::npos || tab > end) return false;
+      insertSeries(text.substr(start, tab - start), text.substr(tab + 1, end - tab - 1));
+      start = end + 1;
+    }
+    return true;
+  }
+
+  bool mapSegment(uint32_t index, bool create) {
+    int flags = readOnly_ ? O_RDONLY : O_RDWR | (create ? O_CREAT | O_EXCL : 0);
+    int fd = ::open(segmentPath(index).c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    // Tệp thưa: phần chưa ghi không tốn đĩa
+    if (create && ftruncate(fd, SEGMENT_BYTES) < 0) { ::close(fd); return false; }
+    void* base = mmap(nullptr, SEGMENT_BYTES, readOnly_ ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return false;
+    segments_.push_back({ (uint8_t*)base, 0 });
+    return true;
+  }
+
+  // Map mọi segment có sẵn rồi dựng chỉ mục từ header khối
+  bool loadSegments() {
+    std::vector<uint32_t> found;
+    if (DIR* d = opendir(dir_.c_str())) {
+      while (dirent* e = readdir(d)) {
+        const char* name = e->d_name;
+        if (strlen(name) == 10 && strcmp(name + 6, ".seg") == 0 && strspn(name, "0123456789") == 6) {
+          found.push_back(strtoul(name, nullptr, 10));
+        }
+      }
+      closedir(d);
+    }
+    std::sort(found.begin(), found.end());
+    for (uint32_t i = 0; i < found.size(); i++) {
+      // Segment phải liền số: thiếu một tệp thì dừng, không đọc lẫn dữ liệu cũ
+      if (found[i] != i || !mapSegment(i, false)) break;
+      scanSegment(i, i + 1 == found.size());
+    }
+    if (readOnly_ || !segments_.empty()) return true;
+    return mapSegment(0, true);
+  }
+
+  void scanSegment(uint32_t index, bool verify) {
+    Segment& seg = segments_[index];
+    uint32_t offset = 0;
+    while (offset + sizeof(BlockHeader) <= SEGMENT_BYTES) {
+      BlockHeader h;
+      memcpy(&h, seg.base + offset, sizeof(h));
+      if (h.magic[0] != 'T' || h.magic[1] != 'B' || h.bytes > SEGMENT_BYTES - offset - sizeof(h) ||
+          h.series >= series_.size()) {
+        break;
+      }
+      if (verify) {
+        uint16_t crc = hublink::crc16((const uint8_t*)&h, offsetof(BlockHeader, crc));
+        if (hublink::crc16(seg.base + offset + sizeof(h), h.bytes, crc) != h.crc) break;
+      }
+      indexBlock(h, index, offset);
+      offset += sizeof(h) + h.bytes;
+    }
+    seg.end = offset;
+  }
+
+  void indexBlock(const BlockHeader& h, uint32_t segment, uint32_t offset) {
+    Series& s = series_[h.series];
+    Series::Block b = { h.tMin, h.tMax, segment, offset };
+    auto at = std::upper_bound(s.blocks.begin(), s.blocks.end(), b.tMin,
+                               [](int64_t t, const Series::Block& x) { return t < x.tMin; });
+    size_t pos = at - s.blocks.begin();
+    s.blocks.insert(at, b);
+    s.maxEnd.resize(s.blocks.size());
+    for (size_t i = pos; i < s.blocks.size(); i++) {
+      s.maxEnd[i] = std::max(i ? s.maxEnd[i - 1] : INT64_MIN, s.blocks[i].tMax);
+    }
+    s.sealedMax = std::max(s.sealedMax, h.tMax);
+    s.sealedPoints += h.count;
+    s.sealedBytes += sizeof(h) + h.bytes;
+  }
+
+  void readBlock(const Series::Block& b, std::vector<gorilla::Point>& out) const {
+    BlockHeader h;
+    const uint8_t* at = segments_[b.segment].base + b.offset;
+    memcpy(&h, at, sizeof(h));
+    if (!gorilla::decode(at + sizeof(h), h.bytes, h.count, h.encoding, h.timeUnit, out)) {
+      fprintf(stderr, "store: khối hỏng ở %06u.seg+%u\n", b.segment, b.offset);
+    }
+  }
+
+  // Nén khối mở của chuỗi id vào segment đang mở
+  void seal(uint32_t id) {
+    Series& s = series_[id];
+    if (s.open.empty() || segments_.empty()) return;
+    gorilla::BitWriter w;
+    BlockHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic[0] = 'T';
+    h.magic[1] = 'B';
+    h.encoding = gorilla::encode(s.open.data(), s.open.size(), w, h.timeUnit);
+    h.series = id;
+    h.tMin = h.tMax = s.open[0].time;
+    for (const gorilla::Point& p : s.open) {
+      h.tMin = std::min(h.tMin, p.time);
+      h.tMax = std::max(h.tMax, p.time);
+    }
+    h.bytes = w.bytes.size();
+    h.count = s.open.size();
+    h.crc = hublink::crc16(w.bytes.data(), w.bytes.size(), hublink::crc16((const uint8_t*)&h, offsetof(BlockHeader, crc)));
+
+    uint32_t need = sizeof(h) + h.bytes;
+    if (segments_.back().end + need > SEGMENT_BYTES) {
+      // Phần còn lại của segment cũ là 0 (tệp thưa): lần quét sau dừng ở đó
+      msync(segments_.back().base, SEGMENT_BYTES, MS_SYNC);
+      if (!mapSegment(segments_.size(), true)) { perror("store segment"); return; }
+    }
+    uint32_t index = segments_.size() - 1;
+    Segment& seg = segments_.back();
+    memcpy(seg.base + seg.end + sizeof(h), w.bytes.data(), h.bytes);
+    memcpy(seg.base + seg.end, &h, sizeof(h));
+    indexBlock(h, index, seg.end);
+    seg.end += need;
+    s.open.clear();
+  }
+
+  void loadWal() {
+    int fd = ::open((dir_ + "/open.wal").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    WalRecord r;
+    while (read(fd, &r, sizeof(r)) == sizeof(r)) {
+      walBytes_ += sizeof(r);
+      if (r.series >= series_.size() || r.time <= series_[r.series].sealedMax) continue;
+      Series& s = series_[r.series];
+      if (s.open.empty()) s.openSince = r.time;
+      s.open.push_back({ r.time, r.value });
+    }
+    ::close(fd);
+  }
+};
@@ -0,0 +1,253 @@
+/**
+ * Sink - Đầu ra NDJSON của gateway: file (ghi nối tiếp) và/hoặc Unix socket
+ *
+ * Mỗi dòng là một object có "hub" đứng đầu:
+ *   {"hub":"h0","id":"soil0001","seq":12,"time":1760000000123,"sensors":{...}}
+ *   {"hub":"h0","id":"soil0001","status":"offline","time":...}
+ *     ("unpolled" khi lượt quét hết hạn trước khi hỏi node)
+ *   {"hub":"h0","event":"data_collection_finished","time":...,"latency_ms":812,"readings":4,"offline":0}
+ *     (thêm "unpolled":N khi lượt bị cắt ở hạn chót)
+ *   {"hub":"h0","devices":[...]}           (trả lời getListDevice)
+ *   {"hub":"h0",<phần còn lại của dòng event/status/error của Master>}
+ * "delta":true / "replay":true đi kèm bản đo như Master đánh dấu. Số trong
+ * "sensors" được chép nguyên văn từ dòng của Master, không qua double.
+ *
+ * ndjson:: định dạng từng dòng vào chuỗi của phía gọi (gateway xếp lại theo
+ * "time" trước khi ghi), Sink chỉ lo ghi ra.
+ *
+ * Các dòng được gom vào một bộ đệm, flush() ghi một lần mỗi vòng epoll. Client
+ * socket đọc chậm giữ phần chưa ghi (tối đa MAX_PENDING rồi bị ngắt) để một
+ * client treo không chặn việc đọc hub.
+ */
+
+#pragma once
+
+#include "EventLoop.h"
+#include "HubPort.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace ndjson {
+
+inline void appendString(std::string& out, jsonscan::Slice s) {
+  out += '"';
+  out.append(s.ptr ? s.ptr : "", s.len);
+  out += '"';
+}
+
+inline void appendNumber(std::string& out, const char* key, int64_t v) {
+  char buf[48];
+  out.append(buf, snprintf(buf, sizeof(buf), ",\"%s\":%lld", key, (long long)v));
+}
+
+inline void begin(std::string& out, const HubPort& hub) {
+  out += "{\"hub\":";
+  appendString(out, jsonscan::Slice(hub.name().data(), hub.name().size()));
+}
+
+inline void reading(std::string& out, const HubPort& hub, const Reading& r) {
+  begin(out, hub);
+  out += ",\"id\":";
+  appendString(out, r.id);
+  if (r.seq) appendNumber(out, "seq", r.seq);
+  appendNumber(out, "time", r.time);
+  if (r.delta) out += ",\"delta\":true";
+  if (r.replay) out += ",\"replay\":true";
+  out += ",\"sensors\":{";
+  for (uint8_t i = 0; i < r.count; i++) {
+    if (i) out += ',';
+    appendString(out, r.fields[i].name);
+    out += ':';
+    out.append(r.fields[i].text.ptr, r.fields[i].text.len);
+  }
+  out += "}}\n";
+}
+
+// status: "offline" hoặc "unpolled"
+inline void status(std::string& out, const HubPort& hub, jsonscan::Slice id, const char* status, int64_t time) {
+  begin(out, hub);
+  out += ",\"id\":";
+  appendString(out, id);
+  out += ",\"status\":\"";
+  out += status;
+  out += '"';
+  appendNumber(out, "time", time);
+  out += "}\n";
+}
+
+// latency < 0: hub tự quét (lệnh từ nơi khác), gateway không biết lúc bắt đầu
+inline void sweepDone(std::string& out, const HubPort& hub, int64_t time, int64_t latency, uint32_t readings, uint32_t offline,
+                      uint32_t unpolled) {
+  begin(out, hub);
+  out += ",\"event\":\"data_collection_finished\"";
+  appendNumber(out, "time", time);
+  if (latency >= 0) {
+    appendNumber(out, "latency_ms", latency);
+    appendNumber(out, "readings", readings);
+    appendNumber(out, "offline", offline);
+    if (unpolled) appendNumber(out, "unpolled", unpolled);
+  }
+  out += "}\n";
+}
+
+// Ghép "hub" vào đầu object của Master; mảng (danh sách thiết bị) thành "devices"
+inline void message(std::string& out, const HubPort& hub, jsonscan::Slice line) {
+  begin(out, hub);
+  if (line.ptr[0] == '[') {
+    out += ",\"devices\":";
+    out.append(line.ptr, line.len);
+    out += '}';
+  } else {
+    const char* p = jsonscan::skipSpace(line.ptr + 1, line.ptr + line.len);
+    if (*p != '}') out += ',';
+    out.append(line.ptr + 1, line.len - 1);
+  }
+  out += '\n';
+}
+
+} // namespace ndjson
+
+class Sink {
+ public:
+  static const size_t MAX_PENDING = 4 << 20;
+
+  uint64_t linesOut = 0;
+  uint32_t clientsDropped = 0;
+
+  explicit Sink(EventLoop& loop) : loop_(loop) {}
+  ~Sink() {
+    for (Client& c : clients_) close(c.fd);
+    if (listenFd_ >= 0) { close(listenFd_); unlink(socketPath_.c_str()); }
+    if (fileFd_ > STDERR_FILENO) close(fileFd_);
+  }
+
+  // "-" = stdout
+  bool openFile(const char* path) {
+    fileFd_ = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return fileFd_ >= 0;
+  }
+
+  bool listen(const char* path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path);
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) return false;
+    unlink(path);  // Socket sót lại từ lần chạy trước
+    if (bind(listenFd_, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listenFd_, 16) < 0) return false;
+    socketPath_ = path;
+    return loop_.add(listenFd_, EPOLLIN, EventLoop::LISTEN, 0);
+  }
+
+  size_t clients() const { return clients_.size(); }
+
+  // Sự kiện epoll của socket nghe (LISTEN) hoặc một client (CLIENT, id = fd)
+  void handle(const epoll_event& e) {
+    if (EventLoop::tag(e) == EventLoop::LISTEN) {
+      int fd;
+      while ((fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        clients_.push_back({ fd, std::string() });
+        loop_.add(fd, EPOLLIN, EventLoop::CLIENT, fd);
+      }
+      return;
+    }
+    Client* c = find(EventLoop::id(e));
+    if (!c) return;
+    if (e.events & (EPOLLHUP | EPOLLERR)) { drop(*c, false); return; }
+    if (e.events & EPOLLIN) {
+      char buf[256];
+      ssize_t n = ::read(c->fd, buf, sizeof(buf));  // Client không gửi gì có nghĩa, chỉ cần biết đã đóng
+      if (n == 0 || (n < 0 && errno != EAGAIN)) { drop(*c, false); return; }
+    }
+    if (e.events & EPOLLOUT) {
+      if (!writeSome(*c, c->pending.data(), c->pending.size(), true)) return;
+      if (c->pending.empty()) loop_.modify(c->fd, EPOLLIN, EventLoop::CLIENT, c->fd);
+    }
+  }
+
+  // Một hoặc nhiều dòng đã định dạng (kết thúc bằng '\n')
+  void write(const std::string& lines) {
+    out_ += lines;
+    for (char c : lines) linesOut += c == '\n';
+  }
+
+  // Ghi phần đã gom vào file và mọi client
+  void flush() {
+    if (out_.empty()) return;
+    if (fileFd_ >= 0) {
+      size_t done = 0;
+      while (done < out_.size()) {
+        ssize_t n = ::write(fileFd_, out_.data() + done, out_.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { perror("sink"); break; }
+        done += n;
+      }
+    }
+    for (size_t i = clients_.size(); i-- > 0;) {
+      Client& c = clients_[i];
+      if (!c.pending.empty()) {
+        if (c.pending.size() + out_.size() > MAX_PENDING) { drop(c, true); continue; }
+        c.pending += out_;
+        continue;
+      }
+      if (writeSome(c, out_.data(), out_.size(), false) && !c.pending.empty()) {
+        loop_.modify(c.fd, EPOLLIN | EPOLLOUT, EventLoop::CLIENT, c.fd);
+      }
+    }
+    out_.clear();
+  }
+
+ private:
+  struct Client {
+    int fd;
+    std::string pending;
+  };
+
+  EventLoop& loop_;
+  std::string out_;
+  int fileFd_ = -1;
+  int listenFd_ = -1;
+  std::string socketPath_;
+  std::vector<Client> clients_;
+
+  Client* find(int fd) {
+    for (Client& c : clients_) {
+      if (c.fd == fd) return &c;
+    }
+    return nullptr;
+  }
+
+  void drop(Client& c, bool slow) {
+    if (slow) clientsDropped++;
+    loop_.remove(c.fd);
+    close(c.fd);
+    c = clients_.back();
+    clients_.pop_back();
+  }
+
+  // Ghi tới khi socket đầy; phần dư vào pending (fromPending: data chính là pending).
+  // false nếu client đã bị ngắt.
+  bool writeSome(Client& c, const char* data, size_t len, bool fromPending) {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = send(c.fd, data + done, len - done, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && errno == EAGAIN) break;
+      if (n <= 0) { drop(c, false); return false; }
+      done += n;
+    }
+    if (fromPending) c.pending.erase(0, done);
+    else c.pending.assign(data + done, len - done);
+    return true;
+  }
+};
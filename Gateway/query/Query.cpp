@@ -0,0 +1,177 @@
+/**
+ * tsquery - Đọc SeriesStore mà gateway ghi (--store DIR), không cần dừng gateway
+ *
+ * Dùng: tsquery DIR                                  Liệt kê chuỗi: số điểm, số khối, byte/điểm
+ *       tsquery DIR NODE FIELD [--from T] [--to T]   In các điểm, mỗi dòng {"time":..,"value":..}
+ *           [--step D | --points N]                  In ô gộp {"time","min","max","mean","count"}
+ *  T là ms Unix hoặc khoảng lùi từ bây giờ: -30m, -6h, -90d (mặc định: toàn bộ)
+ *  D là độ rộng ô (ms hoặc 15m, 1h, 7d); --points N chia [from, to] thành tối đa N ô.
+ *  Ô gộp đọc từ tầng rollup thô nhất vừa với D (Rollup.h).
+ *
+ * Thời gian truy vấn (mở store không tính) và tầng đã đọc in ra stderr.
+ */
+
+#include "Rollup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+int64_t nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// "<số>" ms hoặc "<số><s|m|h|d>"
+bool parseDuration(const char* text, int64_t& out) {
+  char* end;
+  double amount = strtod(text, &end);
+  if (end == text || amount < 0) return false;
+  if (!*end) {
+    out = (int64_t)amount;
+    return true;
+  }
+  const char* units = "smhd";
+  const int64_t scale[] = { 1000, 60000, 3600000, 86400000 };
+  const char* unit = strchr(units, end[0]);
+  if (!unit || end[1]) return false;
+  out = (int64_t)(amount * scale[unit - units]);
+  return true;
+}
+
+// ms Unix, hoặc "-<khoảng>" tính lùi từ now
+bool parseTime(const char* text, int64_t now, int64_t& out) {
+  char* end;
+  if (text[0] != '-') {
+    out = strtoll(text, &end, 10);
+    return end != text && !*end;
+  }
+  int64_t ago;
+  if (!parseDuration(text + 1, ago)) return false;
+  out = now - ago;
+  return true;
+}
+
+double elapsedMs(const timespec& start) {
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// Số ngắn nhất đọc lại ra đúng double (86.58 thay vì 86.579999999999998)
+void printValue(char* buf, size_t size, double v) {
+  for (int precision = 6; precision <= 17; precision++) {
+    snprintf(buf, size, "%.*g", precision, v);
+    if (strtod(buf, nullptr) == v) return;
+  }
+}
+
+void listSeries(const SeriesStore& store) {
+  uint64_t points = 0, bytes = 0;
+  for (const SeriesStore::Series& s : store.series()) {
+    uint64_t n = s.sealedPoints + s.open.size();
+    points += n;
+    bytes += s.sealedBytes;
+    printf("%-12s %-22s points=%-8llu blocks=%-5zu bytes=%-8llu", s.node.c_str(), s.field.c_str(),
+           (unsigned long long)n, s.blocks.size(), (unsigned long long)s.sealedBytes);
+    if (s.sealedPoints) printf(" bytes/point=%.2f", (double)s.sealedBytes / s.sealedPoints);
+    if (!s.blocks.empty()) printf(" from=%lld to=%lld", (long long)s.blocks.front().tMin, (long long)s.maxEnd.back());
+    printf("\n");
+  }
+  printf("series=%zu points=%llu open=%zu segments=%zu bytes=%llu\n", store.series().size(), (unsigned long long)points,
+         store.openPoints(), store.segmentCount(), (unsigned long long)bytes);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Dùng: %s DIR [NODE FIELD [--from T] [--to T] [--step D | --points N]]\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::vector<const char*> args;
+  int64_t now = nowMs();
+  int64_t from = INT64_MIN, to = INT64_MAX;
+  int64_t step = 0, maxPoints = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(a, "--from") == 0 && hasValue) {
+      if (!parseTime(argv[++i], now, from)) { usage(argv[0]); return 1; }
+    } else if (strcmp(a, "--to") == 0 && hasValue) {
+      if (!parseTime(argv[++i], now, to)) { usage(argv[0]); return 1; }
+    } else if (strcmp(a, "--step") == 0 && hasValue) {
+      if (!parseDuration(argv[++i], step) || !step) { usage(argv[0]); return 1; }
+    } else if (strcmp(a, "--points") == 0 && hasValue) {
+      maxPoints = atoll(argv[++i]);
+      if (maxPoints <= 0) { usage(argv[0]); return 1; }
+    } else if (a[0] == '-' && a[1] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      args.push_back(a);
+    }
+  }
+  if (args.size() != 1 && args.size() != 3) { usage(argv[0]); return 1; }
+
+  SeriesStore store;
+  if (!store.open(args[0], true)) { perror(args[0]); return 1; }
+  Rollups rollups(store);
+  rollups.open();
+  if (args.size() == 1) {
+    listSeries(store);
+    return 0;
+  }
+
+  uint32_t id = store.find(args[1], args[2]);
+  if (id == SeriesStore::NONE) {
+    fprintf(stderr, "Không có chuỗi %s/%s\n", args[1], args[2]);
+    return 1;
+  }
+  timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (maxPoints) {
+    // Khoảng mở thì lấy theo dữ liệu đang có
+    const SeriesStore::Series& s = store.series()[id];
+    int64_t first = s.blocks.empty() ? now : s.blocks.front().tMin;
+    for (const gorilla::Point& p : s.open) first = std::min(first, p.time);
+    int64_t span = std::min(to, now) - std::max(from, first);
+    step = std::max<int64_t>(1, (span + maxPoints - 1) / maxPoints);
+  }
+  if (step) {
+    std::vector<Bucket> buckets;
+    int tier = rollups.query(id, from, to, step, buckets);
+    double ms = elapsedMs(start);
+    char min[32], max[32], mean[32];
+    for (const Bucket& b : buckets) {
+      printValue(min, sizeof(min), b.min);
+      printValue(max, sizeof(max), b.max);
+      printValue(mean, sizeof(mean), b.mean());
+      printf("{\"time\":%lld,\"min\":%s,\"max\":%s,\"mean\":%s,\"count\":%u}\n", (long long)b.start, min, max, mean,
+             b.count);
+    }
+    fprintf(stderr, "%zu ô %lld ms từ %s trong %.3f ms\n", buckets.size(), (long long)step,
+            tier < 0 ? "chuỗi thô" : ROLLUP_NAMES[tier], ms);
+    return 0;
+  }
+
+  std::vector<gorilla::Point> points;
+  store.query(id, from, to, points);
+  double ms = elapsedMs(start);
+
+  char value[32];
+  for (const gorilla::Point& p : points) {
+    printValue(value, sizeof(value), p.value);
+    printf("{\"time\":%lld,\"value\":%s}\n", (long long)p.time, value);
+  }
+  fprintf(stderr, "%zu điểm trong %.3f ms\n", points.size(), ms);
+  return 0;
+}
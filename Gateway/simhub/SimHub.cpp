@@ -0,0 +1,538 @@
+/**
+ * SimHub - Bản C++ của SimMasterNode.py: MainHub giả trên một pty của Linux
+ *
+ * Dùng: simhub [--hubs N] [--link PATH] [--soil N] [--atm N] [--offline P] [--step MS]
+ *               [--channel C] [--collide P] [--dump-ms MS] [--seed N] [--quiet]
+ *  - In đường dẫn /dev/pts/N của đầu slave ra stdout; --link tạo symlink ổn định tới nó.
+ *  - --hubs N: N hub trong cùng tiến trình, mỗi hub một pty; PATH có "%d" thì thay bằng
+ *    chỉ số hub, không có thì nối chỉ số vào cuối. Hub i ở kênh nodeproto::CHANNELS[i]
+ *    (--channel: mọi hub cùng một kênh).
+ *  - Hai hub quét cùng lúc trên kênh cách nhau <= 2 thì mỗi bản đo của chúng mất thêm
+ *    với xác suất --collide (mặc định 0.5), giả lập nhiễu lẫn nhau trên không trung.
+ *  - Thêm scanChannels (channel_scan: kênh hiện tại, busy = hub khác đang quét) và
+ *    setChannel <kênh> như Master thật để gateway biết/đổi kênh.
+ *  - Cùng lệnh và cùng dòng trả lời như SimMasterNode.py: helloMaster, getListDevice,
+ *    getDataNow (mỗi node cách --step ms, mất với xác suất --offline), deleteNode,
+ *    deleteAllNode, registerNewNode, cancelRegister, setOutput bin|json, dumpSince, logInfo.
+ *  - Khung HubLink ở chế độ bin giống Master thật (struct float cũ sau ReadingHeader).
+ *  - system_ready sau 1s như Master vừa khởi động; lệnh tới trước đó bị bỏ.
+ *  - dumpSince xuất dần như serviceDump() của Master (mỗi --dump-ms một bản), bản đo
+ *    trực tiếp của lượt quét đang chạy xen vào giữa các bản phát lại.
+ *
+ * Không chặn như bản Python: lượt quét được xếp thành các việc hẹn giờ, lệnh
+ * tới trong lúc quét vẫn được đọc; việc của lệnh sau nối tiếp sau việc đã hẹn
+ * nên thứ tự dòng ra giống bản Python. Đầu slave được giữ mở để gateway ngắt
+ * rồi nối lại không làm hub giả nhận EIO.
+ */
+
+#include <HubLink.h>
+#include <NodeProtocol.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t READING_LOG_SIZE = 512;
+const char* const FIRMWARE = "FW_V1.2_SIMULATOR";
+
+struct Device {
+  std::string id;
+  uint8_t kind;
+};
+
+// Bản đo giữ dạng struct float như nhật ký của Master
+struct LoggedReading {
+  uint32_t seq;
+  uint32_t ts;
+  std::string id;
+  uint8_t kind;
+  nodeproto::SoilData soil;
+  nodeproto::AtmDataV2 atm;  // ATM FW có gió giật
+};
+
+struct Task {
+  int64_t due;
+  std::function<void()> run;
+};
+
+int64_t monoMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class SimHub {
+ public:
+  double offlineRate = 0.05;
+  double collideRate = 0.5;
+  int stepMs = 300;
+  int dumpMs = 10;  // ~1 dòng JSON ở 115200 baud
+  bool quiet = false;
+  uint8_t channel = nodeproto::CHANNEL_DEFAULT;
+  std::vector<SimHub*>* air = nullptr;  // Mọi hub của tiến trình, để tính nhiễu lẫn nhau
+  uint32_t readings = 0, lost = 0, collisions = 0;
+
+  SimHub(uint8_t soil, uint8_t atm, uint32_t seed) : rng_(seed), start_(monoMs()) {
+    char id[16];
+    for (uint8_t i = 1; i <= soil; i++) {
+      snprintf(id, sizeof(id), "soil%05u", i);
+      devices_.push_back({ id, nodeproto::KIND_SOIL });
+    }
+    for (uint8_t i = 1; i <= atm; i++) {
+      snprintf(id, sizeof(id), "atm%05u", i);
+      devices_.push_back({ id, nodeproto::KIND_ATM });
+    }
+  }
+
+  ~SimHub() {
+    if (master_ >= 0) close(master_);
+    if (slave_ >= 0) close(slave_);
+    if (!link_.empty()) unlink(link_.c_str());
+  }
+
+  bool open(const std::string& link) {
+    master_ = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master_ < 0 || grantpt(master_) < 0 || unlockpt(master_) < 0) return false;
+    const char* name = ptsname(master_);
+    if (!name) return false;
+    slave_ = ::open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave_ < 0) return false;
+    termios tio;
+    if (tcgetattr(slave_, &tio) == 0) {
+      cfmakeraw(&tio);
+      tcsetattr(slave_, TCSANOW, &tio);
+    }
+    fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+    if (!link.empty()) {
+      unlink(link.c_str());
+      if (symlink(name, link.c_str()) < 0) { perror(link.c_str()); return false; }
+      link_ = link;
+    }
+    printf("%s\n", name);
+    fflush(stdout);
+
+    schedule(1000, [this] {
+      booted_ = true;
+      sendLine("{\"status\":\"system_ready\"}");
+    });
+    return true;
+  }
+
+  int fd() const { return master_; }
+
+  // ms tới việc hẹn (hoặc bản dump) kế tiếp, -1 nếu không có
+  int timeout() const {
+    int64_t due = INT64_MAX;
+    if (!tasks_.empty()) due = tasks_.front().due;
+    if (dumping_) due = std::min(due, dumpDue_);
+    if (due == INT64_MAX) return -1;
+    int64_t wait = due - monoMs();
+    return wait > 0 ? (int)wait : 0;
+  }
+
+  void runDue() {
+    while (!tasks_.empty() && tasks_.front().due <= monoMs()) {
+      Task t = std::move(tasks_.front());
+      tasks_.pop_front();
+      t.run();
+    }
+    serviceDump();
+  }
+
+  void readCommands() {
+    char buf[256];
+    ssize_t n;
+    while ((n = read(master_, buf, sizeof(buf))) > 0) {
+      for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] != '\n') input_ += buf[i];
+        else if (booted_) { handle(trim(input_)); input_.clear(); }
+        else input_.clear();  // Master còn đang khởi động: lệnh mất như trên Serial thật
+      }
+    }
+  }
+
+ private:
+  std::mt19937 rng_;
+  int64_t start_;
+  int master_ = -1, slave_ = -1;
+  std::string link_;
+  std::string input_;
+  std::vector<Device> devices_;
+  std::deque<LoggedReading> log_;
+  uint32_t nextSeq_ = 1;
+  bool booted_ = false;  // Đã gửi system_ready; trước đó bỏ qua mọi lệnh
+  bool binary_ = false;
+  bool sweeping_ = false;
+  bool dumping_ = false;
+  uint32_t dumpNext_ = 0, dumpEnd_ = 0;
+  int64_t dumpDue_ = 0;
+  std::deque<Task> tasks_;
+  int64_t tail_ = 0;  // Mốc của việc hẹn cuối cùng
+
+  uint32_t millis() const { return (uint32_t)(monoMs() - start_); }
+
+  double uniform(double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng_); }
+
+  // Như round(random.uniform(lo, hi), digits) của bản Python
+  float uniform(double lo, double hi, int digits) {
+    double scale = digits == 1 ? 10 : 100;
+    return (float)(std::round(uniform(lo, hi) * scale) / scale);
+  }
+
+  // Việc chạy sau delay ms tính từ việc đã hẹn cuối cùng (hoặc từ bây giờ nếu không còn việc)
+  void schedule(int delay, std::function<void()> run) {
+    int64_t now = monoMs();
+    tail_ = (tasks_.empty() ? now : std::max(tail_, now)) + delay;
+    tasks_.push_back({ tail_, std::move(run) });
+  }
+
+  static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    size_t e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+  }
+
+  void writeAll(const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len) {
+      ssize_t n = write(master_, p, len);
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) { usleep(1000); continue; }
+      if (n <= 0) return;
+      p += n;
+      len -= n;
+    }
+  }
+
+  void sendLine(const std::string& line) {
+    if (!quiet) fprintf(stderr, "[SENDING] %s\n", line.c_str());
+    std::string out = line + "\r\n";
+    writeAll(out.data(), out.size());
+  }
+
+  void sendFrame(const void* header, uint8_t headerLen, const void* payload = nullptr, uint8_t payloadLen = 0) {
+    uint8_t frame[hublink::MAX_FRAME];
+    size_t n = hublink::encode(frame, header, headerLen, payload, payloadLen);
+    if (n) writeAll(frame, n);
+  }
+
+  int indexOf(const std::string& id) const {
+    for (size_t i = 0; i < devices_.size(); i++) {
+      if (devices_[i].id == id) return (int)i;
+    }
+    return -1;
+  }
+
+  static std::string sensorsJson(const LoggedReading& r) {
+    char buf[256];
+    if (r.kind == nodeproto::KIND_SOIL) {
+      snprintf(buf, sizeof(buf), "{\"soil_moisture\":%.2f,\"soil_temperature\":%.2f}", r.soil.moisture, r.soil.temperature);
+    } else {
+      snprintf(buf, sizeof(buf),
+               "{\"air_temperature\":%.2f,\"air_humidity\":%u,\"rain_intensity\":%u,\"wind_speed\":%.2f,"
+               "\"light_intensity\":%u,\"barometric_pressure\":%.1f,\"wind_gust\":%.2f}",
+               r.atm.air_temp, r.atm.air_humid, r.atm.rain, r.atm.wind, r.atm.light, r.atm.pressure, r.atm.gust);
+    }
+    return buf;
+  }
+
+  void sendReading(int index, const LoggedReading& r, uint8_t frameType) {
+    if (binary_) {
+      hublink::ReadingHeader h = { frameType, r.ts, (uint8_t)index, r.kind, r.seq };
+      if (r.kind == nodeproto::KIND_SOIL) sendFrame(&h, sizeof(h), &r.soil, sizeof(r.soil));
+      else sendFrame(&h, sizeof(h), &r.atm, sizeof(r.atm));
+      return;
+    }
+    std::string line = "{\"sensors\":" + sensorsJson(r) + ",\"id\":\"" + r.id + "\",\"seq\":" + std::to_string(r.seq);
+    if (frameType == hublink::FRAME_REPLAY) line += ",\"ts\":" + std::to_string(r.ts);
+    sendLine(line + "}");
+  }
+
+  LoggedReading measure(const Device& device) {
+    LoggedReading r;
+    memset(&r.soil, 0, sizeof(r.soil));
+    memset(&r.atm, 0, sizeof(r.atm));
+    r.seq = nextSeq_++;
+    r.ts = millis();
+    r.id = device.id;
+    r.kind = device.kind;
+    if (device.kind == nodeproto::KIND_SOIL) {
+      r.soil.moisture = uniform(40.0, 90.0, 2);
+      r.soil.temperature = uniform(20.0, 35.0, 2);
+    } else {
+      r.atm.air_temp = uniform(25.0, 38.0, 2);
+      r.atm.air_humid = (uint8_t)uniform(50.0, 95.0);
+      r.atm.rain = rng_() & 1;
+      r.atm.wind = uniform(0.0, 15.0, 2);
+      r.atm.light = (uint16_t)uniform(100.0, 5000.0);
+      r.atm.pressure = uniform(990.0, 1015.0, 1);
+      r.atm.gust = r.atm.wind + uniform(0.0, 5.0, 2);
+    }
+    log_.push_back(r);
+    if (log_.size() > READING_LOG_SIZE) log_.pop_front();
+    return r;
+  }
+
+  static bool nearby(uint8_t a, uint8_t b) { return abs((int)a - (int)b) <= 2; }
+
+  // Hub khác đang quét trên kênh sát kênh ch
+  bool othersSweeping(uint8_t ch) const {
+    if (!air) return false;
+    for (const SimHub* other : *air) {
+      if (other != this && other->sweeping_ && nearby(other->channel, ch)) return true;
+    }
+    return false;
+  }
+
+  void sweepDone() {
+    sweeping_ = false;
+    if (binary_) {
+      hublink::EventHeader h = { hublink::FRAME_SWEEP_DONE, millis() };
+      sendFrame(&h, sizeof(h));
+      return;
+    }
+    sendLine("{\"event\":\"data_collection_finished\"}");
+  }
+
+  void getDataNow() {
+    if (devices_.empty()) {
+      sendLine("{\"error\":\"no_devices\"}");
+      sweepDone();
+      return;
+    }
+    schedule(0, [this] { sweeping_ = true; });
+    // Chụp danh sách lúc nhận lệnh: node bị xóa giữa lượt vẫn được hỏi như bản Python
+    for (size_t i = 0; i < devices_.size(); i++) {
+      Device device = devices_[i];
+      schedule(stepMs, [this, device, i] {
+        bool collided = othersSweeping(channel) && uniform(0, 1) < collideRate;
+        collisions += collided;
+        if (collided || uniform(0, 1) < offlineRate) {
+          lost++;
+          if (binary_) {
+            hublink::NodeHeader h = { hublink::FRAME_OFFLINE, millis(), (uint8_t)i };
+            sendFrame(&h, sizeof(h));
+          } else {
+            sendLine("{\"id\":\"" + device.id + "\",\"status\":\"offline\"}");
+          }
+          return;
+        }
+        readings++;
+        sendReading(i, measure(device), hublink::FRAME_READING);
+      });
+    }
+    schedule(100, [this] { sweepDone(); });
+  }
+
+  // Như cmdDumpSince() của Master: chốt "to" lúc nhận lệnh, lệnh mới thay dump đang chạy
+  void dumpSince(const std::string& arg) {
+    uint32_t start = strtoul(arg.c_str(), nullptr, 10);
+    uint32_t first = log_.empty() ? nextSeq_ : log_.front().seq;
+    if (start < first) start = first;
+    dumping_ = true;
+    dumpNext_ = start;
+    dumpEnd_ = nextSeq_;
+    dumpDue_ = monoMs();
+    sendLine("{\"event\":\"dump_begin\",\"from\":" + std::to_string(start) + ",\"to\":" + std::to_string(dumpEnd_) +
+             ",\"now\":" + std::to_string(millis()) + "}");
+    serviceDump();
+  }
+
+  void serviceDump() {
+    while (dumping_ && dumpDue_ <= monoMs()) {
+      if (dumpNext_ >= dumpEnd_) {
+        dumping_ = false;
+        sendLine("{\"event\":\"dump_end\",\"next\":" + std::to_string(dumpEnd_) + "}");
+        return;
+      }
+      uint32_t seq = dumpNext_++;
+      if (log_.empty() || seq < log_.front().seq) continue;  // Đã bị ghi đè trong lúc dump
+      const LoggedReading& r = log_[seq - log_.front().seq];
+      int index = indexOf(r.id);
+      if (index < 0) continue;
+      sendReading(index, r, hublink::FRAME_REPLAY);
+      dumpDue_ += dumpMs;
+    }
+  }
+
+  void scanChannels() {
+    std::string channels, busy;
+    for (uint8_t i = 0; i < nodeproto::CHANNEL_COUNT; i++) {
+      if (i) { channels += ','; busy += ','; }
+      channels += std::to_string(nodeproto::CHANNELS[i]);
+      busy += othersSweeping(nodeproto::CHANNELS[i]) ? "100" : "0";
+    }
+    sendLine("{\"event\":\"channel_scan\",\"channel\":" + std::to_string(channel) + ",\"channels\":[" + channels +
+             "],\"busy\":[" + busy + "]}");
+  }
+
+  void setChannel(const std::string& arg) {
+    char* end;
+    long ch = strtol(arg.c_str(), &end, 10);
+    if (end == arg.c_str() || *end || ch < 0 || ch > 255 || !nodeproto::validChannel(ch)) {
+      sendLine("{\"error\":\"bad_args\"}");
+      return;
+    }
+    // Như MainHub: "channel_configured" ngay, "channel_changed" sau khi phát CHN xong
+    sendLine("{\"event\":\"channel_configured\",\"channel\":" + std::to_string(ch) + ",\"auto\":false}");
+    if (ch != channel) {
+      channel = ch;
+      sendLine("{\"event\":\"channel_changed\",\"channel\":" + std::to_string(channel) + "}");
+    }
+  }
+
+  void listDevices() {
+    std::string line = "[";
+    for (size_t i = 0; i < devices_.size(); i++) {
+      if (i) line += ',';
+      line += "{\"id\":\"" + devices_[i].id + "\",\"type\":\"" +
+              (devices_[i].kind == nodeproto::KIND_SOIL ? "soil" : "atm") + "\",\"status\":\"online\"}";
+    }
+    sendLine(line + "]");
+  }
+
+  void handle(const std::string& cmd) {
+    if (cmd.empty()) return;
+    if (!quiet) fprintf(stderr, "[RECEIVED] %s\n", cmd.c_str());
+
+    if (cmd == "helloMaster") {
+      sendLine("Hi!");
+      sendLine(FIRMWARE);
+    } else if (cmd == "getListDevice") {
+      listDevices();
+    } else if (cmd == "getDataNow") {
+      getDataNow();
+    } else if (cmd == "deleteAllNode") {
+      devices_.clear();
+      sendLine("{\"event\":\"all_nodes_deleted\"}");
+    } else if (cmd.compare(0, 11, "deleteNode ") == 0) {
+      std::string id = trim(cmd.substr(11));
+      int index = indexOf(id);
+      if (index >= 0) devices_.erase(devices_.begin() + index);
+      sendLine("{\"event\":\"deleted\",\"id\":\"" + id + "\"}");
+    } else if (cmd == "setOutput bin" || cmd == "setOutput json") {
+      binary_ = cmd == "setOutput bin";
+      sendLine(std::string("{\"event\":\"output_mode\",\"mode\":\"") + (binary_ ? "bin" : "json") + "\"}");
+    } else if (cmd == "registerNewNode") {
+      sendLine("{\"status\":\"register_mode_active\"}");
+    } else if (cmd == "cancelRegister") {
+      sendLine("{\"event\":\"register_cancelled\"}");
+    } else if (cmd.compare(0, 9, "dumpSince") == 0) {
+      dumpSince(trim(cmd.substr(9)));
+    } else if (cmd == "scanChannels") {
+      scanChannels();
+    } else if (cmd.compare(0, 11, "setChannel ") == 0) {
+      setChannel(trim(cmd.substr(11)));
+    } else if (cmd == "logInfo") {
+      uint32_t first = log_.empty() ? nextSeq_ : log_.front().seq;
+      sendLine("{\"event\":\"log_info\",\"first\":" + std::to_string(first) + ",\"next\":" + std::to_string(nextSeq_) +
+               ",\"capacity\":" + std::to_string(READING_LOG_SIZE) + "}");
+    }
+  }
+};
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) { stopRequested = 1; }
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* link = nullptr;
+  int hubs = 1, soil = 3, atm = 1, channel = -1;
+  uint32_t seed = (uint32_t)time(nullptr);
+  double offline = 0.05, collide = 0.5;
+  int step = 300, dumpMs = 10;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(a, "--hubs") == 0 && hasValue) hubs = atoi(argv[++i]);
+    else if (strcmp(a, "--link") == 0 && hasValue) link = argv[++i];
+    else if (strcmp(a, "--soil") == 0 && hasValue) soil = atoi(argv[++i]);
+    else if (strcmp(a, "--atm") == 0 && hasValue) atm = atoi(argv[++i]);
+    else if (strcmp(a, "--offline") == 0 && hasValue) offline = atof(argv[++i]);
+    else if (strcmp(a, "--step") == 0 && hasValue) step = atoi(argv[++i]);
+    else if (strcmp(a, "--channel") == 0 && hasValue) channel = atoi(argv[++i]);
+    else if (strcmp(a, "--collide") == 0 && hasValue) collide = atof(argv[++i]);
+    else if (strcmp(a, "--dump-ms") == 0 && hasValue) dumpMs = atoi(argv[++i]);
+    else if (strcmp(a, "--seed") == 0 && hasValue) seed = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(a, "--quiet") == 0) quiet = true;
+    else {
+      fprintf(stderr, "Dùng: %s [--hubs N] [--link PATH] [--soil N] [--atm N] [--offline P] [--step MS] "
+                      "[--channel C] [--collide P] [--dump-ms MS] [--seed N] [--quiet]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (hubs < 1) hubs = 1;
+  if (channel >= 0 && !nodeproto::validChannel(channel)) {
+    fprintf(stderr, "--channel phải là một trong nodeproto::CHANNELS\n");
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<SimHub>> owned;
+  std::vector<SimHub*> air;
+  for (int i = 0; i < hubs; i++) {
+    owned.emplace_back(new SimHub(soil, atm, seed + i));
+    SimHub& hub = *owned.back();
+    hub.offlineRate = offline;
+    hub.collideRate = collide;
+    hub.stepMs = step;
+    hub.dumpMs = dumpMs;
+    hub.quiet = quiet;
+    hub.channel = channel >= 0 ? channel : nodeproto::CHANNELS[i % nodeproto::CHANNEL_COUNT];
+    hub.air = &air;
+    air.push_back(&hub);
+
+    std::string path;
+    if (link) {
+      char buf[256];
+      if (strstr(link, "%d")) snprintf(buf, sizeof(buf), link, i);
+      else if (hubs > 1) snprintf(buf, sizeof(buf), "%s%d", link, i);
+      else snprintf(buf, sizeof(buf), "%s", link);
+      path = buf;
+    }
+    if (!hub.open(path)) { perror("pty"); return 1; }
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  std::vector<pollfd> fds(air.size());
+  while (!stopRequested) {
+    int timeout = -1;
+    for (size_t i = 0; i < air.size(); i++) {
+      fds[i] = { air[i]->fd(), POLLIN, 0 };
+      int t = air[i]->timeout();
+      if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+    for (size_t i = 0; i < air.size(); i++) {
+      if (fds[i].revents & POLLIN) air[i]->readCommands();
+      air[i]->runDue();
+    }
+  }
+
+  for (size_t i = 0; i < air.size(); i++) {
+    fprintf(stderr, "hub%zu channel=%u readings=%u lost=%u collisions=%u\n", i, air[i]->channel, air[i]->readings,
+            air[i]->lost, air[i]->collisions);
+  }
+  return 0;
+}
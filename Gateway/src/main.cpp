@@ -0,0 +1,285 @@
+/**
+ * Gateway - Đọc luồng Serial của một hoặc nhiều MainHub trên Linux, không cần UI
+ *
+ * Dùng: gateway [tùy chọn] [tên=]tty ...
+ *   --out FILE     Ghi nối tiếp NDJSON vào FILE ("-" = stdout, mặc định khi không có --listen)
+ *   --listen PATH  Unix socket, mỗi client nhận mọi dòng kể từ lúc kết nối
+ *   --poll S       Mỗi hub quét (getDataNow) một lần mỗi S giây, lệch pha nhau (mặc định 0 = chỉ nghe)
+ *   --reorder MS   Giữ dòng tối đa MS ms để gộp các hub theo thứ tự thời gian (mặc định 1000)
+ *   --bin          Yêu cầu hub xuất khung HubLink (setOutput bin)
+ *   --store DIR    Lưu lịch sử mọi trường số cùng rollup 1m/1h/1d vào DIR (đọc bằng tsquery)
+ *
+ * Một luồng, một epoll cho mọi tty và socket: hub nào có dữ liệu thì đọc hub
+ * đó, không có luồng/tác vụ riêng cho từng dòng. Mỗi hub có một HubWorker
+ * (bắt tay, hỏi kênh, quét) do SweepScheduler điều phối, xem Scheduler.h. Hub
+ * bị rút cáp được mở lại mỗi RETRY_MS và lấy lại phần lỡ bằng dumpSince.
+ * Dòng của mọi hub đi qua ReorderBuffer rồi mới tới Sink (định dạng xem Sink.h).
+ *
+ * Chạy thử không cần phần cứng với hub giả lập trên pty (SimHub):
+ *   pio run -e simhub && .pio/build/simhub/program --hubs 3 --link /tmp/hub%d &
+ *   pio run -e native && .pio/build/native/program --poll 5 /tmp/hub0 /tmp/hub1 /tmp/hub2
+ */
+
+#include "EventLoop.h"
+#include "HubPort.h"
+#include "Reorder.h"
+#include "Rollup.h"
+#include "Scheduler.h"
+#include "Sink.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <time.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int64_t RETRY_MS = 2000;  // Mở lại tty đã mất
+const int TICK_MS = 250;
+
+int64_t nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class Gateway : public HubListener {
+ public:
+  std::vector<HubWorker> workers;
+  SweepScheduler scheduler;
+  Rollups* history = nullptr;
+
+  Gateway(EventLoop& loop, Sink& sink, int64_t periodMs, int64_t reorderMs)
+      : scheduler(workers, periodMs), loop_(loop), sink_(sink), reorder_(reorderMs) {}
+
+  void onReading(HubPort& hub, const Reading& reading) override {
+    worker(hub).sweepReadings++;
+    if (history) {
+      for (uint8_t i = 0; i < reading.count; i++) {
+        const SensorField& f = reading.fields[i];
+        history->append(reading.id.ptr, reading.id.len, f.name.ptr, f.name.len, reading.time, f.value());
+      }
+    }
+    std::string line;
+    ndjson::reading(line, hub, reading);
+    reorder_.add(reading.time, std::move(line));
+  }
+
+  void onOffline(HubPort& hub, jsonscan::Slice id, int64_t time) override {
+    worker(hub).sweepOffline++;
+    std::string line;
+    ndjson::status(line, hub, id, "offline", time);
+    reorder_.add(time, std::move(line));
+  }
+
+  void onUnpolled(HubPort& hub, jsonscan::Slice id, int64_t time) override {
+    worker(hub).sweepUnpolled++;
+    std::string line;
+    ndjson::status(line, hub, id, "unpolled", time);
+    reorder_.add(time, std::move(line));
+  }
+
+  void onSweepDone(HubPort& hub, int64_t time) override {
+    HubWorker& w = worker(hub);
+    int64_t latency = scheduler.sweepDone(w, time);
+    std::string line;
+    ndjson::sweepDone(line, hub, time, latency, w.sweepReadings, w.sweepOffline, w.sweepUnpolled);
+    reorder_.add(time, std::move(line));
+  }
+
+  void onMessage(HubPort& hub, jsonscan::Slice text) override {
+    std::string line;
+    ndjson::message(line, hub, text);
+    reorder_.add(now_, std::move(line));
+  }
+
+  void open(uint32_t index, int64_t now) {
+    HubWorker& w = workers[index];
+    w.retryAt = now + RETRY_MS;
+    if (!w.port->open()) return;
+    loop_.add(w.port->fd(), EPOLLIN, EventLoop::HUB, index);
+    scheduler.opened(w, now);
+    fprintf(stderr, "[%s] %s opened\n", w.port->name().c_str(), w.port->path().c_str());
+  }
+
+  void service(uint32_t index, uint32_t events, int64_t now) {
+    HubWorker& w = workers[index];
+    now_ = now;
+    bool alive = !(events & EPOLLERR) && w.port->service(*this, now);
+    if (alive && !(events & EPOLLHUP)) return;
+    // pty: đầu kia đóng thì read() trả EIO / EPOLLHUP; USB-serial bị rút cũng vậy
+    loop_.remove(w.port->fd());
+    w.port->close();
+    w.retryAt = now + RETRY_MS;
+    scheduler.closed(w, now);
+    fprintf(stderr, "[%s] %s closed\n", w.port->name().c_str(), w.port->path().c_str());
+  }
+
+  // Mở lại hub đã mất, chạy lịch quét rồi nhả các dòng đã qua cửa sổ xếp thứ tự
+  void tick(int64_t now) {
+    now_ = now;
+    for (uint32_t i = 0; i < workers.size(); i++) {
+      if (!workers[i].port->isOpen() && now >= workers[i].retryAt) open(i, now);
+    }
+    scheduler.tick(now);
+    if (history) {
+      history->tick(now);
+      history->store().tick(now);
+    }
+    std::string out;
+    reorder_.release(now, out);
+    if (!out.empty()) sink_.write(out);
+  }
+
+  // ms tới việc kế tiếp (lượt quét tới hạn hoặc dòng cần nhả), tối đa TICK_MS
+  int timeout(int64_t now) const {
+    int64_t next = std::min(scheduler.nextWake(now), reorder_.nextDue());
+    return (int)std::max<int64_t>(0, std::min<int64_t>(next - now, TICK_MS));
+  }
+
+  void finish() {
+    std::string out;
+    reorder_.releaseAll(out);
+    if (!out.empty()) sink_.write(out);
+    if (history) history->store().flush();
+  }
+
+  void printStats() const {
+    for (const HubWorker& w : workers) {
+      const HubPort& p = *w.port;
+      const SweepStats& s = w.sweeps;
+      fprintf(stderr, "[%s] fw=%s channel=%d state=%s devices=%zu lines=%u frames=%u readings=%u duplicates=%u "
+              "crc_errors=%u reconnects=%u\n",
+              p.name().c_str(), p.firmware().empty() ? "?" : p.firmware().c_str(),
+              p.channel() == NO_CHANNEL ? -1 : p.channel(), HubWorker::stateName(w.state), p.devices().size(),
+              p.lines, p.frames, p.readings, p.duplicates, p.crcErrors(), p.reconnects);
+      if (s.count) {
+        fprintf(stderr, "[%s] sweeps=%u timeouts=%u waits=%u latency_ms min=%lld avg=%lld p50=%lld p95=%lld max=%lld\n",
+                p.name().c_str(), s.count, s.timeouts, s.waits, (long long)s.minMs, (long long)(s.totalMs / s.count),
+                (long long)s.percentile(50), (long long)s.percentile(95), (long long)s.maxMs);
+      }
+    }
+    fprintf(stderr, "sink: lines=%llu late=%llu clients=%zu dropped=%u\n", (unsigned long long)sink_.linesOut,
+            (unsigned long long)reorder_.late, sink_.clients(), sink_.clientsDropped);
+    if (history) {
+      const SeriesStore& store = history->store();
+      fprintf(stderr, "store: series=%zu open_points=%zu segments=%zu bytes=%llu rollup_late=%llu\n",
+              store.series().size(), store.openPoints(), store.segmentCount(), (unsigned long long)store.bytesUsed(),
+              (unsigned long long)history->late);
+    }
+  }
+
+ private:
+  EventLoop& loop_;
+  Sink& sink_;
+  ReorderBuffer reorder_;
+  int64_t now_ = 0;
+
+  HubWorker& worker(HubPort& hub) {
+    for (HubWorker& w : workers) {
+      if (w.port.get() == &hub) return w;
+    }
+    return workers.front();  // Không xảy ra: mọi HubPort đều thuộc một worker
+  }
+};
+
+void usage(const char* prog) {
+  fprintf(stderr, "Dùng: %s [--out FILE|-] [--listen PATH] [--poll S] [--reorder MS] [--bin] [--store DIR] [tên=]tty ...\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* outPath = nullptr;
+  const char* socketPath = nullptr;
+  const char* storeDir = nullptr;
+  int64_t pollMs = 0;
+  int64_t reorderMs = 1000;
+  bool binary = false;
+  std::vector<std::string> specs;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(a, "--out") == 0 && hasValue) outPath = argv[++i];
+    else if (strcmp(a, "--listen") == 0 && hasValue) socketPath = argv[++i];
+    else if (strcmp(a, "--poll") == 0 && hasValue) pollMs = (int64_t)(atof(argv[++i]) * 1000);
+    else if (strcmp(a, "--reorder") == 0 && hasValue) reorderMs = atoll(argv[++i]);
+    else if (strcmp(a, "--bin") == 0) binary = true;
+    else if (strcmp(a, "--store") == 0 && hasValue) storeDir = argv[++i];
+    else if (a[0] == '-') { usage(argv[0]); return 1; }
+    else specs.push_back(a);
+  }
+  if (specs.empty()) { usage(argv[0]); return 1; }
+  if (!outPath && !socketPath) outPath = "-";
+
+  EventLoop loop;
+  Sink sink(loop);
+  if (!loop.ok()) { perror("epoll"); return 1; }
+  if (outPath && !sink.openFile(outPath)) { perror(outPath); return 1; }
+  if (socketPath && !sink.listen(socketPath)) { perror(socketPath); return 1; }
+  SeriesStore store;
+  Rollups history(store);
+  if (storeDir) {
+    if (!store.open(storeDir, false)) { perror(storeDir); return 1; }
+    history.open();
+  }
+
+  // SIGINT/SIGTERM qua signalfd để thoát sạch (xóa socket, in thống kê)
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  int sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  loop.add(sigFd, EPOLLIN, EventLoop::SIGNAL, 0);
+
+  Gateway gateway(loop, sink, pollMs, reorderMs);
+  if (storeDir) gateway.history = &history;
+  gateway.workers.resize(specs.size());
+  for (size_t i = 0; i < specs.size(); i++) {
+    const std::string& spec = specs[i];
+    size_t eq = spec.find('=');
+    std::string name = eq == std::string::npos ? "h" + std::to_string(i) : spec.substr(0, eq);
+    std::string path = eq == std::string::npos ? spec : spec.substr(eq + 1);
+    gateway.workers[i].port.reset(new HubPort(name, path, binary));
+  }
+
+  epoll_event events[64];
+  bool running = true;
+  int64_t now = nowMs();
+  gateway.tick(now);
+  while (running) {
+    int n = loop.wait(events, 64, gateway.timeout(now));
+    now = nowMs();
+    for (int i = 0; i < n; i++) {
+      switch (EventLoop::tag(events[i])) {
+        case EventLoop::HUB:
+          gateway.service(EventLoop::id(events[i]), events[i].events, now);
+          break;
+        case EventLoop::LISTEN:
+        case EventLoop::CLIENT:
+          sink.handle(events[i]);
+          break;
+        case EventLoop::SIGNAL:
+          running = false;
+          break;
+      }
+    }
+    gateway.tick(now);
+    sink.flush();
+  }
+
+  gateway.finish();
+  sink.flush();
+  gateway.printStats();
+  close(sigFd);
+  return 0;
+}
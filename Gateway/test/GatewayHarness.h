@@ -0,0 +1,170 @@
+/**
+ * GatewayHarness - Chạy SimHub và Gateway thật cho các bài kiểm thử trên pty
+ *
+ * SimHub (simhub/SimHub.cpp) chạy trong tiến trình con fork ra, như khi chạy
+ * riêng; Gateway (src/main.cpp) chạy ngay trong tiến trình kiểm thử với đúng
+ * vòng epoll của main() để bài kiểm thử can thiệp được giữa các vòng (ngắt cổng,
+ * gửi lệnh). main() của hai file được đổi tên khi include.
+ *
+ * NDJSON ghi ra file tạm rồi đọc lại bằng JsonScan.
+ */
+
+#pragma once
+
+#define main simhubMain
+#include "../simhub/SimHub.cpp"
+#undef main
+#define main gatewayMain
+#include "../src/main.cpp"
+#undef main
+
+#include <unity.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace harness {
+namespace {
+
+// Một tiến trình SimHub với --hubs N, pty của hub i ở links[i]
+class SimHubProcess {
+ public:
+  std::vector<std::string> links;
+
+  ~SimHubProcess() { stop(); }
+
+  void start(int hubs, std::vector<std::string> args) {
+    char dir[] = "/tmp/gwtestXXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    dir_ = dir;
+    std::string pattern = dir_ + "/hub%d";
+    args.insert(args.begin(), { "simhub", "--hubs", std::to_string(hubs), "--link", pattern, "--quiet" });
+    for (int i = 0; i < hubs; i++) links.push_back(dir_ + "/hub" + std::to_string(i));
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_ = fork();
+    TEST_ASSERT_TRUE(pid_ >= 0);
+    if (pid_ == 0) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);  // Đường dẫn pty, đã có symlink
+      std::vector<char*> argv;
+      for (std::string& a : args) argv.push_back(&a[0]);
+      argv.push_back(nullptr);
+      _exit(simhubMain((int)args.size(), argv.data()));
+    }
+    for (int wait = 0; wait < 200 && !ready(); wait++) usleep(10000);
+    TEST_ASSERT_TRUE_MESSAGE(ready(), "SimHub không tạo pty");
+  }
+
+  void stop() {
+    if (pid_ > 0) {
+      kill(pid_, SIGTERM);
+      waitpid(pid_, nullptr, 0);
+      pid_ = -1;
+    }
+    for (const std::string& link : links) unlink(link.c_str());
+    links.clear();
+    if (!dir_.empty()) rmdir(dir_.c_str());
+    dir_.clear();
+  }
+
+ private:
+  pid_t pid_ = -1;
+  std::string dir_;
+
+  bool ready() const {
+    for (const std::string& link : links) {
+      if (access(link.c_str(), R_OK | W_OK) != 0) return false;
+    }
+    return true;
+  }
+};
+
+// Một dòng NDJSON của gateway, giữ chuỗi để Value trỏ vào
+struct Line {
+  std::string text;
+  jsonscan::Value doc;
+
+  std::string hub() const { return doc["hub"].string().str(); }
+  bool has(const char* key) const { return (bool)doc[key]; }
+  bool isReading() const { return has("sensors"); }
+  bool isEvent(const char* name) const { return doc["event"].string() == name; }
+  int64_t time() const { return doc["time"].int64(); }
+};
+
+// Gateway như main() với --out file tạm, chạy theo thời gian thật
+class GatewayRun {
+ public:
+  EventLoop loop;
+  Sink sink;
+  Gateway gateway;
+
+  GatewayRun(const std::vector<std::string>& ttys, int64_t periodMs, int64_t reorderMs, bool binary)
+      : sink(loop), gateway(loop, sink, periodMs, reorderMs) {
+    char path[] = "/tmp/gwtestXXXXXX.ndjson";
+    int fd = mkstemps(path, 7);
+    TEST_ASSERT_TRUE(fd >= 0);
+    ::close(fd);
+    out_ = path;
+    TEST_ASSERT_TRUE(sink.openFile(out_.c_str()));
+    gateway.workers.resize(ttys.size());
+    for (size_t i = 0; i < ttys.size(); i++) {
+      gateway.workers[i].port.reset(new HubPort("h" + std::to_string(i), ttys[i], binary));
+    }
+    start_ = nowMs();
+  }
+
+  ~GatewayRun() { unlink(out_.c_str()); }
+
+  int64_t elapsed() const { return nowMs() - start_; }
+
+  // Chạy tới ms tính từ lúc tạo, hook được gọi sau mỗi vòng epoll
+  void runUntil(int64_t ms, const std::function<void(int64_t elapsed)>& hook = nullptr) {
+    epoll_event events[64];
+    int64_t now = nowMs();
+    while (now - start_ < ms) {
+      gateway.tick(now);
+      sink.flush();
+      int n = loop.wait(events, 64, std::min<int64_t>(gateway.timeout(now), start_ + ms - now));
+      now = nowMs();
+      for (int i = 0; i < n; i++) {
+        if (EventLoop::tag(events[i]) == EventLoop::HUB) gateway.service(EventLoop::id(events[i]), events[i].events, now);
+      }
+      if (hook) hook(now - start_);
+    }
+  }
+
+  // Như rút cáp hub: cổng đóng, gateway mở lại sau RETRY_MS
+  void disconnect(uint32_t hub) { gateway.service(hub, EPOLLHUP, nowMs()); }
+
+  // Nhả mọi dòng còn giữ trong cửa sổ xếp thứ tự rồi đọc lại file
+  std::vector<Line> finish() {
+    gateway.finish();
+    sink.flush();
+    std::vector<Line> lines;
+    std::ifstream in(out_);
+    std::string text;
+    while (std::getline(in, text)) lines.push_back({ text, jsonscan::Value() });
+    for (Line& line : lines) {
+      line.doc = jsonscan::Value::parse(line.text.data(), line.text.size());
+      TEST_ASSERT_TRUE_MESSAGE(line.doc.isObject(), line.text.c_str());
+    }
+    return lines;
+  }
+
+ private:
+  std::string out_;
+  int64_t start_;
+};
+
+} // namespace
+} // namespace harness
@@ -0,0 +1,210 @@
+/**
+ * test_hublink - Khung HubLink đi qua một cặp pty thật như cổng Serial của MainHub
+ *
+ * Đầu master ghi dòng JSON và khung (hublink::encode) xen kẽ, đầu slave ở chế
+ * độ raw đọc không chặn và tách bằng hublink::Decoder. Dữ liệu dài hơn bộ đệm
+ * của pty nên ghi và đọc được xen nhau, Decoder nhận các khúc bị cắt tùy ý.
+ *
+ * Chạy: pio test -e native -f test_hublink
+ */
+
+#include <HubLink.h>
+#include <NodeProtocol.h>
+#include <unity.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Event {
+  hublink::Decoder<>::Result kind;
+  std::string data;  // Body của khung hoặc nội dung dòng
+};
+
+int master = -1, slave = -1;
+hublink::Decoder<>* decoder = nullptr;
+std::vector<Event> events;
+
+void readSlave() {
+  uint8_t buf[512];
+  ssize_t n;
+  while ((n = read(slave, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      hublink::Decoder<>::Result r = decoder->feed(buf[i]);
+      if (r == hublink::Decoder<>::FRAME) events.push_back({ r, std::string((const char*)decoder->body(), decoder->bodyLen()) });
+      if (r == hublink::Decoder<>::LINE) events.push_back({ r, std::string(decoder->line(), decoder->lineLen()) });
+    }
+  }
+}
+
+// Ghi hết qua master, đọc slave mỗi khi pty đầy; cuối cùng chờ tới khi slave hết dữ liệu
+void transfer(const std::vector<uint8_t>& bytes) {
+  size_t done = 0;
+  while (done < bytes.size()) {
+    ssize_t n = write(master, bytes.data() + done, bytes.size() - done);
+    if (n > 0) done += n;
+    else TEST_ASSERT_TRUE(errno == EAGAIN);
+    readSlave();
+  }
+  pollfd p = { slave, POLLIN, 0 };
+  while (poll(&p, 1, 50) > 0) readSlave();
+}
+
+void addLine(std::vector<uint8_t>& out, const std::string& line) {
+  out.insert(out.end(), line.begin(), line.end());
+  out.push_back('\r');
+  out.push_back('\n');
+}
+
+std::string addFrame(std::vector<uint8_t>& out, const void* header, uint8_t headerLen, const void* payload, uint8_t payloadLen) {
+  uint8_t frame[hublink::MAX_FRAME];
+  size_t n = hublink::encode(frame, header, headerLen, payload, payloadLen);
+  TEST_ASSERT_TRUE(n > 0);
+  out.insert(out.end(), frame, frame + n);
+  return std::string((const char*)frame + 2, n - 4);
+}
+
+std::string readingFrame(std::vector<uint8_t>& out, uint32_t seq) {
+  hublink::ReadingHeader h = { hublink::FRAME_READING, seq * 10, (uint8_t)(seq % 7), hublink::KIND_SOIL, seq };
+  nodeproto::SoilData d = { 40.0f + seq % 50, 20.0f + seq % 15 };
+  return addFrame(out, &h, sizeof(h), &d, sizeof(d));
+}
+
+} // namespace
+
+void setUp() {
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  TEST_ASSERT_TRUE(master >= 0);
+  TEST_ASSERT_EQUAL(0, grantpt(master));
+  TEST_ASSERT_EQUAL(0, unlockpt(master));
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  TEST_ASSERT_TRUE(slave >= 0);
+  termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  decoder = new hublink::Decoder<>();
+  events.clear();
+}
+
+void tearDown() {
+  delete decoder;
+  decoder = nullptr;
+  close(slave);
+  close(master);
+}
+
+// Mọi khung và dòng ra đúng thứ tự, nguyên vẹn, kể cả khi pty cắt giữa khung
+void test_interleaved_round_trip() {
+  std::vector<uint8_t> out;
+  std::vector<Event> expect;
+  for (uint32_t seq = 1; seq <= 600; seq++) {
+    expect.push_back({ hublink::Decoder<>::FRAME, readingFrame(out, seq) });
+    if (seq % 3 == 0) {
+      std::string line = "{\"event\":\"tick\",\"seq\":" + std::to_string(seq) + "}";
+      addLine(out, line);
+      expect.push_back({ hublink::Decoder<>::LINE, line });
+    }
+    if (seq % 50 == 0) {
+      hublink::EventHeader h = { hublink::FRAME_SWEEP_DONE, seq };
+      expect.push_back({ hublink::Decoder<>::FRAME, addFrame(out, &h, sizeof(h), nullptr, 0) });
+    }
+  }
+  TEST_ASSERT_TRUE(out.size() > 16384);  // Lớn hơn bộ đệm pty
+  transfer(out);
+
+  TEST_ASSERT_EQUAL(expect.size(), events.size());
+  for (size_t i = 0; i < expect.size(); i++) {
+    TEST_ASSERT_EQUAL(expect[i].kind, events[i].kind);
+    TEST_ASSERT_TRUE(expect[i].data == events[i].data);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, decoder->crcErrors);
+}
+
+// Sai một byte body: chỉ khung đó mất, dòng và khung sau vẫn ra
+void test_crc_error_drops_only_that_frame() {
+  std::vector<uint8_t> out;
+  std::string first = readingFrame(out, 1);
+  size_t corrupt = out.size();
+  readingFrame(out, 2);
+  out[corrupt + 5] ^= 0x40;
+  addLine(out, "{\"status\":\"ok\"}");
+  std::string third = readingFrame(out, 3);
+  transfer(out);
+
+  TEST_ASSERT_EQUAL(3, events.size());
+  TEST_ASSERT_TRUE(events[0].data == first);
+  TEST_ASSERT_EQUAL(hublink::Decoder<>::LINE, events[1].kind);
+  TEST_ASSERT_EQUAL_STRING("{\"status\":\"ok\"}", events[1].data.c_str());
+  TEST_ASSERT_TRUE(events[2].data == third);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder->crcErrors);
+}
+
+// LEN = 0 hoặc > MAX_BODY: bỏ SOF đó, phần sau đọc bình thường
+void test_bad_len() {
+  std::vector<uint8_t> out;
+  out.push_back(hublink::SOF);
+  out.push_back(0);
+  addLine(out, "{\"a\":1}");
+  out.push_back(hublink::SOF);
+  out.push_back(hublink::MAX_BODY + 1);
+  std::string frame = readingFrame(out, 7);
+  transfer(out);
+
+  TEST_ASSERT_EQUAL(2, events.size());
+  TEST_ASSERT_EQUAL_STRING("{\"a\":1}", events[0].data.c_str());
+  TEST_ASSERT_TRUE(events[1].data == frame);
+  TEST_ASSERT_EQUAL_UINT32(2, decoder->crcErrors);
+}
+
+// SOF lạc ngay trước khung thật: LEN đọc phải SOF thật, hoặc LEN hợp lệ nuốt đầu
+// khung thật vào body. Cả hai trường hợp khung thật vẫn phải ra.
+void test_stray_sof_does_not_eat_next_frame() {
+  std::vector<uint8_t> out;
+  out.push_back(hublink::SOF);
+  std::string first = readingFrame(out, 1);
+  out.push_back(hublink::SOF);
+  out.push_back(12);  // 12 byte body giả gồm cả đầu khung kế tiếp
+  std::string second = readingFrame(out, 2);
+  std::string third = readingFrame(out, 3);
+  transfer(out);
+
+  TEST_ASSERT_EQUAL(3, events.size());
+  TEST_ASSERT_TRUE(events[0].data == first);
+  TEST_ASSERT_TRUE(events[1].data == second);
+  TEST_ASSERT_TRUE(events[2].data == third);
+  TEST_ASSERT_EQUAL_UINT32(2, decoder->crcErrors);
+}
+
+// Khung bị cắt cụt (mất byte trên dây) rồi tới khung khác: chỉ khung cụt mất
+void test_truncated_frame() {
+  std::vector<uint8_t> out;
+  readingFrame(out, 1);
+  out.resize(out.size() - 3);
+  std::vector<std::string> expect;
+  for (uint32_t seq = 2; seq <= 6; seq++) expect.push_back(readingFrame(out, seq));
+  transfer(out);
+
+  TEST_ASSERT_EQUAL(expect.size(), events.size());
+  for (size_t i = 0; i < expect.size(); i++) TEST_ASSERT_TRUE(events[i].data == expect[i]);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder->crcErrors);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_interleaved_round_trip);
+  RUN_TEST(test_crc_error_drops_only_that_frame);
+  RUN_TEST(test_bad_len);
+  RUN_TEST(test_stray_sof_does_not_eat_next_frame);
+  RUN_TEST(test_truncated_frame);
+  return UNITY_END();
+}
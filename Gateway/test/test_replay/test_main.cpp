@@ -0,0 +1,94 @@
+/**
+ * test_replay - Gateway mất cổng giữa lượt quét rồi lấy lại phần lỡ bằng dumpSince
+ *
+ * Một SimHub nhiều node, quét nhanh, dump chậm (--dump-ms) để lượt quét kế tiếp
+ * sau khi mở lại cổng xen bản đo trực tiếp vào giữa các bản phát lại như
+ * serviceDump() của Master. Mọi seq phải ra đúng một lần, không thiếu, ở cả
+ * chế độ JSON lẫn khung nhị phân.
+ *
+ * Chạy: pio test -e native -f test_replay
+ */
+
+#include "../GatewayHarness.h"
+
+#include <map>
+
+namespace {
+
+harness::SimHubProcess sim;
+
+void recoversAfterReopen(bool binary) {
+  sim.start(1, { "--soil", "30", "--atm", "0", "--step", "20", "--offline", "0", "--dump-ms", "60", "--seed", "7" });
+  harness::GatewayRun run(sim.links, 1000, 0, binary);
+  HubPort& port = *run.gateway.workers[0].port;
+  bool disconnected = false, redumped = false;
+  uint32_t dupsBefore = 0;
+
+  run.runUntil(11000, [&](int64_t elapsed) {
+    const HubWorker& w = run.gateway.workers[0];
+    // Cắt giữa lượt quét, khi hub đã gửi một phần bản đo
+    if (!disconnected && elapsed >= 2500 && w.state == HubWorker::SWEEPING && nowMs() - w.stateAt >= 200) {
+      run.disconnect(0);
+      disconnected = true;
+    }
+    // Xin lại 10 bản đã giao: phải bị bỏ hết vì trùng
+    if (!redumped && elapsed >= 8500) {
+      char cmd[32];
+      snprintf(cmd, sizeof(cmd), "dumpSince %u", port.readings - 10);
+      dupsBefore = port.duplicates;
+      TEST_ASSERT_TRUE(port.send(cmd));
+      redumped = true;
+    }
+  });
+  std::vector<harness::Line> lines = run.finish();
+  sim.stop();
+
+  TEST_ASSERT_TRUE(disconnected);
+  TEST_ASSERT_EQUAL_UINT32(1, port.reconnects);
+  TEST_ASSERT_TRUE(port.duplicates - dupsBefore >= 10);
+
+  std::map<uint32_t, int> seen;
+  uint32_t replays = 0, interleaved = 0, dumps = 0;
+  uint32_t dumpTo = 0;
+  bool inDump = false;
+  for (const harness::Line& line : lines) {
+    if (line.isEvent("dump_begin")) {
+      dumps++;
+      inDump = true;
+      dumpTo = line.doc["to"].uint();
+    } else if (line.isEvent("dump_end")) {
+      inDump = false;
+    } else if (line.isReading()) {
+      uint32_t seq = line.doc["seq"].uint();
+      TEST_ASSERT_TRUE(seq > 0);
+      seen[seq]++;
+      if (line.doc["replay"].boolean()) replays++;
+      else if (inDump && dumps == 1 && seq >= dumpTo) interleaved++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, dumps);  // Sau khi mở lại, và lần xin lại thủ công
+  TEST_ASSERT_TRUE(replays > 0);
+  TEST_ASSERT_TRUE_MESSAGE(interleaved > 0, "Không có bản đo trực tiếp nào tới giữa dump_begin và dump_end");
+  TEST_ASSERT_TRUE(seen.size() > 100);
+  uint32_t expect = 1;
+  for (const auto& s : seen) {
+    TEST_ASSERT_EQUAL_UINT32(expect, s.first);  // Không thiếu seq nào
+    TEST_ASSERT_EQUAL_INT(1, s.second);         // Không seq nào ra hai lần
+    expect++;
+  }
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() { sim.stop(); }
+
+void test_reopen_recovers_json() { recoversAfterReopen(false); }
+void test_reopen_recovers_bin() { recoversAfterReopen(true); }
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_reopen_recovers_json);
+  RUN_TEST(test_reopen_recovers_bin);
+  return UNITY_END();
+}
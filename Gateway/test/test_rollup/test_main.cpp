@@ -0,0 +1,324 @@
+/**
+ * test_rollup - Rollups::query so với ô tính thẳng từ điểm thô
+ *
+ * Chuỗi thô vài ngày: đa số mỗi phút một điểm (ô 1m một điểm, chỉ ghi cột
+ * count), có đoạn dày (ô nhiều điểm), khoảng trống và điểm tới trễ, kể cả vào
+ * ô một điểm đã ghi. Ô của step 1m, 5m, 1h, 2d phải đúng bằng ô gộp từ các
+ * điểm không trễ ở tầng đó: trước và sau khi mở lại store (ô đang gộp dựng lại
+ * trong open()), với store còn ô bốn cột của bản cũ, và khi store chỉ có chuỗi thô.
+ *
+ * Chạy: pio test -e native -f test_rollup
+ */
+
+#include "Rollup.h"
+
+#include <unity.h>
+
+#include <dirent.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using gorilla::Point;
+
+const int64_t DAY = 86400000;
+const int64_t T0 = 1700006400000LL / DAY * DAY;  // Đầu một ngày UTC
+const char NODE[] = "soil0001";
+const char FIELD[] = "soil_moisture";
+const int64_t STEPS[] = { 60000, 300000, 3600000, 2 * DAY };
+
+class TempDir {
+ public:
+  std::string path;
+
+  TempDir() {
+    char dir[] = "/tmp/gwrollupXXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    path = dir;
+  }
+
+  ~TempDir() {
+    if (DIR* d = opendir(path.c_str())) {
+      while (dirent* e = readdir(d)) {
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) unlink((path + "/" + e->d_name).c_str());
+      }
+      closedir(d);
+    }
+    rmdir(path.c_str());
+  }
+};
+
+int64_t alignDown(int64_t t, int64_t width) { return t - ((t % width) + width) % width; }
+
+// Điểm thô theo thứ tự tới; late[tier]: điểm tới khi ô của nó ở tầng đó đã qua
+struct Raw {
+  Point point;
+  bool late[ROLLUP_TIERS];
+};
+
+// Chuỗi thô và mô hình của Rollups: điểm trễ ở một tầng khi ô của nó cũ hơn ô đang gộp
+class Feed {
+ public:
+  std::vector<Raw> raw;
+  uint64_t late = 0;
+
+  void add(int64_t time, double value) {
+    Raw r = { { time, value }, {} };
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+      r.late[tier] = !raw.empty() && alignDown(time, ROLLUP_MS[tier]) < alignDown(newest_, ROLLUP_MS[tier]);
+      late += r.late[tier];
+    }
+    newest_ = raw.empty() ? time : std::max(newest_, time);
+    raw.push_back(r);
+  }
+
+  // Ô step của tầng tier trong [from, to] như Rollups::query
+  std::vector<Bucket> expect(uint8_t tier, int64_t from, int64_t to, int64_t step) const {
+    int64_t width = ROLLUP_MS[tier];
+    std::vector<Bucket> cells;
+    for (const Raw& r : raw) {
+      int64_t cell = alignDown(r.point.time, width);
+      if (r.late[tier] || cell < alignDown(from, width) || cell > to) continue;
+      int64_t start = alignDown(r.point.time, step);
+      auto at = std::lower_bound(cells.begin(), cells.end(), start, [](const Bucket& b, int64_t s) { return b.start < s; });
+      if (at == cells.end() || at->start != start) {
+        at = cells.insert(at, Bucket());
+        at->start = start;
+      }
+      at->add(r.point.value);
+    }
+    return cells;
+  }
+
+ private:
+  int64_t newest_ = 0;
+};
+
+// min/max/count đúng từng bit; sum qua cột mean nên sai số làm tròn
+void assertBuckets(const std::vector<Bucket>& want, const std::vector<Bucket>& got) {
+  TEST_ASSERT_EQUAL_UINT(want.size(), got.size());
+  for (size_t i = 0; i < want.size(); i++) {
+    TEST_ASSERT_EQUAL_INT64(want[i].start, got[i].start);
+    TEST_ASSERT_EQUAL_UINT32(want[i].count, got[i].count);
+    TEST_ASSERT_EQUAL_MEMORY(&want[i].min, &got[i].min, sizeof(double));
+    TEST_ASSERT_EQUAL_MEMORY(&want[i].max, &got[i].max, sizeof(double));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9 * fabs(want[i].sum) + 1e-9, want[i].sum, got[i].sum);
+  }
+}
+
+// Mọi step trên cả khoảng và trên khoảng bắt đầu giữa ô
+void assertQueries(const Rollups& rollups, const Feed& feed) {
+  uint32_t id = rollups.store().find(NODE, FIELD);
+  TEST_ASSERT_TRUE(id != SeriesStore::NONE);
+  int64_t end = feed.raw.back().point.time;
+  const int64_t ranges[][2] = { { T0 - DAY, end + DAY }, { T0 + DAY + 5400000 + 17000, end - 3600000 } };
+  for (const int64_t* range : ranges) {
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+      for (int64_t want : STEPS) {
+        if (want < ROLLUP_MS[tier] || (tier + 1 < ROLLUP_TIERS && want >= ROLLUP_MS[tier + 1])) continue;
+        int64_t step = want;
+        std::vector<Bucket> got;
+        TEST_ASSERT_EQUAL_INT(tier, rollups.query(id, range[0], range[1], step, got));
+        TEST_ASSERT_EQUAL_INT64(want, step);
+        assertBuckets(feed.expect(tier, range[0], range[1], step), got);
+      }
+    }
+  }
+
+  // step dưới 1 phút: chuỗi thô, gồm cả điểm trễ
+  std::vector<Point> raw;
+  for (const Raw& r : feed.raw) raw.push_back({ r.point.time - r.point.time % STORE_TIME_MS, r.point.value });
+  std::stable_sort(raw.begin(), raw.end(), [](const Point& a, const Point& b) { return a.time < b.time; });
+  int64_t step = 1000;
+  std::vector<Bucket> got;
+  TEST_ASSERT_EQUAL_INT(-1, rollups.query(id, INT64_MIN, INT64_MAX, step, got));
+  TEST_ASSERT_EQUAL_UINT(raw.size(), got.size());
+  for (size_t i = 0; i < raw.size(); i++) {
+    TEST_ASSERT_EQUAL_INT64(raw[i].time, got[i].start);
+    TEST_ASSERT_EQUAL_MEMORY(&raw[i].value, &got[i].min, sizeof(double));
+  }
+}
+
+// Bản đo [from, to): mỗi phút (lệch vài giây), có giờ mỗi 20 giây, có khoảng trống;
+// cứ ~300 điểm thì một điểm trễ vào ô đã qua (nửa sau của ô một điểm 1m, giờ trước, ngày trước)
+class Source {
+ public:
+  explicit Source(uint32_t seed) : rng_(seed) {}
+
+  template <typename Append>
+  void run(int64_t from, int64_t to, Feed& feed, Append append) {
+    for (int64_t t = from; t < to;) {
+      int64_t hour = t / 3600000;
+      if (hour % 29 == 7) { t += 3 * 3600000; continue; }  // Node mất vài giờ
+      int64_t time = t + (int64_t)(rng_() % 4000);
+      value_ += (double)((int64_t)(rng_() % 21) - 10) / 100;
+      value_ = round(value_ * 100) / 100;
+      emit(feed, append, time, value_);
+      if (++count_ % 300 == 0) {
+        const int64_t back[] = { 3 * 60000, 2 * 3600000, DAY + 3600000 };
+        int64_t old = time - back[count_ / 300 % 3];
+        // Nửa sau của phút: ô 1m của điểm cũ ở đó chỉ có một điểm (lệch < 4 giây)
+        emit(feed, append, alignDown(old, 60000) + 30000 + (int64_t)(rng_() % 20000), value_ + 50);
+      }
+      t += hour % 5 == 2 ? 20000 : 60000;
+    }
+  }
+
+ private:
+  std::mt19937 rng_;
+  double value_ = 30;
+  uint32_t count_ = 0;
+
+  template <typename Append>
+  void emit(Feed& feed, Append& append, int64_t time, double value) {
+    feed.add(time, value);
+    append(time, value);
+  }
+};
+
+// Điểm trễ cũ hơn khối thô đã ghi chỉ an toàn khi khối chứa nó đã ghi (SeriesStore.h):
+// đóng mọi khối mở của chuỗi thô trước khi đóng store
+void sealRaw(SeriesStore& store) { store.tick(INT64_MAX / 2); }
+
+struct Opened {
+  SeriesStore store;
+  Rollups rollups{ store };
+
+  explicit Opened(const std::string& dir) {
+    TEST_ASSERT_TRUE(store.open(dir, false));
+    rollups.open();
+  }
+
+  void append(int64_t time, double value) {
+    TEST_ASSERT_TRUE(rollups.append(NODE, strlen(NODE), FIELD, strlen(FIELD), time, value));
+  }
+};
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_query_matches_raw_points() {
+  TempDir dir;
+  Feed feed;
+  Source source(24);
+  {
+    Opened db(dir.path);
+    source.run(T0, T0 + 3 * DAY + 5 * 3600000 + 1800000, feed, [&](int64_t t, double v) { db.append(t, v); });
+    TEST_ASSERT_EQUAL_UINT64(feed.late, db.rollups.late);
+    TEST_ASSERT_TRUE(feed.late >= 20);
+    assertQueries(db.rollups, feed);
+    sealRaw(db.store);
+  }
+  // Ô đang gộp (nửa giờ, 5 giờ, phần ngày cuối) dựng lại từ chuỗi thô khi mở
+  Opened db(dir.path);
+  assertQueries(db.rollups, feed);
+  source.run(T0 + 3 * DAY + 5 * 3600000 + 1800000, T0 + 4 * DAY + 600000, feed, [&](int64_t t, double v) { db.append(t, v); });
+  assertQueries(db.rollups, feed);
+}
+
+void test_old_four_column_cells() {
+  TempDir dir;
+  Feed feed;
+  Source source(7);
+  const int64_t cut = T0 + 2 * DAY;
+  {
+    // Store của bản cũ: ô nào cũng ghi đủ bốn cột, kể cả ô một điểm
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    uint32_t id = store.intern(NODE, strlen(NODE), FIELD, strlen(FIELD));
+    source.run(T0, cut, feed, [&](int64_t t, double v) { store.append(id, t, v); });
+    static const char* const COLUMN_NAMES[] = { "min", "max", "mean", "count" };
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++) {
+      uint32_t ids[4];
+      for (int c = 0; c < 4; c++) {
+        std::string name = std::string(FIELD) + '@' + ROLLUP_NAMES[tier] + '.' + COLUMN_NAMES[c];
+        ids[c] = store.intern(NODE, strlen(NODE), name.data(), name.size());
+      }
+      for (const Bucket& b : feed.expect(tier, T0 - 2 * DAY, cut - 1, ROLLUP_MS[tier])) {
+        const double values[4] = { b.min, b.max, b.mean(), (double)b.count };
+        for (int c = 0; c < 4; c++) store.append(ids[c], b.start, values[c]);
+      }
+    }
+    sealRaw(store);
+  }
+  Opened db(dir.path);
+  assertQueries(db.rollups, feed);
+  source.run(cut, cut + DAY + 7200000, feed, [&](int64_t t, double v) { db.append(t, v); });
+  assertQueries(db.rollups, feed);
+}
+
+void test_open_rebuilds_from_raw_series() {
+  TempDir dir;
+  Feed feed;
+  Source source(3);
+  {
+    // Chuỗi thô ghi trước khi có Rollup: gộp bù toàn bộ ở lần mở đầu tiên
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    uint32_t id = store.intern(NODE, strlen(NODE), FIELD, strlen(FIELD));
+    source.run(T0, T0 + DAY + 3600000 + 600000, feed, [&](int64_t t, double v) { store.append(id, t, v); });
+    sealRaw(store);
+  }
+  // Điểm trễ đã nằm trong chuỗi thô: lúc gộp bù không phân biệt được, gộp theo thứ tự time
+  for (Raw& r : feed.raw) std::fill(r.late, r.late + ROLLUP_TIERS, false);
+  feed.late = 0;
+  {
+    Opened db(dir.path);
+    TEST_ASSERT_EQUAL_UINT64(0, db.rollups.late);
+    assertQueries(db.rollups, feed);
+  }
+  Opened db(dir.path);
+  assertQueries(db.rollups, feed);
+  Feed more;
+  source.run(T0 + DAY + 3600000 + 600000, T0 + 2 * DAY, more, [&](int64_t t, double v) { db.append(t, v); });
+  for (const Raw& r : more.raw) feed.add(r.point.time, r.point.value);
+  TEST_ASSERT_EQUAL_UINT64(feed.late, db.rollups.late);
+  assertQueries(db.rollups, feed);
+}
+
+void test_late_point_in_earlier_block() {
+  // Điểm trễ ghi ở khối sau nhưng time trước điểm đầu khối chứa điểm của ô:
+  // theo tMin khối của nó đứng trước, ô một điểm vẫn phải lấy điểm ghi trước
+  TempDir dir;
+  Opened db(dir.path);
+  Feed feed;
+  for (int i = 0; i < 30; i++) {
+    int64_t time = T0 + i * 60000 + 40000;
+    feed.add(time, i);
+    db.append(time, i);
+    if (!i) db.store.setBlockLimit(db.store.find(NODE, FIELD), 10, BLOCK_SPAN_MS);
+    if (i == 25) {
+      feed.add(T0 + 10 * 60000 + 5000, 100);
+      db.append(T0 + 10 * 60000 + 5000, 100);
+    }
+  }
+  const SeriesStore::Series& raw = db.store.series()[db.store.find(NODE, FIELD)];
+  TEST_ASSERT_EQUAL_UINT(3, raw.blocks.size());
+  TEST_ASSERT_EQUAL_INT64(T0 + 10 * 60000 + 5000, raw.blocks[1].tMin);
+  TEST_ASSERT_EQUAL_UINT64(1, db.rollups.late);  // Chỉ trễ ở tầng 1m
+
+  int64_t step = 60000;
+  std::vector<Bucket> got;
+  db.rollups.query(db.store.find(NODE, FIELD), T0 + 10 * 60000, T0 + 10 * 60000, step, got);
+  TEST_ASSERT_EQUAL_UINT(1, got.size());
+  TEST_ASSERT_EQUAL_UINT32(1, got[0].count);
+  TEST_ASSERT_EQUAL_DOUBLE(10, got[0].min);
+  assertQueries(db.rollups, feed);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_query_matches_raw_points);
+  RUN_TEST(test_old_four_column_cells);
+  RUN_TEST(test_open_rebuilds_from_raw_series);
+  RUN_TEST(test_late_point_in_earlier_block);
+  return UNITY_END();
+}
@@ -0,0 +1,141 @@
+/**
+ * test_scheduler - Lịch quét nhiều hub qua SimHub trên pty
+ *
+ * Lượt quét của mỗi hub lấy từ dòng data_collection_finished: bắt đầu ở
+ * time - latency_ms, kết thúc ở time (cùng đồng hồ của gateway).
+ *   - Luồng gộp của mọi hub ra theo thứ tự "time", các hub lệch pha period/N
+ *   - Hub cùng kênh (--channel, --collide 1) không bao giờ quét chồng nhau
+ *   - Hub khác kênh quét song song
+ *
+ * Chạy: pio test -e native -f test_scheduler
+ */
+
+#include "../GatewayHarness.h"
+
+#include <map>
+
+namespace {
+
+harness::SimHubProcess sim;
+
+struct Sweep {
+  int64_t start, end;
+};
+
+// Lượt quét do gateway gửi của từng hub, theo thứ tự
+std::map<std::string, std::vector<Sweep>> sweepsByHub(const std::vector<harness::Line>& lines) {
+  std::map<std::string, std::vector<Sweep>> sweeps;
+  for (const harness::Line& line : lines) {
+    if (!line.isEvent("data_collection_finished") || !line.has("latency_ms")) continue;
+    int64_t latency = line.doc["latency_ms"].int64();
+    sweeps[line.hub()].push_back({ line.time() - latency, line.time() });
+  }
+  return sweeps;
+}
+
+uint32_t offlineTotal(const std::vector<harness::Line>& lines) {
+  uint32_t offline = 0;
+  for (const harness::Line& line : lines) {
+    if (line.isEvent("data_collection_finished")) offline += line.doc["offline"].uint();
+  }
+  return offline;
+}
+
+// Số cặp lượt quét của hai hub khác nhau chồng lên nhau
+int overlaps(const std::map<std::string, std::vector<Sweep>>& sweeps) {
+  int count = 0;
+  for (auto a = sweeps.begin(); a != sweeps.end(); ++a) {
+    for (auto b = std::next(a); b != sweeps.end(); ++b) {
+      for (const Sweep& x : a->second) {
+        for (const Sweep& y : b->second) count += x.start < y.end && y.start < x.end;
+      }
+    }
+  }
+  return count;
+}
+
+uint32_t totalWaits(const Gateway& gateway) {
+  uint32_t waits = 0;
+  for (const HubWorker& w : gateway.workers) waits += w.sweeps.waits;
+  return waits;
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() { sim.stop(); }
+
+void test_merged_stream_ordered_and_staggered() {
+  const int hubs = 3;
+  const int64_t period = 1500;
+  sim.start(hubs, { "--soil", "3", "--atm", "1", "--step", "50", "--offline", "0", "--seed", "3" });
+  harness::GatewayRun run(sim.links, period, 1000, false);
+  run.runUntil(9000);
+  std::vector<harness::Line> lines = run.finish();
+
+  // Mọi dòng (bản đo của ba hub, sự kiện) ra theo "time" không giảm
+  int64_t last = 0;
+  std::map<std::string, int> readings;
+  for (const harness::Line& line : lines) {
+    if (!line.has("time")) continue;
+    TEST_ASSERT_TRUE_MESSAGE(line.time() >= last, line.text.c_str());
+    last = line.time();
+    if (line.isReading()) readings[line.hub()]++;
+  }
+  TEST_ASSERT_EQUAL(hubs, (int)readings.size());
+
+  std::map<std::string, std::vector<Sweep>> sweeps = sweepsByHub(lines);
+  TEST_ASSERT_EQUAL(hubs, (int)sweeps.size());
+  // Bỏ lượt đầu (bắt tay xong muộn có thể trễ một chu kỳ), các lượt sau cách đúng period
+  for (const auto& hub : sweeps) {
+    TEST_ASSERT_TRUE_MESSAGE(hub.second.size() >= 4, hub.first.c_str());
+    for (size_t k = 2; k < hub.second.size(); k++) {
+      TEST_ASSERT_INT64_WITHIN(100, period, hub.second[k].start - hub.second[k - 1].start);
+    }
+  }
+  // Hub i lệch hub h0 i*period/N
+  int64_t base = sweeps["h0"].back().start;
+  for (int i = 1; i < hubs; i++) {
+    int64_t offset = ((sweeps["h" + std::to_string(i)].back().start - base) % period + period) % period;
+    TEST_ASSERT_INT64_WITHIN(100, period * i / hubs, offset);
+  }
+}
+
+// Cùng kênh, va chạm chắc chắn nếu quét chồng: không node nào được báo offline
+void test_conflicting_channels_never_overlap() {
+  sim.start(3, { "--soil", "3", "--atm", "1", "--step", "60", "--offline", "0", "--channel", "76", "--collide", "1",
+                 "--seed", "5" });
+  harness::GatewayRun run(sim.links, 600, 0, false);
+  run.runUntil(8000);
+  std::vector<harness::Line> lines = run.finish();
+
+  std::map<std::string, std::vector<Sweep>> sweeps = sweepsByHub(lines);
+  TEST_ASSERT_EQUAL(3, (int)sweeps.size());
+  for (const auto& hub : sweeps) TEST_ASSERT_TRUE_MESSAGE(hub.second.size() >= 3, hub.first.c_str());
+  TEST_ASSERT_EQUAL(0, overlaps(sweeps));
+  TEST_ASSERT_EQUAL_UINT32(0, offlineTotal(lines));
+  // Ba lượt ~240ms không vừa trong chu kỳ 600ms: phải có hub chờ
+  TEST_ASSERT_TRUE(totalWaits(run.gateway) > 0);
+}
+
+// Cùng tải nhưng mỗi hub một kênh mặc định: lượt quét chạy song song, không ai chờ
+void test_separate_channels_run_in_parallel() {
+  sim.start(3, { "--soil", "3", "--atm", "1", "--step", "60", "--offline", "0", "--collide", "1", "--seed", "5" });
+  harness::GatewayRun run(sim.links, 600, 0, false);
+  run.runUntil(8000);
+  std::vector<harness::Line> lines = run.finish();
+
+  std::map<std::string, std::vector<Sweep>> sweeps = sweepsByHub(lines);
+  TEST_ASSERT_EQUAL(3, (int)sweeps.size());
+  TEST_ASSERT_TRUE(overlaps(sweeps) > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, offlineTotal(lines));
+  TEST_ASSERT_EQUAL_UINT32(0, totalWaits(run.gateway));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_merged_stream_ordered_and_staggered);
+  RUN_TEST(test_conflicting_channels_never_overlap);
+  RUN_TEST(test_separate_channels_run_in_parallel);
+  return UNITY_END();
+}
@@ -0,0 +1,515 @@
+/**
+ * test_store - Định dạng trên đĩa của SeriesStore và bộ nén Gorilla
+ *
+ * Khối ngẫu nhiên ở mọi encoding (XOR, thập phân 0..3 chữ số) và mọi đơn vị
+ * time phải giải nén ra đúng từng bit; tiền tố bậc và cửa sổ XOR dùng lại được
+ * kiểm theo từng bit. Store thật trong thư mục tạm: khối timeUnit 0 ghi tay như
+ * store cũ, WAL đọc lại so với sealedMax, khối cuối hỏng CRC bị bỏ và điểm của
+ * nó lấy lại từ WAL, sang segment mới khi segment đầy.
+ *
+ * Chạy: pio test -e native -f test_store
+ */
+
+#include "SeriesStore.h"
+
+#include <unity.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using gorilla::Point;
+
+const int64_t T0 = 1700000000000LL;
+
+// Thư mục store tạm, xóa khi hủy
+class TempDir {
+ public:
+  std::string path;
+
+  TempDir() {
+    char dir[] = "/tmp/gwstoreXXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    path = dir;
+  }
+
+  ~TempDir() {
+    if (DIR* d = opendir(path.c_str())) {
+      while (dirent* e = readdir(d)) {
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) unlink((path + "/" + e->d_name).c_str());
+      }
+      closedir(d);
+    }
+    rmdir(path.c_str());
+  }
+
+  std::string file(const char* name) const { return path + "/" + name; }
+};
+
+void assertSame(const std::vector<Point>& want, const std::vector<Point>& got) {
+  TEST_ASSERT_EQUAL_UINT(want.size(), got.size());
+  for (size_t i = 0; i < want.size(); i++) {
+    TEST_ASSERT_EQUAL_INT64(want[i].time, got[i].time);
+    TEST_ASSERT_EQUAL_MEMORY(&want[i].value, &got[i].value, sizeof(double));
+  }
+}
+
+// time sau khi store làm tròn xuống STORE_TIME_MS
+int64_t stored(int64_t time) { return time - time % STORE_TIME_MS; }
+
+std::vector<Point> queryAll(const SeriesStore& store, uint32_t id) {
+  std::vector<Point> out;
+  store.query(id, INT64_MIN, INT64_MAX, out);
+  return out;
+}
+
+// Khối n điểm có đúng đơn vị time unit (chỉ số TIME_UNITS): đa số đều nhịp, có
+// bước nhảy lớn (mọi bậc của TIME_BUCKETS) và điểm lùi time
+std::vector<Point> randomTimes(std::mt19937_64& rng, size_t n, uint8_t unit) {
+  int64_t u = gorilla::TIME_UNITS[unit];
+  int64_t cadence = unit == 2 ? 1 : 60000 / u;
+  std::vector<Point> points(n);
+  int64_t t = T0 / 60000 * 60000;
+  for (size_t i = 0; i < n; i++) {
+    switch (rng() % 8) {
+      case 0: t += (int64_t)(rng() % (1ULL << (rng() % 35))) * u; break;
+      case 1: t -= (int64_t)(rng() % 100000) * u; break;
+      case 2: break;
+      default: t += (cadence + (int64_t)(rng() % 5) - 2) * u; break;
+    }
+    points[i].time = t;
+  }
+  // Ít nhất một điểm lệch khỏi đơn vị lớn hơn để timeUnitFor chọn đúng unit
+  if (unit + 1 < gorilla::TIME_UNIT_COUNT && points[n / 2].time % gorilla::TIME_UNITS[unit + 1] == 0) points[n / 2].time += u;
+  return points;
+}
+
+// Giá trị cho encoding: XOR (bit ngẫu nhiên, gồm NaN/inf, xen số đổi chậm và lặp lại) hoặc thập phân d chữ số
+void randomValues(std::mt19937_64& rng, std::vector<Point>& points, uint8_t encoding) {
+  if (encoding == gorilla::ENCODING_XOR) {
+    double slow = 20;
+    for (size_t i = 0; i < points.size(); i++) {
+      uint64_t bits = rng();
+      switch (rng() % 4) {
+        case 0: memcpy(&points[i].value, &bits, sizeof(bits)); break;
+        case 1: points[i].value = i ? points[i - 1].value : slow; break;
+        default: slow += (double)(bits % 1000) / 997; points[i].value = slow; break;
+      }
+    }
+    points[0].value = 0.123456789;  // Không có cách thập phân nào đúng
+    return;
+  }
+  int d = encoding - gorilla::ENCODING_XOR - 1;
+  double scale = pow(10, d);
+  int64_t v = 2150;
+  for (Point& p : points) {
+    switch (rng() % 6) {
+      case 0: v = (int64_t)(rng() % 2000000000000ULL) - 1000000000000LL; break;  // Mọi bậc của DECIMAL_BUCKETS
+      case 1: break;
+      default: v += (int64_t)(rng() % 41) - 20; break;
+    }
+    p.value = (double)v / scale;
+  }
+  // Chữ số thập phân cuối khác 0 để decimalsFor không chọn ít chữ số hơn
+  points[0].value = (double)(v / 10 * 10 + 7) / scale;
+}
+
+// Ghi zz theo bậc rồi 3 bit đánh dấu; đọc lại: k bit '1' (thêm '0' trừ bậc cuối), widths[k - 1] bit zz
+void checkBucket(uint64_t zz, const gorilla::Buckets& b, uint8_t k) {
+  gorilla::BitWriter w;
+  gorilla::writeBucketed(w, zz, b);
+  w.write(5, 3);
+  gorilla::BitReader r(w.bytes.data(), w.bytes.size());
+  bool one;
+  for (uint8_t i = 0; i < k; i++) {
+    TEST_ASSERT_TRUE(r.bit(one));
+    TEST_ASSERT_TRUE(one);
+  }
+  if (k < b.count) {
+    TEST_ASSERT_TRUE(r.bit(one));
+    TEST_ASSERT_FALSE(one);
+  }
+  uint64_t v;
+  if (k) {
+    TEST_ASSERT_TRUE(r.read(b.widths[k - 1], v));
+    TEST_ASSERT_EQUAL_UINT64(zz, v);
+  }
+  TEST_ASSERT_TRUE(r.read(3, v));
+  TEST_ASSERT_EQUAL_UINT64(5, v);
+
+  gorilla::BitReader back(w.bytes.data(), w.bytes.size());
+  TEST_ASSERT_TRUE(gorilla::readBucketed(back, v, b));
+  TEST_ASSERT_EQUAL_UINT64(zz, v);
+}
+
+// Điểm đều nhịp mỗi phút lệch vài trăm ms, giá trị thập phân đổi chậm
+std::vector<Point> minutePoints(size_t n, int64_t start, double base) {
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++) points.push_back({ start + (int64_t)i * 60000 + (int64_t)(i * 37 % 400), base + (double)(i % 17) / 10 });
+  return points;
+}
+
+std::vector<Point> storedPoints(const std::vector<Point>& points) {
+  std::vector<Point> out = points;
+  for (Point& p : out) p.time = stored(p.time);
+  return out;
+}
+
+void appendAll(SeriesStore& store, uint32_t id, const std::vector<Point>& points) {
+  for (const Point& p : points) store.append(id, p.time, p.value);
+}
+
+// Đảo các bit của một byte trong tệp
+void flipByte(const std::string& path, off_t offset) {
+  int fd = open(path.c_str(), O_RDWR);
+  TEST_ASSERT_TRUE(fd >= 0);
+  uint8_t b;
+  TEST_ASSERT_EQUAL_INT(1, pread(fd, &b, 1, offset));
+  b ^= 0xFF;
+  TEST_ASSERT_EQUAL_INT(1, pwrite(fd, &b, 1, offset));
+  close(fd);
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_bucket_prefixes() {
+  const gorilla::Buckets& t = gorilla::TIME_BUCKETS;
+  checkBucket(0, t, 0);
+  checkBucket(1, t, 1);
+  checkBucket(127, t, 1);
+  checkBucket(128, t, 2);
+  checkBucket(511, t, 2);
+  checkBucket(512, t, 3);
+  checkBucket(4095, t, 3);
+  checkBucket(4096, t, 4);
+  checkBucket(0xFFFFFFFFULL, t, 4);
+  checkBucket(0x100000000ULL, t, 5);
+  checkBucket(~0ULL, t, 5);
+
+  const gorilla::Buckets& d = gorilla::DECIMAL_BUCKETS;
+  checkBucket(0, d, 0);
+  checkBucket(63, d, 1);
+  checkBucket(64, d, 2);
+  checkBucket(1023, d, 2);
+  checkBucket(1024, d, 3);
+  checkBucket(65535, d, 3);
+  checkBucket(65536, d, 4);
+  checkBucket(~0ULL, d, 4);
+}
+
+void test_xor_reuses_previous_window() {
+  // 1.0 -> x = 0xF00000: cửa sổ mới, lead bị chặn ở 31, trail 20, rộng 13
+  // -> x = 0x600000: lead 31 >= 31, trail 21 >= 20, dùng lại cửa sổ
+  // -> x có bit 62: lead 1 < 31, cửa sổ mới; -> lặp lại: một bit '0'
+  // -> x có bit 63 và bit 0: cửa sổ rộng 64 ghi thành 0
+  uint64_t bits[5] = { 0x3FF0000000000000ULL };
+  bits[1] = bits[0] ^ 0xF00000;
+  bits[2] = bits[1] ^ 0x600000;
+  bits[3] = bits[2] ^ (1ULL << 62);
+  bits[4] = bits[3] ^ 0x8000000000000001ULL;
+  std::vector<Point> points;
+  for (int i = 0; i < 5; i++) {
+    points.push_back({ i, 0 });
+    memcpy(&points.back().value, &bits[i], 8);
+  }
+  points.insert(points.begin() + 4, points[3]);
+
+  gorilla::BitWriter w;
+  gorilla::encodeXor(w, points.data(), points.size());
+  gorilla::BitReader r(w.bytes.data(), w.bytes.size());
+  uint64_t v;
+  TEST_ASSERT_TRUE(r.read(64, v));
+  TEST_ASSERT_EQUAL_UINT64(bits[0], v);
+  const uint64_t expect[][2] = {
+    { 0x3, 2 }, { 31, 5 }, { 13, 6 }, { 0xF, 13 },          // Cửa sổ mới
+    { 0x2, 2 }, { 0x6, 13 },                               // Dùng lại cửa sổ của điểm trước
+    { 0x3, 2 }, { 1, 5 }, { 1, 6 }, { 1, 1 },              // Cửa sổ mới ở bit 62
+    { 0x0, 1 },                                            // Không đổi
+    { 0x3, 2 }, { 0, 5 }, { 0, 6 }, { 0x8000000000000001ULL, 64 },
+  };
+  for (const uint64_t* e : expect) {
+    TEST_ASSERT_TRUE(r.read((uint8_t)e[1], v));
+    TEST_ASSERT_EQUAL_UINT64(e[0], v);
+  }
+  TEST_ASSERT_FALSE(r.read(8, v));
+
+  // Cả khối (cột time đứng trước) giải nén lại đúng
+  gorilla::BitWriter block;
+  uint8_t unit;
+  TEST_ASSERT_EQUAL_UINT8(gorilla::ENCODING_XOR, gorilla::encode(points.data(), points.size(), block, unit));
+  std::vector<Point> out;
+  TEST_ASSERT_TRUE(gorilla::decode(block.bytes.data(), block.bytes.size(), points.size(), gorilla::ENCODING_XOR, unit, out));
+  assertSame(points, out);
+}
+
+void test_picks_decimal_before_xor() {
+  const struct {
+    double values[3];
+    uint8_t encoding;
+  } cases[] = {
+    { { 21, -3, 0 }, gorilla::ENCODING_XOR + 1 },
+    { { 21.5, 21.75, 22 }, gorilla::ENCODING_XOR + 3 },
+    { { 1013.25, 0.001, -7 }, gorilla::ENCODING_XOR + 4 },
+    { { 21.5, 0.0001, 22 }, gorilla::ENCODING_XOR },       // Quá MAX_DECIMALS
+    { { 1e300, 1, 2 }, gorilla::ENCODING_XOR },            // Số nguyên quá lớn
+    { { 21.5, NAN, 22 }, gorilla::ENCODING_XOR },
+  };
+  for (const auto& c : cases) {
+    Point points[3] = { { T0, c.values[0] }, { T0 + 60000, c.values[1] }, { T0 + 120000, c.values[2] } };
+    gorilla::BitWriter w;
+    uint8_t unit;
+    TEST_ASSERT_EQUAL_UINT8(c.encoding, gorilla::encode(points, 3, w, unit));
+    std::vector<Point> out;
+    TEST_ASSERT_TRUE(gorilla::decode(w.bytes.data(), w.bytes.size(), 3, c.encoding, unit, out));
+    for (int i = 0; i < 3; i++) TEST_ASSERT_EQUAL_MEMORY(&points[i].value, &out[i].value, 8);
+  }
+}
+
+void test_random_blocks_round_trip() {
+  std::mt19937_64 rng(23);
+  for (uint8_t unit = 0; unit < gorilla::TIME_UNIT_COUNT; unit++) {
+    for (uint8_t encoding = gorilla::ENCODING_XOR; encoding <= gorilla::ENCODING_XOR + 1 + gorilla::MAX_DECIMALS; encoding++) {
+      for (int trial = 0; trial < 20; trial++) {
+        size_t n = 2 + rng() % (trial < 10 ? 30 : BLOCK_POINTS);
+        std::vector<Point> points = randomTimes(rng, n, unit);
+        randomValues(rng, points, encoding);
+
+        gorilla::BitWriter w;
+        uint8_t gotUnit;
+        TEST_ASSERT_EQUAL_UINT8(encoding, gorilla::encode(points.data(), n, w, gotUnit));
+        TEST_ASSERT_EQUAL_UINT8(unit, gotUnit);
+        std::vector<Point> out = { { 1, 1 } };  // decode nối vào sau phần đã có
+        TEST_ASSERT_TRUE(gorilla::decode(w.bytes.data(), w.bytes.size(), n, encoding, gotUnit, out));
+        out.erase(out.begin());
+        assertSame(points, out);
+
+        // Khối bị cắt cụt không giải nén được
+        std::vector<Point> cut;
+        TEST_ASSERT_FALSE(gorilla::decode(w.bytes.data(), w.bytes.size() - 9, n, encoding, gotUnit, cut));
+      }
+    }
+  }
+}
+
+void test_decode_rejects_bad_blocks() {
+  Point points[2] = { { T0, 1.5 }, { T0 + 1000, 0.1234567 } };
+  gorilla::BitWriter w;
+  uint8_t unit;
+  uint8_t encoding = gorilla::encode(points, 2, w, unit);
+  std::vector<Point> out;
+  TEST_ASSERT_FALSE(gorilla::decode(w.bytes.data(), w.bytes.size(), 2, gorilla::ENCODING_XOR + 2 + gorilla::MAX_DECIMALS, unit, out));
+  TEST_ASSERT_FALSE(gorilla::decode(w.bytes.data(), w.bytes.size(), 2, encoding, gorilla::TIME_UNIT_COUNT, out));
+
+  // Điểm thứ hai dùng lại cửa sổ khi chưa có cửa sổ nào
+  gorilla::BitWriter bad;
+  bad.write(T0, 64);
+  bad.bit(0);
+  bad.write(0x3FF0000000000000ULL, 64);
+  bad.write(0x2, 2);
+  bad.write(0, 16);
+  TEST_ASSERT_FALSE(gorilla::decode(bad.bytes.data(), bad.bytes.size(), 2, gorilla::ENCODING_XOR, 0, out));
+}
+
+void test_time_unit_zero_block() {
+  // Khối như store cũ ghi (trước khi có đơn vị time): delta theo ms, thập phân 1 chữ số
+  const int64_t t0 = T0 + 123;
+  const Point want[3] = { { t0, 21.5 }, { t0 + 60007, 21.7 }, { t0 + 120005, 21.4 } };
+  gorilla::BitWriter w;
+  w.write(t0, 64);
+  w.write(0x1E, 5);                 // delta 60007 - 0: zigzag 120014, bậc 32 bit
+  w.write(120014, 32);
+  w.write(0x2, 2);                  // 59998 - 60007 = -9: zigzag 17, bậc 7 bit
+  w.write(17, 7);
+  w.write(gorilla::zigzag(215), 64);
+  w.write(0x2, 2);                  // 217 - 215 = 2: zigzag 4
+  w.write(4, 6);
+  w.write(0x2, 2);                  // 214 - 217 = -3: zigzag 5
+  w.write(5, 6);
+
+  std::vector<Point> out;
+  TEST_ASSERT_TRUE(gorilla::decode(w.bytes.data(), w.bytes.size(), 3, gorilla::ENCODING_XOR + 2, 0, out));
+  assertSame(std::vector<Point>(want, want + 3), out);
+
+  // Cùng khối trong segment của một store cũ
+  TempDir dir;
+  int fd = open(dir.file("series.tsv").c_str(), O_WRONLY | O_CREAT, 0644);
+  TEST_ASSERT_EQUAL_INT(11, write(fd, "node\tfield\n", 11));
+  close(fd);
+  BlockHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "TB", 2);
+  h.encoding = gorilla::ENCODING_XOR + 2;
+  h.timeUnit = 0;
+  h.series = 0;
+  h.tMin = want[0].time;
+  h.tMax = want[2].time;
+  h.bytes = w.bytes.size();
+  h.count = 3;
+  h.crc = hublink::crc16(w.bytes.data(), w.bytes.size(), hublink::crc16((const uint8_t*)&h, offsetof(BlockHeader, crc)));
+  fd = open(dir.file("000000.seg").c_str(), O_RDWR | O_CREAT, 0644);
+  TEST_ASSERT_EQUAL_INT(0, ftruncate(fd, SEGMENT_BYTES));
+  TEST_ASSERT_EQUAL_INT(sizeof(h), pwrite(fd, &h, sizeof(h), 0));
+  TEST_ASSERT_EQUAL_INT(w.bytes.size(), pwrite(fd, w.bytes.data(), w.bytes.size(), sizeof(h)));
+  close(fd);
+
+  std::vector<Point> all(want, want + 3);
+  std::vector<Point> more = minutePoints(5, t0 + 180000, 21);
+  {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    TEST_ASSERT_EQUAL_UINT64(3, store.series()[0].sealedPoints);
+    assertSame(all, queryAll(store, 0));
+    // Khối mới ghi sau khối cũ dùng đơn vị giây
+    store.setBlockLimit(0, 5, BLOCK_SPAN_MS);
+    appendAll(store, 0, more);
+  }
+  std::vector<Point> tail = storedPoints(more);
+  all.insert(all.end(), tail.begin(), tail.end());
+  SeriesStore store;
+  TEST_ASSERT_TRUE(store.open(dir.path, true));
+  TEST_ASSERT_EQUAL_UINT(2, store.series()[0].blocks.size());
+  TEST_ASSERT_EQUAL_UINT(0, store.openPoints());
+  assertSame(all, queryAll(store, 0));
+}
+
+void test_wal_replay_skips_sealed_points() {
+  TempDir dir;
+  std::vector<Point> a = minutePoints(250, T0, 20), b = minutePoints(30, T0 + 500, 55);
+  {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    uint32_t ia = store.intern("n", 1, "a", 1), ib = store.intern("n", 1, "b", 1);
+    store.setBlockLimit(ia, 100, BLOCK_SPAN_MS);
+    for (size_t i = 0; i < a.size(); i++) {
+      store.append(ia, a[i].time, a[i].value);
+      if (i < b.size()) store.append(ib, b[i].time, b[i].value);
+    }
+  }
+  // WAL còn cả 280 điểm, 200 điểm đầu của a đã nằm trong hai khối
+  struct stat st;
+  TEST_ASSERT_EQUAL_INT(0, stat(dir.file("open.wal").c_str(), &st));
+  TEST_ASSERT_EQUAL_INT(280 * sizeof(WalRecord), st.st_size);
+
+  for (int pass = 0; pass < 2; pass++) {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, pass == 1));
+    const SeriesStore::Series& sa = store.series()[0];
+    TEST_ASSERT_EQUAL_UINT64(200, sa.sealedPoints);
+    TEST_ASSERT_EQUAL_INT64(stored(a[199].time), sa.sealedMax);
+    TEST_ASSERT_EQUAL_UINT(50, sa.open.size());
+    TEST_ASSERT_EQUAL_INT64(stored(a[200].time), sa.openSince);
+    TEST_ASSERT_EQUAL_UINT(80, store.openPoints());
+    assertSame(storedPoints(a), queryAll(store, 0));
+    assertSame(storedPoints(b), queryAll(store, 1));
+    if (pass == 0) store.compact();  // Lần sau đọc WAL chỉ còn điểm mở
+  }
+  TEST_ASSERT_EQUAL_INT(0, stat(dir.file("open.wal").c_str(), &st));
+  TEST_ASSERT_EQUAL_INT(80 * sizeof(WalRecord), st.st_size);
+}
+
+void test_corrupt_tail_block_dropped() {
+  TempDir dir;
+  std::vector<Point> points = minutePoints(350, T0, 20);
+  uint32_t offset;
+  {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    uint32_t id = store.intern("n", 1, "a", 1);
+    store.setBlockLimit(id, 100, BLOCK_SPAN_MS);
+    appendAll(store, id, points);
+    TEST_ASSERT_EQUAL_UINT(3, store.series()[id].blocks.size());
+    offset = store.series()[id].blocks.back().offset;
+  }
+  // Mất điện lúc đang ghi khối cuối: byte cuối của dữ liệu nén sai
+  BlockHeader h;
+  int fd = open(dir.file("000000.seg").c_str(), O_RDONLY);
+  TEST_ASSERT_EQUAL_INT(sizeof(h), pread(fd, &h, sizeof(h), offset));
+  close(fd);
+  flipByte(dir.file("000000.seg"), offset + sizeof(h) + h.bytes - 1);
+
+  std::vector<Point> want = storedPoints(points);
+  {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    const SeriesStore::Series& s = store.series()[0];
+    TEST_ASSERT_EQUAL_UINT(2, s.blocks.size());
+    TEST_ASSERT_EQUAL_UINT64(200, s.sealedPoints);
+    TEST_ASSERT_EQUAL_INT64(want[199].time, s.sealedMax);
+    TEST_ASSERT_EQUAL_UINT64(offset, store.bytesUsed());
+    TEST_ASSERT_EQUAL_UINT(150, s.open.size());  // 100 điểm của khối bị bỏ lấy lại từ WAL
+    assertSame(want, queryAll(store, 0));
+
+    // Khối kế tiếp ghi đè lên khối hỏng
+    std::vector<Point> more = minutePoints(20, T0 + 350 * 60000, 30);
+    store.setBlockLimit(0, 100, BLOCK_SPAN_MS);
+    appendAll(store, 0, more);
+    TEST_ASSERT_EQUAL_UINT(3, s.blocks.size());
+    TEST_ASSERT_EQUAL_UINT(offset, s.blocks.back().offset);
+    std::vector<Point> tail = storedPoints(more);
+    want.insert(want.end(), tail.begin(), tail.end());
+  }
+  SeriesStore store;
+  TEST_ASSERT_TRUE(store.open(dir.path, true));
+  TEST_ASSERT_EQUAL_UINT64(want.size() - store.openPoints(), store.series()[0].sealedPoints);
+  assertSame(want, queryAll(store, 0));
+}
+
+void test_segment_rollover() {
+  TempDir dir;
+  std::mt19937_64 rng(24);
+  std::vector<Point> points;
+  {
+    SeriesStore store;
+    TEST_ASSERT_TRUE(store.open(dir.path, false));
+    uint32_t id = store.intern("n", 1, "x", 1);
+    // Giá trị bit ngẫu nhiên: ~9 byte/điểm, segment đầy sau khoảng 450k điểm
+    for (int64_t t = T0; store.segmentCount() < 2 || points.size() % BLOCK_POINTS != 100; t += 1000) {
+      uint64_t bits = rng();
+      Point p = { t, 0 };
+      memcpy(&p.value, &bits, 8);
+      points.push_back(p);
+      store.append(id, p.time, p.value, false);
+      TEST_ASSERT_TRUE(store.segmentCount() <= 2);
+    }
+    store.compact();
+  }
+  SeriesStore store;
+  TEST_ASSERT_TRUE(store.open(dir.path, false));
+  TEST_ASSERT_EQUAL_UINT(2, store.segmentCount());
+  const SeriesStore::Series& s = store.series()[0];
+  TEST_ASSERT_EQUAL_UINT(100, s.open.size());
+  TEST_ASSERT_EQUAL_UINT(0, s.blocks.front().segment);
+  TEST_ASSERT_EQUAL_UINT(1, s.blocks.back().segment);
+  // Phần cuối segment 0 không đủ chỗ cho khối tiếp theo
+  size_t first = 0;
+  while (s.blocks[first].segment == 0) first++;
+  TEST_ASSERT_EQUAL_UINT64(s.sealedBytes, store.bytesUsed());
+  TEST_ASSERT_TRUE(store.bytesUsed() > SEGMENT_BYTES);
+  TEST_ASSERT_EQUAL_UINT(0, s.blocks[first].offset);
+  assertSame(points, queryAll(store, 0));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bucket_prefixes);
+  RUN_TEST(test_xor_reuses_previous_window);
+  RUN_TEST(test_picks_decimal_before_xor);
+  RUN_TEST(test_random_blocks_round_trip);
+  RUN_TEST(test_decode_rejects_bad_blocks);
+  RUN_TEST(test_time_unit_zero_block);
+  RUN_TEST(test_wal_replay_skips_sealed_points);
+  RUN_TEST(test_corrupt_tail_block_dropped);
+  RUN_TEST(test_segment_rollover);
+  return UNITY_END();
+}
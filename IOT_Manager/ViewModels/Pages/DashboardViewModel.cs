@@ -178,10 +178,18 @@ namespace IOT_Manager.ViewModels.Pages
                     bool hasSensors = root.TryGetProperty("sensors", out sensors) || root.TryGetProperty("Sensors", out sensors);
                     bool hasId = root.TryGetProperty("id", out nodeId) || root.TryGetProperty("Id", out nodeId);
 
+                    // Lô mẫu của node (setSampleInterval): mẫu cũ nhất trước, dashboard chỉ hiện mẫu mới nhất
+                    if (!hasSensors && hasId && root.TryGetProperty("batch", out var batch)
+                        && batch.ValueKind == JsonValueKind.Array && batch.GetArrayLength() > 0)
+                    {
+                        hasSensors = batch[batch.GetArrayLength() - 1].TryGetProperty("sensors", out sensors);
+                    }
+
                     if (hasSensors && hasId)
                     {
                         string id = nodeId.GetString();
-                        UpdateNodeData(id, sensors);
+                        bool delta = root.TryGetProperty("delta", out var d) && d.ValueKind == JsonValueKind.True;
+                        UpdateNodeData(id, sensors, delta);
                         AddToLog($"Data <{id}> updated.");
 
                         _uploadDebounceTimer.Stop();
@@ -237,7 +245,8 @@ namespace IOT_Manager.ViewModels.Pages
             }
         }
 
-        private void UpdateNodeData(string id, JsonElement sensorElement)
+        // delta: Master chỉ gửi các trường đổi quá deadband (setReport), giữ giá trị cũ của trường vắng
+        private void UpdateNodeData(string id, JsonElement sensorElement, bool delta = false)
         {
             var node = Nodes.FirstOrDefault(n => n.NodeId == id);
 
@@ -253,6 +262,12 @@ namespace IOT_Manager.ViewModels.Pages
             try
             {
                 var dict = JsonSerializer.Deserialize<Dictionary<string, object>>(sensorElement.GetRawText(), _jsonOptions);
+                if (delta && dict != null && node.RawSensors != null)
+                {
+                    var merged = new Dictionary<string, object>(node.RawSensors);
+                    foreach (var kvp in dict) merged[kvp.Key] = kvp.Value;
+                    dict = merged;
+                }
                 node.RawSensors = dict;
 
                 node.Attributes.Clear();
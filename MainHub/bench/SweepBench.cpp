@@ -0,0 +1,300 @@
+/**
+ * SweepBench - Đo thời gian getDataNow của MainHub trên radio giả lập
+ *
+ * Chạy firmware thật (setup/loop trong src/main.cpp) với node ảo của NativeSim
+ * theo ma trận số node x tỉ lệ mất gói x tỉ lệ node offline. Mỗi kịch bản
+ * quét nhiều lượt, ghi ra JSON: histogram thời gian mỗi lượt quét, mỗi node,
+ * số lần phát radio trên một bản ghi, số lần phát lại và tổng thời gian phát.
+ * Lượt bị Hub cắt ở hạn chót (data_collection_finished có "unpolled") được đếm
+ * riêng với lượt bench tự bỏ vì không thấy kết thúc.
+ *
+ * Đồng hồ ảo nên kết quả chỉ phụ thuộc --seed, so sánh được giữa các commit:
+ *   pio run -e bench && .pio/build/bench/program --out bench.json
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <SimNodes.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern RF24 radio;  // Radio của firmware trong src/main.cpp
+
+namespace {
+
+// Biên trên (ms) của từng ô histogram, ô cuối là phần còn lại
+const uint32_t BUCKETS_MS[] = { 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+const size_t BUCKET_COUNT = sizeof(BUCKETS_MS) / sizeof(BUCKETS_MS[0]) + 1;
+const uint64_t SWEEP_GIVE_UP_US = 120000000;
+
+struct Histogram {
+  uint32_t counts[BUCKET_COUNT] = {};
+  std::vector<uint32_t> samples;  // µs
+
+  void add(uint64_t us) {
+    samples.push_back((uint32_t)us);
+    size_t i = 0;
+    while (i < BUCKET_COUNT - 1 && us > BUCKETS_MS[i] * 1000ULL) i++;
+    counts[i]++;
+  }
+  double percentileMs(double p) {
+    if (samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[i] / 1000.0;
+  }
+};
+
+struct NodeResult {
+  Histogram latency;
+  uint32_t readings = 0, offline = 0;
+};
+
+struct Scenario {
+  int nodes;
+  double loss;
+  double offlineFraction;
+};
+
+struct Options {
+  std::vector<int> nodes{ 1, 10, 50, 200 };
+  std::vector<double> loss{ 0.0, 0.05, 0.2 };
+  std::vector<double> offline{ 0.0, 0.1 };
+  int sweeps = 5;
+  uint32_t seed = 1;
+  bool perNode = true;
+  const char* out = nullptr;
+};
+
+// --- ĐỌC OUTPUT SERIAL CỦA HUB ---
+
+std::string lineBuf;
+std::vector<std::pair<uint64_t, std::string>> lines;
+
+void captureSerial(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == '\n') {
+      if (!lineBuf.empty() && lineBuf.back() == '\r') lineBuf.pop_back();
+      lines.emplace_back(sim::now(), lineBuf);
+      lineBuf.clear();
+    } else {
+      lineBuf += (char)data[i];
+    }
+  }
+}
+
+std::string field(const std::string& line, const char* key) {
+  std::string k = std::string("\"") + key + "\":\"";
+  size_t a = line.find(k);
+  if (a == std::string::npos) return "";
+  a += k.size();
+  size_t b = line.find('"', a);
+  return b == std::string::npos ? "" : line.substr(a, b - a);
+}
+
+void step() {
+  loop();
+  sim::advance(sim::callCostUs);
+}
+
+void runUntil(uint64_t t) {
+  while (sim::now() < t) step();
+}
+
+// --- JSON ---
+
+FILE* out = stdout;
+
+void writeHistogram(const char* name, Histogram& h) {
+  fprintf(out, "\"%s\":{\"count\":%zu,\"p50_ms\":%.3f,\"p95_ms\":%.3f,\"max_ms\":%.3f,\"buckets\":[", name,
+          h.samples.size(), h.percentileMs(0.5), h.percentileMs(0.95), h.percentileMs(1.0));
+  for (size_t i = 0; i < BUCKET_COUNT; i++) {
+    if (i) fputc(',', out);
+    if (i < BUCKET_COUNT - 1) fprintf(out, "{\"le_ms\":%u,\"n\":%u}", BUCKETS_MS[i], h.counts[i]);
+    else fprintf(out, "{\"le_ms\":null,\"n\":%u}", h.counts[i]);
+  }
+  fputs("]}", out);
+}
+
+// --- MỘT KỊCH BẢN ---
+
+void runScenario(const Scenario& sc, const Options& opt, bool first) {
+  sim::reset();
+  Preferences::wipe();
+  sim::seed(opt.seed);
+  lines.clear();
+  lineBuf.clear();
+  setup();
+
+  std::vector<std::unique_ptr<sim::VirtualNode>> nodes;
+  char id[11];
+  for (int i = 0; i < sc.nodes; i++) {
+    // Khoảng 1/5 là ATM Node (gói dữ liệu dài hơn, chờ OK lâu hơn)
+    if (i % 5 == 4) snprintf(id, sizeof(id), "atm%05d", (i + 1) % 100000);
+    else snprintf(id, sizeof(id), "soil%04d", (i + 1) % 10000);
+    nodes.emplace_back(new sim::VirtualNode(i % 5 == 4 ? sim::NODE_ATM : sim::NODE_SOIL, id));
+  }
+
+  // Đăng ký không mất gói, qua đúng lệnh Serial của App
+  uint32_t cost = sim::callCostUs;
+  sim::callCostUs = 200;
+  int unregistered = 0;
+  for (auto& node : nodes) {
+    sim::serialInput("registerNewNode\n");
+    node->allowRegister();
+    uint64_t giveUp = sim::now() + 10000000;
+    while (!node->registered() && sim::now() < giveUp) step();
+    if (!node->registered()) unregistered++;
+    runUntil(sim::now() + 600000);  // Hub nháy LED rồi thoát chế độ đăng ký
+  }
+  sim::callCostUs = cost;
+
+  int offline = (int)(sc.nodes * sc.offlineFraction + 0.5);
+  for (int i = 0; i < offline; i++) nodes[nodes.size() - 1 - i]->setOnline(false);
+
+  sim::Air& air = sim::Air::get();
+  air.config.loss = sc.loss;
+  air.stats = sim::AirStats();
+  RF24::Counters hubStart = radio.counters;
+  uint64_t nodeAttempts0 = 0, nodeWrites0 = 0;
+  for (auto& n : nodes) { nodeAttempts0 += n->radio().counters.attempts; nodeWrites0 += n->radio().counters.writes; }
+
+  Histogram sweepHist;
+  std::vector<NodeResult> perNode(nodes.size());
+  uint32_t readings = 0, offlineReports = 0, unpolledReports = 0, timeouts = 0, truncated = 0;
+
+  for (int s = 0; s < opt.sweeps; s++) {
+    lines.clear();
+    uint64_t start = sim::now();
+    sim::serialInput("getDataNow\n");
+    bool done = false;
+    size_t seen = 0;
+    while (!done && sim::now() - start < SWEEP_GIVE_UP_US) {
+      step();
+      for (; seen < lines.size(); seen++) {
+        const std::string& l = lines[seen].second;
+        uint64_t dt = lines[seen].first - start;
+        if (l.find("data_collection_finished") != std::string::npos) {
+          sweepHist.add(dt);
+          if (l.find("\"unpolled\"") != std::string::npos) truncated++;
+          done = true;
+          continue;
+        }
+        std::string nid = field(l, "id");
+        if (nid.empty()) continue;
+        for (size_t i = 0; i < nodes.size(); i++) {
+          if (nid != nodes[i]->id()) continue;
+          if (l.find("\"sensors\"") != std::string::npos) {
+            perNode[i].latency.add(dt);
+            perNode[i].readings++;
+            readings++;
+          } else if (l.find("offline") != std::string::npos) {
+            perNode[i].offline++;
+            offlineReports++;
+          } else if (l.find("unpolled") != std::string::npos) {
+            unpolledReports++;
+          }
+        }
+      }
+    }
+    if (!done) timeouts++;
+    runUntil(sim::now() + 1000000);
+  }
+
+  uint64_t nodeAttempts = 0, nodeWrites = 0;
+  for (auto& n : nodes) { nodeAttempts += n->radio().counters.attempts; nodeWrites += n->radio().counters.writes; }
+  nodeAttempts -= nodeAttempts0;
+  nodeWrites -= nodeWrites0;
+  uint32_t hubWrites = radio.counters.writes - hubStart.writes;
+  uint32_t hubAttempts = radio.counters.attempts - hubStart.attempts;
+
+  Histogram allNodes;
+  for (auto& r : perNode) for (uint32_t us : r.latency.samples) allNodes.add(us);
+
+  fprintf(out, "%s\n{\"nodes\":%d,\"loss\":%.3f,\"offline_fraction\":%.3f,\"offline\":%d,\"sweeps\":%d,\"unregistered\":%d,", first ? "" : ",",
+          sc.nodes, sc.loss, sc.offlineFraction, offline, opt.sweeps, unregistered);
+  fprintf(out, "\"readings\":%u,\"offline_reports\":%u,\"unpolled_reports\":%u,\"sweep_truncated\":%u,\"sweep_timeouts\":%u,",
+          readings, offlineReports, unpolledReports, truncated, timeouts);
+  fprintf(out, "\"radio\":{\"air_attempts\":%llu,\"hub_writes\":%u,\"hub_retransmits\":%u,\"node_writes\":%llu,"
+               "\"node_retransmits\":%llu,\"collisions\":%llu,\"lost\":%llu,\"attempts_per_reading\":%.3f,\"air_ms\":%.1f},",
+          (unsigned long long)air.stats.attempts, hubWrites, hubAttempts - hubWrites, (unsigned long long)nodeWrites,
+          (unsigned long long)(nodeAttempts - nodeWrites), (unsigned long long)air.stats.collisions,
+          (unsigned long long)air.stats.lost, readings ? (double)air.stats.attempts / readings : 0.0,
+          air.stats.airtimeUs / 1000.0);
+  writeHistogram("sweep", sweepHist);
+  fputc(',', out);
+  writeHistogram("node", allNodes);
+  if (opt.perNode) {
+    fputs(",\"per_node\":[", out);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      NodeResult& r = perNode[i];
+      fprintf(out, "%s{\"id\":\"%s\",\"readings\":%u,\"offline\":%u,\"p50_ms\":%.3f,\"max_ms\":%.3f}", i ? "," : "",
+              nodes[i]->id(), r.readings, r.offline, r.latency.percentileMs(0.5), r.latency.percentileMs(1.0));
+    }
+    fputc(']', out);
+  }
+  fputc('}', out);
+  fflush(out);
+
+  fprintf(stderr, "[bench] nodes=%d loss=%.2f offline=%d sweep_p50=%.1fms readings=%u truncated=%u\n", sc.nodes, sc.loss,
+          offline, sweepHist.percentileMs(0.5), readings, truncated);
+  sim::reset();
+}
+
+template <class T>
+std::vector<T> parseList(const char* s) {
+  std::vector<T> v;
+  while (*s) {
+    char* end;
+    v.push_back((T)strtod(s, &end));
+    s = *end == ',' ? end + 1 : end;
+    if (end == s && *s) break;
+  }
+  return v;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--nodes" && hasValue) opt.nodes = parseList<int>(argv[++i]);
+    else if (a == "--loss" && hasValue) opt.loss = parseList<double>(argv[++i]);
+    else if (a == "--offline" && hasValue) opt.offline = parseList<double>(argv[++i]);
+    else if (a == "--sweeps" && hasValue) opt.sweeps = atoi(argv[++i]);
+    else if (a == "--seed" && hasValue) opt.seed = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--out" && hasValue) opt.out = argv[++i];
+    else if (a == "--no-per-node") opt.perNode = false;
+    else {
+      fprintf(stderr,
+              "Usage: %s [--nodes 1,10,50,200] [--loss 0,0.05,0.2] [--offline 0,0.1] [--sweeps 5] [--seed 1]\n"
+              "          [--no-per-node] [--out FILE]\n",
+              argv[0]);
+      return a == "--help" ? 0 : 2;
+    }
+  }
+  if (opt.out && !(out = fopen(opt.out, "w"))) {
+    perror(opt.out);
+    return 1;
+  }
+
+  sim::setSerialSink(captureSerial);
+  fprintf(out, "{\"benchmark\":\"sweep\",\"seed\":%u,\"scenarios\":[", opt.seed);
+  bool first = true;
+  for (int n : opt.nodes) {
+    for (double loss : opt.loss) {
+      for (double off : opt.offline) {
+        runScenario(Scenario{ n, loss, off }, opt, first);
+        first = false;
+      }
+    }
+  }
+  fputs("\n]}\n", out);
+  if (out != stdout) fclose(out);
+  return 0;
+}
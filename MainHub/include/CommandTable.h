@@ -0,0 +1,65 @@
+/**
+ * CommandTable - Bảng tra lệnh Serial thời gian hằng số
+ *
+ * Tên lệnh (phần trước dấu cách đầu tiên) được băm FNV-1a vào bảng địa chỉ mở
+ * Slots ô, nên dispatch() chỉ tốn một lần băm + một strcmp bất kể số lệnh.
+ * Phần còn lại của dòng được truyền nguyên cho handler dưới dạng args
+ * (chuỗi rỗng nếu không có). Không dùng String/heap.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef void (*CommandHandler)(char* args);
+
+template <uint8_t Slots>
+class CommandTable {
+  static_assert((Slots & (Slots - 1)) == 0, "Slots phải là lũy thừa của 2");
+
+ public:
+  CommandTable() { memset(entries_, 0, sizeof(entries_)); }
+
+  // Gọi lúc setup(), name phải sống suốt chương trình (chuỗi hằng)
+  bool add(const char* name, CommandHandler handler) {
+    uint8_t i = hash(name, strlen(name)) & (Slots - 1);
+    for (uint8_t n = 0; n < Slots; n++, i = (i + 1) & (Slots - 1)) {
+      if (!entries_[i].name) { entries_[i].name = name; entries_[i].handler = handler; return true; }
+    }
+    return false;
+  }
+
+  // line bị sửa tại chỗ (tách tên lệnh), trả về false nếu không có lệnh
+  bool dispatch(char* line) {
+    char* args = strchr(line, ' ');
+    size_t verbLen = args ? (size_t)(args - line) : strlen(line);
+    if (args) {
+      *args++ = '\0';
+      while (*args == ' ') args++;
+    } else {
+      args = line + verbLen;  // Chuỗi rỗng
+    }
+
+    uint8_t i = hash(line, verbLen) & (Slots - 1);
+    for (uint8_t n = 0; n < Slots && entries_[i].name; n++, i = (i + 1) & (Slots - 1)) {
+      if (strcmp(entries_[i].name, line) == 0) { entries_[i].handler(args); return true; }
+    }
+    return false;
+  }
+
+ private:
+  struct Entry {
+    const char* name;
+    CommandHandler handler;
+  };
+
+  static uint32_t hash(const char* s, size_t len) {
+    uint32_t h = 2166136261UL;
+    while (len--) h = (h ^ (uint8_t)*s++) * 16777619UL;
+    return h ^ (h >> 16);
+  }
+
+  Entry entries_[Slots];
+};
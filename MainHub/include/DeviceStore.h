@@ -0,0 +1,204 @@
+/**
+ * DeviceStore - Danh sách node của Master trong NVS: một blob có phiên bản và CRC
+ * cộng một nhật ký thay đổi ngắn
+ *
+ * Blob "reg" = DeviceStoreHeader + count x StoredDevice, chỉ gồm trường cần lưu
+ * (không có isOnline, thống kê liên kết hay byte đệm của struct lúc chạy). Mỗi
+ * lần thêm/sửa/xóa một node chỉ ghi một mục nhỏ vào key "l0".."l15" thay vì ghi
+ * lại cả danh sách; nhật ký đầy thì gộp vào blob mới (gen tăng) rồi xóa nhật ký.
+ * Mục mang gen của blob nó thuộc về: mất điện giữa lúc gộp thì mục cũ còn sót bị
+ * bỏ qua vì khác gen. Khởi động đọc tối đa 1 + DEVICE_LOG_MAX key, không phụ
+ * thuộc số node.
+ *
+ * Thứ tự node được giữ: mục PUT của id mới thêm vào cuối, mục DEL xóa tại chỗ,
+ * giống thao tác trên std::vector devices của Master.
+ */
+
+#pragma once
+
+#include <Preferences.h>
+#include <HubLink.h>
+#include <NodeProtocol.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DEVICE_STORE_VERSION 1
+#define DEVICE_LOG_MAX       16
+
+struct __attribute__((packed)) StoredDevice {
+  char id[11];
+  uint8_t type;
+  uint8_t addr;
+  uint8_t via;              // NO_NODE = Master hỏi trực tiếp
+  uint16_t wakePeriod;
+  uint16_t heartbeat;       // ReportConfig
+  uint16_t deadband[nodeproto::DEADBAND_FIELDS];
+};
+
+struct __attribute__((packed)) DeviceStoreHeader {
+  char magic[2];            // "DV"
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t gen;             // Tăng mỗi lần ghi lại blob
+  uint16_t count;
+  uint16_t crc;             // CRC-16 của các trường trên (trừ crc) và toàn bộ bản ghi
+};
+
+enum DeviceLogOp : uint8_t { DEVICE_LOG_PUT = 1, DEVICE_LOG_DEL = 2 };
+
+struct __attribute__((packed)) DeviceLogEntry {
+  uint16_t gen;
+  uint8_t op;
+  StoredDevice device;      // DEL chỉ dùng id
+  uint16_t crc;
+};
+
+static_assert(sizeof(StoredDevice) == 30, "Đổi StoredDevice phải tăng DEVICE_STORE_VERSION");
+
+class DeviceStore {
+ public:
+  DeviceStore(Preferences& prefs, const char* ns) : prefs_(prefs), ns_(ns) {}
+
+  enum LoadResult { LOAD_EMPTY, LOAD_OK, LOAD_CORRUPT };
+
+  // Đọc blob rồi áp nhật ký. LOAD_EMPTY: chưa từng lưu theo layout này (có thể còn layout cũ).
+  LoadResult load(std::vector<StoredDevice>& out) {
+    out.clear();
+    gen_ = 0;
+    logCount_ = 0;
+    LoadResult result = LOAD_EMPTY;
+    prefs_.begin(ns_, true);
+    size_t len = prefs_.getBytesLength("reg");
+    if (len) {
+      result = LOAD_CORRUPT;
+      uint8_t* blob = (uint8_t*)malloc(len);
+      DeviceStoreHeader h;
+      if (blob && prefs_.getBytes("reg", blob, len) == len && len >= sizeof(h)) {
+        memcpy(&h, blob, sizeof(h));
+        const uint8_t* records = blob + sizeof(h);
+        if (memcmp(h.magic, "DV", 2) == 0 && h.version == DEVICE_STORE_VERSION &&
+            len == sizeof(h) + h.count * sizeof(StoredDevice) && h.crc == blobCrc(h, records)) {
+          out.resize(h.count);
+          memcpy(out.data(), records, h.count * sizeof(StoredDevice));
+          gen_ = h.gen;
+          result = LOAD_OK;
+        }
+      }
+      free(blob);
+    }
+    // Blob hỏng: bỏ cả nhật ký, lần gộp kế tiếp ghi blob mới với gen khác
+    if (result != LOAD_CORRUPT) {
+      DeviceLogEntry e;
+      while (logCount_ < DEVICE_LOG_MAX && readLog(logCount_, e)) {
+        apply(out, e);
+        logCount_++;
+        result = LOAD_OK;
+      }
+    }
+    prefs_.end();
+    return result;
+  }
+
+  // Thêm/sửa một node. false: nhật ký đầy, gọi save() với cả danh sách.
+  bool put(const StoredDevice& device) { return append(DEVICE_LOG_PUT, device); }
+
+  bool remove(const char* id) {
+    StoredDevice d;
+    memset(&d, 0, sizeof(d));
+    strncpy(d.id, id, sizeof(d.id) - 1);
+    return append(DEVICE_LOG_DEL, d);
+  }
+
+  // Ghi lại cả danh sách thành blob mới và xóa nhật ký
+  void save(const std::vector<StoredDevice>& all) {
+    DeviceStoreHeader h;
+    memcpy(h.magic, "DV", 2);
+    h.version = DEVICE_STORE_VERSION;
+    h.reserved = 0;
+    h.gen = gen_ + 1;
+    h.count = all.size();
+    h.crc = blobCrc(h, (const uint8_t*)all.data());
+    size_t len = sizeof(h) + all.size() * sizeof(StoredDevice);
+    uint8_t* blob = (uint8_t*)malloc(len);
+    if (!blob) return;
+    memcpy(blob, &h, sizeof(h));
+    memcpy(blob + sizeof(h), all.data(), all.size() * sizeof(StoredDevice));
+    prefs_.begin(ns_, false);
+    bool ok = prefs_.putBytes("reg", blob, len) == len;
+    if (ok) {
+      gen_ = h.gen;
+      char key[4];
+      // Xóa cả mục sót lại từ gen khác (blob hỏng, mất điện giữa lúc gộp)
+      for (uint8_t i = 0; i < DEVICE_LOG_MAX; i++) {
+        if (prefs_.isKey(logKey(key, i))) prefs_.remove(key);
+      }
+      logCount_ = 0;
+    }
+    prefs_.end();
+    free(blob);
+  }
+
+  // Xóa cả namespace, kể cả key của layout cũ
+  void clear() {
+    prefs_.begin(ns_, false);
+    prefs_.clear();
+    prefs_.end();
+    gen_ = 0;
+    logCount_ = 0;
+  }
+
+ private:
+  Preferences& prefs_;
+  const char* ns_;
+  uint16_t gen_ = 0;
+  uint8_t logCount_ = 0;
+
+  static char* logKey(char* key, uint8_t i) {
+    key[0] = 'l';
+    if (i < 10) { key[1] = '0' + i; key[2] = '\0'; }
+    else { key[1] = '0' + i / 10; key[2] = '0' + i % 10; key[3] = '\0'; }
+    return key;
+  }
+
+  static uint16_t blobCrc(const DeviceStoreHeader& h, const uint8_t* records) {
+    uint16_t crc = hublink::crc16((const uint8_t*)&h, offsetof(DeviceStoreHeader, crc));
+    return hublink::crc16(records, h.count * sizeof(StoredDevice), crc);
+  }
+
+  static uint16_t entryCrc(const DeviceLogEntry& e) {
+    return hublink::crc16((const uint8_t*)&e, offsetof(DeviceLogEntry, crc));
+  }
+
+  bool readLog(uint8_t i, DeviceLogEntry& e) {
+    char key[4];
+    if (prefs_.getBytes(logKey(key, i), &e, sizeof(e)) != sizeof(e)) return false;
+    return e.gen == gen_ && e.crc == entryCrc(e) && (e.op == DEVICE_LOG_PUT || e.op == DEVICE_LOG_DEL);
+  }
+
+  static void apply(std::vector<StoredDevice>& list, const DeviceLogEntry& e) {
+    for (size_t i = 0; i < list.size(); i++) {
+      if (strncmp(list[i].id, e.device.id, sizeof(e.device.id)) != 0) continue;
+      if (e.op == DEVICE_LOG_PUT) list[i] = e.device;
+      else list.erase(list.begin() + i);
+      return;
+    }
+    if (e.op == DEVICE_LOG_PUT) list.push_back(e.device);
+  }
+
+  bool append(uint8_t op, const StoredDevice& device) {
+    if (logCount_ >= DEVICE_LOG_MAX) return false;
+    DeviceLogEntry e;
+    e.gen = gen_;
+    e.op = op;
+    e.device = device;
+    e.crc = entryCrc(e);
+    char key[4];
+    prefs_.begin(ns_, false);
+    bool ok = prefs_.putBytes(logKey(key, logCount_), &e, sizeof(e)) == sizeof(e);
+    prefs_.end();
+    if (ok) logCount_++;
+    return ok;
+  }
+};
@@ -0,0 +1,57 @@
+/**
+ * LineReader - Đọc lệnh Serial theo dòng, không chặn, không cấp phát động
+ *
+ * Khác Serial.readStringUntil(): không chờ timeout khi dòng chưa đủ, byte nào
+ * có sẵn thì lấy byte đó rồi trả về ngay. Dòng dài hơn N-1 ký tự bị bỏ cả dòng
+ * (tới '\n') và báo OVERFLOW để không thực thi nửa lệnh.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+template <size_t N>
+class LineReader {
+ public:
+  enum Result { NONE, LINE, OVERFLOW };
+
+  // S là bất kỳ kiểu nào có available()/read() (HardwareSerial, Stream giả lập...)
+  template <class S>
+  Result poll(S& in) {
+    if (ready_) { len_ = 0; ready_ = false; }
+
+    while (in.available() > 0) {
+      int c = in.read();
+      if (c < 0) break;
+
+      if (c == '\n') {
+        if (discarding_) { discarding_ = false; len_ = 0; return OVERFLOW; }
+        trimEnd();
+        if (len_ == 0) continue;  // Dòng trống
+        buf_[len_] = '\0';
+        ready_ = true;
+        return LINE;
+      }
+      if (discarding_ || c == '\r') continue;
+      if (len_ == 0 && (c == ' ' || c == '\t')) continue;  // Bỏ khoảng trắng đầu dòng
+      if (len_ < N - 1) buf_[len_++] = (char)c;
+      else discarding_ = true;
+    }
+    return NONE;
+  }
+
+  // Chỉ hợp lệ sau khi poll() trả về LINE, tới lần poll() kế tiếp
+  char* line() { return buf_; }
+  size_t length() const { return len_; }
+
+ private:
+  void trimEnd() {
+    while (len_ > 0 && (buf_[len_ - 1] == ' ' || buf_[len_ - 1] == '\t')) len_--;
+  }
+
+  char buf_[N];
+  size_t len_ = 0;
+  bool ready_ = false;
+  bool discarding_ = false;
+};
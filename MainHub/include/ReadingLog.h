@@ -0,0 +1,129 @@
+/**
+ * ReadingLog - Vòng đệm các bản ghi đo của Master, đánh số thứ tự tăng dần
+ *
+ * Mỗi bản ghi 32 byte: số thứ tự (seq), millis() lúc nhận, byte địa chỉ node,
+ * loại node và số đo dạng struct float (nodeproto::SoilData/AtmData/AtmDataV2). seq bắt đầu từ 1 và không
+ * bao giờ lặp lại trong một lần chạy, host lưu seq cuối cùng đã nhận rồi hỏi
+ * lại phần còn thiếu bằng lệnh dumpSince sau khi mất kết nối.
+ *
+ * Lưu node theo addr thay vì chỉ số: chỉ số đổi khi xóa node, addr thì không.
+ *
+ * Tùy chọn lưu Flash (chỉ ESP32): định nghĩa READING_LOG_PARTITION là nhãn
+ * một phân vùng data trong bảng phân vùng, ví dụ
+ *     readlog, data, 0x99, , 64K
+ * và build_flags = -DREADING_LOG_PARTITION=\"readlog\". Bản ghi được ghi tiếp
+ * vào phân vùng theo vòng, sector kế tiếp bị xóa khi vòng ghi chạm tới; lúc
+ * khởi động seq được khôi phục từ bản ghi mới nhất còn trong Flash. Vòng RAM
+ * vẫn giữ các bản ghi gần nhất để dump không phải đọc Flash.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ESP32) && defined(READING_LOG_PARTITION)
+#include <esp_partition.h>
+#define READING_LOG_FLASH 1
+#endif
+
+#define LOG_PAYLOAD_MAX 21  // sizeof(AtmData), struct lớn nhất trong nhật ký
+
+struct __attribute__((packed)) LogRecord {
+  uint32_t seq;        // 0 hoặc 0xFFFFFFFF: ô trống
+  uint32_t timestamp;  // millis() của Master lúc nhận
+  uint8_t addr;        // Byte thấp địa chỉ node
+  uint8_t nodeType;
+  uint8_t len;
+  uint8_t payload[LOG_PAYLOAD_MAX];
+};
+
+static_assert(sizeof(LogRecord) == 32, "LogRecord phải chia hết sector Flash");
+
+template <size_t Capacity>
+class ReadingLog {
+ public:
+  ReadingLog() { memset(records_, 0, sizeof(records_)); }
+
+  // Gọi lúc setup(), trước bản ghi đầu tiên
+  void begin() {
+#ifdef READING_LOG_FLASH
+    part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, READING_LOG_PARTITION);
+    if (part_) slots_ = part_->size / sizeof(LogRecord);
+    if (slots_ < RECORDS_PER_SECTOR * 2) { part_ = nullptr; return; }
+
+    // Tìm seq lớn nhất còn hợp lệ rồi nạp lại phần đuôi vào RAM
+    LogRecord r;
+    for (uint32_t i = 0; i < slots_; i++) {
+      if (readSlot(i, r) && r.seq >= next_) next_ = r.seq + 1;
+    }
+    uint32_t from = next_ > Capacity ? next_ - Capacity : 1;
+    for (uint32_t seq = from; seq < next_; seq++) {
+      if (readSlot(seq % slots_, r) && r.seq == seq) records_[seq % Capacity] = r;
+    }
+#endif
+  }
+
+  // Thêm bản ghi, payload dài hơn LOG_PAYLOAD_MAX bị cắt
+  const LogRecord& append(uint32_t timestamp, uint8_t addr, uint8_t nodeType, const uint8_t* payload, uint8_t len) {
+    if (len > LOG_PAYLOAD_MAX) len = LOG_PAYLOAD_MAX;
+    LogRecord& r = records_[next_ % Capacity];
+    memset(&r, 0, sizeof(r));
+    r.seq = next_++;
+    r.timestamp = timestamp;
+    r.addr = addr;
+    r.nodeType = nodeType;
+    r.len = len;
+    memcpy(r.payload, payload, len);
+#ifdef READING_LOG_FLASH
+    if (part_) writeSlot(r);
+#endif
+    return r;
+  }
+
+  // seq cũ nhất có thể còn giữ (có thể đã bị xóa cùng sector Flash, xem get())
+  uint32_t first() const {
+    uint32_t depth = Capacity;
+#ifdef READING_LOG_FLASH
+    if (part_) depth = slots_ - RECORDS_PER_SECTOR;
+#endif
+    return next_ > depth ? next_ - depth : 1;
+  }
+
+  // seq sẽ được cấp cho bản ghi kế tiếp
+  uint32_t next() const { return next_; }
+
+  // Chép bản ghi seq vào out, false nếu đã bị ghi đè hoặc chưa tồn tại
+  bool get(uint32_t seq, LogRecord& out) const {
+    if (seq == 0 || seq >= next_ || seq < first()) return false;
+    const LogRecord& r = records_[seq % Capacity];
+    if (r.seq == seq) { out = r; return true; }
+#ifdef READING_LOG_FLASH
+    if (part_ && readSlot(seq % slots_, out) && out.seq == seq) return true;
+#endif
+    return false;
+  }
+
+ private:
+  LogRecord records_[Capacity];
+  uint32_t next_ = 1;
+
+#ifdef READING_LOG_FLASH
+  static const uint32_t RECORDS_PER_SECTOR = SPI_FLASH_SEC_SIZE / sizeof(LogRecord);
+  const esp_partition_t* part_ = nullptr;
+  uint32_t slots_ = 0;
+
+  bool readSlot(uint32_t slot, LogRecord& r) const {
+    if (esp_partition_read(part_, slot * sizeof(LogRecord), &r, sizeof(r)) != ESP_OK) return false;
+    return r.seq != 0 && r.seq != 0xFFFFFFFF && r.seq % slots_ == slot && r.len <= LOG_PAYLOAD_MAX;
+  }
+
+  // Ghi vào ô đầu sector thì xóa cả sector trước (mất RECORDS_PER_SECTOR bản cũ nhất)
+  void writeSlot(const LogRecord& r) {
+    uint32_t offset = (r.seq % slots_) * sizeof(LogRecord);
+    if (offset % SPI_FLASH_SEC_SIZE == 0) esp_partition_erase_range(part_, offset, SPI_FLASH_SEC_SIZE);
+    esp_partition_write(part_, offset, &r, sizeof(r));
+  }
+#endif
+};
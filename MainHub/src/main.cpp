@@ -6,6 +6,48 @@
  * - ATM Logic: Đã map đủ trường dữ liệu.
  * - Handshake: Lệnh helloMaster.
  * - End of Data Signal: Báo hiệu khi quét xong danh sách.
+ * - Pipeline Sweep: getDataNow chạy dạng máy trạng thái, nhiều GET song song
+ *   trên pipe 1..5, không chặn loop(). Hạn chót mỗi lượt tăng theo số node
+ *   online; node chưa kịp hỏi khi hết hạn được báo "unpolled", không phải offline.
+ * - Address Table: Master cấp địa chỉ pipe duy nhất khi REG, trả về trong REG_OK.
+ * - Push Mode: Node tự gửi dữ liệu theo chu kỳ vào PUSH_PIPE, Master luôn nghe
+ *   pipe 1 và chuyển tiếp ngay ra Serial (lệnh setPushInterval).
+ * - Binary Output: "setOutput bin" chuyển dữ liệu đo sang khung HubLink
+ *   (độ dài + CRC16), "setOutput json" quay lại JSON để debug.
+ * - Command Dispatcher: đọc lệnh không chặn vào bộ đệm cố định, tra bảng băm,
+ *   vòng lặp chính không dùng String/heap.
+ * - Adaptive Polling: mỗi node có RTT và tỉ lệ thành công riêng, timeout và số
+ *   lần gửi lại tính từ đó; node hỏng liên tục chỉ được thăm dò theo backoff mũ.
+ * - ACK Payload: GET gửi dạng "GETA"; node hỗ trợ nạp sẵn [addr][số đo] làm
+ *   payload của auto-ACK nên lần phát GET mang dữ liệu về luôn, không cần chờ
+ *   node phát lại và gửi OK. Node cũ vẫn trả lời theo 3 bước như trước.
+ * - Sleepy Nodes: "setSleep <id> <giây>" cho Soil Node ngủ giữa các lần thức.
+ *   Gói push lúc thức là mốc lịch: lượt quét bỏ qua node ngủ (chỉ báo offline
+ *   khi lỡ lịch), cấu hình cho node ngủ được xếp hàng tới cửa sổ nghe kế tiếp.
+ * - Reading Log: mọi bản đo được đánh số seq và giữ trong vòng đệm RAM (tùy
+ *   chọn Flash), "dumpSince <seq>" phát lại phần host bỏ lỡ trong một lượt.
+ * - Compact Payload: node gửi số đo dạng số nguyên có byte schema
+ *   (Shared/NodeProtocol), Master vẫn nhận struct float của node cũ.
+ * - Delta Report: "setReport <id> <heartbeat> [deadband...]" chỉ chuyển ra
+ *   Serial các trường đổi quá deadband ("delta":true), đủ trường mỗi heartbeat
+ *   giây. Node cũng nhận cấu hình (gói RPT) và chỉ gửi [addr] khi không đổi.
+ * - Batch: "setSampleInterval <id> <giây>" cho node tự lấy mẫu và xếp hàng giữa
+ *   hai lần hỏi (gói BAT). Node gửi nhiều mẫu có tuổi trong một khung; khung có
+ *   BATCH_MORE thì Master gửi GETA tiếp ngay trong lượt quét. Mẫu vào nhật ký
+ *   theo thời điểm lấy mẫu, cả lô được in một lần khi nhận khung cuối.
+ * - Relay: "setRoute <id> <relay id>" cho node ngoài tầm Master đi qua một ATM
+ *   Node (gói RTE). Relay tự hỏi node con và gửi số đo có tuổi trong khung relay
+ *   khi được hỏi/push; cấu hình tới node con được bọc gói FWD qua từng relay.
+ * - Channel: Master cộng số lần phát lại (ARC) của các GET có ACK; "setChannel
+ *   auto" thì khi trung bình quá ngưỡng Master đo RPD các kênh trong
+ *   nodeproto::CHANNELS và chuyển cả mạng sang kênh ít nhiễu nhất bằng gói CHN
+ *   phát chung. "scanChannels" chỉ đo, "setChannel <kênh>" chuyển tay. Node lỡ
+ *   gói CHN được báo lại trên kênh cũ khi quét, node push/ngủ tự dò kênh.
+ * - Link Rate: mỗi node hỏi trực tiếp có tốc độ và mức PA riêng. Sau mỗi
+ *   LINK_EVAL_WRITES lần gửi GET, Master xem tỉ lệ mất và ARC: liên kết sạch
+ *   thì lên 1M/2M (gói LNK) rồi hạ dần PA, liên kết xấu thì tăng PA hoặc lùi
+ *   tốc độ. Master luôn nghe ở 250kbps, node luôn tự phát ở 250kbps; node quá
+ *   lease không có GET tự về 250kbps, GET không ACK thì lần gửi chẵn hỏi ở 250kbps.
  */
 
 #include <Arduino.h>
@@ -13,7 +55,13 @@
 #include <RF24.h>
 #include <Preferences.h>
 #include <ArduinoJson.h>
+#include <HubLink.h>
+#include <NodeProtocol.h>
 #include <vector>
+#include "LineReader.h"
+#include "CommandTable.h"
+#include "ReadingLog.h"
+#include "DeviceStore.h"
 
 const String Version = "FW_V1.2"; // Phiên bản Firmware
 
@@ -24,41 +72,257 @@ const String Version = "FW_V1.2"; // Phiên bản Firmware
 
 RF24 radio(PIN_CE, PIN_CSN);
 const uint64_t REGISTER_PIPE = 0xF0F0F0F0E1LL; 
+const uint64_t REGISTER_REPLY_PIPE = 0xF0F0F0F0D2LL; // Node nghe REG_OK tại đây
+const uint64_t PUSH_PIPE = 0xF0F0F0F0C3LL;           // Node ở Push Mode gửi dữ liệu tại đây
+
+// Phân bổ pipe nhận: 0 = Auto-ACK khi phát, 1 = PUSH_PIPE (luôn mở),
+// 2 = REGISTER_PIPE khi đang đăng ký, 2..5 = các slot khi quét
+#define PUSH_RX_PIPE      1
+#define REGISTER_RX_PIPE  2
 const uint64_t BASE_ADDR_PREFIX = 0xF0F0F0F000LL; 
 
+// Byte thấp địa chỉ node, các pipe 2..5 chỉ khác pipe 1 ở byte này
+#define NO_NODE      0xFF
+#define MAX_NODES    240
+#define DEVICE_LAYOUT 3   // Layout cũ "nodeN": 2 có trường addr, 3 có wakePeriod (chỉ còn đọc để chuyển sang DeviceStore)
+
+#define CMD_LINE_MAX  64  // Lệnh dài nhất: "setReport <id 10 ký tự> <65535> + 6 x <65535>"
+
+#define READING_LOG_SIZE  512  // Số bản đo giữ trong RAM (32 byte mỗi bản)
+#define SERIAL_TX_BUFFER  1024
+#define DUMP_MIN_TX_SPACE 256  // Byte trống tối thiểu trong bộ đệm TX, đủ cho dòng JSON ATM dài nhất
+
 enum NodeType { UNKNOWN = 0, SOIL_NODE = 1, ATM_NODE = 2 };
 
-struct NodeDevice {
+// Phần đầu của node, đúng bằng bản ghi "nodeN" 20 byte của layout cũ. Flash giờ lưu StoredDevice.
+struct NodeRecord {
   char id[11];
   NodeType type;
   bool isOnline;
+  uint8_t addr;     // Byte thấp địa chỉ pipe do Master cấp
+  uint16_t wakePeriod; // Giây giữa hai lần node thức, 0 = luôn nghe (nằm trong byte đệm cũ)
 };
 
-// Ép kiểu packed để đảm bảo size đồng nhất
-struct __attribute__((packed)) SoilData {
-  float moisture;
-  float temperature;
+static_assert(sizeof(NodeRecord) == 20, "Bản ghi \"nodeN\" của layout cũ dài 20 byte");
+
+// Thống kê liên kết lúc chạy (không lưu), dùng để tính timeout và số lần gửi lại
+struct LinkStats {
+  uint16_t srtt8;           // RTT trung bình (ms) x8, 0 = chưa có mẫu
+  uint16_t rttvar4;         // Độ lệch RTT (ms) x4
+  uint8_t okRate;           // Tỉ lệ một lần gửi GET có dữ liệu về, 0..255
+  uint8_t samples;          // Số lần gửi đã ghi nhận (bão hòa ở 255)
+  uint8_t failStreak;       // Số lượt quét thất bại liên tiếp
+  bool ackReply;            // Lần trả lời gần nhất nằm trong ACK payload, node sẽ không gửi dữ liệu riêng
+  unsigned long nextProbe;  // Thời điểm được thăm dò lại khi node đã "chết"
+  uint8_t rate;             // nodeproto::LinkRate node đang nghe, 0 = RATE_BASE
+  uint8_t paBoost;          // PA của Master khi gửi cho node: RF24_PA_LOW + paBoost
+  uint8_t paFloor;          // paBoost thấp nhất từng đủ ở tốc độ hiện tại
+  uint8_t holdShift;        // Số lần lên tốc độ bị lùi lại, giãn thời gian chờ lên lại
+  bool missed;              // GET gần nhất ở tốc độ đã chọn không có ACK
+  uint8_t tuneWrites;       // Lần gửi GET ở tốc độ hiện tại từ lần đánh giá trước
+  uint8_t tuneFails;        // Trong đó không có ACK
+  uint16_t tuneRetries;     // Tổng ARC của các lần có ACK
+  unsigned long heardAt;    // GET có ACK gần nhất ở tốc độ đã chọn (gia hạn lease của node)
+  unsigned long promoteAt;  // Chưa được lên tốc độ trước thời điểm này
 };
 
-struct __attribute__((packed)) AtmData {
-  float air_temp;
-  float air_humid;
-  uint8_t rain;
-  float wind;
-  float light;
-  float pressure;
+#define PENDING_PUSH   0x01
+#define PENDING_SLEEP  0x02
+#define PENDING_REPORT 0x04
+#define PENDING_SAMPLE 0x08
+
+// Lọc bản đo theo deadband, lưu trong StoredDevice (layout cũ: key "rptN" riêng)
+struct ReportConfig {
+  uint16_t heartbeat;                    // Giây giữa hai bản đủ trường, 0 = chuyển mọi bản đo
+  uint16_t deadband[nodeproto::DEADBAND_FIELDS];  // Phần mười đơn vị JSON, theo thứ tự trường; gió giật dùng của gió
 };
 
+struct NodeDevice : NodeRecord {
+  LinkStats link;
+  unsigned long lastWake;   // millis() lần cuối nhận gói push (mốc lịch của node ngủ)
+  uint8_t pending;          // PENDING_*: cấu hình chờ cửa sổ nghe kế tiếp của node ngủ
+  uint16_t pendingPush, pendingSleep, pendingSample;
+  ReportConfig report, pendingReport;
+  int32_t reported[nodeproto::FIELDS_MAX];  // Giá trị thô từng trường đã chuyển ra Serial gần nhất
+  unsigned long keyframeAt;           // millis() bản đủ trường gần nhất
+  bool keyframed;                     // Đã có bản đủ trường từ khi bật lọc
+  bool hasLatest;
+  int32_t latest[nodeproto::FIELDS_MAX];  // Bản đo đủ gần nhất, phát lại khi node chỉ báo "không đổi"
+  uint32_t batchFrom;       // seq đầu tiên của lô đang nhận dở, 0 = không có
+  unsigned long batchAt;    // millis() lúc nhận khung batch gần nhất
+  uint8_t via;              // addr relay hỏi thay Master, NO_NODE = Master hỏi trực tiếp
+  uint8_t channel;          // Kênh lần cuối nghe được node, khác kênh làm việc = node có thể chưa đổi kênh
+};
+
+// Struct float của FW cũ, vẫn là định dạng của nhật ký và khung HubLink ra host.
+// Node mới gửi payload số nguyên có byte schema (NodeProtocol.h).
+using nodeproto::SoilData;
+using nodeproto::AtmData;
+using nodeproto::AtmDataV2;
+using nodeproto::ChannelPacket;
+using nodeproto::LinkPacket;
+
 struct __attribute__((packed)) RegisterPacket {
   char cmd[4]; 
   char id[11];
 };
 
+// Push Mode: [addr][payload số đo], addr để Master tra bảng nodeByAddr
+struct __attribute__((packed)) PushHeader {
+  uint8_t addr;
+};
+
+struct __attribute__((packed)) ConfigPacket {
+  char cmd[4];            // "CFG"
+  uint16_t pushInterval;  // Giây, 0 = chỉ trả lời khi Master hỏi
+};
+
+struct __attribute__((packed)) SleepPacket {
+  char cmd[4];            // "SLP"
+  uint16_t wakePeriod;    // Giây, 0 = node luôn nghe
+};
+
+struct __attribute__((packed)) ReportPacket {
+  char cmd[4];                           // "RPT"
+  uint16_t heartbeat;                    // Giây, 0 = node luôn gửi đủ số đo
+  uint16_t deadband[nodeproto::DEADBAND_FIELDS];  // Như ReportConfig, node chỉ dùng số trường của mình
+};
+
+struct __attribute__((packed)) SamplePacket {
+  char cmd[4];              // "BAT"
+  uint16_t sampleInterval;  // Giây, 0 = node không xếp hàng mẫu
+};
+
+struct __attribute__((packed)) RoutePacket {
+  char cmd[4];      // "RTE"
+  uint8_t child;    // addr node con
+  uint8_t add;      // 1 = relay bắt đầu hỏi node con, 0 = thôi hỏi
+};
+
+// Gói cấu hình cho node qua relay: [FWD][addr chặng kế][gói gốc], bọc một lần mỗi relay
+struct __attribute__((packed)) ForwardHeader {
+  char cmd[4];      // "FWD"
+  uint8_t addr;
+};
+
+struct __attribute__((packed)) RegisterAck {
+  char cmd[7];      // "REG_OK"
+  char id[11];      // Node so khớp ID trước khi nhận địa chỉ
+  uint8_t addr;
+};
+
 enum SystemState { STATE_IDLE, STATE_REGISTERING, STATE_RESET_PENDING };
+enum OutputMode { OUTPUT_JSON, OUTPUT_BINARY };
+
+// --- CẤU HÌNH QUÉT DỮ LIỆU ---
+// Mỗi pipe 2..5 giữ một node đang chờ trả lời
+#define POLL_FIRST_PIPE     2
+#define POLL_SLOTS          4
+#define POLL_MAX_ATTEMPTS   5     // Số lần gửi GET tối đa cho mỗi node
+#define POLL_REPLY_TIMEOUT  500   // ms chờ dữ liệu sau khi GET được ACK (trần)
+#define POLL_MIN_TIMEOUT    80    // ms, sàn cho timeout: node gửi lại dữ liệu tới 15 lần cách 4ms
+#define POLL_RETRY_GAP      20    // ms giãn cách trước khi gửi lại GET
+#define RADIO_ARD           5     // setRetries: chờ ACK (ARD+1)*250us mỗi lần phát
+#define RADIO_ARC           15    // setRetries: số lần phát lại khi không có ACK
+#define WRITE_FAIL_MS       ((RADIO_ARC + 1) * (RADIO_ARD + 1) / 4)  // radio.write() không ACK chặn loop() ~24ms
+#define BATCH_FRAME_GAP     3     // ms cho node nạp khung batch kế tiếp vào ACK payload
+#define BATCH_HOLD_MS       1000  // Lô dở dang (mất khung cuối) được in sau khoảng này
+#define PROBE_AFTER_FAILS   3     // Số lượt quét hỏng liên tiếp trước khi chuyển sang thăm dò
+#define PROBE_BASE_MS       30000UL
+#define PROBE_MAX_MS        1800000UL
+#define WAKE_GRACE_MS       5000UL  // Node ngủ bị coi là offline khi lỡ 2 lần thức + khoảng này
+#define ROUTE_MAX_RELAYS    2       // Gói lớn nhất (RPT 18 byte) + 2 header FWD vừa 32 byte
+#ifndef SWEEP_DEADLINE_MS
+#define SWEEP_DEADLINE_MS   5000  // Sàn của hạn chót cả lượt quét, cộng thêm phần của từng node (sweepBudget)
+#endif
+
+// --- KÊNH RADIO ---
+#define CHANNEL_MIN_WRITES   32       // Số GET có ACK tối thiểu trước khi đánh giá kênh
+#define CHANNEL_BAD_RETRIES  24       // Phát lại trung bình x16 (1.5 lần mỗi GET) coi là kênh nhiễu
+#define CHANNEL_HOLD_MS      600000UL // Không tự đổi kênh lại trong 10 phút
+#define CHANNEL_ANNOUNCES    4        // Số lần phát chung gói CHN, node đang bận phát có thể lỡ một lần
+#define CHANNEL_ANNOUNCE_GAP 50       // ms giữa hai lần phát CHN
+#define SCAN_SAMPLES         64       // Mẫu RPD mỗi kênh
+#define SCAN_DWELL_US        200      // RPD cần nghe tối thiểu 170us
+
+// --- TỐC ĐỘ LIÊN KẾT ---
+#define LINK_EVAL_WRITES     16       // Số lần gửi GET giữa hai lần đánh giá một liên kết
+#define LINK_BAD_RETRIES     24       // ARC trung bình x16 từ đây (hoặc >= 25% mất) là liên kết xấu
+#define LINK_GOOD_RETRIES    2        // ARC trung bình x16 tới đây và không mất là liên kết sạch
+#define LINK_PA_STEPS        2        // paBoost tối đa: RF24_PA_LOW + 2 = RF24_PA_MAX
+#define LINK_HOLD_MS         60000UL  // Chờ trước khi thử lại tốc độ vừa bị lùi, nhân đôi mỗi lần
+#define LINK_HOLD_MAX_SHIFT  5
+#define LINK_LEASE_S         300      // Node không nhận GET quá lâu thì tự về RATE_BASE
+#define LINK_LEASE_GRACE_MS  10000UL
+
+enum SlotState : uint8_t { SLOT_FREE, SLOT_SEND, SLOT_WAIT, SLOT_ACK };
+
+struct PollSlot {
+  SlotState state;
+  uint16_t device;        // Chỉ số trong devices
+  uint8_t attempts;       // Số lần đã gửi GET
+  unsigned long stamp;    // SEND: thời điểm được gửi; WAIT: thời điểm GET được ACK
+};
+
+// Tiến trình lệnh dumpSince, mỗi vòng loop() chỉ xuất phần vừa bộ đệm TX
+struct DumpState {
+  bool active;
+  uint32_t next;          // seq kế tiếp cần xuất
+  uint32_t end;           // seq dừng (không gồm), chốt lúc nhận lệnh
+};
+
+// Chất lượng kênh làm việc đo trong lúc quét. Kênh và chế độ tự đổi lưu ở namespace "radio"
+// để deleteAllNode (xóa namespace "nodes") không đưa Master về kênh mặc định.
+struct ChannelState {
+  uint8_t current;
+  bool autoMove;            // "setChannel auto"
+  uint16_t writes;          // GET có ACK từ lần đánh giá trước
+  uint32_t retries;         // Tổng ARC của các GET đó
+  unsigned long movedAt;
+};
+
+// Đo RPD từng kênh, mỗi vòng loop() một kênh rồi quay về kênh làm việc
+struct ScanState {
+  bool active;
+  bool move;                // Quét do kênh nhiễu: đổi kênh khi đo xong
+  uint8_t next;             // Chỉ số kế tiếp trong nodeproto::CHANNELS
+  uint8_t busy[nodeproto::CHANNEL_COUNT];  // % mẫu có sóng
+};
+
+// Phát chung CHN trên kênh cũ, mỗi vòng loop() nhiều nhất một gói, giữa hai gói vẫn nghe push
+struct MoveState {
+  bool active;
+  uint8_t channel;          // Kênh mới
+  uint8_t rates;            // Bit các tốc độ đang có node nghe
+  uint8_t rate;             // Tốc độ đang phát
+  uint8_t sent;             // Số gói đã phát ở tốc độ này
+  unsigned long sentAt;
+};
+
+struct SweepState {
+  bool active;
+  bool queued;            // getDataNow tới lúc đang phát CHN, bắt đầu ngay khi đổi kênh xong
+  uint16_t next;          // Node kế tiếp chưa được nạp vào slot
+  unsigned long startedAt;
+  unsigned long deadline; // ms tính từ startedAt
+  PollSlot slots[POLL_SLOTS];
+};
 
 SystemState currentState = STATE_IDLE;
+OutputMode outputMode = OUTPUT_JSON;
 std::vector<NodeDevice> devices;
+uint8_t nodeByAddr[256];  // addr -> chỉ số trong devices, NO_NODE nếu trống
 Preferences preferences;
+DeviceStore deviceStore(preferences, "nodes");
+SweepState sweep;
+DumpState dump;
+ChannelState channelState;
+ScanState scan;
+MoveState channelMove;
+ReadingLog<READING_LOG_SIZE> readingLog;
+uint16_t openBatches = 0;  // Số node có lô đang nhận dở
+LineReader<CMD_LINE_MAX> cmdReader;
+CommandTable<32> commands;
 
 unsigned long btnPressTime = 0;
 bool lastBtnState = HIGH;
@@ -69,16 +333,80 @@ bool ledState = LOW;
 
 void loadDevices();
 void saveDevices();
+void saveDevice(const NodeDevice& device);
+void forgetDevice(const char* id);
 void clearDevices();
 void processSerialCommand();
 void handleButton();
 void handleLed();
 void enterRegisterMode();
 void exitRegisterMode();
-void handleRegistration();
-uint64_t generateNodeAddress(const char* id);
+void handleRegistration(const uint8_t* buf, uint8_t size);
+void serviceRadio();
+void handlePush(const uint8_t* buf, uint8_t size);
+void configurePush(char* args);
+void configureSleep(char* args);
+void configureReport(char* args);
+void configureSample(char* args);
+void configureRoute(char* args);
+void configureChannel(char* args);
+void cmdScanChannels(char*);
+void loadChannel();
+void saveChannel();
+void startScan(bool move);
+void scanStep();
+void checkChannel();
+void moveChannel(uint8_t channel);
+void moveStep();
+bool catchUpDue(const NodeDevice& device, unsigned long now);
+bool catchUpChannel(NodeDevice& device);
+void useRate(uint8_t rate, uint8_t boost);
+void useBaseRate();
+bool isTunable(const NodeDevice& device);
+uint8_t pollRate(NodeDevice& device, uint8_t attempt, unsigned long now);
+void recordLink(NodeDevice& device, uint8_t rate, bool acked, uint8_t arc, unsigned long now);
+void tuneLink(NodeDevice& device, unsigned long now);
+bool sendLink(const NodeDevice& device, uint8_t rate, uint8_t boost);
+bool isSleeping(const NodeDevice& device);
+bool missedWake(const NodeDevice& device, unsigned long now);
+void deliverPending(NodeDevice& device);
+bool isRouted(const NodeDevice& device);
+NodeDevice* relayOf(const NodeDevice& device);
+bool routedVia(const NodeDevice& device, const NodeDevice& relay);
+bool sendRoute(const NodeDevice& relay, uint8_t child, bool add);
+bool reachedIndirectly(const NodeDevice& device, unsigned long now);
+void registerCommands();
+NodeDevice* findDevice(const char* id);
+uint8_t legacyAddress(const char* id);
+uint64_t nodeAddress(const NodeDevice& device);
+void rebuildAddressTable();
+bool allocateAddress(const char* id, uint8_t& addr);
+uint8_t attemptBudget(const NodeDevice& device);
+unsigned long replyTimeout(const NodeDevice& device, uint8_t attempts);
+void recordAttempt(NodeDevice& device, bool ok);
+void recordSweep(NodeDevice& device, bool ok, unsigned long now);
+void startSweep();
+void pollStep();
+void takeAckReading(uint8_t i);
+void handleSweepPacket(uint8_t pipe, const uint8_t* buf, uint8_t size, unsigned long now);
+void finishSweep();
+bool emitReading(NodeDevice& device, const uint8_t* buf, uint8_t size);
+void emitUnchanged(NodeDevice& device);
+bool collectRelay(NodeDevice& relay, const uint8_t* buf, uint8_t size);
+void flushBatch(NodeDevice& device);
+void flushStaleBatches();
+void reportOffline(const NodeDevice& device);
+void reportUnpolled(const NodeDevice& device);
+void reportSweepDone(uint16_t unpolled = 0);
+void writeReading(const NodeDevice& device, const LogRecord& record, uint8_t frameType, uint8_t fields = 0xFF);
+void writeBatch(const NodeDevice& device, uint32_t from, uint32_t end);
+uint8_t fillSensors(JsonObject sensors, const LogRecord& record, uint8_t fields);
+void serviceDump();
 
 void setup() {
+#ifdef ESP32
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER);  // Mặc định chỉ có FIFO 128 byte, dump sẽ chặn loop()
+#endif
   Serial.begin(115200);
   pinMode(PIN_LED, OUTPUT);
   pinMode(PIN_BTN, INPUT_PULLUP);
@@ -91,13 +419,18 @@ void setup() {
   
   radio.setPALevel(RF24_PA_LOW); 
   radio.setDataRate(RF24_250KBPS);
-  radio.setRetries(5, 15);
+  radio.setRetries(RADIO_ARD, RADIO_ARC);
   radio.enableDynamicPayloads();
+  radio.enableAckPayload(); // Nhận số đo trong ACK của GET, ACK của Master vẫn rỗng
+  radio.enableDynamicAck(); // Gói CHN phát chung không chờ ACK
+  loadChannel();
   
-  radio.openReadingPipe(1, REGISTER_PIPE);
+  radio.openReadingPipe(PUSH_RX_PIPE, PUSH_PIPE);
   radio.startListening();
 
+  registerCommands();
   loadDevices();
+  readingLog.begin();
   Serial.println("{\"status\":\"system_ready\"}");
 }
 
@@ -106,16 +439,47 @@ void loop() {
   handleButton();
   handleLed();
 
-  if (currentState == STATE_REGISTERING) {
-    handleRegistration();
-  }
+  if (sweep.active) pollStep();
+  else serviceRadio();
+  if (scan.active && !sweep.active && currentState == STATE_IDLE) scanStep();
+  if (channelMove.active && !sweep.active && currentState == STATE_IDLE) moveStep();
+
+  if (dump.active) serviceDump();
+  if (openBatches) flushStaleBatches();
 }
 
-uint64_t generateNodeAddress(const char* str) {
+// Hash DJB2 cũ, chỉ còn dùng để chuyển đổi node đăng ký từ FW cũ
+uint8_t legacyAddress(const char* str) {
     unsigned long hash = 5381;
     int c;
     while ((c = *str++)) hash = ((hash << 5) + hash) + c;
-    return BASE_ADDR_PREFIX | (hash & 0xFF); 
+    return hash & 0xFF; 
+}
+
+uint64_t nodeAddress(const NodeDevice& device) {
+  return BASE_ADDR_PREFIX | device.addr;
+}
+
+bool isReservedAddress(uint8_t addr) {
+  return addr == NO_NODE || addr == (uint8_t)REGISTER_PIPE || addr == (uint8_t)REGISTER_REPLY_PIPE ||
+         addr == (uint8_t)PUSH_PIPE || addr == (uint8_t)nodeproto::CHANNEL_PIPE;
+}
+
+void rebuildAddressTable() {
+  memset(nodeByAddr, NO_NODE, sizeof(nodeByAddr));
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (nodeByAddr[devices[i].addr] == NO_NODE) nodeByAddr[devices[i].addr] = i;
+  }
+}
+
+// Ưu tiên byte hash cũ nếu còn trống, không thì dò tuyến tính tới ô trống kế tiếp
+bool allocateAddress(const char* id, uint8_t& addr) {
+  if (devices.size() >= MAX_NODES) return false;
+  uint8_t candidate = legacyAddress(id);
+  for (int n = 0; n < 256; n++, candidate++) {
+    if (!isReservedAddress(candidate) && nodeByAddr[candidate] == NO_NODE) { addr = candidate; return true; }
+  }
+  return false;
 }
 
 void handleButton() {
@@ -127,6 +491,7 @@ void handleButton() {
   }
 
   bool reading = digitalRead(PIN_BTN);
+  if (sweep.active) { lastBtnState = reading; return; } // Bỏ qua nút khi radio đang quét
   if (reading == LOW && lastBtnState == HIGH) btnPressTime = millis();
 
   if (reading == HIGH && lastBtnState == LOW) {
@@ -177,230 +542,1583 @@ void handleLed() {
 }
 
 void processSerialCommand() {
-  if (Serial.available()) {
-    String cmd = Serial.readStringUntil('\n');
-    cmd.trim();
-    if (cmd.length() == 0) return;
-
-    // --- LỆNH HANDSHAKE ---
-    if (cmd == "helloMaster") {
-        Serial.println("Hi!"); 
-        Serial.println(Version);
+  switch (cmdReader.poll(Serial)) {
+    case LineReader<CMD_LINE_MAX>::LINE:
+      commands.dispatch(cmdReader.line()); // Lệnh lạ bỏ qua như trước
+      break;
+    case LineReader<CMD_LINE_MAX>::OVERFLOW:
+      Serial.println("{\"error\":\"line_too_long\"}");
+      break;
+    default:
+      break;
+  }
+}
+
+// --- CÁC LỆNH SERIAL ---
+
+// --- LỆNH HANDSHAKE ---
+void cmdHello(char*) {
+  Serial.println("Hi!"); 
+  Serial.println(Version);
+}
+
+void cmdListDevices(char*) {
+  JsonDocument doc;
+  JsonArray arr = doc.to<JsonArray>();
+  for (const auto& device : devices) {
+    JsonObject obj = arr.add<JsonObject>();
+    obj["id"] = device.id;
+    obj["type"] = (device.type == SOIL_NODE) ? "soil" : "atm";
+    obj["status"] = device.isOnline ? "online" : "offline";
+    obj["addr"] = device.addr;
+    if (device.link.samples) {
+      obj["rtt"] = device.link.srtt8 >> 3;                       // ms
+      obj["success"] = (device.link.okRate * 100 + 127) / 255;   // % mỗi lần gửi GET
     }
-    else if (cmd == "getListDevice") {
-      JsonDocument doc;
-      JsonArray arr = doc.to<JsonArray>();
-      for (const auto& device : devices) {
-        JsonObject obj = arr.add<JsonObject>();
-        obj["id"] = device.id;
-        obj["type"] = (device.type == SOIL_NODE) ? "soil" : "atm";
-        obj["status"] = device.isOnline ? "online" : "offline";
-      }
-      serializeJson(doc, Serial); Serial.println();
+    if (device.report.heartbeat) obj["heartbeat"] = device.report.heartbeat;
+    if (isSleeping(device)) {
+      obj["sleep"] = device.wakePeriod;
+      unsigned long next = device.lastWake + device.wakePeriod * 1000UL;
+      obj["next_wake"] = (long)(next - millis()) > 0 ? (next - millis()) / 1000 : 0;  // s, ước lượng
+      if (device.pending) obj["pending"] = true;
     }
-    else if (cmd == "getDataNow") {
-      if (devices.empty()) {
-        Serial.println("{\"error\":\"no_devices\"}"); 
-        Serial.println("{\"event\":\"data_collection_finished\"}"); // Vẫn báo finish để app biết đường tắt loading
-        return;
-      }
+    if (NodeDevice* relay = relayOf(device)) obj["via"] = relay->id;
+    if (device.channel != channelState.current) obj["channel"] = device.channel;
+    if (device.link.rate != nodeproto::RATE_BASE) obj["kbps"] = nodeproto::rateKbps(device.link.rate);
+  }
+  serializeJson(doc, Serial); Serial.println();
+}
+
+void cmdGetData(char*) {
+  if (devices.empty()) {
+    Serial.println("{\"error\":\"no_devices\"}"); 
+    reportSweepDone(); // Vẫn báo finish để app biết đường tắt loading
+    return;
+  }
+  if (sweep.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  if (channelMove.active) { sweep.queued = true; return; }  // Node có thể đã sang kênh mới
+  startSweep();
+}
+
+void cmdDeleteAll(char*) { clearDevices(); }
+
+void cmdDeleteNode(char* id) {
+  NodeDevice* device = findDevice(id);
+  if (!device) return;
+  if (sweep.active) finishSweep(); // Chỉ số trong slot sẽ sai sau khi xóa
+  if (device->batchFrom) openBatches--;
+  if (NodeDevice* relay = relayOf(*device)) sendRoute(*relay, device->addr, false); // Relay thôi hỏi node đã xóa
+  for (auto& d : devices) {
+    if (d.via == device->addr) { d.via = NO_NODE; saveDevice(d); } // Node con của relay bị xóa quay về hỏi trực tiếp
+  }
+  devices.erase(devices.begin() + (device - devices.data()));
+  rebuildAddressTable();
+  forgetDevice(id);
+  Serial.print("{\"event\":\"deleted\",\"id\":\""); Serial.print(id); Serial.println("\"}");
+}
+
+void cmdSetOutput(char* mode) {
+  if (strcmp(mode, "bin") == 0) outputMode = OUTPUT_BINARY;
+  else if (strcmp(mode, "json") == 0) outputMode = OUTPUT_JSON;
+  else return;
+  Serial.print("{\"event\":\"output_mode\",\"mode\":\""); Serial.print(mode); Serial.println("\"}");
+}
+
+void cmdRegister(char*) { enterRegisterMode(); }
+
+void cmdCancelRegister(char*) { exitRegisterMode(); Serial.println("{\"event\":\"register_cancelled\"}"); }
+
+void cmdDumpSince(char* args) {
+  uint32_t from = strtoul(args, nullptr, 10);
+  if (from < readingLog.first()) from = readingLog.first();
+  dump.active = true;
+  dump.next = from;
+  dump.end = readingLog.next();
+  Serial.print("{\"event\":\"dump_begin\",\"from\":"); Serial.print(from);
+  Serial.print(",\"to\":"); Serial.print(dump.end);
+  Serial.print(",\"now\":"); Serial.print(millis()); Serial.println("}");
+}
+
+void cmdLogInfo(char*) {
+  Serial.print("{\"event\":\"log_info\",\"first\":"); Serial.print(readingLog.first());
+  Serial.print(",\"next\":"); Serial.print(readingLog.next());
+  Serial.print(",\"capacity\":"); Serial.print(READING_LOG_SIZE); Serial.println("}");
+}
+
+void registerCommands() {
+  commands.add("helloMaster", cmdHello);
+  commands.add("getListDevice", cmdListDevices);
+  commands.add("getDataNow", cmdGetData);
+  commands.add("deleteAllNode", cmdDeleteAll);
+  commands.add("deleteNode", cmdDeleteNode);
+  commands.add("setPushInterval", configurePush);
+  commands.add("setSleep", configureSleep);
+  commands.add("setReport", configureReport);
+  commands.add("setSampleInterval", configureSample);
+  commands.add("setRoute", configureRoute);
+  commands.add("setChannel", configureChannel);
+  commands.add("scanChannels", cmdScanChannels);
+  commands.add("setOutput", cmdSetOutput);
+  commands.add("registerNewNode", cmdRegister);
+  commands.add("cancelRegister", cmdCancelRegister);
+  commands.add("dumpSince", cmdDumpSince);
+  commands.add("logInfo", cmdLogInfo);
+}
+
+NodeDevice* findDevice(const char* id) {
+  for (auto& d : devices) { if (strncmp(d.id, id, sizeof(d.id)) == 0) return &d; }
+  return nullptr;
+}
+
+// --- BỘ MÁY QUÉT KHÔNG CHẶN ---
+// Mỗi lần gọi pollStep() chỉ thực hiện tối đa một giao dịch phát rồi trả về loop().
+
+// Hết hạn lượt quét khi node còn chờ gửi lại/trả lời: chưa biết online hay không
+void abandonSlot(uint8_t i) {
+  PollSlot& s = sweep.slots[i];
+  NodeDevice& device = devices[s.device];
+  flushBatch(device);
+  reportUnpolled(device);
+  radio.closeReadingPipe(POLL_FIRST_PIPE + i);
+  s.state = SLOT_FREE;
+}
+
+void releaseSlot(uint8_t i, bool success) {
+  PollSlot& s = sweep.slots[i];
+  NodeDevice& device = devices[s.device];
+  device.isOnline = success;
+  flushBatch(device); // Hết lượt giữa lô thì in phần đã nhận
+  if (!success) {
+    reportOffline(device);
+  }
+  radio.closeReadingPipe(POLL_FIRST_PIPE + i);
+  s.state = SLOT_FREE;
+}
+
+void failAttempt(uint8_t i, unsigned long now) {
+  PollSlot& s = sweep.slots[i];
+  NodeDevice& device = devices[s.device];
+  recordAttempt(device, false);
+  if (s.attempts >= attemptBudget(device)) {
+    recordSweep(device, false, now);
+    releaseSlot(i, false);
+    return;
+  }
+  s.state = SLOT_SEND;
+  s.stamp = now + POLL_RETRY_GAP;
+}
+
+// --- THỐNG KÊ LIÊN KẾT ---
+
+bool isProbing(const NodeDevice& device) { return device.link.failStreak >= PROBE_AFTER_FAILS; }
+
+// Node Master hỏi trực tiếp sẽ được hỏi trong lượt quét lúc now (không đang chờ hạn thăm dò)
+bool pollDue(const NodeDevice& device, unsigned long now) {
+  return !isProbing(device) || (long)(now - device.link.nextProbe) >= 0;
+}
+
+// Số lần gửi GET để xác suất bỏ lỡ node còn dưới ~1% với tỉ lệ thành công đo được
+uint8_t attemptBudget(const NodeDevice& device) {
+  const LinkStats& l = device.link;
+  if (isProbing(device)) return 1;
+  if (l.samples < 4) return POLL_MAX_ATTEMPTS;
+  if (l.okRate >= 230) return 2;  // >= 90%
+  if (l.okRate >= 199) return 3;  // >= 78%
+  if (l.okRate >= 173) return 4;  // >= 68%
+  return POLL_MAX_ATTEMPTS;
+}
+
+// Timeout kiểu TCP (srtt + 4*rttvar), nhân đôi sau mỗi lần hụt
+unsigned long replyTimeout(const NodeDevice& device, uint8_t attempts) {
+  const LinkStats& l = device.link;
+  if (l.srtt8 == 0) return POLL_REPLY_TIMEOUT;
+  unsigned long rto = (l.srtt8 >> 3) + l.rttvar4;
+  if (rto < POLL_MIN_TIMEOUT) rto = POLL_MIN_TIMEOUT;
+  if (attempts > 1) rto <<= (attempts - 1);
+  return rto < POLL_REPLY_TIMEOUT ? rto : POLL_REPLY_TIMEOUT;
+}
+
+void recordRtt(NodeDevice& device, unsigned long rtt) {
+  LinkStats& l = device.link;
+  if (rtt > POLL_REPLY_TIMEOUT) rtt = POLL_REPLY_TIMEOUT;
+  if (l.srtt8 == 0) {
+    l.srtt8 = (rtt << 3) | 1;  // |1 để mẫu RTT = 0ms vẫn khác "chưa có mẫu"
+    l.rttvar4 = rtt << 1;
+    return;
+  }
+  int err = (int)rtt - (l.srtt8 >> 3);
+  l.srtt8 += err;
+  if (err < 0) err = -err;
+  l.rttvar4 += err - (l.rttvar4 >> 2);
+}
 
-      // Xóa buffer để tránh đọc phải gói tin rác/cũ
-      radio.stopListening();
-      radio.flush_rx(); 
-
-      for (auto& device : devices) {
-        uint64_t nodeAddr = generateNodeAddress(device.id);
-        
-        radio.stopListening();
-        radio.flush_rx();
-        radio.openWritingPipe(nodeAddr);
-        
-        bool success = false;
-        char req[] = "GET";
-        
-        delay(5); 
-
-        // Thử kết nối 5 lần
-        for (int i = 0; i < 5; i++) {
-          if (radio.write(&req, sizeof(req))) {
-            radio.openReadingPipe(1, nodeAddr);
-            radio.startListening();
-            
-            unsigned long startWait = millis();
-            bool timeout = false;
-            while (!radio.available()) {
-              if (millis() - startWait > 500) { timeout = true; break; }
-            }
-            
-            if (!timeout) {
-              uint8_t payloadSize = radio.getDynamicPayloadSize(); 
-              
-              JsonDocument doc;
-              JsonObject sensors = doc["sensors"].to<JsonObject>();
-              
-              if (device.type == SOIL_NODE) {
-                if (payloadSize == sizeof(SoilData)) {
-                    SoilData data;
-                    radio.read(&data, sizeof(data));
-                    sensors["soil_moisture"] = data.moisture;
-                    sensors["soil_temperature"] = data.temperature;
-                    success = true;
-                } else {
-                    char trash[32]; radio.read(&trash, payloadSize);
-                }
-              } else {
-                // --- LOGIC ATM ĐẦY ĐỦ ---
-                if (payloadSize == sizeof(AtmData)) {
-                    AtmData data;
-                    radio.read(&data, sizeof(data));
-                    sensors["air_temperature"] = data.air_temp;
-                    sensors["air_humidity"] = data.air_humid;
-                    sensors["rain_intensity"] = data.rain;
-                    sensors["wind_speed"] = data.wind;
-                    sensors["light_intensity"] = data.light;
-                    sensors["barometric_pressure"] = data.pressure;
-                    success = true;
-                } else {
-                     char trash[32]; radio.read(&trash, payloadSize);
-                }
-              }
-              
-              if (success) {
-                  radio.stopListening();
-                  radio.openWritingPipe(nodeAddr);
-                  char ack[] = "OK";
-                  delay(10); 
-                  radio.write(&ack, sizeof(ack));
-                  
-                  // In dữ liệu của từng node ngay khi nhận được
-                  doc["id"] = device.id;
-                  serializeJson(doc, Serial); Serial.println();
-                  break; 
-              }
-            }
-          }
-          delay(20);
-        }
-        device.isOnline = success;
-        if(!success) {
-           Serial.print("{\"id\":\""); Serial.print(device.id); Serial.println("\",\"status\":\"offline\"}");
-        }
+void recordAttempt(NodeDevice& device, bool ok) {
+  LinkStats& l = device.link;
+  if (l.samples == 0) l.okRate = ok ? 255 : 0;
+  else l.okRate += ((ok ? 255 : 0) - (int)l.okRate) / 8;
+  if (l.samples < 255) l.samples++;
+}
+
+// Node hỏng nhiều lượt liên tiếp chỉ được hỏi lại sau 30s, 60s, ... tối đa 30 phút
+void recordSweep(NodeDevice& device, bool ok, unsigned long now) {
+  LinkStats& l = device.link;
+  if (ok) { l.failStreak = 0; device.channel = channelState.current; return; }
+  if (l.failStreak < 255) l.failStreak++;
+  if (!isProbing(device)) return;
+  uint8_t shift = l.failStreak - PROBE_AFTER_FAILS;
+  unsigned long wait = shift < 6 ? PROBE_BASE_MS << shift : PROBE_MAX_MS;
+  l.nextProbe = now + (wait < PROBE_MAX_MS ? wait : PROBE_MAX_MS);
+}
+
+void resetLink(NodeDevice& device) { memset(&device.link, 0, sizeof(device.link)); }
+
+// Hạn chót theo số node sẽ được hỏi: node online đủ số lần gửi với timeout (đã nhân đôi)
+// của chính nó, các slot chạy song song. Node offline sẽ được hỏi (chưa thăm dò, hoặc tới
+// hạn thăm dò) tốn WRITE_FAIL_MS mỗi GET không ACK, radio.write() chặn cả vòng quét nên
+// phần này không chia cho số slot.
+unsigned long sweepBudget(unsigned long now) {
+  unsigned long parallel = 0, blocking = 0;
+  for (const auto& device : devices) {
+    if (isSleeping(device) || isRouted(device) || !pollDue(device, now)) continue;
+    uint8_t attempts = attemptBudget(device);
+    if (device.isOnline) {
+      for (uint8_t a = 1; a <= attempts; a++) parallel += replyTimeout(device, a) + POLL_RETRY_GAP;
+    } else {
+      parallel += attempts * POLL_RETRY_GAP;
+      blocking += attempts * WRITE_FAIL_MS;
+    }
+  }
+  return SWEEP_DEADLINE_MS + parallel / POLL_SLOTS + blocking;
+}
+
+void startSweep() {
+  sweep.active = true;
+  sweep.next = 0;
+  sweep.startedAt = millis();
+  sweep.deadline = sweepBudget(sweep.startedAt);
+  for (auto& s : sweep.slots) s.state = SLOT_FREE;
+
+  radio.stopListening();
+  radio.setChannel(channelState.current); // Có thể đang ở CHANNEL_DEFAULT để đăng ký
+  for (auto& device : devices) {
+    if (device.channel != channelState.current && catchUpDue(device, sweep.startedAt)) catchUpChannel(device);
+  }
+
+  // Xóa buffer để tránh đọc phải gói tin rác/cũ
+  radio.stopListening();
+  radio.flush_rx();
+  radio.closeReadingPipe(REGISTER_RX_PIPE); // Dùng lại cho slot đầu tiên
+  radio.startListening();
+}
+
+void finishSweep() {
+  // Node còn dở dang hoặc chưa tới lượt khi hết hạn: báo "unpolled", giữ trạng thái online cũ
+  uint16_t unpolled = 0;
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    if (sweep.slots[i].state == SLOT_ACK) releaseSlot(i, true);
+    else if (sweep.slots[i].state != SLOT_FREE) { abandonSlot(i); unpolled++; }
+  }
+  while (sweep.next < devices.size()) {
+    NodeDevice& device = devices[sweep.next++];
+    if (reachedIndirectly(device, millis())) continue;
+    reportUnpolled(device);
+    unpolled++;
+  }
+  sweep.active = false;
+  unsigned long now = millis();
+  for (auto& device : devices) {
+    if (device.link.tuneWrites >= LINK_EVAL_WRITES) tuneLink(device, now);
+  }
+
+  // --- THÔNG BÁO HOÀN TẤT ---
+  reportSweepDone(unpolled);
+  checkChannel();
+
+  if (currentState == STATE_REGISTERING) {
+    radio.stopListening();
+    radio.setChannel(nodeproto::CHANNEL_DEFAULT);
+    radio.openReadingPipe(REGISTER_RX_PIPE, REGISTER_PIPE);
+    radio.startListening();
+  }
+}
+
+void sendGet(uint8_t i) {
+  PollSlot& s = sweep.slots[i];
+  NodeDevice& device = devices[s.device];
+  uint64_t nodeAddr = nodeAddress(device);
+  char req[] = "GETA"; // Node cũ chỉ so 3 ký tự đầu, 'A' báo Master nhận được ACK payload
+  // Chưa có bản đo đủ để phát lại (Master vừa khởi động) thì hỏi kiểu cũ: node luôn trả đủ trường
+  if (device.report.heartbeat && !device.hasLatest) req[3] = '\0';
+
+  radio.stopListening();
+  radio.openReadingPipe(POLL_FIRST_PIPE + i, nodeAddr); // Mở trước để không lỡ phản hồi nhanh
+  radio.openWritingPipe(nodeAddr);
+  s.attempts++;
+  uint8_t rate = pollRate(device, s.attempts, millis());
+  useRate(rate, device.link.paBoost);
+  bool acked = radio.write(&req, req[3] ? sizeof(req) : sizeof(req) - 1);
+  uint8_t arc = radio.getARC();
+  useBaseRate();
+  radio.startListening();
+  recordLink(device, rate, acked, arc, millis());
+
+  if (!acked) { failAttempt(i, millis()); return; }
+  // Chỉ GET có ACK: GET hỏng thường do node offline, không nói gì về nhiễu trên kênh
+  channelState.writes++;
+  channelState.retries += arc;
+  s.state = SLOT_WAIT; s.stamp = millis();
+  takeAckReading(i);
+
+  // ACK rỗng từ node đã trả lời bằng ACK: payload chưa kịp nạp lại hoặc GET bị coi là gói
+  // lặp (PID 2 bit), node không gửi dữ liệu riêng nên hỏi lại luôn thay vì chờ timeout
+  if (s.state == SLOT_WAIT && req[3] && device.link.ackReply) failAttempt(i, millis());
+}
+
+// ACK payload của GET nằm ở pipe 0 ngay khi write() trả về. Gói khác lọt vào FIFO
+// trong lúc phát được xử lý như ở bước 1 của pollStep(). Payload pipe 0 mang addr
+// của node khác là dư từ lần phát OK/CFG trước, bỏ đi. Payload chỉ có addr là
+// node báo số đo không đổi (đã cấu hình setReport).
+void takeAckReading(uint8_t i) {
+  PollSlot& s = sweep.slots[i];
+  uint8_t pipe;
+  while (radio.available(&pipe)) {
+    uint8_t buf[32];
+    uint8_t size = radio.getDynamicPayloadSize();
+    radio.read(&buf, size);
+    if (pipe != 0) { handleSweepPacket(pipe, buf, size, millis()); continue; }
+
+    NodeDevice& device = devices[s.device];
+    if (s.state != SLOT_WAIT || size < sizeof(PushHeader) || buf[0] != device.addr) continue;
+    if (size == sizeof(PushHeader)) {
+      if (!device.hasLatest) continue; // GET kiểu cũ: node sẽ gửi đủ số đo riêng
+      emitUnchanged(device);
+    } else if (!emitReading(device, buf + sizeof(PushHeader), size - sizeof(PushHeader))) {
+      continue;
+    }
+    recordAttempt(device, true);
+    recordSweep(device, true, millis());
+    device.link.ackReply = true;
+    if (device.batchFrom || nodeproto::isRelay(buf + sizeof(PushHeader), size - sizeof(PushHeader))) {
+      // Node còn mẫu (BATCH_MORE) hoặc relay vừa gửi số đo của node con (số đo của chính
+      // relay luôn theo sau): hỏi tiếp khung kế tiếp, mỗi khung có đủ số lần gửi
+      s.state = SLOT_SEND;
+      s.attempts = 0;
+      s.stamp = millis() + BATCH_FRAME_GAP;
+      continue;
+    }
+    releaseSlot(i, true); // Node không chờ OK khi đã trả lời bằng ACK
+  }
+}
+
+void sendOk(uint8_t i) {
+  recordSweep(devices[sweep.slots[i].device], true, millis());
+  char ack[] = "OK";
+  const NodeDevice& device = devices[sweep.slots[i].device];
+  radio.stopListening();
+  radio.openWritingPipe(nodeAddress(device));
+  useRate(device.link.rate, device.link.paBoost); // Node chờ OK ở tốc độ nó đang nghe
+  radio.write(&ack, sizeof(ack));
+  useBaseRate();
+  radio.startListening();
+  releaseSlot(i, true);
+}
+
+// Pipe 0 chỉ còn ACK payload dư, pipe 2..5 là node trả lời GET theo cách cũ
+void handleSweepPacket(uint8_t pipe, const uint8_t* buf, uint8_t size, unsigned long now) {
+  if (pipe == PUSH_RX_PIPE) { handlePush(buf, size); return; }
+  if (pipe < POLL_FIRST_PIPE || pipe >= POLL_FIRST_PIPE + POLL_SLOTS) return;
+
+  uint8_t i = pipe - POLL_FIRST_PIPE;
+  PollSlot& s = sweep.slots[i];
+  if (s.state != SLOT_WAIT) return;
+  NodeDevice& device = devices[s.device];
+  if (emitReading(device, buf, size)) {
+    recordAttempt(device, true);
+    recordRtt(device, now - s.stamp);
+    device.link.ackReply = false;
+    s.state = SLOT_ACK;
+  } else {
+    failAttempt(i, now); // Sai kích thước gói
+  }
+}
+
+void pollStep() {
+  unsigned long now = millis();
+  if (now - sweep.startedAt > sweep.deadline) { finishSweep(); return; }
+
+  // 1. Gom phản hồi, pipe cho biết slot nào
+  uint8_t pipe;
+  while (radio.available(&pipe)) {
+    uint8_t buf[32];
+    uint8_t size = radio.getDynamicPayloadSize();
+    radio.read(&buf, size);
+    handleSweepPacket(pipe, buf, size, now);
+  }
+
+  // 2. Slot chờ quá lâu -> gửi lại hoặc bỏ
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    PollSlot& s = sweep.slots[i];
+    if (s.state == SLOT_WAIT && now - s.stamp > replyTimeout(devices[s.device], s.attempts)) failAttempt(i, now);
+  }
+
+  // 3. Nạp node mới vào slot trống, node đang thăm dò chưa tới hạn thì báo offline luôn
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    PollSlot& s = sweep.slots[i];
+    if (s.state != SLOT_FREE) continue;
+    while (sweep.next < devices.size()) {
+      NodeDevice& device = devices[sweep.next];
+      if (isSleeping(device) || isRouted(device)) {
+        // Node ngủ không nghe GET, số đo của nó tự tới theo lịch thức; node qua relay do relay hỏi
+        if (!reachedIndirectly(device, now)) { device.isOnline = false; reportOffline(device); }
+        sweep.next++;
+        continue;
       }
-      
-      // --- THÔNG BÁO HOÀN TẤT ---
-      // Gửi sau khi vòng lặp duyệt hết danh sách thiết bị
-      Serial.println("{\"event\":\"data_collection_finished\"}");
+      if (pollDue(device, now)) break;
+      device.isOnline = false;
+      reportOffline(device);
+      sweep.next++;
+    }
+    if (sweep.next >= devices.size()) break;
+    s.state = SLOT_SEND; s.device = sweep.next++; s.attempts = 0; s.stamp = now;
+  }
+
+  // 4. Một giao dịch phát mỗi bước: ưu tiên OK để giải phóng slot
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    if (sweep.slots[i].state == SLOT_ACK) { sendOk(i); return; }
+  }
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    if (sweep.slots[i].state == SLOT_SEND && (long)(now - sweep.slots[i].stamp) >= 0) { sendGet(i); return; }
+  }
+
+  // 5. Hết node và không còn slot bận -> kết thúc
+  if (sweep.next < devices.size()) return;
+  for (uint8_t i = 0; i < POLL_SLOTS; i++) {
+    if (sweep.slots[i].state != SLOT_FREE) return;
+  }
+  finishSweep();
+}
+
+// --- PUSH MODE ---
+
+// Ngoài lúc quét: xả FIFO, phân loại theo pipe
+void serviceRadio() {
+  uint8_t pipe;
+  while (radio.available(&pipe)) {
+    uint8_t buf[32];
+    uint8_t size = radio.getDynamicPayloadSize();
+    radio.read(&buf, size);
+    if (pipe == PUSH_RX_PIPE) handlePush(buf, size);
+    else if (pipe == REGISTER_RX_PIPE && currentState == STATE_REGISTERING) handleRegistration(buf, size);
+  }
+}
+
+// Gói chỉ có addr: số đo không đổi, node ngủ vẫn gửi để làm mốc lịch thức
+void handlePush(const uint8_t* buf, uint8_t size) {
+  if (size < sizeof(PushHeader)) return;
+  uint8_t index = nodeByAddr[buf[0]];
+  if (index == NO_NODE) return; // Node lạ hoặc đã bị xóa
+  NodeDevice& device = devices[index];
+  if (size == sizeof(PushHeader)) emitUnchanged(device);
+  else if (!emitReading(device, buf + sizeof(PushHeader), size - sizeof(PushHeader))) return;
+  device.isOnline = true;
+  device.link.failStreak = 0; // Node tự gửi được nghĩa là đã sống lại, bỏ thăm dò
+  device.channel = radio.getChannel(); // CHANNEL_DEFAULT nếu Master đang ở chế độ đăng ký
+  device.lastWake = millis();
+  if (device.pending && !device.batchFrom) deliverPending(device); // Node còn đang phát tiếp khung batch
+}
+
+// Node qua relay: gói được bọc FWD từng chặng rồi gửi cho relay gần Master nhất.
+// true chỉ có nghĩa relay đó đã nhận, các chặng sau không báo lại.
+bool sendToNode(const NodeDevice& device, const void* buf, uint8_t len) {
+  uint8_t packet[32];
+  if (len > sizeof(packet)) return false;
+  memcpy(packet, buf, len);
+  const NodeDevice* hop = &device;
+  while (isRouted(*hop)) {
+    const NodeDevice* relay = relayOf(*hop);
+    if (!relay || len + sizeof(ForwardHeader) > sizeof(packet)) return false; // Cũng chặn tuyến vòng trong Flash
+    ForwardHeader fwd;
+    memset(&fwd, 0, sizeof(fwd));
+    strcpy(fwd.cmd, "FWD");
+    fwd.addr = hop->addr;
+    memmove(packet + sizeof(fwd), packet, len);
+    memcpy(packet, &fwd, sizeof(fwd));
+    len += sizeof(fwd);
+    hop = relay;
+  }
+
+  radio.stopListening();
+  radio.openWritingPipe(nodeAddress(*hop));
+  useRate(hop->link.rate, hop->link.paBoost);
+  bool ok = radio.write(packet, len);
+  useBaseRate();
+  radio.startListening();
+  return ok;
+}
+
+// "<id> <số>" -> id + value trong [0, 65535], false nếu sai cú pháp (đã báo lỗi).
+// more: phía gọi đọc tiếp tham số sau số này, cho phép dấu cách ngay sau nó.
+bool parseIdValue(char* args, const char*& id, uint16_t& value, bool more = false) {
+  char* arg = strchr(args, ' ');
+  if (!arg || arg == args) { Serial.println("{\"error\":\"bad_args\"}"); return false; }
+  *arg++ = '\0';
+  char* end;
+  long n = strtol(arg, &end, 10);
+  if (end == arg || (*end && !(more && *end == ' ')) || n < 0 || n > 65535) { Serial.println("{\"error\":\"bad_args\"}"); return false; }
+  id = args;
+  value = n;
+  return true;
+}
+
+void reportConfigured(const char* event, const char* id, const char* key, uint16_t value) {
+  Serial.print("{\"event\":\""); Serial.print(event); Serial.print("\",\"id\":\""); Serial.print(id);
+  Serial.print("\",\""); Serial.print(key); Serial.print("\":"); Serial.print(value); Serial.println("}");
+}
+
+void reportQueued(const char* id) {
+  Serial.print("{\"event\":\"config_queued\",\"id\":\""); Serial.print(id); Serial.println("\"}");
+}
 
-      radio.openReadingPipe(1, REGISTER_PIPE);
-      radio.startListening();
+bool sendPushConfig(const NodeDevice& device, uint16_t seconds) {
+  ConfigPacket cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  strcpy(cfg.cmd, "CFG");
+  cfg.pushInterval = seconds;
+  return sendToNode(device, &cfg, sizeof(cfg));
+}
+
+bool sendSleepConfig(NodeDevice& device, uint16_t seconds) {
+  SleepPacket slp;
+  memset(&slp, 0, sizeof(slp));
+  strcpy(slp.cmd, "SLP");
+  slp.wakePeriod = seconds;
+  if (!sendToNode(device, &slp, sizeof(slp))) return false;
+  if (seconds) device.link.rate = nodeproto::RATE_BASE; // Node ngủ tự về tốc độ gốc
+  device.wakePeriod = seconds;
+  device.lastWake = millis(); // Node bắt đầu chu kỳ đầu tiên ngay sau gói này
+  saveDevice(device);
+  return true;
+}
+
+// "setPushInterval <id> <giây>", 0 để quay lại chế độ hỏi-đáp
+void configurePush(char* args) {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  const char* id;
+  uint16_t seconds;
+  if (!parseIdValue(args, id, seconds)) return;
+
+  NodeDevice* target = findDevice(id);
+  if (!target) { Serial.println("{\"error\":\"not_found\"}"); return; }
+  if (isRouted(*target) && seconds) { Serial.println("{\"error\":\"unsupported\"}"); return; } // Master không nghe được gói push
+  if (isSleeping(*target)) {
+    target->pending |= PENDING_PUSH;
+    target->pendingPush = seconds;
+    reportQueued(id);
+    return;
+  }
+
+  if (!sendPushConfig(*target, seconds)) { Serial.print("{\"error\":\"node_unreachable\",\"id\":\""); Serial.print(id); Serial.println("\"}"); return; }
+  reportConfigured("push_configured", id, "interval", seconds);
+}
+
+// "setSleep <id> <giây>", 0 để node luôn nghe. Chỉ Soil Node hỗ trợ chế độ ngủ.
+void configureSleep(char* args) {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  const char* id;
+  uint16_t seconds;
+  if (!parseIdValue(args, id, seconds)) return;
+
+  NodeDevice* target = findDevice(id);
+  if (!target) { Serial.println("{\"error\":\"not_found\"}"); return; }
+  if (target->type != SOIL_NODE || (isRouted(*target) && seconds)) { Serial.println("{\"error\":\"unsupported\"}"); return; }
+  if (isSleeping(*target)) {
+    target->pending |= PENDING_SLEEP;
+    target->pendingSleep = seconds;
+    reportQueued(id);
+    return;
+  }
+
+  if (!sendSleepConfig(*target, seconds)) { Serial.print("{\"error\":\"node_unreachable\",\"id\":\""); Serial.print(id); Serial.println("\"}"); return; }
+  reportConfigured("sleep_configured", id, "period", seconds);
+}
+
+bool sendReportConfig(NodeDevice& device, const ReportConfig& config) {
+  ReportPacket rpt;
+  memset(&rpt, 0, sizeof(rpt));
+  strcpy(rpt.cmd, "RPT");
+  rpt.heartbeat = config.heartbeat;
+  memcpy(rpt.deadband, config.deadband, sizeof(rpt.deadband));
+  if (!sendToNode(device, &rpt, sizeof(rpt))) return false;
+  device.report = config;
+  device.keyframed = false; // Bản đo kế tiếp đủ trường, làm mốc cho deadband
+  saveDevice(device);
+  return true;
+}
+
+// "setReport <id> <heartbeat giây> [deadband...]", deadband thiếu coi là 0 (mọi thay đổi).
+// heartbeat 0 tắt lọc, node và Master quay lại gửi mọi bản đo đủ trường.
+void configureReport(char* args) {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  const char* id;
+  uint16_t heartbeat;
+  if (!parseIdValue(args, id, heartbeat, true)) return;
+
+  NodeDevice* target = findDevice(id);
+  if (!target) { Serial.println("{\"error\":\"not_found\"}"); return; }
+
+  // parseIdValue chỉ đọc số đầu tiên, phần deadband nằm ngay sau nó
+  ReportConfig config;
+  memset(&config, 0, sizeof(config));
+  config.heartbeat = heartbeat;
+  uint8_t fields = nodeproto::fieldCount(target->type);
+  if (fields > nodeproto::DEADBAND_FIELDS) fields = nodeproto::DEADBAND_FIELDS;  // Gió giật theo deadband của gió
+  char* p = strchr(args + strlen(args) + 1, ' '); // id == args
+  for (uint8_t n = 0; p && *p; n++) {
+    char* end;
+    long value = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ' ') || n >= fields || value < 0 || value > 65535) { Serial.println("{\"error\":\"bad_args\"}"); return; }
+    config.deadband[n] = value;
+    p = end;
+  }
+
+  if (isSleeping(*target)) {
+    target->pending |= PENDING_REPORT;
+    target->pendingReport = config;
+    reportQueued(id);
+    return;
+  }
+
+  if (!sendReportConfig(*target, config)) { Serial.print("{\"error\":\"node_unreachable\",\"id\":\""); Serial.print(id); Serial.println("\"}"); return; }
+  reportConfigured("report_configured", id, "heartbeat", heartbeat);
+}
+
+bool sendSampleConfig(const NodeDevice& device, uint16_t seconds) {
+  SamplePacket bat;
+  memset(&bat, 0, sizeof(bat));
+  strcpy(bat.cmd, "BAT");
+  bat.sampleInterval = seconds;
+  return sendToNode(device, &bat, sizeof(bat));
+}
+
+// "setSampleInterval <id> <giây>": node lấy mẫu theo chu kỳ này và gửi cả hàng đợi
+// mỗi lần được hỏi/push. 0 để node chỉ gửi số đo hiện tại như trước.
+void configureSample(char* args) {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  const char* id;
+  uint16_t seconds;
+  if (!parseIdValue(args, id, seconds)) return;
+
+  NodeDevice* target = findDevice(id);
+  if (!target) { Serial.println("{\"error\":\"not_found\"}"); return; }
+  if (isSleeping(*target)) {
+    target->pending |= PENDING_SAMPLE;
+    target->pendingSample = seconds;
+    reportQueued(id);
+    return;
+  }
+
+  if (!sendSampleConfig(*target, seconds)) { Serial.print("{\"error\":\"node_unreachable\",\"id\":\""); Serial.print(id); Serial.println("\"}"); return; }
+  reportConfigured("sample_configured", id, "interval", seconds);
+}
+
+// --- NODE NGỦ ---
+
+bool isSleeping(const NodeDevice& device) { return device.wakePeriod != 0; }
+
+// Chu kỳ WDT của node lệch tới ~10%, và node có thể lỡ một lần thức vì nhiễu
+bool missedWake(const NodeDevice& device, unsigned long now) {
+  return now - device.lastWake > device.wakePeriod * 2000UL + WAKE_GRACE_MS;
+}
+
+// Gọi ngay sau gói push: node ngủ chỉ nghe trong WAKE_WINDOW_MS sau đó.
+// Gửi hỏng thì giữ lại, thử tiếp ở lần thức sau.
+void deliverPending(NodeDevice& device) {
+  if (device.pending & PENDING_PUSH) {
+    if (!sendPushConfig(device, device.pendingPush)) return;
+    device.pending &= ~PENDING_PUSH;
+    reportConfigured("push_configured", device.id, "interval", device.pendingPush);
+  }
+  if (device.pending & PENDING_SAMPLE) {
+    if (!sendSampleConfig(device, device.pendingSample)) return;
+    device.pending &= ~PENDING_SAMPLE;
+    reportConfigured("sample_configured", device.id, "interval", device.pendingSample);
+  }
+  if (device.pending & PENDING_REPORT) {
+    if (!sendReportConfig(device, device.pendingReport)) return;
+    device.pending &= ~PENDING_REPORT;
+    reportConfigured("report_configured", device.id, "heartbeat", device.report.heartbeat);
+  }
+  if (device.pending & PENDING_SLEEP) {
+    if (!sendSleepConfig(device, device.pendingSleep)) return;
+    device.pending &= ~PENDING_SLEEP;
+    reportConfigured("sleep_configured", device.id, "period", device.wakePeriod);
+  }
+}
+
+// --- KÊNH RADIO ---
+
+void loadChannel() {
+  preferences.begin("radio", false);
+  channelState.current = preferences.getUChar("channel", nodeproto::CHANNEL_DEFAULT);
+  channelState.autoMove = preferences.getUChar("auto", 0);
+  preferences.end();
+  if (!nodeproto::validChannel(channelState.current)) channelState.current = nodeproto::CHANNEL_DEFAULT;
+  channelState.movedAt = millis() - CHANNEL_HOLD_MS; // Được tự đổi kênh ngay từ lần đánh giá đầu
+  radio.setChannel(channelState.current);
+}
+
+void saveChannel() {
+  preferences.begin("radio", false);
+  preferences.putUChar("channel", channelState.current);
+  preferences.putUChar("auto", channelState.autoMove);
+  preferences.end();
+}
+
+bool sendChannel(const NodeDevice& device, uint8_t channel) {
+  ChannelPacket chn;
+  memset(&chn, 0, sizeof(chn));
+  strcpy(chn.cmd, "CHN");
+  chn.channel = channel;
+  return sendToNode(device, &chn, sizeof(chn));
+}
+
+// Node Master hỏi trực tiếp mà chưa trả lời trên kênh làm việc: mới đăng ký ở CHANNEL_DEFAULT,
+// hoặc lỡ gói CHN phát chung và đã hỏng ít nhất một lượt. Node ngủ/push tự dò kênh, node qua
+// relay do relay báo (relay gửi CHN cho node con trước khi tự đổi kênh).
+bool catchUpDue(const NodeDevice& device, unsigned long now) {
+  if (isSleeping(device) || isRouted(device)) return false;
+  if (device.link.samples && !device.link.failStreak) return false;
+  return pollDue(device, now);
+}
+
+// Gửi CHN riêng cho node trên kênh cũ của nó rồi quay về kênh làm việc
+bool catchUpChannel(NodeDevice& device) {
+  radio.setChannel(device.channel);
+  bool ok = sendChannel(device, channelState.current);
+  radio.stopListening();
+  radio.setChannel(channelState.current);
+  radio.startListening();
+  if (ok) device.channel = channelState.current;
+  return ok;
+}
+
+// Phát chung CHN trên kênh cũ vài lần rồi mới đổi (moveStep). device.channel giữ kênh cũ tới khi
+// node trả lời trên kênh mới, node không theo kịp được catchUpChannel() báo lại.
+void moveChannel(uint8_t channel) {
+  channelMove.active = true;
+  channelMove.channel = channel;
+  channelMove.rates = 1 << nodeproto::RATE_BASE;
+  for (const auto& device : devices) channelMove.rates |= 1 << device.link.rate;
+  channelMove.rate = 0;
+  while (!(channelMove.rates & (1 << channelMove.rate))) channelMove.rate++;
+  channelMove.sent = 0;
+}
+
+// Một gói CHN mỗi lần gọi, cách nhau CHANNEL_ANNOUNCE_GAP trong cùng tốc độ. Phát ở mọi tốc độ
+// đang có node nghe, tốc độ đã chọn dùng PA lớn nhất để tới được mọi node.
+void moveStep() {
+  unsigned long now = millis();
+  if (channelMove.sent && now - channelMove.sentAt < CHANNEL_ANNOUNCE_GAP) return;
+
+  ChannelPacket chn;
+  memset(&chn, 0, sizeof(chn));
+  strcpy(chn.cmd, "CHN");
+  chn.channel = channelMove.channel;
+  radio.stopListening();
+  radio.openWritingPipe(nodeproto::CHANNEL_PIPE);
+  useRate(channelMove.rate, channelMove.rate == nodeproto::RATE_BASE ? 0 : LINK_PA_STEPS);
+  radio.write(&chn, sizeof(chn), true); // Nhiều node cùng nhận, không ai ACK
+  useBaseRate();
+  channelMove.sentAt = now;
+  if (++channelMove.sent == CHANNEL_ANNOUNCES) {
+    channelMove.sent = 0;
+    do channelMove.rate++;
+    while (channelMove.rate < nodeproto::RATE_COUNT && !(channelMove.rates & (1 << channelMove.rate)));
+  }
+  if (channelMove.rate < nodeproto::RATE_COUNT) {
+    radio.startListening();
+    return;
+  }
+
+  channelMove.active = false;
+  radio.setChannel(channelMove.channel);
+  radio.startListening();
+  channelState.current = channelMove.channel;
+  channelState.writes = 0;
+  channelState.retries = 0;
+  channelState.movedAt = now;
+  saveChannel();
+  Serial.print("{\"event\":\"channel_changed\",\"channel\":"); Serial.print(channelState.current); Serial.println("}");
+  if (sweep.queued) {
+    sweep.queued = false;
+    startSweep();
+  }
+}
+
+// Gọi sau mỗi lượt quét: đủ mẫu thì đánh giá số lần phát lại trung bình rồi bắt đầu lại
+void checkChannel() {
+  if (channelState.writes < CHANNEL_MIN_WRITES) return;
+  bool noisy = channelState.retries * 16 >= (uint32_t)channelState.writes * CHANNEL_BAD_RETRIES;
+  channelState.writes = 0;
+  channelState.retries = 0;
+  if (noisy && channelState.autoMove && !scan.active && !channelMove.active && millis() - channelState.movedAt >= CHANNEL_HOLD_MS) startScan(true);
+}
+
+void startScan(bool move) {
+  scan.active = true;
+  scan.move = move;
+  scan.next = 0;
+}
+
+// Đo một kênh (SCAN_SAMPLES lần bật nghe rồi đọc RPD, ~15ms) và quay về kênh làm việc ngay
+// để node push chỉ phải gửi lại. Lưu lượng của chính mạng cũng làm kênh làm việc "bận".
+void scanStep() {
+  uint8_t hits = 0;
+  radio.stopListening();
+  radio.setChannel(nodeproto::CHANNELS[scan.next]);
+  for (uint8_t n = 0; n < SCAN_SAMPLES; n++) {
+    radio.startListening();
+    delayMicroseconds(SCAN_DWELL_US);
+    radio.stopListening();
+    if (radio.testRPD()) hits++;
+  }
+  radio.setChannel(channelState.current);
+  radio.startListening();
+  scan.busy[scan.next++] = hits * 100 / SCAN_SAMPLES;
+  if (scan.next < nodeproto::CHANNEL_COUNT) return;
+
+  scan.active = false;
+  JsonDocument doc;
+  doc["event"] = "channel_scan";
+  doc["channel"] = channelState.current;
+  JsonArray channels = doc["channels"].to<JsonArray>();
+  JsonArray busy = doc["busy"].to<JsonArray>();  // %, cùng thứ tự với channels
+  uint8_t best = nodeproto::CHANNEL_COUNT;
+  for (uint8_t i = 0; i < nodeproto::CHANNEL_COUNT; i++) {
+    channels.add(nodeproto::CHANNELS[i]);
+    busy.add(scan.busy[i]);
+    if (nodeproto::CHANNELS[i] == channelState.current) continue;
+    if (best == nodeproto::CHANNEL_COUNT || scan.busy[i] < scan.busy[best]) best = i;
+  }
+  serializeJson(doc, Serial); Serial.println();
+
+  // Số lần phát lại đã cho thấy kênh hiện tại nhiễu, RPD có thể không thấy (nhiễu dưới -64dBm)
+  if (scan.move && best < nodeproto::CHANNEL_COUNT) moveChannel(nodeproto::CHANNELS[best]);
+}
+
+void cmdScanChannels(char*) {
+  if (sweep.active || scan.active || channelMove.active || currentState != STATE_IDLE) { Serial.println("{\"error\":\"busy\"}"); return; }
+  startScan(false);
+}
+
+// "setChannel <kênh>" chuyển cả mạng sang kênh trong nodeproto::CHANNELS và tắt tự đổi,
+// "setChannel auto" để Master tự đổi khi kênh làm việc nhiễu.
+void configureChannel(char* args) {
+  if (sweep.active || scan.active || channelMove.active || currentState != STATE_IDLE) { Serial.println("{\"error\":\"busy\"}"); return; }
+  if (strcmp(args, "auto") == 0) {
+    channelState.autoMove = true;
+    saveChannel();
+  } else {
+    char* end;
+    long channel = strtol(args, &end, 10);
+    if (end == args || *end || channel < 0 || channel > 255 || !nodeproto::validChannel(channel)) {
+      Serial.println("{\"error\":\"bad_args\"}");
+      return;
     }
-    else if (cmd == "deleteAllNode") { clearDevices(); }
-    else if (cmd.startsWith("deleteNode ")) {
-        String idToDelete = cmd.substring(11); idToDelete.trim();
-        bool found = false;
-        for (auto it = devices.begin(); it != devices.end(); ) {
-            if (String(it->id) == idToDelete) { it = devices.erase(it); found = true; } else { ++it; }
-        }
-        if (found) { saveDevices(); Serial.print("{\"event\":\"deleted\",\"id\":\""); Serial.print(idToDelete); Serial.println("\"}"); }
+    channelState.autoMove = false;
+    if (channel != channelState.current) moveChannel(channel);
+    else saveChannel();
+  }
+  // Kênh đích, "channel_changed" báo sau khi phát CHN xong
+  Serial.print("{\"event\":\"channel_configured\",\"channel\":"); Serial.print(channelMove.active ? channelMove.channel : channelState.current);
+  Serial.print(",\"auto\":"); Serial.print(channelState.autoMove ? "true" : "false"); Serial.println("}");
+}
+
+// --- TỐC ĐỘ LIÊN KẾT ---
+
+// Chỉ đổi lúc không nghe. ACK (kèm payload) của node về cùng tốc độ với gói vừa phát.
+void useRate(uint8_t rate, uint8_t boost) {
+  radio.setDataRate((rf24_datarate_e)nodeproto::rf24DataRate(rate));
+  radio.setPALevel(RF24_PA_LOW + boost);
+}
+
+// Master luôn nghe ở tốc độ gốc: gói push, REG và trả lời kiểu cũ đều phát ở 250kbps
+void useBaseRate() { useRate(nodeproto::RATE_BASE, 0); }
+
+// Node ngủ chỉ nghe sau gói push, node qua relay do relay hỏi ở tốc độ gốc
+bool isTunable(const NodeDevice& device) { return !isSleeping(device) && !isRouted(device); }
+
+void reportLinkRate(const NodeDevice& device) {
+  Serial.print("{\"event\":\"link_rate\",\"id\":\""); Serial.print(device.id);
+  Serial.print("\",\"kbps\":"); Serial.print(nodeproto::rateKbps(device.link.rate));
+  Serial.print(",\"pa\":"); Serial.print(RF24_PA_LOW + device.link.paBoost); Serial.println("}");  // Mức rf24_pa_dbm_e của Master
+}
+
+// Bắt đầu lại việc đếm cho lần đánh giá kế tiếp
+void clearTune(LinkStats& l) {
+  l.tuneWrites = 0;
+  l.tuneFails = 0;
+  l.tuneRetries = 0;
+}
+
+// Tốc độ cho lần gửi GET thứ attempt. GET ở tốc độ đã chọn không có ACK thì lần chẵn hỏi ở tốc
+// độ gốc phòng khi node đã tự về (hết lease, khởi động lại) hay là firmware cũ bỏ qua LNK. Chỉ
+// sau GET không ACK: node không nghe ở tốc độ gốc thì lần hỏi đó phát lại đủ 15 lần ở 250kbps.
+// Quá lease thì coi như node đã về.
+uint8_t pollRate(NodeDevice& device, uint8_t attempt, unsigned long now) {
+  LinkStats& l = device.link;
+  if (l.rate == nodeproto::RATE_BASE) return l.rate;
+  if (now - l.heardAt > LINK_LEASE_S * 1000UL + LINK_LEASE_GRACE_MS) {
+    l.rate = nodeproto::RATE_BASE;
+    clearTune(l);
+    reportLinkRate(device);
+    return l.rate;
+  }
+  return l.missed && !(attempt & 1) ? nodeproto::RATE_BASE : l.rate;
+}
+
+// Lùi về tốc độ gốc và giãn thời gian chờ trước lần lên kế tiếp
+void holdLink(LinkStats& l, unsigned long now) {
+  l.promoteAt = now + (LINK_HOLD_MS << l.holdShift);
+  if (l.holdShift < LINK_HOLD_MAX_SHIFT) l.holdShift++;
+}
+
+void recordLink(NodeDevice& device, uint8_t rate, bool acked, uint8_t arc, unsigned long now) {
+  LinkStats& l = device.link;
+  if (rate != l.rate) {
+    // Node nghe được GET ở tốc độ gốc nên không còn ở tốc độ đã chọn
+    if (!acked) return;
+    l.rate = nodeproto::RATE_BASE;
+    l.paFloor = 0;
+    holdLink(l, now);
+    clearTune(l);
+    reportLinkRate(device);
+  }
+  l.missed = !acked;
+  if (l.tuneWrites < 255) l.tuneWrites++;
+  if (!acked) { l.tuneFails++; return; }
+  l.tuneRetries += arc;
+  l.heardAt = now;
+}
+
+// Báo node tốc độ mới, gửi ở tốc độ node đang nghe. Node chỉ đổi sau khi đã ACK gói này.
+bool sendLink(const NodeDevice& device, uint8_t rate, uint8_t boost) {
+  LinkPacket lnk;
+  memset(&lnk, 0, sizeof(lnk));
+  strcpy(lnk.cmd, "LNK");
+  lnk.rate = rate;
+  lnk.pa = rate == nodeproto::RATE_BASE ? RF24_PA_HIGH : RF24_PA_LOW + boost;
+  lnk.lease = LINK_LEASE_S;
+  return sendToNode(device, &lnk, sizeof(lnk));
+}
+
+// Gọi sau lượt quét khi đủ LINK_EVAL_WRITES lần gửi. Liên kết xấu: tăng PA, PA đã lớn nhất
+// thì lùi tốc độ. Liên kết sạch: lên tốc độ kế tiếp với PA lớn nhất, rồi hạ PA từng bước
+// tới mức thấp nhất chưa từng xấu. PA ở tốc độ đã chọn được báo cho node cho ACK payload.
+void tuneLink(NodeDevice& device, unsigned long now) {
+  LinkStats& l = device.link;
+  uint8_t acked = l.tuneWrites - l.tuneFails;
+  bool lossy = l.tuneFails * 4 >= l.tuneWrites || l.tuneRetries * 16 >= acked * LINK_BAD_RETRIES;
+  bool clean = !l.tuneFails && l.tuneRetries * 16 <= acked * LINK_GOOD_RETRIES;
+  clearTune(l);
+  if (!acked || !isTunable(device)) return; // Node offline không nói gì về liên kết
+
+  uint8_t rate = l.rate, boost = l.paBoost;
+  if (lossy) {
+    l.paFloor = boost < LINK_PA_STEPS ? boost + 1 : LINK_PA_STEPS;
+    if (boost < LINK_PA_STEPS) boost++;
+    else if (rate > nodeproto::RATE_BASE) { rate--; holdLink(l, now); }
+  } else if (clean) {
+    if (rate + 1 < nodeproto::RATE_COUNT && (long)(now - l.promoteAt) >= 0) {
+      rate++;
+      boost = LINK_PA_STEPS;
+      l.paFloor = 0;
+    } else if (boost > l.paFloor) {
+      boost--;
     }
-    else if (cmd == "registerNewNode") enterRegisterMode();
-    else if (cmd == "cancelRegister") { exitRegisterMode(); Serial.println("{\"event\":\"register_cancelled\"}"); }
   }
+  if (rate == l.rate && boost == l.paBoost) return;
+
+  // Chưa báo được thì giữ nguyên, thử lại ở lần đánh giá sau
+  if ((rate != nodeproto::RATE_BASE || l.rate != nodeproto::RATE_BASE) && !sendLink(device, rate, boost)) return;
+  bool changed = rate != l.rate;
+  l.rate = rate;
+  l.paBoost = boost;
+  l.heardAt = now;
+  if (changed) reportLinkRate(device);
+}
+
+// --- XUẤT DỮ LIỆU RA SERIAL (JSON HOẶC KHUNG HUBLINK) ---
+
+void writeFrame(const void* header, uint8_t headerLen, const void* payload = nullptr, uint8_t payloadLen = 0) {
+  uint8_t frame[hublink::MAX_FRAME];
+  size_t n = hublink::encode(frame, header, headerLen, payload, payloadLen);
+  if (n) Serial.write(frame, n);
+}
+
+void reportOffline(const NodeDevice& device) {
+  if (outputMode == OUTPUT_BINARY) {
+    hublink::NodeHeader h = { hublink::FRAME_OFFLINE, (uint32_t)millis(), (uint8_t)(&device - devices.data()) };
+    writeFrame(&h, sizeof(h));
+    return;
+  }
+  Serial.print("{\"id\":\""); Serial.print(device.id); Serial.println("\",\"status\":\"offline\"}");
+}
+
+void reportUnpolled(const NodeDevice& device) {
+  if (outputMode == OUTPUT_BINARY) {
+    hublink::NodeHeader h = { hublink::FRAME_UNPOLLED, (uint32_t)millis(), (uint8_t)(&device - devices.data()) };
+    writeFrame(&h, sizeof(h));
+    return;
+  }
+  Serial.print("{\"id\":\""); Serial.print(device.id); Serial.println("\",\"status\":\"unpolled\"}");
+}
+
+// unpolled > 0: lượt quét bị cắt ở hạn chót
+void reportSweepDone(uint16_t unpolled) {
+  if (outputMode == OUTPUT_BINARY) {
+    hublink::EventHeader h = { hublink::FRAME_SWEEP_DONE, (uint32_t)millis() };
+    writeFrame(&h, sizeof(h));
+    return;
+  }
+  if (!unpolled) { Serial.println("{\"event\":\"data_collection_finished\"}"); return; }
+  Serial.print("{\"event\":\"data_collection_finished\",\"unpolled\":"); Serial.print(unpolled); Serial.println("}");
+}
+
+bool keyframeDue(const NodeDevice& device, unsigned long now) {
+  return !device.keyframed || now - device.keyframeAt >= device.report.heartbeat * 1000UL;
+}
+
+// Bit i = trường i cần chuyển ra Serial, 0 = bỏ cả bản đo. Trường đã chuyển thành mốc mới
+// cho deadband của chính nó nên thay đổi chậm vẫn được báo khi dồn quá deadband.
+uint8_t reportFields(NodeDevice& device, const int32_t* raw, unsigned long now) {
+  uint8_t count = nodeproto::fieldCount(device.type);
+  const uint16_t* scale = nodeproto::fieldScale(device.type);
+  uint8_t all = (1 << count) - 1;
+  if (!device.report.heartbeat) return all;
+
+  uint8_t fields = 0;
+  if (keyframeDue(device, now)) {
+    fields = all;
+    device.keyframed = true;
+    device.keyframeAt = now;
+  } else {
+    for (uint8_t i = 0; i < count; i++) {
+      uint16_t deadband = device.report.deadband[nodeproto::deadbandIndex(i)];
+      if (nodeproto::beyondDeadband(raw[i], device.reported[i], deadband, scale[i])) fields |= 1 << i;
+    }
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (fields & (1 << i)) device.reported[i] = raw[i];
+  }
+  return fields;
+}
+
+// Bản đo bị deadband lọc bỏ không vào nhật ký, seq không bị hở. Nhật ký giữ struct
+// float cũ để bản ghi Flash của FW trước và host đọc khung HubLink không phải đổi.
+void emitFields(NodeDevice& device, const int32_t* raw) {
+  if (raw != device.latest) memcpy(device.latest, raw, sizeof(device.latest));
+  device.hasLatest = true;
+  uint8_t fields = reportFields(device, raw, millis());
+  if (!fields) return;
+
+  uint8_t payload[LOG_PAYLOAD_MAX];
+  uint8_t len = nodeproto::toLegacy(device.type, raw, payload);
+  const LogRecord& record = readingLog.append(millis(), device.addr, device.type, payload, len);
+  writeReading(device, record, hublink::FRAME_READING, fields);
+}
+
+// --- BATCH ---
+
+// Mẫu batch luôn đủ trường nên là mốc deadband và keyframe mới, không qua reportFields
+void logBatchEntry(NodeDevice& device, const int32_t* raw, unsigned long at) {
+  memcpy(device.latest, raw, sizeof(device.latest));
+  memcpy(device.reported, raw, sizeof(device.reported));
+  device.hasLatest = true;
+  device.keyframed = true;
+  device.keyframeAt = at;
+
+  uint8_t payload[LOG_PAYLOAD_MAX];
+  uint8_t len = nodeproto::toLegacy(device.type, raw, payload);
+  readingLog.append(at, device.addr, device.type, payload, len);
+}
+
+// Mỗi mẫu vào nhật ký với mốc lúc node lấy mẫu; lô chỉ được in khi nhận khung cuối
+// (không có BATCH_MORE) hoặc khi bỏ dở, để host nhận cả lô một lần.
+bool collectBatch(NodeDevice& device, const uint8_t* buf, uint8_t size) {
+  uint8_t count = nodeproto::batchCount(device.type, buf, size);
+  if (!count) return false;
+  unsigned long now = millis();
+  if (!device.batchFrom) {
+    device.batchFrom = readingLog.next();
+    openBatches++;
+  }
+  device.batchAt = now;
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t age;
+    int32_t raw[nodeproto::FIELDS_MAX];
+    if (nodeproto::batchEntry(device.type, buf, i, age, raw)) logBatchEntry(device, raw, now - age * 1000UL);
+  }
+  if (!nodeproto::batchMore(buf)) flushBatch(device);
+  return true;
+}
+
+void flushBatch(NodeDevice& device) {
+  if (!device.batchFrom) return;
+  writeBatch(device, device.batchFrom, readingLog.next());
+  device.batchFrom = 0;
+  openBatches--;
+}
+
+// Node ngừng giữa lô (khung push cuối bị mất): in phần đã nhận sau BATCH_HOLD_MS
+void flushStaleBatches() {
+  unsigned long now = millis();
+  for (auto& device : devices) {
+    if (device.batchFrom && now - device.batchAt > BATCH_HOLD_MS) flushBatch(device);
+  }
+}
+
+// --- RELAY ---
+
+bool isRouted(const NodeDevice& device) { return device.via != NO_NODE; }
+
+// Relay hỏi thay node này, nullptr nếu Master hỏi trực tiếp hoặc relay đã bị xóa
+NodeDevice* relayOf(const NodeDevice& device) {
+  if (!isRouted(device) || nodeByAddr[device.via] == NO_NODE) return nullptr;
+  return &devices[nodeByAddr[device.via]];
+}
+
+// relay nằm trên tuyến của node (không nhất thiết là chặng cuối)
+bool routedVia(const NodeDevice& device, const NodeDevice& relay) {
+  const NodeDevice* hop = relayOf(device);
+  for (uint8_t n = 0; hop && n < ROUTE_MAX_RELAYS; n++, hop = relayOf(*hop)) {
+    if (hop == &relay) return true;
+  }
+  return false;
+}
+
+// Node ngủ và node qua relay không được lượt quét hỏi: coi là online khi chưa lỡ lịch
+// thức, hoặc khi relay chưa báo mất node và mọi relay trên tuyến còn online ở lượt quét trước.
+bool reachedIndirectly(const NodeDevice& device, unsigned long now) {
+  if (isSleeping(device)) return !missedWake(device, now);
+  if (!isRouted(device) || !device.isOnline) return false; // Relay đã báo mất node con
+  const NodeDevice* hop = relayOf(device);
+  for (uint8_t n = 0; hop && n < ROUTE_MAX_RELAYS; n++, hop = relayOf(*hop)) {
+    if (!hop->isOnline) return false;
+    if (!isRouted(*hop)) return true;
+  }
+  return false;
+}
+
+bool sendRoute(const NodeDevice& relay, uint8_t child, bool add) {
+  RoutePacket rte;
+  memset(&rte, 0, sizeof(rte));
+  strcpy(rte.cmd, "RTE");
+  rte.child = child;
+  rte.add = add;
+  return sendToNode(relay, &rte, sizeof(rte));
+}
+
+// "setRoute <id> <relay id>" cho node ngoài tầm Master đi qua một ATM Node, relay có thể
+// đi qua relay khác (tối đa ROUTE_MAX_RELAYS). "setRoute <id> direct" để Master hỏi lại trực
+// tiếp. Node phải đăng ký trong tầm Master trước; node qua relay không ngủ và không push.
+void configureRoute(char* args) {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
+  char* arg = strchr(args, ' ');
+  if (!arg || arg == args) { Serial.println("{\"error\":\"bad_args\"}"); return; }
+  *arg++ = '\0';
+
+  NodeDevice* target = findDevice(args);
+  if (!target) { Serial.println("{\"error\":\"not_found\"}"); return; }
+  NodeDevice* relay = nullptr;
+  if (strcmp(arg, "direct") != 0) {
+    relay = findDevice(arg);
+    if (!relay) { Serial.println("{\"error\":\"not_found\"}"); return; }
+    if (relay->type != ATM_NODE || isSleeping(*target)) { Serial.println("{\"error\":\"unsupported\"}"); return; }
+    // Tuyến mới không được vòng lại node này và không dài quá ROUTE_MAX_RELAYS
+    uint8_t relays = 0;
+    for (const NodeDevice* hop = relay; hop; hop = relayOf(*hop)) {
+      if (hop == target || ++relays > ROUTE_MAX_RELAYS) { Serial.println("{\"error\":\"route_loop\"}"); return; }
+    }
+  }
+
+  NodeDevice* old = relayOf(*target);
+  if (relay && relay != old && !sendRoute(*relay, target->addr, true)) {
+    Serial.print("{\"error\":\"node_unreachable\",\"id\":\""); Serial.print(relay->id); Serial.println("\"}");
+    return;
+  }
+  // Relay cũ không nhận được RTE thì vẫn hỏi node, collectRelay() bỏ mục của node không còn đi qua nó
+  if (old && old != relay) sendRoute(*old, target->addr, false);
+  // Relay hỏi node con ở tốc độ gốc. Node không nhận LNK thì tự về khi hết lease.
+  if (target->link.rate != nodeproto::RATE_BASE) sendLink(*target, nodeproto::RATE_BASE, 0);
+  target->via = relay ? relay->addr : NO_NODE;
+  resetLink(*target); // Thống kê liên kết trực tiếp không còn đúng
+  saveDevice(*target);
+
+  Serial.print("{\"event\":\"route_configured\",\"id\":\""); Serial.print(target->id);
+  Serial.print("\",\"via\":\""); Serial.print(relay ? relay->id : "direct"); Serial.println("\"}");
+}
+
+// Khung relay: số đo của node con vào nhật ký theo thời điểm relay nhận, mỗi node con một
+// dòng batch như collectBatch(). Mục báo mất/không đổi xử lý sau để không lẫn vào lô.
+bool collectRelay(NodeDevice& relay, const uint8_t* buf, uint8_t size) {
+  unsigned long now = millis();
+  uint32_t from = readingLog.next();
+  uint8_t touched[(32 - sizeof(nodeproto::RelayHeader)) / sizeof(nodeproto::RelayEntry)];
+  uint8_t touchedCount = 0;
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    uint8_t offset = sizeof(nodeproto::RelayHeader);
+    nodeproto::RelayEntry entry;
+    const uint8_t* data;
+    for (uint8_t i = 0; i < buf[1] && nodeproto::relayEntry(buf, size, offset, entry, data); i++) {
+      uint8_t index = nodeByAddr[entry.addr];
+      if (index == NO_NODE || !routedVia(devices[index], relay)) continue; // Node đã đổi tuyến/bị xóa
+      NodeDevice& child = devices[index];
+      bool status = entry.len == 0 || entry.len == nodeproto::RELAY_LOST;
+      if (status != (pass == 1)) continue;
+
+      if (entry.len == nodeproto::RELAY_LOST) {
+        if (child.isOnline) { child.isOnline = false; reportOffline(child); }
+        continue;
+      }
+      child.isOnline = true;
+      child.channel = channelState.current;
+      if (!entry.len) { emitUnchanged(child); continue; }
+      int32_t raw[nodeproto::FIELDS_MAX];
+      if (!nodeproto::decode(child.type, data, entry.len, raw)) continue;
+      logBatchEntry(child, raw, now - entry.age * 1000UL);
+      if (!memchr(touched, index, touchedCount)) touched[touchedCount++] = index;
+    }
+    if (pass == 0) {
+      for (uint8_t i = 0; i < touchedCount; i++) writeBatch(devices[touched[i]], from, readingLog.next());
+    }
+  }
+  return true;
+}
+
+// Ghi vào nhật ký rồi in dữ liệu của node ngay khi nhận được, false nếu sai kích thước/schema.
+// Nhận cả payload số nguyên lẫn struct float của node chưa nâng cấp.
+bool emitReading(NodeDevice& device, const uint8_t* buf, uint8_t size) {
+  if (nodeproto::isRelay(buf, size)) return collectRelay(device, buf, size);
+  if (nodeproto::isBatch(buf, size)) return collectBatch(device, buf, size);
+  int32_t raw[nodeproto::FIELDS_MAX];
+  if (!nodeproto::decode(device.type, buf, size, raw)) return false;
+  emitFields(device, raw);
+  return true;
+}
+
+// Node báo không đổi (gói chỉ có addr): tới hạn heartbeat thì phát lại bản đủ gần nhất
+void emitUnchanged(NodeDevice& device) {
+  if (!device.hasLatest || !keyframeDue(device, millis())) return;
+  emitFields(device, device.latest);
+}
+
+// fields: bit i = trường i của struct. Thiếu trường thì JSON có "delta":true, host giữ
+// giá trị cũ của các trường vắng. Khung nhị phân luôn mang nguyên struct.
+void writeReading(const NodeDevice& device, const LogRecord& record, uint8_t frameType, uint8_t fields) {
+  if (outputMode == OUTPUT_BINARY) {
+    // Gửi nguyên struct đã packed, host tự giải mã theo nodeType
+    hublink::ReadingHeader h = { frameType, record.timestamp, (uint8_t)(&device - devices.data()),
+                                 record.nodeType, record.seq };
+    writeFrame(&h, sizeof(h), record.payload, record.len);
+    return;
+  }
+
+  JsonDocument doc;
+  uint8_t all = fillSensors(doc["sensors"].to<JsonObject>(), record, fields);
+  doc["id"] = device.id;
+  doc["seq"] = record.seq;
+  if ((fields & all) != all) doc["delta"] = true;
+  if (frameType == hublink::FRAME_REPLAY) doc["ts"] = record.timestamp;
+  serializeJson(doc, Serial); Serial.println();
+}
+
+// Khung nhị phân: mỗi mẫu một FRAME_READING với timestamp lúc lấy mẫu. JSON: một dòng
+// {"id","now","batch":[{"sensors","seq","ts"}...]}, ts đổi sang giờ host theo now như dump.
+void writeBatch(const NodeDevice& device, uint32_t from, uint32_t end) {
+  LogRecord record;
+  if (outputMode == OUTPUT_BINARY) {
+    for (uint32_t seq = from; seq < end; seq++) {
+      if (readingLog.get(seq, record) && record.addr == device.addr) writeReading(device, record, hublink::FRAME_READING);
+    }
+    return;
+  }
+
+  JsonDocument doc;
+  doc["id"] = device.id;
+  doc["now"] = millis();
+  JsonArray batch = doc["batch"].to<JsonArray>();
+  for (uint32_t seq = from; seq < end; seq++) {
+    if (!readingLog.get(seq, record) || record.addr != device.addr) continue; // Bản ghi của node khác xen giữa
+    JsonObject item = batch.add<JsonObject>();
+    fillSensors(item["sensors"].to<JsonObject>(), record, 0xFF);
+    item["seq"] = record.seq;
+    item["ts"] = record.timestamp;
+  }
+  serializeJson(doc, Serial); Serial.println();
+}
+
+// Trường có bit trong fields của bản ghi vào sensors, trả về mask đủ trường của bản ghi
+// (AtmDataV2 khi node gửi gió giật, AtmData của node cũ không có bit 0x40)
+uint8_t fillSensors(JsonObject sensors, const LogRecord& record, uint8_t fields) {
+  if (record.nodeType == SOIL_NODE) {
+    SoilData data;
+    memcpy(&data, record.payload, sizeof(data));
+    if (fields & 0x01) sensors["soil_moisture"] = data.moisture;
+    if (fields & 0x02) sensors["soil_temperature"] = data.temperature;
+    return 0x03;
+  }
+  // --- LOGIC ATM ĐẦY ĐỦ ---
+  if (record.len == sizeof(AtmDataV2)) {
+    AtmDataV2 data;
+    memcpy(&data, record.payload, sizeof(data));
+    if (fields & 0x01) sensors["air_temperature"] = data.air_temp;
+    if (fields & 0x02) sensors["air_humidity"] = data.air_humid;
+    if (fields & 0x04) sensors["rain_intensity"] = data.rain;
+    if (fields & 0x08) sensors["wind_speed"] = data.wind;
+    if (fields & 0x10) sensors["light_intensity"] = data.light;
+    if (fields & 0x20) sensors["barometric_pressure"] = data.pressure;
+    if (fields & 0x40) sensors["wind_gust"] = data.gust;
+    return 0x7F;
+  }
+  AtmData data;
+  memcpy(&data, record.payload, sizeof(data));
+  if (fields & 0x01) sensors["air_temperature"] = data.air_temp;
+  if (fields & 0x02) sensors["air_humidity"] = data.air_humid;
+  if (fields & 0x04) sensors["rain_intensity"] = data.rain;
+  if (fields & 0x08) sensors["wind_speed"] = data.wind;
+  if (fields & 0x10) sensors["light_intensity"] = data.light;
+  if (fields & 0x20) sensors["barometric_pressure"] = data.pressure;
+  return 0x3F;
+}
+
+// Phát lại nhật ký theo từng bản khi bộ đệm TX còn chỗ, không chặn loop() khi Serial chậm.
+// Bản ghi của node đã bị xóa được bỏ qua vì host không còn ID để gán.
+void serviceDump() {
+  LogRecord record;
+  while (dump.next < dump.end && Serial.availableForWrite() >= DUMP_MIN_TX_SPACE) {
+    uint32_t seq = dump.next++;
+    if (!readingLog.get(seq, record)) continue;  // Đã bị ghi đè trong lúc dump
+    uint8_t index = nodeByAddr[record.addr];
+    if (index == NO_NODE || devices[index].type != record.nodeType) continue;
+    writeReading(devices[index], record, hublink::FRAME_REPLAY);
+  }
+  if (dump.next < dump.end) return;
+
+  dump.active = false;
+  Serial.print("{\"event\":\"dump_end\",\"next\":"); Serial.print(dump.end); Serial.println("}");
 }
 
 void enterRegisterMode() {
+  if (sweep.active || channelMove.active) { Serial.println("{\"error\":\"busy\"}"); return; }
   currentState = STATE_REGISTERING;
   Serial.println("{\"status\":\"register_mode_active\"}");
-  radio.openReadingPipe(1, REGISTER_PIPE);
+  radio.stopListening();
+  radio.setChannel(nodeproto::CHANNEL_DEFAULT); // Node mới chưa biết kênh làm việc
+  radio.openReadingPipe(REGISTER_RX_PIPE, REGISTER_PIPE);
   radio.startListening();
 }
 
 void exitRegisterMode() {
   currentState = STATE_IDLE;
   digitalWrite(PIN_LED, LOW);
+  // Ngoài chế độ đăng ký không ACK gói REG để node tự lùi lại
+  if (sweep.active) return;
+  radio.stopListening();
+  radio.closeReadingPipe(REGISTER_RX_PIPE);
+  radio.setChannel(channelState.current);
+  radio.startListening();
 }
 
-void handleRegistration() {
-  if (radio.available()) {
-    RegisterPacket packet;
-    uint8_t size = radio.getDynamicPayloadSize();
+void handleRegistration(const uint8_t* buf, uint8_t size) {
+  if (size != sizeof(RegisterPacket)) return; // Gói rác sai kích thước
+  RegisterPacket packet;
+  memcpy(&packet, buf, sizeof(packet));
+  packet.id[10] = '\0';
+  if (strncmp(packet.cmd, "REG", 3) != 0) return;
 
-    if (size == sizeof(RegisterPacket)) {
-      radio.read(&packet, sizeof(packet));
-      
-      if (strncmp(packet.cmd, "REG", 3) == 0) {
-        String newId = String(packet.id);
-        NodeType newType = UNKNOWN;
-        if (newId.startsWith("soil")) newType = SOIL_NODE;
-        else if (newId.startsWith("atm")) newType = ATM_NODE;
-        
-        if (newType != UNKNOWN) {
-          bool exists = false;
-          for (const auto& d : devices) { if (String(d.id) == newId) { exists = true; break; } }
-          
-          if (!exists) {
-            NodeDevice newNode;
-            strncpy(newNode.id, packet.id, 10); newNode.id[10] = '\0';
-            newNode.type = newType; newNode.isOnline = true;
-            devices.push_back(newNode);
-            saveDevices();
-            
-            radio.stopListening();
-            uint64_t nodeAddr = generateNodeAddress(newNode.id);
-            radio.openWritingPipe(nodeAddr); 
-            
-            delay(50); // Delay quan trọng
-            
-            char ack[] = "REG_OK";
-            if (radio.write(&ack, sizeof(ack))) {
-               Serial.print("{\"event\":\"registered\",\"id\":\""); Serial.print(newId); Serial.println("\"}");
-               exitRegisterMode();
-               digitalWrite(PIN_LED, HIGH); delay(500); digitalWrite(PIN_LED, LOW);
-            } else {
-               // Nếu gửi ACK thất bại, xóa node vừa lưu để thử lại
-               devices.pop_back(); saveDevices();
-            }
-            
-            radio.openReadingPipe(1, REGISTER_PIPE);
-            radio.startListening();
-          }
-        }
-      }
-    } else {
-        // Xóa gói tin rác sai kích thước
-        char trash[32]; radio.read(&trash, size);
+  NodeType newType = UNKNOWN;
+  if (strncmp(packet.id, "soil", 4) == 0) newType = SOIL_NODE;
+  else if (strncmp(packet.id, "atm", 3) == 0) newType = ATM_NODE;
+  if (newType == UNKNOWN) return;
+
+  NodeDevice* found = findDevice(packet.id);
+  int existing = found ? (int)(found - devices.data()) : -1;
+
+  // Node đã có (mất EEPROM, đăng ký lại) thì gửi lại địa chỉ cũ
+  RegisterAck ack;
+  memset(&ack, 0, sizeof(ack));
+  strcpy(ack.cmd, "REG_OK");
+  strncpy(ack.id, packet.id, 10);
+
+  if (existing >= 0) {
+    NodeDevice& device = devices[existing];
+    ack.addr = device.addr;
+    resetLink(device); // Node vừa khởi động lại, thống kê cũ không còn đúng
+    device.channel = nodeproto::CHANNEL_DEFAULT; // Lượt quét kế tiếp báo kênh làm việc
+    device.pending = 0;
+    if (device.wakePeriod || device.report.heartbeat) { // Node tự xóa chu kỳ ngủ và cấu hình RPT khi nhận REG_OK
+      device.wakePeriod = 0;
+      memset(&device.report, 0, sizeof(device.report));
+      saveDevice(device);
+    }
+    for (auto& d : devices) {
+      if (d.via == device.addr) { d.via = NO_NODE; saveDevice(d); } // Relay cũng xóa danh sách node con
+    }
+  } else {
+    NodeDevice newNode;
+    memset(&newNode, 0, sizeof(newNode));
+    strncpy(newNode.id, packet.id, 10); newNode.id[10] = '\0';
+    newNode.type = newType; newNode.isOnline = true;
+    newNode.via = NO_NODE;
+    newNode.channel = nodeproto::CHANNEL_DEFAULT;
+    if (!allocateAddress(newNode.id, newNode.addr)) {
+      Serial.println("{\"error\":\"address_table_full\"}");
+      return;
     }
+    devices.push_back(newNode);
+    nodeByAddr[newNode.addr] = devices.size() - 1;
+    saveDevice(newNode);
+    ack.addr = newNode.addr;
+  }
+
+  radio.stopListening();
+  radio.openWritingPipe(REGISTER_REPLY_PIPE); 
+  
+  delay(50); // Delay quan trọng
+  
+  bool sent = radio.write(&ack, sizeof(ack));
+  radio.startListening();
+
+  if (sent) {
+     Serial.print("{\"event\":\"registered\",\"id\":\""); Serial.print(packet.id); Serial.println("\"}");
+     exitRegisterMode();
+     digitalWrite(PIN_LED, HIGH); delay(500); digitalWrite(PIN_LED, LOW);
   }
+  // Gửi thất bại vẫn giữ địa chỉ đã cấp: có thể chỉ ACK bị mất và node đã nhận REG_OK.
+  // Node chưa nhận sẽ gửi lại REG và được trả đúng địa chỉ này, tránh cấp trùng cho node khác.
 }
 
-void loadDevices() {
-  preferences.begin("nodes", false); 
+StoredDevice toStored(const NodeDevice& device) {
+  StoredDevice stored;
+  memset(&stored, 0, sizeof(stored));
+  memcpy(stored.id, device.id, sizeof(stored.id));
+  stored.type = device.type;
+  stored.addr = device.addr;
+  stored.via = device.via;
+  stored.wakePeriod = device.wakePeriod;
+  stored.heartbeat = device.report.heartbeat;
+  memcpy(stored.deadband, device.report.deadband, sizeof(stored.deadband));
+  return stored;
+}
+
+NodeDevice fromStored(const StoredDevice& stored) {
+  NodeDevice nd;
+  memset(&nd, 0, sizeof(nd));
+  memcpy(nd.id, stored.id, sizeof(nd.id));
+  nd.id[sizeof(nd.id) - 1] = '\0';
+  nd.type = (NodeType)stored.type;
+  nd.addr = stored.addr;
+  nd.via = stored.via;
+  nd.wakePeriod = stored.wakePeriod;
+  nd.report.heartbeat = stored.heartbeat;
+  memcpy(nd.report.deadband, stored.deadband, sizeof(nd.report.deadband));
+  nd.channel = channelState.current; // Không lưu: coi như node đã theo lần đổi kênh cuối
+  return nd;
+}
+
+// Layout cũ: "count", "layout" và "nodeN" (NodeRecord) + "rptN" + "viaN" cho từng node.
+// Trả về số node đã ghi trong "count" để xóa key sau khi đã lưu sang DeviceStore.
+int loadLegacyDevices() {
+  preferences.begin("nodes", true);
   int count = preferences.getInt("count", 0);
-  devices.clear();
+  int layout = preferences.getInt("layout", 1);
+  char key[16];  // "node" + mọi giá trị int
   for (int i = 0; i < count; i++) {
-    String key = "node" + String(i);
-    if (preferences.isKey(key.c_str())) {
-      size_t len = preferences.getBytesLength(key.c_str());
-      char buf[len]; preferences.getBytes(key.c_str(), buf, len);
-      NodeDevice nd; memcpy(&nd, buf, sizeof(NodeDevice)); devices.push_back(nd);
-    }
+    snprintf(key, sizeof(key), "node%d", i);
+    size_t len = preferences.getBytesLength(key);
+    if (!len) continue;
+    NodeDevice nd; memset(&nd, 0, sizeof(nd));
+    uint8_t buf[64];  // Bản ghi "nodeN" của mọi layout cũ đều ngắn hơn
+    if (len > sizeof(buf) || preferences.getBytes(key, buf, sizeof(buf)) != len) continue;
+    memcpy(static_cast<NodeRecord*>(&nd), buf, len < sizeof(NodeRecord) ? len : sizeof(NodeRecord));
+    nd.id[sizeof(nd.id) - 1] = '\0';
+    nd.isOnline = false;
+    if (layout < 2) nd.addr = legacyAddress(nd.id); // Node cũ vẫn nghe ở địa chỉ hash
+    if (layout < 3) nd.wakePeriod = 0;              // Trước đây là byte đệm, không có nghĩa
+    snprintf(key, sizeof(key), "rpt%d", i);
+    if (preferences.getBytesLength(key) == sizeof(ReportConfig)) preferences.getBytes(key, &nd.report, sizeof(ReportConfig));
+    snprintf(key, sizeof(key), "via%d", i);
+    nd.via = preferences.getUChar(key, NO_NODE);
+    nd.channel = channelState.current;
+    devices.push_back(nd);
   }
   preferences.end();
+  return count;
 }
 
-void saveDevices() {
+void removeLegacyKeys(int count) {
+  static const char* const PREFIXES[] = { "node", "rpt", "via" };
+  char key[16];
   preferences.begin("nodes", false);
-  preferences.putInt("count", devices.size());
-  for (int i = 0; i < devices.size(); i++) {
-    String key = "node" + String(i); preferences.putBytes(key.c_str(), &devices[i], sizeof(NodeDevice));
+  preferences.remove("count");
+  preferences.remove("layout");
+  for (int i = 0; i < count; i++) {
+    for (const char* prefix : PREFIXES) {
+      snprintf(key, sizeof(key), "%s%d", prefix, i);
+      preferences.remove(key);
+    }
   }
   preferences.end();
 }
 
+// Blob + nhật ký của DeviceStore. Chưa có thì chuyển layout cũ: ghi blob trước rồi mới xóa
+// key cũ, mất điện giữa chừng thì lần khởi động sau đọc blob và chỉ còn sót key cũ.
+void loadDevices() {
+  std::vector<StoredDevice> stored;
+  DeviceStore::LoadResult result = deviceStore.load(stored);
+  devices.clear();
+  if (result == DeviceStore::LOAD_EMPTY) {
+    int legacy = loadLegacyDevices();
+    if (legacy) {
+      saveDevices();
+      removeLegacyKeys(legacy);
+      Serial.print("{\"event\":\"devices_migrated\",\"count\":"); Serial.print(devices.size()); Serial.println("}");
+    }
+  } else {
+    for (const auto& s : stored) devices.push_back(fromStored(s));
+    if (result == DeviceStore::LOAD_CORRUPT) {
+      Serial.println("{\"error\":\"device_store_corrupt\"}");
+      saveDevices(); // Blob mới (rỗng) để nhật ký ghi tiếp có gen hợp lệ
+    }
+  }
+  rebuildAddressTable();
+}
+
+// Ghi lại cả danh sách, gọi khi nhật ký đầy hoặc lúc chuyển layout
+void saveDevices() {
+  std::vector<StoredDevice> all;
+  all.reserve(devices.size());
+  for (const auto& device : devices) all.push_back(toStored(device));
+  deviceStore.save(all);
+}
+
+// Một node vừa thêm/đổi cấu hình: chỉ ghi một mục nhật ký
+void saveDevice(const NodeDevice& device) {
+  if (!deviceStore.put(toStored(device))) saveDevices();
+}
+
+// Gọi sau khi đã xóa node khỏi devices
+void forgetDevice(const char* id) {
+  if (!deviceStore.remove(id)) saveDevices();
+}
+
 void clearDevices() {
-  preferences.begin("nodes", false); preferences.clear(); preferences.end();
+  if (sweep.active) finishSweep();
+  deviceStore.clear();
   devices.clear();
+  openBatches = 0;
+  rebuildAddressTable();
   Serial.println("{\"event\":\"all_nodes_deleted\"}");
   digitalWrite(PIN_LED, LOW);
 }
\ No newline at end of file
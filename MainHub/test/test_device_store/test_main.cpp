@@ -0,0 +1,402 @@
+/**
+ * test_device_store - Danh sách node trong NVS: DeviceStore và chuyển layout cũ
+ *
+ * Chạy firmware thật (src/main.cpp, test_build_src) trên Preferences giả lập của
+ * NativeSim. Mỗi lần "khởi động" gọi setup() như lúc cấp nguồn lại, danh sách node
+ * đọc qua lệnh getListDevice. DeviceStore được thử riêng trên namespace khác.
+ *
+ * Chạy: pio test -e native -f test_device_store
+ */
+
+#include <Arduino.h>
+#include <DeviceStore.h>
+#include <Preferences.h>
+#include <SimCore.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint8_t NO_NODE = 0xFF;
+
+std::string lineBuf;
+std::vector<std::string> lines;
+
+void captureSerial(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == '\n') {
+      if (!lineBuf.empty() && lineBuf.back() == '\r') lineBuf.pop_back();
+      lines.push_back(lineBuf);
+      lineBuf.clear();
+    } else {
+      lineBuf += (char)data[i];
+    }
+  }
+}
+
+bool printed(const char* text) {
+  for (const auto& line : lines) {
+    if (line.find(text) != std::string::npos) return true;
+  }
+  return false;
+}
+
+// Cấp nguồn lại: RAM mất, NVS còn
+void boot() {
+  lines.clear();
+  setup();
+}
+
+// Kết quả getListDevice của firmware, mỗi node một object JSON (không lồng nhau)
+std::vector<std::string> listDevices() {
+  lines.clear();
+  sim::serialInput("getListDevice\n");
+  for (int i = 0; i < 100; i++) {
+    loop();
+    sim::advance(sim::callCostUs);
+    for (const auto& line : lines) {
+      if (line.empty() || line[0] != '[') continue;
+      std::vector<std::string> objects;
+      for (size_t a = line.find('{'); a != std::string::npos; a = line.find('{', a + 1)) {
+        objects.push_back(line.substr(a, line.find('}', a) - a + 1));
+      }
+      return objects;
+    }
+  }
+  TEST_FAIL_MESSAGE("getListDevice không trả lời");
+  return {};
+}
+
+std::string text(const std::string& object, const char* key) {
+  std::string k = std::string("\"") + key + "\":\"";
+  size_t a = object.find(k);
+  if (a == std::string::npos) return "";
+  a += k.size();
+  return object.substr(a, object.find('"', a) - a);
+}
+
+// -1 nếu không có trường
+long number(const std::string& object, const char* key) {
+  std::string k = std::string("\"") + key + "\":";
+  size_t a = object.find(k);
+  return a == std::string::npos ? -1 : strtol(object.c_str() + a + k.size(), nullptr, 10);
+}
+
+// Hash DJB2 mà layout 1 dùng làm địa chỉ node
+uint8_t legacyAddress(const char* id) {
+  unsigned long hash = 5381;
+  while (*id) hash = hash * 33 + (uint8_t)*id++;
+  return hash & 0xFF;
+}
+
+// Bản ghi "nodeN" 20 byte: id[11], NodeType (int, lệch 12), isOnline, addr, wakePeriod
+void putLegacyNode(Preferences& prefs, int i, const char* id, int32_t type, uint8_t addr, uint16_t wake) {
+  uint8_t rec[20];
+  memset(rec, 0xA5, sizeof(rec));  // Byte đệm của struct cũ là rác
+  memset(rec, 0, 11);
+  strncpy((char*)rec, id, 10);
+  memcpy(rec + 12, &type, sizeof(type));
+  rec[16] = 1;
+  rec[17] = addr;
+  memcpy(rec + 18, &wake, sizeof(wake));
+  char key[16];
+  snprintf(key, sizeof(key), "node%d", i);
+  prefs.putBytes(key, rec, sizeof(rec));
+}
+
+void putLegacyReport(Preferences& prefs, int i, uint16_t heartbeat) {
+  uint16_t rpt[1 + nodeproto::DEADBAND_FIELDS] = { heartbeat };
+  char key[16];
+  snprintf(key, sizeof(key), "rpt%d", i);
+  prefs.putBytes(key, rpt, sizeof(rpt));
+}
+
+void putLegacyVia(Preferences& prefs, int i, uint8_t via) {
+  char key[16];
+  snprintf(key, sizeof(key), "via%d", i);
+  prefs.putUChar(key, via);
+}
+
+StoredDevice stored(const char* id, uint8_t addr, uint16_t heartbeat = 0) {
+  StoredDevice d;
+  memset(&d, 0, sizeof(d));
+  strncpy(d.id, id, sizeof(d.id) - 1);
+  d.type = 1;
+  d.addr = addr;
+  d.via = NO_NODE;
+  d.heartbeat = heartbeat;
+  return d;
+}
+
+std::vector<uint8_t> readKey(const char* ns, const char* key) {
+  Preferences prefs;
+  prefs.begin(ns, true);
+  std::vector<uint8_t> bytes(prefs.getBytesLength(key));
+  if (!bytes.empty()) prefs.getBytes(key, bytes.data(), bytes.size());
+  prefs.end();
+  return bytes;
+}
+
+void writeKey(const char* ns, const char* key, const std::vector<uint8_t>& bytes) {
+  Preferences prefs;
+  prefs.begin(ns, false);
+  prefs.putBytes(key, bytes.data(), bytes.size());
+  prefs.end();
+}
+
+} // namespace
+
+void setUp() {
+  sim::reset();
+  Preferences::wipe();
+  sim::setSerialSink(captureSerial);
+  lines.clear();
+  lineBuf.clear();
+}
+
+void tearDown() {}
+
+// --- DeviceStore ---
+
+// Nhật ký áp lên blob theo đúng thứ tự: sửa tại chỗ, thêm vào cuối, xóa tại chỗ
+void test_log_replay() {
+  Preferences prefs;
+  DeviceStore store(prefs, "t");
+  std::vector<StoredDevice> list;
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_EMPTY, store.load(list));
+  store.save({ stored("soil0001", 1), stored("soil0002", 2), stored("soil0003", 3) });
+  TEST_ASSERT_TRUE(store.put(stored("soil0004", 4)));
+  TEST_ASSERT_TRUE(store.put(stored("soil0001", 1, 600)));
+  TEST_ASSERT_TRUE(store.remove("soil0002"));
+
+  DeviceStore reboot(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_OK, reboot.load(list));
+  TEST_ASSERT_EQUAL(3, list.size());
+  TEST_ASSERT_EQUAL_STRING("soil0001", list[0].id);
+  TEST_ASSERT_EQUAL_UINT16(600, list[0].heartbeat);
+  TEST_ASSERT_EQUAL_STRING("soil0003", list[1].id);
+  TEST_ASSERT_EQUAL_STRING("soil0004", list[2].id);
+
+  // Ghi tiếp sau khi đọc lại: mục mới nối sau mục cũ chứ không ghi đè l0
+  TEST_ASSERT_TRUE(reboot.put(stored("soil0005", 5)));
+  DeviceStore again(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_OK, again.load(list));
+  TEST_ASSERT_EQUAL(4, list.size());
+  TEST_ASSERT_EQUAL_STRING("soil0005", list[3].id);
+}
+
+// Nhật ký đầy: put() báo false, save() gộp vào blob mới và xóa l0..l15
+void test_log_full_then_compact() {
+  Preferences prefs;
+  DeviceStore store(prefs, "t");
+  std::vector<StoredDevice> list;
+  store.load(list);
+  char id[11];
+  for (int i = 0; i < DEVICE_LOG_MAX; i++) {
+    snprintf(id, sizeof(id), "soil%04d", i);
+    list.push_back(stored(id, i));
+    TEST_ASSERT_TRUE(store.put(list.back()));
+  }
+  TEST_ASSERT_FALSE(store.put(stored("soil9999", 99)));
+  uint16_t gen = *(const uint16_t*)(readKey("t", "l0").data());
+
+  list.push_back(stored("soil9999", 99));
+  store.save(list);
+  prefs.begin("t", true);
+  for (uint8_t i = 0; i < DEVICE_LOG_MAX; i++) {
+    char key[4];
+    snprintf(key, sizeof(key), "l%u", i);
+    TEST_ASSERT_FALSE(prefs.isKey(key));
+  }
+  prefs.end();
+  std::vector<uint8_t> blob = readKey("t", "reg");
+  TEST_ASSERT_EQUAL(sizeof(DeviceStoreHeader) + list.size() * sizeof(StoredDevice), blob.size());
+  TEST_ASSERT_EQUAL_UINT16(gen + 1, ((const DeviceStoreHeader*)blob.data())->gen);
+
+  TEST_ASSERT_TRUE(store.put(stored("soil0000", 0, 30)));
+  DeviceStore reboot(prefs, "t");
+  std::vector<StoredDevice> loaded;
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_OK, reboot.load(loaded));
+  TEST_ASSERT_EQUAL(DEVICE_LOG_MAX + 1, loaded.size());
+  TEST_ASSERT_EQUAL_UINT16(30, loaded[0].heartbeat);
+  TEST_ASSERT_EQUAL_STRING("soil9999", loaded.back().id);
+}
+
+// Mất điện sau khi ghi blob mới nhưng trước khi xóa nhật ký: mục gen cũ bị bỏ qua
+void test_stale_log_after_interrupted_compaction() {
+  Preferences prefs;
+  DeviceStore store(prefs, "t");
+  std::vector<StoredDevice> list;
+  store.load(list);
+  store.save({ stored("soil0001", 1) });
+  store.put(stored("soil0002", 2));
+  std::vector<uint8_t> staleEntry = readKey("t", "l0");
+  store.save({ stored("soil0001", 1, 60) });
+  writeKey("t", "l0", staleEntry);
+
+  DeviceStore reboot(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_OK, reboot.load(list));
+  TEST_ASSERT_EQUAL(1, list.size());
+  TEST_ASSERT_EQUAL_UINT16(60, list[0].heartbeat);
+}
+
+// Blob sai CRC hoặc bị cắt cụt: LOAD_CORRUPT, danh sách rỗng, nhật ký cũng bị bỏ
+void test_corrupt_and_truncated_blob() {
+  Preferences prefs;
+  std::vector<StoredDevice> list;
+  DeviceStore store(prefs, "t");
+  store.load(list);
+  store.save({ stored("soil0001", 1), stored("soil0002", 2) });
+  store.put(stored("soil0003", 3));
+  std::vector<uint8_t> blob = readKey("t", "reg");
+
+  std::vector<uint8_t> flipped = blob;
+  flipped[sizeof(DeviceStoreHeader) + 3] ^= 0x01;
+  writeKey("t", "reg", flipped);
+  DeviceStore a(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_CORRUPT, a.load(list));
+  TEST_ASSERT_EQUAL(0, list.size());
+
+  std::vector<uint8_t> truncated(blob.begin(), blob.end() - 5);
+  writeKey("t", "reg", truncated);
+  DeviceStore b(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_CORRUPT, b.load(list));
+  TEST_ASSERT_EQUAL(0, list.size());
+
+  std::vector<uint8_t> stub(blob.begin(), blob.begin() + 3);  // Ngắn hơn cả header
+  writeKey("t", "reg", stub);
+  DeviceStore c(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_CORRUPT, c.load(list));
+
+  // Blob mới ghi đè: gen khác nên mục nhật ký cũ không sống lại
+  c.save({ stored("soil0004", 4) });
+  DeviceStore d(prefs, "t");
+  TEST_ASSERT_EQUAL(DeviceStore::LOAD_OK, d.load(list));
+  TEST_ASSERT_EQUAL(1, list.size());
+  TEST_ASSERT_EQUAL_STRING("soil0004", list[0].id);
+}
+
+// --- loadDevices() của firmware ---
+
+// Layout 1: không có key "layout", địa chỉ là hash của id, wakePeriod là byte đệm rác
+void test_migrates_layout1() {
+  Preferences prefs;
+  prefs.begin("nodes", false);
+  prefs.putInt("count", 3);
+  putLegacyNode(prefs, 0, "soil0001", 1, 0x11, 0xA5A5);
+  putLegacyNode(prefs, 2, "atm00001", 2, 0x22, 0xA5A5);  // node1 mất (xóa dở): bỏ qua
+  prefs.end();
+
+  boot();
+  TEST_ASSERT_TRUE(printed("{\"event\":\"devices_migrated\",\"count\":2}"));
+  std::vector<std::string> nodes = listDevices();
+  TEST_ASSERT_EQUAL(2, nodes.size());
+  TEST_ASSERT_EQUAL_STRING("soil0001", text(nodes[0], "id").c_str());
+  TEST_ASSERT_EQUAL_STRING("soil", text(nodes[0], "type").c_str());
+  TEST_ASSERT_EQUAL(legacyAddress("soil0001"), number(nodes[0], "addr"));
+  TEST_ASSERT_EQUAL(-1, number(nodes[0], "sleep"));
+  TEST_ASSERT_EQUAL_STRING("atm00001", text(nodes[1], "id").c_str());
+  TEST_ASSERT_EQUAL_STRING("atm", text(nodes[1], "type").c_str());
+  TEST_ASSERT_EQUAL(legacyAddress("atm00001"), number(nodes[1], "addr"));
+
+  prefs.begin("nodes", true);
+  TEST_ASSERT_FALSE(prefs.isKey("count"));
+  TEST_ASSERT_FALSE(prefs.isKey("node0"));
+  TEST_ASSERT_FALSE(prefs.isKey("node2"));
+  TEST_ASSERT_TRUE(prefs.isKey("reg"));
+  prefs.end();
+}
+
+// Layout 3 kèm "rptN" và "viaN": lần khởi động sau đọc từ blob, không chuyển lại
+void test_migrates_layout3_with_report_and_route() {
+  Preferences prefs;
+  prefs.begin("nodes", false);
+  prefs.putInt("count", 2);
+  prefs.putInt("layout", 3);
+  putLegacyNode(prefs, 0, "atm00001", 2, 7, 0);
+  putLegacyNode(prefs, 1, "soil0001", 1, 8, 60);
+  putLegacyReport(prefs, 1, 300);
+  putLegacyVia(prefs, 0, NO_NODE);
+  putLegacyVia(prefs, 1, 7);
+  prefs.end();
+
+  for (int pass = 0; pass < 2; pass++) {
+    boot();
+    TEST_ASSERT_EQUAL(pass == 0, printed("devices_migrated"));
+    std::vector<std::string> nodes = listDevices();
+    TEST_ASSERT_EQUAL(2, nodes.size());
+    TEST_ASSERT_EQUAL(7, number(nodes[0], "addr"));
+    TEST_ASSERT_EQUAL_STRING("", text(nodes[0], "via").c_str());
+    TEST_ASSERT_EQUAL_STRING("soil0001", text(nodes[1], "id").c_str());
+    TEST_ASSERT_EQUAL(8, number(nodes[1], "addr"));
+    TEST_ASSERT_EQUAL(60, number(nodes[1], "sleep"));
+    TEST_ASSERT_EQUAL(300, number(nodes[1], "heartbeat"));
+    TEST_ASSERT_EQUAL_STRING("atm00001", text(nodes[1], "via").c_str());
+  }
+
+  prefs.begin("nodes", true);
+  TEST_ASSERT_FALSE(prefs.isKey("rpt1"));
+  TEST_ASSERT_FALSE(prefs.isKey("via1"));
+  prefs.end();
+}
+
+// Mất điện giữa saveDevices() và removeLegacyKeys(): blob đã có nên key cũ còn sót bị bỏ qua
+void test_leftover_legacy_keys_ignored() {
+  Preferences prefs;
+  DeviceStore store(prefs, "nodes");
+  std::vector<StoredDevice> list;
+  store.load(list);
+  store.save({ stored("soil0001", 3) });
+  prefs.begin("nodes", false);
+  prefs.putInt("count", 2);
+  prefs.putInt("layout", 3);
+  putLegacyNode(prefs, 0, "soil0001", 1, 3, 0);
+  putLegacyNode(prefs, 1, "soil0002", 1, 4, 0);  // Đã bị xóa sau khi chuyển layout
+  prefs.end();
+
+  boot();
+  TEST_ASSERT_FALSE(printed("devices_migrated"));
+  std::vector<std::string> nodes = listDevices();
+  TEST_ASSERT_EQUAL(1, nodes.size());
+  TEST_ASSERT_EQUAL_STRING("soil0001", text(nodes[0], "id").c_str());
+}
+
+// Blob hỏng trên Master: báo lỗi, bắt đầu danh sách rỗng với blob mới thay vì đọc key cũ
+void test_corrupt_blob_on_boot() {
+  Preferences prefs;
+  DeviceStore store(prefs, "nodes");
+  std::vector<StoredDevice> list;
+  store.load(list);
+  store.save({ stored("soil0001", 3), stored("soil0002", 4) });
+  std::vector<uint8_t> blob = readKey("nodes", "reg");
+  blob.resize(blob.size() - 1);
+  writeKey("nodes", "reg", blob);
+  prefs.begin("nodes", false);
+  prefs.putInt("count", 1);
+  putLegacyNode(prefs, 0, "soil0009", 1, 9, 0);
+  prefs.end();
+
+  boot();
+  TEST_ASSERT_TRUE(printed("{\"error\":\"device_store_corrupt\"}"));
+  TEST_ASSERT_FALSE(printed("devices_migrated"));
+  TEST_ASSERT_EQUAL(0, listDevices().size());
+
+  boot();
+  TEST_ASSERT_FALSE(printed("device_store_corrupt"));
+  TEST_ASSERT_EQUAL(0, listDevices().size());
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_log_replay);
+  RUN_TEST(test_log_full_then_compact);
+  RUN_TEST(test_stale_log_after_interrupted_compaction);
+  RUN_TEST(test_corrupt_and_truncated_blob);
+  RUN_TEST(test_migrates_layout1);
+  RUN_TEST(test_migrates_layout3_with_report_and_route);
+  RUN_TEST(test_leftover_legacy_keys_ignored);
+  RUN_TEST(test_corrupt_blob_on_boot);
+  return UNITY_END();
+}
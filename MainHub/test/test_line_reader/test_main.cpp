@@ -0,0 +1,175 @@
+/**
+ * test_line_reader - LineReader và CommandTable không cần Arduino
+ *
+ * Stream giả chỉ trả những byte đã "tới" trước lần poll() đó, như Serial khi
+ * lệnh tới rải rác qua nhiều vòng loop().
+ *
+ * Chạy: pio test -e native -f test_line_reader
+ */
+
+#include "CommandTable.h"
+#include "LineReader.h"
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct FakeStream {
+  std::string data;
+  size_t pos = 0;
+
+  void arrive(const char* s) { data += s; }
+  int available() { return (int)(data.size() - pos); }
+  int read() { return pos < data.size() ? (uint8_t)data[pos++] : -1; }
+};
+
+std::vector<std::string> calls;  // "tên|args" theo thứ tự gọi
+
+void onAlpha(char* args) { calls.push_back(std::string("alpha|") + args); }
+void onBeta(char* args) { calls.push_back(std::string("beta|") + args); }
+void onDumpSince(char* args) { calls.push_back(std::string("dumpSince|") + args); }
+
+} // namespace
+
+void setUp() { calls.clear(); }
+void tearDown() {}
+
+void test_line_split_across_polls() {
+  LineReader<32> reader;
+  FakeStream in;
+  in.arrive("getDa");
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));
+  in.arrive("taN");
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));
+  in.arrive("ow\n");
+  TEST_ASSERT_EQUAL(LineReader<32>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("getDataNow", reader.line());
+  TEST_ASSERT_EQUAL(10, reader.length());
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));
+}
+
+// Hai lệnh tới trong cùng một lần: mỗi poll() trả một dòng
+void test_two_lines_in_one_read() {
+  LineReader<32> reader;
+  FakeStream in;
+  in.arrive("helloMaster\ngetListDevice\n");
+  TEST_ASSERT_EQUAL(LineReader<32>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("helloMaster", reader.line());
+  TEST_ASSERT_EQUAL(LineReader<32>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("getListDevice", reader.line());
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));
+}
+
+void test_crlf_and_whitespace_trimmed() {
+  LineReader<32> reader;
+  FakeStream in;
+  in.arrive("  \tsetSleep soil00001 60 \t\r\n\r\n   \r\n");
+  TEST_ASSERT_EQUAL(LineReader<32>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("setSleep soil00001 60", reader.line());
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));  // Dòng trống bị bỏ
+}
+
+// Dòng dài hơn N-1 bị bỏ cả dòng (kể cả phần tới ở lần poll sau), dòng kế tiếp đọc bình thường
+void test_overflow_then_recover() {
+  LineReader<16> reader;
+  FakeStream in;
+  in.arrive("0123456789abcdef");
+  TEST_ASSERT_EQUAL(LineReader<16>::NONE, reader.poll(in));
+  in.arrive("ghij");
+  TEST_ASSERT_EQUAL(LineReader<16>::NONE, reader.poll(in));
+  in.arrive("klm\nbeta\n");
+  TEST_ASSERT_EQUAL(LineReader<16>::OVERFLOW, reader.poll(in));
+  TEST_ASSERT_EQUAL(LineReader<16>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("beta", reader.line());
+}
+
+// Đúng N-1 ký tự vẫn vừa
+void test_line_at_capacity() {
+  LineReader<8> reader;
+  FakeStream in;
+  in.arrive("1234567\n12345678\nok\n");
+  TEST_ASSERT_EQUAL(LineReader<8>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("1234567", reader.line());
+  TEST_ASSERT_EQUAL(LineReader<8>::OVERFLOW, reader.poll(in));
+  TEST_ASSERT_EQUAL(LineReader<8>::LINE, reader.poll(in));
+  TEST_ASSERT_EQUAL_STRING("ok", reader.line());
+}
+
+void test_dispatch_splits_arguments() {
+  CommandTable<8> table;
+  TEST_ASSERT_TRUE(table.add("alpha", onAlpha));
+  TEST_ASSERT_TRUE(table.add("beta", onBeta));
+  TEST_ASSERT_TRUE(table.add("dumpSince", onDumpSince));
+
+  char a[] = "alpha   x y  z";
+  char b[] = "beta";
+  char c[] = "dumpSince 42";
+  TEST_ASSERT_TRUE(table.dispatch(a));
+  TEST_ASSERT_TRUE(table.dispatch(b));
+  TEST_ASSERT_TRUE(table.dispatch(c));
+  TEST_ASSERT_EQUAL(3, calls.size());
+  TEST_ASSERT_EQUAL_STRING("alpha|x y  z", calls[0].c_str());  // Chỉ bỏ dấu cách ngay sau tên lệnh
+  TEST_ASSERT_EQUAL_STRING("beta|", calls[1].c_str());
+  TEST_ASSERT_EQUAL_STRING("dumpSince|42", calls[2].c_str());
+}
+
+void test_unknown_command() {
+  CommandTable<8> table;
+  table.add("alpha", onAlpha);
+  char unknown[] = "gamma 1";
+  char prefix[] = "alph";       // Tiền tố của lệnh có thật
+  char longer[] = "alphabet";   // Lệnh có thật là tiền tố
+  TEST_ASSERT_FALSE(table.dispatch(unknown));
+  TEST_ASSERT_FALSE(table.dispatch(prefix));
+  TEST_ASSERT_FALSE(table.dispatch(longer));
+  TEST_ASSERT_EQUAL(0, calls.size());
+}
+
+// Bảng đầy: add() báo false, mọi lệnh đã thêm vẫn tìm được dù va chạm băm
+void test_full_table() {
+  static const char* const NAMES[] = { "a", "b", "c", "d" };
+  CommandTable<4> table;
+  for (const char* name : NAMES) TEST_ASSERT_TRUE(table.add(name, onAlpha));
+  TEST_ASSERT_FALSE(table.add("e", onBeta));
+  for (const char* name : NAMES) {
+    char line[4];
+    strcpy(line, name);
+    TEST_ASSERT_TRUE(table.dispatch(line));
+  }
+  char e[] = "e";
+  TEST_ASSERT_FALSE(table.dispatch(e));
+  TEST_ASSERT_EQUAL(4, calls.size());
+}
+
+// Đường đi như processSerialCommand(): dòng từ LineReader đưa thẳng cho dispatch()
+void test_reader_into_table() {
+  LineReader<32> reader;
+  CommandTable<8> table;
+  table.add("dumpSince", onDumpSince);
+  FakeStream in;
+  in.arrive("dumpSi");
+  TEST_ASSERT_EQUAL(LineReader<32>::NONE, reader.poll(in));
+  in.arrive("nce 17\r\n");
+  TEST_ASSERT_EQUAL(LineReader<32>::LINE, reader.poll(in));
+  TEST_ASSERT_TRUE(table.dispatch(reader.line()));
+  TEST_ASSERT_EQUAL_STRING("dumpSince|17", calls[0].c_str());
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_line_split_across_polls);
+  RUN_TEST(test_two_lines_in_one_read);
+  RUN_TEST(test_crlf_and_whitespace_trimmed);
+  RUN_TEST(test_overflow_then_recover);
+  RUN_TEST(test_line_at_capacity);
+  RUN_TEST(test_dispatch_splits_arguments);
+  RUN_TEST(test_unknown_command);
+  RUN_TEST(test_full_table);
+  RUN_TEST(test_reader_into_table);
+  return UNITY_END();
+}
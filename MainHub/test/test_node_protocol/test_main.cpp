@@ -0,0 +1,304 @@
+/**
+ * test_node_protocol - Payload radio của node (NodeProtocol.h) như Master giải mã
+ *
+ * Master, HubDump, gateway và SimHub nhận biết định dạng theo kích thước và byte
+ * schema, nên mỗi bài kiểm thử khóa cả kích thước lẫn giá trị:
+ *   - ATM V2 (có gió giật), ATM V1 và struct float cũ SoilData/AtmData
+ *   - toLegacy: AtmDataV2 chỉ khi có gió giật
+ *   - Khung batch 2 mẫu V2 trong một gói 32 byte, khung relay cắt cụt/RELAY_LOST
+ *   - Deadband của gió giật (dùng của gió) và gió giật có rồi mất
+ *
+ * Chạy: pio test -e native -f test_node_protocol
+ */
+
+#include <NodeProtocol.h>
+#include <RelayQueue.h>
+#include <SampleQueue.h>
+
+#include <unity.h>
+
+#include <string.h>
+
+using namespace nodeproto;
+
+namespace {
+
+// Một bản đo ATM đủ trường, thứ tự như fields(AtmPayload)
+const int32_t ATM_RAW[FIELDS_MAX] = { 2512, 70, 3, 512, 900, 10085, 845 };
+
+void assertRaw(const int32_t* expected, const int32_t* raw, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) TEST_ASSERT_EQUAL_INT32(expected[i], raw[i]);
+}
+
+AtmPayloadV1 atmV1() {
+  AtmPayloadV1 p = { SCHEMA_ATM_V1, 2512, 70, 3, 512, 900, 10085 };
+  return p;
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_atm_v2_round_trip() {
+  AtmPayload p = makeAtm(ATM_RAW);
+  TEST_ASSERT_EQUAL(13, sizeof(p));
+  TEST_ASSERT_EQUAL_UINT8(SCHEMA_ATM_V2, p.schema);
+  TEST_ASSERT_EQUAL_UINT8(sizeof(AtmPayload), schemaSize(SCHEMA_ATM_V2));
+  TEST_ASSERT_EQUAL_UINT8(KIND_ATM, schemaKind(SCHEMA_ATM_V2));
+
+  int32_t raw[FIELDS_MAX];
+  TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, (const uint8_t*)&p, sizeof(p), raw));
+  assertRaw(ATM_RAW, raw, FIELDS_MAX);
+  // Cùng byte nhưng khai là Soil, hoặc thiếu một byte: không nhận
+  TEST_ASSERT_EQUAL_UINT8(0, decode(KIND_SOIL, (const uint8_t*)&p, sizeof(p), raw));
+  TEST_ASSERT_EQUAL_UINT8(0, decode(KIND_ATM, (const uint8_t*)&p, sizeof(p) - 1, raw));
+}
+
+void test_atm_v1_decodes_without_gust() {
+  AtmPayloadV1 p = atmV1();
+  TEST_ASSERT_EQUAL(11, sizeof(p));
+  TEST_ASSERT_EQUAL_UINT8(sizeof(AtmPayloadV1), schemaSize(SCHEMA_ATM_V1));
+
+  int32_t raw[FIELDS_MAX];
+  TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, (const uint8_t*)&p, sizeof(p), raw));
+  assertRaw(ATM_RAW, raw, ATM_GUST);
+  TEST_ASSERT_EQUAL_INT32(NO_VALUE, raw[ATM_GUST]);
+
+  // Schema và kích thước phải khớp nhau
+  uint8_t buf[sizeof(AtmPayload)];
+  AtmPayload v2 = makeAtm(ATM_RAW);
+  memcpy(buf, &v2, sizeof(v2));
+  buf[0] = SCHEMA_ATM_V1;
+  TEST_ASSERT_EQUAL_UINT8(0, decode(KIND_ATM, buf, sizeof(AtmPayload), raw));
+  memcpy(buf, &p, sizeof(p));
+  buf[0] = SCHEMA_ATM_V2;
+  TEST_ASSERT_EQUAL_UINT8(0, decode(KIND_ATM, buf, sizeof(AtmPayloadV1), raw));
+}
+
+void test_legacy_float_structs() {
+  int32_t raw[FIELDS_MAX];
+
+  AtmData atm = { 25.12f, 70.0f, 3, 5.12f, 900.0f, 1008.5f };
+  TEST_ASSERT_EQUAL(21, sizeof(atm));
+  TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, (const uint8_t*)&atm, sizeof(atm), raw));
+  assertRaw(ATM_RAW, raw, ATM_GUST);
+  TEST_ASSERT_EQUAL_INT32(NO_VALUE, raw[ATM_GUST]);
+
+  SoilData soil = { 45.3f, 27.25f };
+  TEST_ASSERT_EQUAL(8, sizeof(soil));
+  TEST_ASSERT_EQUAL_UINT8(2, decode(KIND_SOIL, (const uint8_t*)&soil, sizeof(soil), raw));
+  TEST_ASSERT_EQUAL_INT32(453, raw[0]);
+  TEST_ASSERT_EQUAL_INT32(2725, raw[1]);
+
+  SoilPayload compact = makeSoil(453, 2725);
+  TEST_ASSERT_EQUAL(5, sizeof(compact));
+  TEST_ASSERT_EQUAL_UINT8(2, decode(KIND_SOIL, (const uint8_t*)&compact, sizeof(compact), raw));
+  TEST_ASSERT_EQUAL_INT32(453, raw[0]);
+  TEST_ASSERT_EQUAL_INT32(2725, raw[1]);
+  TEST_ASSERT_EQUAL_UINT8(0, decode(KIND_ATM, (const uint8_t*)&soil, sizeof(soil), raw));
+}
+
+// Host phân biệt ba struct float chỉ bằng kích thước
+void test_to_legacy_picks_struct_by_gust() {
+  TEST_ASSERT_EQUAL(20, sizeof(AtmDataV2));
+  uint8_t out[sizeof(AtmData)];  // Struct float lớn nhất
+  int32_t raw[FIELDS_MAX];
+  memcpy(raw, ATM_RAW, sizeof(raw));
+
+  TEST_ASSERT_EQUAL_UINT8(sizeof(AtmDataV2), toLegacy(KIND_ATM, raw, out));
+  AtmDataV2 v2;
+  memcpy(&v2, out, sizeof(v2));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 25.12f, v2.air_temp);
+  TEST_ASSERT_EQUAL_UINT8(70, v2.air_humid);
+  TEST_ASSERT_EQUAL_UINT8(3, v2.rain);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 5.12f, v2.wind);
+  TEST_ASSERT_EQUAL_UINT16(900, v2.light);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1008.5f, v2.pressure);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 8.45f, v2.gust);
+
+  raw[ATM_GUST] = NO_VALUE;
+  TEST_ASSERT_EQUAL_UINT8(sizeof(AtmData), toLegacy(KIND_ATM, raw, out));
+  int32_t back[FIELDS_MAX];
+  TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, out, sizeof(AtmData), back));
+  assertRaw(raw, back, FIELDS_MAX);
+
+  int32_t soil[2] = { 453, 2725 };
+  TEST_ASSERT_EQUAL_UINT8(sizeof(SoilData), toLegacy(KIND_SOIL, soil, out));
+}
+
+// 3 byte header + 2 x (2 byte tuổi + 12 byte) = 31 byte, vừa gói 32 byte sau addr
+void test_batch_two_v2_entries_per_frame() {
+  SampleQueue<AtmPayload, 8> queue;
+  int32_t raw[FIELDS_MAX];
+  memcpy(raw, ATM_RAW, sizeof(raw));
+  for (uint16_t at = 10; at < 13; at++) {
+    raw[ATM_GUST] = 800 + at;
+    queue.push(at, makeAtm(raw));
+  }
+
+  uint8_t frame[31], taken;
+  uint8_t len = queue.pack(frame, sizeof(frame), 20, taken);
+  TEST_ASSERT_EQUAL_UINT8(2, taken);
+  TEST_ASSERT_EQUAL_UINT8(31, len);
+  TEST_ASSERT_EQUAL_UINT8(14, batchEntrySize(SCHEMA_ATM_V2));
+  TEST_ASSERT_TRUE(batchMore(frame));
+  TEST_ASSERT_EQUAL_UINT8(2, batchCount(KIND_ATM, frame, len));
+  TEST_ASSERT_EQUAL_UINT8(0, batchCount(KIND_SOIL, frame, len));
+
+  for (uint8_t i = 0; i < 2; i++) {
+    uint16_t age;
+    int32_t out[FIELDS_MAX];
+    TEST_ASSERT_TRUE(batchEntry(KIND_ATM, frame, i, age, out));
+    TEST_ASSERT_EQUAL_UINT16(10 - i, age);
+    TEST_ASSERT_EQUAL_INT32(810 + i, out[ATM_GUST]);
+    assertRaw(ATM_RAW, out, ATM_GUST);
+  }
+
+  // Độ dài không khớp số mẫu x kích thước mẫu của schema
+  TEST_ASSERT_EQUAL_UINT8(0, batchCount(KIND_ATM, frame, len - 1));
+  TEST_ASSERT_EQUAL_UINT8(0, batchCount(KIND_ATM, frame, sizeof(BatchHeader) + 2 * batchEntrySize(SCHEMA_ATM_V1)));
+  uint8_t bad[sizeof(frame)];
+  memcpy(bad, frame, len);
+  bad[2] = 3;
+  TEST_ASSERT_EQUAL_UINT8(0, batchCount(KIND_ATM, bad, len));
+  bad[2] = 2;
+  bad[1] = 0x7E;  // Schema mẫu lạ
+  TEST_ASSERT_EQUAL_UINT8(0, batchCount(KIND_ATM, bad, len));
+  uint16_t age;
+  int32_t out[FIELDS_MAX];
+  TEST_ASSERT_FALSE(batchEntry(KIND_ATM, bad, 0, age, out));
+}
+
+// Khung batch của ATM FW cũ: mẫu 12 byte, không có gió giật
+void test_batch_v1_entries() {
+  SampleQueue<AtmPayloadV1, 4> queue;
+  queue.push(5, atmV1());
+  queue.push(6, atmV1());
+  uint8_t frame[31], taken;
+  uint8_t len = queue.pack(frame, sizeof(frame), 6, taken);
+  TEST_ASSERT_EQUAL_UINT8(2, taken);
+  TEST_ASSERT_EQUAL_UINT8(sizeof(BatchHeader) + 2 * 12, len);
+  TEST_ASSERT_FALSE(batchMore(frame));
+  TEST_ASSERT_EQUAL_UINT8(2, batchCount(KIND_ATM, frame, len));
+  uint16_t age;
+  int32_t out[FIELDS_MAX];
+  TEST_ASSERT_TRUE(batchEntry(KIND_ATM, frame, 0, age, out));
+  TEST_ASSERT_EQUAL_UINT16(1, age);
+  TEST_ASSERT_EQUAL_INT32(NO_VALUE, out[ATM_GUST]);
+}
+
+void test_relay_entries() {
+  AtmPayload atm = makeAtm(ATM_RAW);
+  uint8_t frame[32];
+  uint8_t len = 0;
+  RelayHeader h = { SCHEMA_RELAY, 2 };
+  memcpy(frame, &h, sizeof(h));
+  len += sizeof(h);
+  RelayEntry reading = { 0x21, 7, sizeof(atm) };
+  memcpy(frame + len, &reading, sizeof(reading));
+  memcpy(frame + len + sizeof(reading), &atm, sizeof(atm));
+  len += sizeof(reading) + sizeof(atm);
+  RelayEntry lost = { 0x22, 3, RELAY_LOST };
+  memcpy(frame + len, &lost, sizeof(lost));
+  len += sizeof(lost);
+
+  uint8_t offset = sizeof(RelayHeader);
+  RelayEntry e;
+  const uint8_t* data;
+  TEST_ASSERT_TRUE(relayEntry(frame, len, offset, e, data));
+  TEST_ASSERT_EQUAL_UINT8(0x21, e.addr);
+  TEST_ASSERT_EQUAL_UINT16(7, e.age);
+  int32_t raw[FIELDS_MAX];
+  TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, data, e.len, raw));
+  assertRaw(ATM_RAW, raw, FIELDS_MAX);
+
+  TEST_ASSERT_TRUE(relayEntry(frame, len, offset, e, data));
+  TEST_ASSERT_EQUAL_UINT8(0x22, e.addr);
+  TEST_ASSERT_EQUAL_UINT8(RELAY_LOST, e.len);
+  TEST_ASSERT_EQUAL_UINT8(len, offset);  // RELAY_LOST không kèm data
+  TEST_ASSERT_FALSE(relayEntry(frame, len, offset, e, data));
+
+  // Mục đầu bị cắt một byte data, hoặc chỉ còn nửa header
+  offset = sizeof(RelayHeader);
+  TEST_ASSERT_FALSE(relayEntry(frame, sizeof(RelayHeader) + sizeof(RelayEntry) + sizeof(atm) - 1, offset, e, data));
+  TEST_ASSERT_EQUAL_UINT8(sizeof(RelayHeader), offset);
+  TEST_ASSERT_FALSE(relayEntry(frame, sizeof(RelayHeader) + 2, offset, e, data));
+  // len lớn hơn bản đo lớn nhất
+  RelayEntry huge = { 0x21, 0, RELAY_DATA_MAX + 1 };
+  memcpy(frame + sizeof(RelayHeader), &huge, sizeof(huge));
+  TEST_ASSERT_FALSE(relayEntry(frame, sizeof(frame), offset, e, data));
+}
+
+// Relay tách khung batch V2 của node con thành từng bản đo 13 byte, mỗi khung relay một mục
+void test_relay_queue_splits_v2_batch() {
+  SampleQueue<AtmPayload, 4> samples;
+  samples.push(40, makeAtm(ATM_RAW));
+  samples.push(45, makeAtm(ATM_RAW));
+  uint8_t batch[31], taken;
+  uint8_t len = samples.pack(batch, sizeof(batch), 50, taken);
+
+  RelayQueue<8> queue;
+  TEST_ASSERT_TRUE(queue.add(0x21, 100, batch, len));
+  TEST_ASSERT_EQUAL_UINT8(2, queue.size());
+
+  const uint16_t ages[] = { 10, 5 };
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t frame[31];
+    len = queue.pack(frame, sizeof(frame), 100, taken);
+    TEST_ASSERT_EQUAL_UINT8(1, taken);
+    uint8_t offset = sizeof(RelayHeader);
+    RelayEntry e;
+    const uint8_t* data;
+    int32_t raw[FIELDS_MAX];
+    TEST_ASSERT_TRUE(relayEntry(frame, len, offset, e, data));
+    TEST_ASSERT_EQUAL_UINT8(0x21, e.addr);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(AtmPayload), e.len);
+    TEST_ASSERT_EQUAL_UINT16(ages[i], e.age);
+    TEST_ASSERT_EQUAL_UINT8(FIELDS_MAX, decode(KIND_ATM, data, e.len, raw));
+    assertRaw(ATM_RAW, raw, FIELDS_MAX);
+    queue.drop(taken);
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_gust_uses_wind_deadband() {
+  TEST_ASSERT_EQUAL_UINT8(ATM_WIND, deadbandIndex(ATM_GUST));
+  const uint16_t deadband[DEADBAND_FIELDS] = { 0, 0, 0, 10, 0, 0 };  // Gió 1.0 m/s, trường khác mọi thay đổi
+  int32_t last[FIELDS_MAX], now[FIELDS_MAX];
+  memcpy(last, ATM_RAW, sizeof(last));
+  memcpy(now, ATM_RAW, sizeof(now));
+  TEST_ASSERT_FALSE(anyBeyond(KIND_ATM, now, last, deadband));
+  now[ATM_GUST] += 90;  // 0.9 m/s
+  TEST_ASSERT_FALSE(anyBeyond(KIND_ATM, now, last, deadband));
+  now[ATM_GUST] += 20;
+  TEST_ASSERT_TRUE(anyBeyond(KIND_ATM, now, last, deadband));
+}
+
+// Node hạ về FW không có gió giật (hoặc ngược lại): luôn coi là thay đổi
+void test_gust_present_to_missing() {
+  const uint16_t deadband[DEADBAND_FIELDS] = { 50, 50, 50, 50, 50, 50 };
+  int32_t last[FIELDS_MAX], now[FIELDS_MAX];
+  memcpy(last, ATM_RAW, sizeof(last));
+  memcpy(now, ATM_RAW, sizeof(now));
+  now[ATM_GUST] = NO_VALUE;
+  TEST_ASSERT_TRUE(anyBeyond(KIND_ATM, now, last, deadband));
+  TEST_ASSERT_TRUE(anyBeyond(KIND_ATM, last, now, deadband));
+  last[ATM_GUST] = NO_VALUE;
+  TEST_ASSERT_FALSE(anyBeyond(KIND_ATM, now, last, deadband));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_atm_v2_round_trip);
+  RUN_TEST(test_atm_v1_decodes_without_gust);
+  RUN_TEST(test_legacy_float_structs);
+  RUN_TEST(test_to_legacy_picks_struct_by_gust);
+  RUN_TEST(test_batch_two_v2_entries_per_frame);
+  RUN_TEST(test_batch_v1_entries);
+  RUN_TEST(test_relay_entries);
+  RUN_TEST(test_relay_queue_splits_v2_batch);
+  RUN_TEST(test_gust_uses_wind_deadband);
+  RUN_TEST(test_gust_present_to_missing);
+  return UNITY_END();
+}
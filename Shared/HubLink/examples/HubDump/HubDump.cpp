@@ -0,0 +1,195 @@
+/**
+ * HubDump - Công cụ Linux đọc cổng Serial của MainHub
+ *
+ * Dùng: HubDump <tty> [--bin]
+ *  - Lệnh gõ trên stdin được gửi thẳng tới Master (helloMaster, getDataNow, ...).
+ *  - Dòng JSON in nguyên văn; khung HubLink được giải mã về cùng dạng JSON
+ *    để so sánh trực tiếp hai chế độ xuất.
+ *  - --bin: gửi "setOutput bin" ngay khi mở cổng.
+ *
+ * Chạy thử không cần phần cứng: socat -d -d pty,raw,echo=0 pty,raw,echo=0
+ * rồi nối SimMasterNode.py vào một đầu, HubDump vào đầu còn lại.
+ */
+
+#include <HubLink.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Khớp với struct packed trong MainHub/src/main.cpp
+struct __attribute__((packed)) SoilData {
+  float moisture;
+  float temperature;
+};
+
+struct __attribute__((packed)) AtmData {
+  float air_temp;
+  float air_humid;
+  uint8_t rain;
+  float wind;
+  float light;
+  float pressure;
+};
+
+// ATM có gió giật, 20 byte
+struct __attribute__((packed)) AtmDataV2 {
+  float air_temp;
+  uint8_t air_humid;
+  uint8_t rain;
+  float wind;
+  uint16_t light;
+  float pressure;
+  float gust;
+};
+
+static std::vector<std::string> nodeIds;  // Chỉ số node -> ID, lấy từ getListDevice
+
+static int openTty(const char* path) {
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return -1;
+  termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B115200);
+    cfsetospeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+static void sendLine(int fd, const char* cmd) {
+  std::string line(cmd);
+  line += '\n';
+  if (write(fd, line.data(), line.size()) < 0) perror("write");
+}
+
+// Danh sách thiết bị là mảng JSON, chỉ cần lấy các "id" theo thứ tự
+static void learnDeviceList(const char* line) {
+  nodeIds.clear();
+  const char* p = line;
+  while ((p = strstr(p, "\"id\":\""))) {
+    p += 6;
+    const char* end = strchr(p, '"');
+    if (!end) break;
+    nodeIds.emplace_back(p, end - p);
+    p = end;
+  }
+}
+
+static std::string nodeName(uint8_t node) {
+  if (node < nodeIds.size()) return nodeIds[node];
+  return "#" + std::to_string(node);
+}
+
+static void printFrame(const uint8_t* body, uint8_t len) {
+  switch (body[0]) {
+    case hublink::FRAME_READING:
+    case hublink::FRAME_REPLAY: {
+      if (len < sizeof(hublink::ReadingHeader)) break;
+      hublink::ReadingHeader h;
+      memcpy(&h, body, sizeof(h));
+      const uint8_t* payload = body + sizeof(h);
+      uint8_t size = len - sizeof(h);
+      std::string id = nodeName(h.node);
+
+      if (h.nodeType == hublink::KIND_SOIL && size == sizeof(SoilData)) {
+        SoilData d;
+        memcpy(&d, payload, sizeof(d));
+        printf("{\"sensors\":{\"soil_moisture\":%g,\"soil_temperature\":%g},\"id\":\"%s\",\"ts\":%u,\"seq\":%u}\n",
+               d.moisture, d.temperature, id.c_str(), h.timestamp, h.seq);
+      } else if (h.nodeType == hublink::KIND_ATM && size == sizeof(AtmData)) {
+        AtmData d;
+        memcpy(&d, payload, sizeof(d));
+        printf("{\"sensors\":{\"air_temperature\":%g,\"air_humidity\":%g,\"rain_intensity\":%u,"
+               "\"wind_speed\":%g,\"light_intensity\":%g,\"barometric_pressure\":%g},\"id\":\"%s\",\"ts\":%u,\"seq\":%u}\n",
+               d.air_temp, d.air_humid, d.rain, d.wind, d.light, d.pressure, id.c_str(), h.timestamp, h.seq);
+      } else if (h.nodeType == hublink::KIND_ATM && size == sizeof(AtmDataV2)) {
+        AtmDataV2 d;
+        memcpy(&d, payload, sizeof(d));
+        printf("{\"sensors\":{\"air_temperature\":%g,\"air_humidity\":%u,\"rain_intensity\":%u,"
+               "\"wind_speed\":%g,\"light_intensity\":%u,\"barometric_pressure\":%g,\"wind_gust\":%g},"
+               "\"id\":\"%s\",\"ts\":%u,\"seq\":%u}\n",
+               d.air_temp, d.air_humid, d.rain, d.wind, d.light, d.pressure, d.gust, id.c_str(), h.timestamp, h.seq);
+      } else {
+        printf("{\"error\":\"bad_payload\",\"id\":\"%s\",\"size\":%u}\n", id.c_str(), size);
+      }
+      return;
+    }
+    case hublink::FRAME_OFFLINE: {
+      if (len < sizeof(hublink::NodeHeader)) break;
+      hublink::NodeHeader h;
+      memcpy(&h, body, sizeof(h));
+      printf("{\"id\":\"%s\",\"status\":\"offline\",\"ts\":%u}\n", nodeName(h.node).c_str(), h.timestamp);
+      return;
+    }
+    case hublink::FRAME_UNPOLLED: {
+      if (len < sizeof(hublink::NodeHeader)) break;
+      hublink::NodeHeader h;
+      memcpy(&h, body, sizeof(h));
+      printf("{\"id\":\"%s\",\"status\":\"unpolled\",\"ts\":%u}\n", nodeName(h.node).c_str(), h.timestamp);
+      return;
+    }
+    case hublink::FRAME_SWEEP_DONE:
+      printf("{\"event\":\"data_collection_finished\"}\n");
+      return;
+  }
+  printf("{\"error\":\"unknown_frame\",\"type\":%u}\n", body[0]);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Dùng: %s <tty> [--bin]\n", argv[0]);
+    return 1;
+  }
+  int fd = openTty(argv[1]);
+  if (fd < 0) { perror(argv[1]); return 1; }
+
+  sendLine(fd, "getListDevice");
+  if (argc > 2 && strcmp(argv[2], "--bin") == 0) sendLine(fd, "setOutput bin");
+
+  hublink::Decoder<> decoder;
+  std::string input;
+  pollfd fds[2] = { { fd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) { perror("poll"); break; }
+
+    if (fds[0].revents & (POLLERR | POLLHUP)) break;
+    if (fds[0].revents & POLLIN) {
+      uint8_t buf[512];
+      ssize_t n = read(fd, buf, sizeof(buf));
+      for (ssize_t i = 0; i < n; i++) {
+        switch (decoder.feed(buf[i])) {
+          case hublink::Decoder<>::LINE:
+            if (decoder.line()[0] == '[') learnDeviceList(decoder.line());
+            printf("%s\n", decoder.line());
+            break;
+          case hublink::Decoder<>::FRAME:
+            printFrame(decoder.body(), decoder.bodyLen());
+            break;
+          default:
+            break;
+        }
+      }
+      fflush(stdout);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char c;
+      if (read(STDIN_FILENO, &c, 1) <= 0) break;
+      if (c == '\n') { sendLine(fd, input.c_str()); input.clear(); }
+      else input += c;
+    }
+  }
+
+  if (decoder.crcErrors) fprintf(stderr, "CRC errors: %u\n", decoder.crcErrors);
+  close(fd);
+  return 0;
+}
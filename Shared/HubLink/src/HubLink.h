@@ -0,0 +1,214 @@
+/**
+ * HubLink - Giao thức khung nhị phân MainHub <-> Host
+ *
+ * Khung: [SOF 0xA5][len][body ... len byte][crc16 LSB][crc16 MSB]
+ *  - CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) tính trên len + body.
+ *  - JSON của Master chỉ gồm ký tự ASCII nên byte 0xA5 luôn là đầu khung,
+ *    host có thể đọc lẫn khung nhị phân và dòng JSON trên cùng một cổng.
+ *
+ * Dùng chung cho firmware (chỉ phần mã hóa) và chương trình phía host (Decoder).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace hublink {
+
+const uint8_t SOF = 0xA5;
+const uint8_t MAX_BODY = 64;
+const size_t MAX_FRAME = MAX_BODY + 4;
+
+enum FrameType : uint8_t {
+  FRAME_READING    = 0x01,  // ReadingHeader + struct dữ liệu gốc của node
+  FRAME_OFFLINE    = 0x02,  // NodeHeader: node không trả lời trong lượt quét
+  FRAME_SWEEP_DONE = 0x03,  // EventHeader: tương đương data_collection_finished
+  FRAME_REPLAY     = 0x04,  // Như FRAME_READING, phát lại từ nhật ký theo lệnh dumpSince
+  FRAME_UNPOLLED   = 0x05,  // NodeHeader: lượt quét hết hạn trước khi hỏi xong node
+};
+
+// Giá trị nodeType khớp với enum NodeType của MainHub. Struct sau ReadingHeader
+// (nodeproto::SoilData/AtmData/AtmDataV2) nhận theo kích thước: Soil 8 byte, ATM
+// 21 byte, ATM có gió giật 20 byte.
+enum NodeKind : uint8_t { KIND_UNKNOWN = 0, KIND_SOIL = 1, KIND_ATM = 2 };
+
+struct __attribute__((packed)) EventHeader {
+  uint8_t type;
+  uint32_t timestamp;   // millis() của Master
+};
+
+struct __attribute__((packed)) NodeHeader {
+  uint8_t type;
+  uint32_t timestamp;
+  uint8_t node;         // Chỉ số node, trùng thứ tự trong getListDevice
+};
+
+struct __attribute__((packed)) ReadingHeader {
+  uint8_t type;
+  uint32_t timestamp;
+  uint8_t node;
+  uint8_t nodeType;
+  uint32_t seq;         // Số thứ tự trong nhật ký của Master, tăng dần từ 1
+};
+
+inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF) {
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Ghi một khung vào out (tối thiểu len + 4 byte), trả về số byte, 0 nếu body quá dài
+inline size_t encode(uint8_t* out, const uint8_t* body, uint8_t len) {
+  if (len == 0 || len > MAX_BODY) return 0;
+  out[0] = SOF;
+  out[1] = len;
+  memcpy(out + 2, body, len);
+  uint16_t crc = crc16(out + 1, len + 1);
+  out[len + 2] = crc & 0xFF;
+  out[len + 3] = crc >> 8;
+  return len + 4;
+}
+
+// Ghép header + payload rồi mã hóa, tránh phải dựng body tạm ở phía gọi
+inline size_t encode(uint8_t* out, const void* header, uint8_t headerLen, const void* payload, uint8_t payloadLen) {
+  uint8_t body[MAX_BODY];
+  if (headerLen + payloadLen > MAX_BODY) return 0;
+  memcpy(body, header, headerLen);
+  if (payloadLen) memcpy(body + headerLen, payload, payloadLen);
+  return encode(out, body, headerLen + payloadLen);
+}
+
+/**
+ * Bộ tách luồng phía host: nhận từng byte, trả về FRAME khi có khung hợp lệ
+ * hoặc LINE khi có một dòng văn bản (đã bỏ '\r'). Dữ liệu trả về chỉ hợp lệ
+ * tới lần gọi feed() kế tiếp.
+ *
+ * Khung sai LEN/CRC có thể là SOF lạc (nhiễu) nuốt mất đầu khung thật nằm bên
+ * trong: các byte đã nhận sau SOF đó được đọc lại từ SOF kế tiếp (nếu có) thay
+ * vì bỏ cả, nên chỉ khung hỏng bị mất.
+ */
+template <size_t LineCap = 16384>
+class Decoder {
+ public:
+  enum Result { NONE, FRAME, LINE };
+
+  uint32_t crcErrors = 0;       // Khung sai CRC hoặc sai độ dài
+  uint32_t droppedLines = 0;    // Dòng dài hơn LineCap
+
+  Result feed(uint8_t b) {
+    if (pending_) push(b);
+    Result r = pending_ ? NONE : step(b);
+    return r == NONE ? drain() : r;
+  }
+
+  const uint8_t* body() const { return body_; }
+  uint8_t bodyLen() const { return len_; }
+  uint8_t frameType() const { return body_[0]; }
+  const char* line() const { return line_; }
+  size_t lineLen() const { return lineLen_; }
+
+ private:
+  enum State : uint8_t { IDLE, LEN, BODY, CRC_LO, CRC_HI };
+  static const size_t REPLAY_CAP = 2 * MAX_FRAME;  // Byte đọc lại nằm trong một khung hỏng cộng byte tới sau
+
+  State state_ = IDLE;
+  uint8_t len_ = 0, pos_ = 0;
+  uint16_t crc_ = 0;
+  uint8_t body_[MAX_BODY];
+  char line_[LineCap];
+  size_t lineLen_ = 0;
+  bool lineReady_ = false, overflow_ = false;
+  uint8_t replay_[REPLAY_CAP];  // Vòng: byte chờ đọc lại, từ head_
+  size_t head_ = 0, pending_ = 0;
+
+  void push(uint8_t b) {
+    if (pending_ == REPLAY_CAP) return;  // Không xảy ra: mỗi lần đọc lại lấy ra nhiều hơn đưa vào
+    replay_[(head_ + pending_++) % REPLAY_CAP] = b;
+  }
+
+  Result drain() {
+    while (pending_) {
+      uint8_t b = replay_[head_];
+      head_ = (head_ + 1) % REPLAY_CAP;
+      pending_--;
+      Result r = step(b);
+      if (r != NONE) return r;
+    }
+    return NONE;
+  }
+
+  // Khung hỏng: đưa body + CRC từ SOF đầu tiên bên trong lên trước các byte đang chờ
+  void resync(const uint8_t* bytes, size_t n) {
+    crcErrors++;
+    state_ = IDLE;
+    size_t from = 0;
+    while (from < n && bytes[from] != SOF) from++;
+    if (from == n) return;
+    n -= from;
+    if (pending_ + n > REPLAY_CAP) return;
+    head_ = (head_ + REPLAY_CAP - n) % REPLAY_CAP;
+    pending_ += n;
+    for (size_t i = 0; i < n; i++) replay_[(head_ + i) % REPLAY_CAP] = bytes[from + i];
+  }
+
+  Result step(uint8_t b) {
+    if (lineReady_) { lineLen_ = 0; lineReady_ = false; }
+
+    switch (state_) {
+      case IDLE:
+        if (b == SOF) { state_ = LEN; return NONE; }
+        if (b == '\n') {
+          if (overflow_) { overflow_ = false; lineLen_ = 0; droppedLines++; return NONE; }
+          if (lineLen_ == 0) return NONE;
+          line_[lineLen_] = '\0';
+          lineReady_ = true;
+          return LINE;
+        }
+        if (b == '\r') return NONE;
+        if (lineLen_ < LineCap - 1) line_[lineLen_++] = (char)b;
+        else overflow_ = true;
+        return NONE;
+
+      case LEN:
+        if (b == 0 || b > MAX_BODY) {
+          crcErrors++;
+          state_ = b == SOF ? LEN : IDLE;  // SOF trước là nhiễu, byte này mới là đầu khung
+          return NONE;
+        }
+        len_ = b; pos_ = 0; state_ = BODY;
+        return NONE;
+
+      case BODY:
+        body_[pos_++] = b;
+        if (pos_ == len_) state_ = CRC_LO;
+        return NONE;
+
+      case CRC_LO:
+        crc_ = b; state_ = CRC_HI;
+        return NONE;
+
+      case CRC_HI: {
+        crc_ |= (uint16_t)b << 8;
+        state_ = IDLE;
+        uint16_t expect = crc16(&len_, 1);
+        expect = crc16(body_, len_, expect);
+        if (crc_ != expect) {
+          uint8_t consumed[MAX_BODY + 2];
+          memcpy(consumed, body_, len_);
+          consumed[len_] = crc_ & 0xFF;
+          consumed[len_ + 1] = b;
+          resync(consumed, len_ + 2);
+          return NONE;
+        }
+        return FRAME;
+      }
+    }
+    return NONE;
+  }
+};
+
+} // namespace hublink
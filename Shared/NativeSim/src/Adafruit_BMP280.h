@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Adafruit_Sensor.h>
+
+#include "SimSensors.h"
+
+class Adafruit_BMP280 {
+ public:
+  bool begin(uint8_t addr = 0x77) { (void)addr; return sim::sensors.bmpPresent; }
+  float readTemperature() { return sim::jitter(sim::sensors.airTemp, 0.1f); }
+  float readPressure() { return sim::jitter(sim::sensors.pressurePa, 20.0f); }
+};
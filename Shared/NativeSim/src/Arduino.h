@@ -0,0 +1,230 @@
+/**
+ * Arduino.h giả lập cho môi trường native
+ *
+ * Chỉ cài phần API mà ba firmware trong repo thực sự dùng. millis()/micros()
+ * đọc đồng hồ ảo trong SimCore và tiến thêm sim::callCostUs mỗi lần gọi, để
+ * các vòng chờ bận kiểu "while (millis() - start < 500)" vẫn kết thúc.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+
+#include "SimCore.h"
+
+using std::isnan;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define A0 36
+#define A1 39
+#define A2 34
+#define A3 35
+
+#define IRAM_ATTR
+#define PROGMEM
+#define F(s) (s)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+namespace sim {
+int serialAvailable();
+int serialRead();
+int serialPeek();
+void serialWrite(const uint8_t* data, size_t len);
+int pinRead(int pin);
+void pinSetMode(int pin, int mode);
+int analogSample(int pin);
+void setInterrupt(int pin, void (*fn)());
+}
+
+// --- THỜI GIAN ---
+inline unsigned long micros() { sim::advance(sim::callCostUs); return (unsigned long)sim::now(); }
+inline unsigned long millis() { sim::advance(sim::callCostUs); return (unsigned long)(sim::now() / 1000); }
+inline void delay(unsigned long ms) { sim::advance((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { sim::advance(us); }
+inline void yield() { sim::advance(sim::callCostUs); }
+
+// --- GPIO ---
+inline void pinMode(int pin, int mode) { sim::pinSetMode(pin, mode); }
+inline void digitalWrite(int pin, int level) { sim::setPin(pin, level ? HIGH : LOW); }
+inline int digitalRead(int pin) { return sim::pinRead(pin); }
+inline int analogRead(int pin) { return sim::analogSample(pin); }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int pin, void (*fn)(), int) { sim::setInterrupt(pin, fn); }
+inline void detachInterrupt(int pin) { sim::setInterrupt(pin, nullptr); }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// --- FREERTOS (ESP32) ---
+// Một luồng duy nhất nên khóa spinlock không cần làm gì
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+
+// --- TOÁN ---
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+template <class T, class L, class H>
+inline T constrain(T x, L lo, H hi) { return x < (T)lo ? (T)lo : (x > (T)hi ? (T)hi : x); }
+
+inline void randomSeed(unsigned long s) { sim::seed((uint32_t)s); }
+inline long random(long max) { return max > 0 ? (long)(sim::rand32() % (uint32_t)max) : 0; }
+inline long random(long min, long max) { return max > min ? min + random(max - min) : min; }
+
+// --- String ---
+class String {
+ public:
+  String(const char* s = "") : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned int v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  String(double v, int decimals = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    s_ = buf;
+  }
+
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return s_.size(); }
+  char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* o) const { return s_ == o; }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o) { s_ += o; return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  friend String operator+(String a, const String& b) { a += b; return a; }
+  friend String operator+(String a, const char* b) { a += b; return a; }
+  friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+
+  bool startsWith(const String& p) const { return s_.compare(0, p.s_.size(), p.s_) == 0; }
+  bool endsWith(const String& p) const {
+    return s_.size() >= p.s_.size() && s_.compare(s_.size() - p.s_.size(), p.s_.size(), p.s_) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t i = s_.find(c, from);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  int indexOf(const String& p, unsigned int from = 0) const {
+    size_t i = s_.find(p.s_, from);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    return from < s_.size() ? String(s_.substr(from, to - from)) : String();
+  }
+  void trim() {
+    size_t a = s_.find_first_not_of(" \t\r\n");
+    size_t b = s_.find_last_not_of(" \t\r\n");
+    s_ = a == std::string::npos ? std::string() : s_.substr(a, b - a + 1);
+  }
+  long toInt() const { return atol(s_.c_str()); }
+  float toFloat() const { return atof(s_.c_str()); }
+
+ private:
+  std::string s_;
+};
+
+// --- Print / Serial ---
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t* data, size_t len) = 0;
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) {
+    if (base == DEC) return printf("%ld", v);
+    return print((unsigned long)v, base);
+  }
+  size_t print(unsigned long v, int base = DEC) {
+    if (base == HEX) return printf("%lX", v);
+    if (base == BIN) {
+      char buf[65];
+      int i = 64;
+      buf[i] = 0;
+      do { buf[--i] = '0' + (v & 1); v >>= 1; } while (v);
+      return write(buf + i);
+    }
+    return printf("%lu", v);
+  }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  template <class T>
+  size_t println(const T& v) { size_t n = print(v); return n + println(); }
+  template <class T>
+  size_t println(const T& v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+  size_t println() { return write("\r\n"); }
+
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+#include <stdarg.h>
+
+inline size_t Print::printf(const char* fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  if ((size_t)n >= sizeof(buf)) n = sizeof(buf) - 1;
+  return write((const uint8_t*)buf, n);
+}
+
+class HardwareSerial : public Print {
+ public:
+  void begin(unsigned long) {}
+  void end() {}
+  operator bool() const { return true; }
+  int available() { sim::advance(sim::callCostUs); return sim::serialAvailable(); }
+  int read() { return sim::serialRead(); }
+  int peek() { return sim::serialPeek(); }
+  int availableForWrite() { return 1024; }  // Đầu ra được ghi ngay, bộ đệm TX không bao giờ đầy
+  void flush() {}
+  using Print::write;
+  size_t write(uint8_t c) override { sim::serialWrite(&c, 1); return 1; }
+  size_t write(const uint8_t* data, size_t len) override { sim::serialWrite(data, len); return len; }
+};
+
+extern HardwareSerial Serial;
+
+// Firmware cung cấp, SimMain gọi
+void setup();
+void loop();
@@ -0,0 +1,25 @@
+/**
+ * DHT.h giả lập - trả giá trị trong sim::sensors có thêm nhiễu nhỏ
+ */
+
+#pragma once
+
+#include "SimSensors.h"
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+ public:
+  DHT(uint8_t pin, uint8_t type) { (void)pin; (void)type; }
+  void begin() {}
+  float readTemperature(bool fahrenheit = false) {
+    if (sim::sensors.dhtFail) return NAN;
+    float c = sim::jitter(sim::sensors.airTemp, 0.3f);
+    return fahrenheit ? c * 1.8f + 32 : c;
+  }
+  float readHumidity() {
+    if (sim::sensors.dhtFail) return NAN;
+    return sim::jitter(sim::sensors.airHumid, 1.0f);
+  }
+};
@@ -0,0 +1,42 @@
+/**
+ * EEPROM.h giả lập - gộp API AVR (read/write/update) và ESP32 (begin/commit)
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class EEPROMClass {
+ public:
+  static const size_t SIZE = 1024;
+
+  EEPROMClass() { memset(data_, 0xFF, sizeof(data_)); }  // Ô nhớ chưa ghi đọc ra 0xFF
+  bool begin(size_t size) { (void)size; return true; }
+  bool commit() { return true; }
+  void end() {}
+  size_t length() const { return SIZE; }
+
+  uint8_t read(int addr) const { return inRange(addr) ? data_[addr] : 0xFF; }
+  void write(int addr, uint8_t value) { if (inRange(addr)) data_[addr] = value; }
+  void update(int addr, uint8_t value) { write(addr, value); }
+
+  template <class T>
+  T& get(int addr, T& value) const {
+    if (inRange(addr) && addr + sizeof(T) <= SIZE) memcpy(&value, data_ + addr, sizeof(T));
+    return value;
+  }
+  template <class T>
+  const T& put(int addr, const T& value) {
+    if (inRange(addr) && addr + sizeof(T) <= SIZE) memcpy(data_ + addr, &value, sizeof(T));
+    return value;
+  }
+
+  // Chỉ có trong mô phỏng: đưa về trạng thái xuất xưởng
+  void wipe() { memset(data_, 0xFF, sizeof(data_)); }
+
+ private:
+  static bool inRange(int addr) { return addr >= 0 && (size_t)addr < SIZE; }
+  uint8_t data_[SIZE];
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,48 @@
+#include "Preferences.h"
+
+std::map<std::string, Preferences::Namespace>& Preferences::store() {
+  static std::map<std::string, Namespace> nvs;
+  return nvs;
+}
+
+void Preferences::wipe() { store().clear(); }
+
+bool Preferences::begin(const char* name, bool readOnly) {
+  ns_ = &store()[name];
+  readOnly_ = readOnly;
+  return true;
+}
+
+bool Preferences::clear() {
+  if (!ns_ || readOnly_) return false;
+  ns_->clear();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (!ns_ || readOnly_) return false;
+  return ns_->erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) { return ns_ && ns_->count(key); }
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  if (!ns_ || readOnly_) return 0;
+  const uint8_t* p = (const uint8_t*)value;
+  (*ns_)[key].assign(p, p + len);
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  if (!ns_) return 0;
+  auto it = ns_->find(key);
+  return it == ns_->end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  if (!ns_) return 0;
+  auto it = ns_->find(key);
+  if (it == ns_->end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
@@ -0,0 +1,51 @@
+/**
+ * Preferences.h giả lập - NVS của ESP32 giữ trong RAM suốt tiến trình
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false);
+  void end() { ns_ = nullptr; }
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+
+  size_t putBytes(const char* key, const void* value, size_t len);
+  size_t getBytesLength(const char* key);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+
+  size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  int32_t getInt(const char* key, int32_t def = 0) { return get(key, def); }
+  size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint32_t getUInt(const char* key, uint32_t def = 0) { return get(key, def); }
+  size_t putUChar(const char* key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint8_t getUChar(const char* key, uint8_t def = 0) { return get(key, def); }
+  size_t putUShort(const char* key, uint16_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint16_t getUShort(const char* key, uint16_t def = 0) { return get(key, def); }
+
+  size_t freeEntries() { return 500; }
+
+  // Chỉ có trong mô phỏng: xóa toàn bộ NVS (mọi namespace)
+  static void wipe();
+
+ private:
+  typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+
+  template <class T>
+  T get(const char* key, T def) {
+    T v;
+    return getBytes(key, &v, sizeof(v)) == sizeof(v) ? v : def;
+  }
+
+  static std::map<std::string, Namespace>& store();
+  Namespace* ns_ = nullptr;
+  bool readOnly_ = false;
+};
@@ -0,0 +1,334 @@
+#include "RF24.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim {
+
+Air& Air::get() {
+  static Air air;
+  return air;
+}
+
+void Air::attach(RF24* radio) { radios_.push_back(radio); }
+
+void Air::detach(RF24* radio) { radios_.erase(std::remove(radios_.begin(), radios_.end(), radio), radios_.end()); }
+
+void Air::setLinkLoss(uint32_t a, uint32_t b, double loss) { links_[std::make_pair(std::min(a, b), std::max(a, b))] = loss; }
+
+double Air::linkLoss(uint32_t a, uint32_t b) const {
+  auto it = links_.find(std::make_pair(std::min(a, b), std::max(a, b)));
+  return it != links_.end() ? it->second : config.loss;
+}
+
+void Air::setLinkMargin(uint32_t a, uint32_t b, double db) { margins_[std::make_pair(std::min(a, b), std::max(a, b))] = db; }
+
+// Độ nhạy kém đi theo tốc độ (chỉ số rf24_datarate_e: 1M, 2M, 250K) và công suất giảm theo PA.
+// Tỉ lệ mất đi từ ~0 tới ~1 trong khoảng vài dB quanh biên 0, giống đường cong PER của chip.
+double Air::linkLoss(uint32_t from, uint32_t to, uint8_t dataRate, uint8_t pa) const {
+  static const double RATE_DB[] = { 9, 12, 0 };
+  static const double PA_DB[] = { 18, 12, 6, 0 };
+  double loss = linkLoss(from, to);
+  auto it = margins_.find(std::make_pair(std::min(from, to), std::max(from, to)));
+  if (it == margins_.end()) return loss;
+  double margin = it->second - RATE_DB[dataRate < 3 ? dataRate : 2] - PA_DB[pa < 4 ? pa : 3];
+  double fade = 1.0 / (1.0 + std::exp(margin / 1.5));
+  return 1.0 - (1.0 - loss) * (1.0 - fade);
+}
+
+void Air::setNoise(uint8_t channel, double prob) { noise_[channel & 0x7F] = prob; }
+
+double Air::noise(uint8_t channel) const { return noise_[channel & 0x7F]; }
+
+void Air::reset() {
+  config = AirConfig();
+  stats = AirStats();
+  links_.clear();
+  margins_.clear();
+  for (int i = 0; i < 128; i++) { noise_[i] = 0; busy_[i] = 0; }
+}
+
+} // namespace sim
+
+namespace {
+uint32_t nextRadioId = 0;
+}
+
+RF24::RF24(uint16_t, uint16_t) : id_(++nextRadioId) {
+  // Giá trị mặc định của thanh ghi RX_ADDR_P0..P5 trên chip
+  pipeAddr_[0] = 0xE7E7E7E7E7ULL;
+  pipeAddr_[1] = 0xC2C2C2C2C2ULL;
+  for (uint8_t i = 2; i < 6; i++) pipeAddr_[i] = 0xC2C2C2C2C1ULL + i;
+  sim::Air::get().attach(this);
+}
+
+RF24::~RF24() { sim::Air::get().detach(this); }
+
+bool RF24::begin() {
+  trackRx();
+  powered_ = true;
+  listening_ = false;
+  rx_.clear();
+  ackQueue_.clear();
+  return true;
+}
+
+void RF24::openReadingPipe(uint8_t pipe, uint64_t address) {
+  if (pipe > 5) return;
+  pipeAddr_[pipe] = address & ADDR_MASK;
+  pipeOpen_[pipe] = true;
+}
+
+void RF24::powerUp() {
+  trackRx();
+  powered_ = true;
+}
+
+void RF24::powerDown() {
+  trackRx();
+  powered_ = false;
+}
+
+void RF24::trackRx() {
+  uint64_t t = sim::now();
+  if (powered_ && listening_) rxUs_ += t - rxSince_;
+  rxSince_ = t;
+}
+
+uint64_t RF24::rxTimeUs() const {
+  return rxUs_ + ((powered_ && listening_) ? sim::now() - rxSince_ : 0);
+}
+
+void RF24::startListening() {
+  trackRx();
+  listening_ = true;
+  if (ackPayloads_) flush_tx();
+}
+
+void RF24::stopListening() {
+  trackRx();
+  listening_ = false;
+  lastPid_ = 0xFF;  // Chuyển chế độ làm mới bộ lọc gói lặp
+  if (ackPayloads_) flush_tx();
+}
+
+bool RF24::available(uint8_t* pipe) {
+  sim::advance(sim::callCostUs);  // Mỗi lần hỏi là một giao dịch SPI
+  if (!ready()) return false;
+  if (pipe) *pipe = rx_.front().pipe;
+  return true;
+}
+
+uint8_t RF24::getDynamicPayloadSize() { return ready() ? rx_.front().len : 0; }
+
+void RF24::read(void* buf, uint8_t len) {
+  if (!ready()) {
+    memset(buf, 0, len);
+    return;
+  }
+  const Packet& p = rx_.front();
+  uint8_t n = std::min(len, p.len);
+  memcpy(buf, p.data, n);
+  if (len > n) memset((uint8_t*)buf + n, 0, len - n);
+  rx_.pop_front();
+}
+
+bool RF24::writeAckPayload(uint8_t pipe, const void* buf, uint8_t len) {
+  if (!ackPayloads_ || ackQueue_.size() >= FIFO_DEPTH || pipe > 5) return false;
+  AckPayload p;
+  p.pipe = pipe;
+  p.len = std::min<uint8_t>(len, 32);
+  p.sent = false;
+  memcpy(p.data, buf, p.len);
+  ackQueue_.push_back(p);
+  return true;
+}
+
+// Như chip thật: payload đã gửi chỉ rời FIFO khi nhận gói mang PID mới (bên phát
+// đã nhận ACK), gói phát lại do mất ACK nhận lại đúng payload đó
+bool RF24::takeAckPayload(uint8_t pipe, bool retransmit, AckPayload& out) {
+  if (!retransmit) {
+    for (auto it = ackQueue_.begin(); it != ackQueue_.end();) {
+      if (it->pipe == pipe && it->sent) it = ackQueue_.erase(it);
+      else ++it;
+    }
+  }
+  for (AckPayload& p : ackQueue_) {
+    if (p.pipe != pipe) continue;
+    p.sent = true;
+    out = p;
+    return true;
+  }
+  return false;
+}
+
+bool RF24::testRPD() {
+  sim::Air& air = sim::Air::get();
+  uint64_t busy = air.busyUntil(channel_);
+  return sim::uniform() < air.noise(channel_) || (busy && busy + 1000 > sim::now());
+}
+
+int RF24::matchPipe(uint64_t address) const {
+  if (pipeOpen_[0] && pipeAddr_[0] == address) return 0;
+  if (pipeOpen_[1] && pipeAddr_[1] == address) return 1;
+  for (uint8_t i = 2; i < 6; i++) {
+    if (pipeOpen_[i] && ((pipeAddr_[1] & ~0xFFULL) | (pipeAddr_[i] & 0xFF)) == address) return i;
+  }
+  return -1;
+}
+
+uint32_t RF24::airtimeUs(uint8_t len) const {
+  // Preamble 1 + địa chỉ 5 + payload + CRC 2 byte, cộng 9 bit trường điều khiển
+  uint32_t bits = 8 * (1 + 5 + len + 2) + 9;
+  switch (dataRate_) {
+    case RF24_250KBPS: return bits * 4;
+    case RF24_2MBPS: return bits / 2;
+    default: return bits;
+  }
+}
+
+// --- PHÁT ---
+
+bool RF24::write(const void* buf, uint8_t len, bool multicast) {
+  beginWrite(buf, len, multicast);
+  while (tx_.busy) sim::advanceTo(tx_.doneAt);
+  return tx_.ok;
+}
+
+void RF24::beginWrite(const void* buf, uint8_t len, bool multicast) {
+  tx_.gen++;
+  tx_.busy = true;
+  tx_.ok = false;
+  tx_.noAck = multicast || !autoAck_;
+  tx_.len = std::min<uint8_t>(len, 32);
+  tx_.retries = 0;
+  tx_.address = txAddress_;
+  tx_.doneAt = sim::now();
+  memcpy(tx_.data, buf, tx_.len);
+  pid_ = (pid_ + 1) & 0x03;
+  counters.writes++;
+  uint32_t gen = tx_.gen;
+  sim::schedule(sim::now(), [this, gen] { attempt(gen); });
+}
+
+void RF24::attempt(uint32_t gen) {
+  if (gen != tx_.gen || !tx_.busy) return;
+  sim::Air& air = sim::Air::get();
+  uint64_t t = sim::now();
+  uint64_t end = t + 130 + airtimeUs(tx_.len);
+  counters.attempts++;
+  air.stats.attempts++;
+  air.stats.airtimeUs += airtimeUs(tx_.len);
+
+  bool corrupted = !powered_;
+  if (!corrupted && air.busyUntil(channel_) > t) {
+    corrupted = true;
+    air.stats.collisions++;
+  } else if (!corrupted && sim::uniform() < air.noise(channel_)) {
+    corrupted = true;
+    air.stats.lost++;
+  }
+  if (powered_) air.occupy(channel_, std::max(air.busyUntil(channel_), end));
+
+  RF24* acker = nullptr;
+  uint8_t ackPipe = 0;
+  int ackers = 0;
+  if (!corrupted) {
+    for (RF24* r : air.radios()) {
+      if (r == this || !r->powered_ || !r->listening_) continue;
+      if (r->channel_ != channel_ || r->dataRate_ != dataRate_) continue;
+      int pipe = r->matchPipe(tx_.address);
+      if (pipe < 0) continue;
+      if (sim::uniform() < air.linkLoss(id_, r->id_, dataRate_, paLevel_)) {
+        air.stats.lost++;
+        continue;
+      }
+      uint64_t visibleAt = tx_.noAck || !r->autoAck_ || !air.config.autoAck ? end : end + 130 + airtimeUs(0);
+      if (!r->deliver(this, pipe, tx_.data, tx_.len, pid_, visibleAt)) continue;  // FIFO đầy: chip bỏ gói và không ACK
+      if (r->autoAck_) {
+        ackers++;
+        acker = r;
+        ackPipe = pipe;
+      }
+    }
+  }
+
+  if (tx_.noAck || !air.config.autoAck) {
+    finish(gen, powered_, end);
+    return;
+  }
+
+  if (ackers == 1 && sim::uniform() >= air.config.ackLoss &&
+      sim::uniform() >= air.linkLoss(acker->id_, id_, dataRate_, acker->paLevel_)) {
+    AckPayload payload;
+    bool hasPayload = acker->ackPayloads_ && acker->takeAckPayload(ackPipe, acker->lastDuplicate_, payload);
+    uint64_t ackEnd = end + 130 + airtimeUs(hasPayload ? payload.len : 0);
+    air.stats.airtimeUs += airtimeUs(hasPayload ? payload.len : 0);
+    air.occupy(channel_, std::max(air.busyUntil(channel_), ackEnd));
+    air.stats.acked++;
+    uint64_t doneAt = ackEnd + air.config.latencyUs;
+    if (hasPayload && ackPayloads_) {  // Bên phát không bật EN_ACK_PAY: payload vẫn bị lấy khỏi FIFO nhưng bỏ qua
+      sim::schedule(doneAt, [this, payload] {
+        if (rx_.size() >= FIFO_DEPTH) return;
+        Packet p;
+        p.pipe = 0;
+        p.len = payload.len;
+        p.visibleAt = sim::now();
+        memcpy(p.data, payload.data, payload.len);
+        rx_.push_back(p);
+        counters.ackPayloads++;
+        if (onReceive_) onReceive_();
+      });
+    }
+    finish(gen, true, doneAt);
+    return;
+  }
+
+  if (ackers > 1) air.stats.collisions++;
+  uint64_t next = end + retryDelayUs();
+  if (tx_.retries < arc_) {
+    tx_.retries++;
+    tx_.doneAt = next;
+    sim::schedule(next, [this, gen] { attempt(gen); });
+  } else {
+    finish(gen, false, next);
+  }
+}
+
+void RF24::finish(uint32_t gen, bool ok, uint64_t at) {
+  tx_.doneAt = at;
+  sim::schedule(at, [this, gen, ok] {
+    if (gen != tx_.gen) return;
+    tx_.busy = false;
+    tx_.ok = ok;
+    lastArc_ = tx_.retries;
+    if (ok) counters.writeOk++;
+  });
+}
+
+bool RF24::deliver(const RF24* from, uint8_t pipe, const uint8_t* data, uint8_t len, uint8_t pid, uint64_t visibleAt) {
+  sim::Air& air = sim::Air::get();
+  // Chip thật so PID và CRC của gói trước, ở đây thay CRC bằng tổng kiểm tra payload
+  uint32_t sum = len;
+  for (uint8_t i = 0; i < len; i++) sum = sum * 31 + data[i];
+  lastDuplicate_ = from->id_ == lastFrom_ && pid == lastPid_ && sum == lastSum_;
+  if (lastDuplicate_) {
+    air.stats.duplicates++;
+    return true;
+  }
+  if (rx_.size() >= FIFO_DEPTH) return false;
+  lastFrom_ = from->id_;
+  lastPid_ = pid;
+  lastSum_ = sum;
+  Packet p;
+  p.pipe = pipe;
+  p.len = dynamicPayloads_ ? len : payloadSize_;
+  p.visibleAt = visibleAt;
+  memset(p.data, 0, sizeof(p.data));
+  memcpy(p.data, data, std::min(len, p.len));
+  rx_.push_back(p);
+  counters.received++;
+  air.stats.delivered++;
+  if (onReceive_) sim::schedule(visibleAt, [this] { if (onReceive_) onReceive_(); });
+  return true;
+}
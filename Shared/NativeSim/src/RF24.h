@@ -0,0 +1,126 @@
+/**
+ * RF24.h giả lập - cùng API với thư viện nrf24/RF24 mà firmware dùng
+ *
+ * write() chặn như radio thật: đồng hồ ảo tiến qua từng lần phát/phát lại,
+ * trong lúc đó các node ảo vẫn chạy. Actor của mô phỏng không được chặn nên
+ * dùng thêm beginWrite()/txBusy()/txOk() (chỉ có trong bản giả lập).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <deque>
+#include <functional>
+
+#include "SimAir.h"
+
+typedef enum { RF24_PA_MIN = 0, RF24_PA_LOW, RF24_PA_HIGH, RF24_PA_MAX, RF24_PA_ERROR } rf24_pa_dbm_e;
+typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
+typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
+
+class RF24 {
+ public:
+  RF24(uint16_t cePin, uint16_t csnPin);
+  ~RF24();
+
+  bool begin();
+  bool isChipConnected() { return true; }
+  void powerUp();
+  void powerDown();
+
+  void setPALevel(uint8_t level, bool lnaEnable = true) { (void)lnaEnable; paLevel_ = level; }
+  uint8_t getPALevel() { return paLevel_; }
+  bool setDataRate(rf24_datarate_e rate) { dataRate_ = rate; return true; }
+  rf24_datarate_e getDataRate() { return dataRate_; }
+  void setChannel(uint8_t channel) { channel_ = channel > 125 ? 125 : channel; }
+  uint8_t getChannel() { return channel_; }
+  void setRetries(uint8_t delay, uint8_t count) { ard_ = delay & 0x0F; arc_ = count & 0x0F; }
+  void setAutoAck(bool enable) { autoAck_ = enable; }
+  void setPayloadSize(uint8_t size) { payloadSize_ = size > 32 ? 32 : size; }
+  void setCRCLength(rf24_crclength_e) {}
+  void enableDynamicPayloads() { dynamicPayloads_ = true; }
+  void enableAckPayload() { ackPayloads_ = true; dynamicPayloads_ = true; }
+  void enableDynamicAck() {}
+
+  void openWritingPipe(uint64_t address) { txAddress_ = address & ADDR_MASK; }
+  void openReadingPipe(uint8_t pipe, uint64_t address);
+  void closeReadingPipe(uint8_t pipe) { if (pipe < 6) pipeOpen_[pipe] = false; }
+  void startListening();
+  void stopListening();
+
+  bool available() { return available(nullptr); }
+  bool available(uint8_t* pipe);
+  bool rxFifoFull() { return rx_.size() >= FIFO_DEPTH; }
+  uint8_t getDynamicPayloadSize();
+  uint8_t getPayloadSize() { return payloadSize_; }
+  void read(void* buf, uint8_t len);
+  uint8_t flush_rx() { rx_.clear(); return 0; }
+  uint8_t flush_tx() { ackQueue_.clear(); return 0; }
+
+  bool write(const void* buf, uint8_t len) { return write(buf, len, false); }
+  bool write(const void* buf, uint8_t len, bool multicast);
+  bool writeAckPayload(uint8_t pipe, const void* buf, uint8_t len);
+  bool isAckPayloadAvailable() { return available(); }
+  uint8_t getARC() { return lastArc_; }
+  bool testRPD();
+  bool testCarrier() { return testRPD(); }
+
+  // --- Chỉ có trong mô phỏng ---
+  void beginWrite(const void* buf, uint8_t len, bool multicast = false);
+  bool txBusy() const { return tx_.busy; }
+  bool txOk() const { return tx_.ok; }
+  uint64_t txDoneAt() const { return tx_.doneAt; }
+  uint32_t simId() const { return id_; }
+  void onReceive(std::function<void()> fn) { onReceive_ = std::move(fn); }  // Gọi khi có gói đọc được trong FIFO
+  bool isListening() const { return listening_; }
+  bool isPowered() const { return powered_; }
+  uint64_t rxTimeUs() const;  // Tổng thời gian đã bật nguồn và ở chế độ nghe, ~13.5mA trên chip thật
+
+  struct Counters {
+    uint32_t writes = 0, writeOk = 0, attempts = 0, received = 0, ackPayloads = 0;
+  } counters;
+
+ private:
+  static const uint64_t ADDR_MASK = 0xFFFFFFFFFFULL;
+  static const uint8_t FIFO_DEPTH = 3;
+
+  struct Packet { uint8_t pipe; uint8_t len; uint8_t data[32]; uint64_t visibleAt; };  // Firmware chỉ thấy gói khi ACK đã phát xong
+  struct AckPayload { uint8_t pipe; uint8_t len; uint8_t data[32]; bool sent; };
+  struct TxState {
+    bool busy = false, ok = false, noAck = false;
+    uint8_t len = 0, retries = 0;
+    uint8_t data[32];
+    uint64_t address = 0, doneAt = 0;
+    uint32_t gen = 0;
+  };
+
+  int matchPipe(uint64_t address) const;
+  void attempt(uint32_t gen);
+  void finish(uint32_t gen, bool ok, uint64_t at);
+  bool deliver(const RF24* from, uint8_t pipe, const uint8_t* data, uint8_t len, uint8_t pid, uint64_t visibleAt);
+  bool ready() const { return !rx_.empty() && rx_.front().visibleAt <= sim::now(); }
+  bool takeAckPayload(uint8_t pipe, bool retransmit, AckPayload& out);
+  uint32_t airtimeUs(uint8_t len) const;
+  uint32_t retryDelayUs() const { return (ard_ + 1) * 250; }
+  void trackRx();  // Gọi trước mỗi lần đổi powered_/listening_
+
+  uint32_t id_;
+  bool powered_ = false, listening_ = false, autoAck_ = true;
+  bool dynamicPayloads_ = false, ackPayloads_ = false;
+  uint8_t channel_ = 76, paLevel_ = RF24_PA_MAX, payloadSize_ = 32;
+  rf24_datarate_e dataRate_ = RF24_1MBPS;
+  uint8_t ard_ = 5, arc_ = 15, lastArc_ = 0, pid_ = 0;
+  uint64_t txAddress_ = 0;
+  uint64_t pipeAddr_[6] = {};
+  bool pipeOpen_[6] = {};
+  std::deque<Packet> rx_;
+  std::deque<AckPayload> ackQueue_;
+  TxState tx_;
+  std::function<void()> onReceive_;
+  uint32_t lastFrom_ = 0;
+  uint8_t lastPid_ = 0xFF;
+  bool lastDuplicate_ = false;  // Gói cuối cùng deliver() nhận là bản phát lại
+  uint64_t rxUs_ = 0, rxSince_ = 0;
+  uint32_t lastSum_ = 0;
+};
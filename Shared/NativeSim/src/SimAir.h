@@ -0,0 +1,74 @@
+/**
+ * SimAir - Không gian sóng ảo dùng chung cho mọi RF24 trong tiến trình
+ *
+ * Mô hình ở mức gói tin của nRF24L01+ Enhanced ShockBurst:
+ * - Gói chỉ tới radio đang bật, đang nghe, cùng kênh, cùng tốc độ và có pipe
+ *   khớp địa chỉ (pipe 2-5 dùng 4 byte cao của pipe 1 như chip thật)
+ * - Mỗi lần phát có thể mất theo xác suất của liên kết, ACK mất độc lập
+ * - Hai radio cùng nhận một địa chỉ thì ACK va nhau, bên gửi coi như thất bại
+ * - Phát chồng lên nhau trên cùng kênh thì gói phát sau bị hỏng
+ * - Gói phát lại (ACK bị mất) được bên nhận nhận diện qua PID và không đẩy lần hai
+ * - Liên kết có biên (dB, ở 250kbps và PA_MAX) thì tỉ lệ mất tăng khi tốc độ cao
+ *   hơn (độ nhạy kém đi) hoặc PA bên phát thấp hơn
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+class RF24;
+
+namespace sim {
+
+struct AirConfig {
+  double loss = 0.0;          // Xác suất mất một lần phát (mặc định cho mọi liên kết)
+  double ackLoss = 0.0;       // Xác suất mất ACK khi gói đã tới nơi
+  uint32_t latencyUs = 0;     // Trễ cộng thêm cho mỗi giao dịch có ACK
+  bool autoAck = true;        // false: bên nhận không bao giờ ACK, write() trả true ngay sau lần phát đầu
+};
+
+struct AirStats {
+  uint64_t attempts = 0;      // Số lần phát (kể cả phát lại)
+  uint64_t delivered = 0;     // Số gói vào FIFO bên nhận
+  uint64_t acked = 0;
+  uint64_t lost = 0;          // Mất do liên kết hoặc nhiễu
+  uint64_t collisions = 0;    // Phát chồng hoặc ACK va nhau
+  uint64_t duplicates = 0;    // Gói phát lại bị PID lọc
+  uint64_t airtimeUs = 0;     // Tổng thời gian phát (gói và ACK), không gồm 130us chuyển chế độ
+};
+
+class Air {
+ public:
+  static Air& get();
+
+  AirConfig config;
+  AirStats stats;
+
+  void setLinkLoss(uint32_t a, uint32_t b, double loss);  // Đối xứng, 1.0 = ngoài tầm phủ sóng
+  double linkLoss(uint32_t a, uint32_t b) const;
+  void setLinkMargin(uint32_t a, uint32_t b, double db);  // Đối xứng, thay cho phần mất tính theo tốc độ/PA
+  double linkLoss(uint32_t from, uint32_t to, uint8_t dataRate, uint8_t pa) const;  // rf24_datarate_e, rf24_pa_dbm_e của bên phát
+  void setNoise(uint8_t channel, double prob);            // Xác suất một lần phát trên kênh bị nhiễu phá
+  double noise(uint8_t channel) const;
+  void reset();                                           // Giữ radio, xóa cấu hình liên kết và thống kê
+
+  // --- Dùng nội bộ bởi RF24 ---
+  void attach(RF24* radio);
+  void detach(RF24* radio);
+  const std::vector<RF24*>& radios() const { return radios_; }
+  uint64_t busyUntil(uint8_t channel) const { return busy_[channel & 0x7F]; }
+  void occupy(uint8_t channel, uint64_t until) { busy_[channel & 0x7F] = until; }
+
+ private:
+  std::vector<RF24*> radios_;
+  std::map<std::pair<uint32_t, uint32_t>, double> links_;
+  std::map<std::pair<uint32_t, uint32_t>, double> margins_;
+  double noise_[128] = {};
+  uint64_t busy_[128] = {};
+};
+
+} // namespace sim
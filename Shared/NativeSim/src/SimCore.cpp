@@ -0,0 +1,159 @@
+#include "SimCore.h"
+#include "Arduino.h"
+#include "SimAir.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <map>
+#include <queue>
+#include <vector>
+
+namespace sim {
+
+uint32_t callCostUs = 20;
+
+namespace {
+
+struct Event {
+  uint64_t time;
+  uint64_t seq;
+  Actor* actor;
+  uint64_t stamp;
+  std::function<void()> fn;
+  bool operator>(const Event& o) const { return time != o.time ? time > o.time : seq > o.seq; }
+};
+
+uint64_t nowUs = 0;
+uint64_t seqCounter = 0;
+bool inEvent = false;
+std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+
+std::deque<uint8_t> serialRx;
+std::function<void(const uint8_t*, size_t)> serialSink;
+
+struct Analog { int value; int noise; };
+std::map<int, int> pinLevels;
+std::map<int, int> pinModes;
+std::map<int, Analog> analogValues;
+std::map<int, void (*)()> interrupts;
+
+} // namespace
+
+uint64_t now() { return nowUs; }
+
+void advance(uint64_t us) { advanceTo(nowUs + us); }
+
+void advanceTo(uint64_t t) {
+  if (inEvent) return;  // Actor không được tự làm tiến thời gian
+  while (!events.empty() && events.top().time <= t) {
+    Event e = events.top();
+    events.pop();
+    if (e.actor && (e.actor->wake_ != e.time || e.actor->stamp_ != e.stamp)) continue;  // Lịch đã bị ghi đè
+    if (e.time > nowUs) nowUs = e.time;
+    inEvent = true;
+    if (e.actor) { e.actor->wake_ = NEVER; e.actor->wake(); }
+    else e.fn();
+    inEvent = false;
+  }
+  if (t > nowUs) nowUs = t;
+}
+
+void Actor::wakeAt(uint64_t t) {
+  if (t < nowUs) t = nowUs;
+  wake_ = t;
+  stamp_ = ++seqCounter;
+  events.push(Event{ t, seqCounter, this, stamp_, nullptr });
+}
+
+void schedule(uint64_t at, std::function<void()> fn) {
+  if (at < nowUs) at = nowUs;
+  events.push(Event{ at, ++seqCounter, nullptr, 0, std::move(fn) });
+}
+
+void reset() {
+  while (!events.empty()) events.pop();
+  nowUs = 0;
+  serialRx.clear();
+  Air::get().reset();
+}
+
+void seed(uint32_t s) { rngState = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)s * 0xBF58476D1CE4E5B9ULL); }
+
+uint32_t rand32() {
+  // splitmix64
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+double uniform() { return rand32() / 4294967296.0; }
+
+void serialInput(const char* data, size_t len) { serialRx.insert(serialRx.end(), data, data + len); }
+void serialInput(const char* line) { serialInput(line, strlen(line)); }
+void setSerialSink(std::function<void(const uint8_t*, size_t)> sink) { serialSink = std::move(sink); }
+
+void setPin(int pin, int level) { pinLevels[pin] = level; }
+void setAnalog(int pin, int value, int noise) { analogValues[pin] = Analog{ value, noise }; }
+
+void triggerInterrupt(int pin) {
+  auto it = interrupts.find(pin);
+  if (it != interrupts.end() && it->second) it->second();
+}
+
+// --- PHẦN ĐỆM CHO Arduino.h ---
+
+int serialAvailable() { return serialRx.size(); }
+
+int serialRead() {
+  if (serialRx.empty()) return -1;
+  int c = serialRx.front();
+  serialRx.pop_front();
+  return c;
+}
+
+int serialPeek() { return serialRx.empty() ? -1 : serialRx.front(); }
+
+void serialWrite(const uint8_t* data, size_t len) {
+  if (serialSink) serialSink(data, len);
+  else fwrite(data, 1, len, stdout);
+}
+
+int pinRead(int pin) {
+  auto it = pinLevels.find(pin);
+  if (it != pinLevels.end()) return it->second;
+  return pinModes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void pinSetMode(int pin, int mode) { pinModes[pin] = mode; }
+
+int analogSample(int pin) {
+  auto it = analogValues.find(pin);
+  if (it == analogValues.end()) return 512;
+  int v = it->second.value;
+  if (it->second.noise) v += (int)(rand32() % (2 * it->second.noise + 1)) - it->second.noise;
+  return v < 0 ? 0 : v;
+}
+
+void setInterrupt(int pin, void (*fn)()) { interrupts[pin] = fn; }
+
+} // namespace sim
+
+HardwareSerial Serial;
+
+#include "EEPROM.h"
+#include "SPI.h"
+#include "SimSensors.h"
+#include "Wire.h"
+
+SPIClass SPI;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+namespace sim {
+Sensors sensors;
+}
@@ -0,0 +1,60 @@
+/**
+ * SimCore - Đồng hồ ảo, lịch sự kiện và trạng thái phần cứng giả lập
+ *
+ * Thời gian là micro giây ảo, chỉ tiến khi firmware gọi millis()/micros()/delay()
+ * hoặc khi radio chặn trong write(). Mỗi lần tiến, các Actor (node/hub ảo) và
+ * sự kiện radio tới hạn được chạy theo đúng thứ tự thời gian, nên cùng seed
+ * thì mọi lần chạy cho kết quả giống hệt nhau.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+namespace sim {
+
+const uint64_t NEVER = UINT64_MAX;
+
+// --- ĐỒNG HỒ ẢO ---
+uint64_t now();                 // µs, không làm tiến thời gian
+void advance(uint64_t us);
+void advanceTo(uint64_t t);
+extern uint32_t callCostUs;     // Thời gian ảo tiêu tốn cho mỗi lần firmware gọi millis()/micros()
+
+// --- LỊCH SỰ KIỆN ---
+class Actor {
+ public:
+  virtual ~Actor() {}
+  virtual void wake() = 0;      // Gọi khi tới lịch, Actor tự đặt lịch kế tiếp
+  void wakeAt(uint64_t t);      // Ghi đè lịch cũ
+  void wakeIn(uint64_t us) { wakeAt(now() + us); }
+  uint64_t nextWake() const { return wake_; }
+
+ private:
+  friend void advanceTo(uint64_t t);
+  uint64_t wake_ = NEVER;
+  uint64_t stamp_ = 0;
+};
+
+void schedule(uint64_t at, std::function<void()> fn);
+void reset();                   // Xóa lịch, radio, Actor, đưa đồng hồ về 0 (dùng giữa các kịch bản benchmark)
+
+// --- NGẪU NHIÊN TẤT ĐỊNH ---
+void seed(uint32_t s);
+uint32_t rand32();
+double uniform();               // [0, 1)
+
+// --- SERIAL CỦA FIRMWARE ---
+void serialInput(const char* data, size_t len);
+void serialInput(const char* line);
+void setSerialSink(std::function<void(const uint8_t*, size_t)> sink);  // Mặc định ghi ra stdout
+
+// --- GPIO / ADC ---
+void setPin(int pin, int level);
+void setAnalog(int pin, int value, int noise = 0);
+void triggerInterrupt(int pin);
+
+} // namespace sim
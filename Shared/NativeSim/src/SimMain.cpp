@@ -0,0 +1,323 @@
+/**
+ * SimMain - Điểm vào của bản build native, thay cho main() của Arduino core
+ *
+ * Chạy setup() rồi loop() của firmware trên đồng hồ ảo, kèm các node/hub ảo
+ * cùng một không gian sóng. Lệnh Serial đọc từ stdin, kết quả Serial ra stdout,
+ * nhật ký mô phỏng ra stderr.
+ *
+ * File này chỉ chứa main(): chương trình nào tự định nghĩa main() (benchmark)
+ * thì linker không kéo file này vào.
+ */
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "SimNodes.h"
+
+#if !defined(SIM_HUB_FIRMWARE) && !defined(SIM_NODE_FIRMWARE)
+#define SIM_HUB_FIRMWARE
+#endif
+
+extern RF24 radio;  // Radio của firmware đang chạy (MainHub, Soil hoặc ATM Node)
+
+namespace {
+
+struct Options {
+  int soil = -1, atm = -1, offline = 0;
+  long hubPollMs = -1;
+  int sleepS = 0, reportS = 0, sampleS = 0;
+  int far = 0, hops = 1;
+  double marginMin = 0, marginMax = 0;
+  bool margins = false;
+  int pulsePin = -1;
+  double pulseHz = 0;
+  long durationMs = 60000;
+  uint32_t seed = 1;
+  bool realtime = false, registerNodes = true;
+};
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --soil N          Số Soil Node ảo (mặc định 3 khi firmware là MainHub)\n"
+          "  --atm N           Số ATM Node ảo (mặc định 1 khi firmware là MainHub)\n"
+          "  --offline N       N node cuối cùng tắt nguồn sau khi đăng ký\n"
+          "  --no-register     Không tự đăng ký node ảo vào Hub\n"
+          "  --hub MS          Hub ảo hỏi dữ liệu mỗi MS (mặc định 2000 khi firmware là node)\n"
+          "  --sleep S         Cho Soil Node ngủ, thức mỗi S giây (setSleep / gói SLP)\n"
+          "  --report S        Bật deadband mặc định, bản đủ mỗi S giây (setReport / gói RPT)\n"
+          "  --sample S        Node lấy mẫu mỗi S giây, gửi theo lô (setSampleInterval / gói BAT)\n"
+          "  --far N           N Soil Node cuối ngoài tầm Hub, đi qua ATM Node làm relay (setRoute / gói RTE)\n"
+          "  --hops N          Số ATM Node nối tiếp làm relay cho --far (mặc định 1)\n"
+          "  --loss P          Xác suất mất gói mỗi lần phát\n"
+          "  --ack-loss P      Xác suất mất ACK\n"
+          "  --noise CH:P      Kênh CH bị nhiễu phá mỗi lần phát với xác suất P (lặp được)\n"
+          "  --margin MIN:MAX  Biên (dB, ở 250kbps/PA_MAX) Hub-node trải đều từ MIN tới MAX, mất gói theo tốc độ/PA\n"
+          "  --latency US      Trễ thêm mỗi giao dịch\n"
+          "  --pulse PIN:HZ    Xung ngẫu nhiên (Poisson) trung bình HZ lần/giây vào ngắt PIN (cảm biến gió: 12)\n"
+          "  --no-ack          Tắt auto-ack trên toàn không gian sóng\n"
+          "  --seed N          Hạt giống ngẫu nhiên\n"
+          "  --duration MS     Thời gian ảo chạy (mặc định 60000, 0 = vô hạn)\n"
+          "  --call-cost US    Thời gian ảo mỗi lần gọi millis()/micros() (mặc định 20)\n"
+          "  --realtime        Giữ đồng hồ ảo theo đồng hồ thật (mặc định khi stdin là terminal)\n",
+          prog);
+}
+
+// Khoảng cách giữa hai xung phân bố mũ nên số xung mỗi giây dao động như gió giật
+void schedulePulse(int pin, double hz) {
+  uint64_t gap = (uint64_t)(-log(1.0 - sim::uniform()) / hz * 1e6) + 1;
+  sim::schedule(sim::now() + gap, [pin, hz] {
+    sim::triggerInterrupt(pin);
+    schedulePulse(pin, hz);
+  });
+}
+
+uint64_t wallUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void pumpStdin() {
+  char buf[256];
+  ssize_t n;
+  while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) sim::serialInput(buf, n);
+}
+
+void runFor(uint64_t us) {
+  uint64_t until = sim::now() + us;
+  while (sim::now() < until) { loop(); sim::advance(sim::callCostUs); }
+}
+
+// Cho các Soil Node ảo ngủ bằng lệnh setSleep của MainHub
+void configureSleep(std::vector<std::unique_ptr<sim::VirtualNode>>& nodes, int seconds) {
+#ifdef SIM_HUB_FIRMWARE
+  char cmd[48];
+  for (auto& node : nodes) {
+    if (node->kind() != sim::NODE_SOIL || !node->registered()) continue;
+    snprintf(cmd, sizeof(cmd), "setSleep %s %d\n", node->id(), seconds);
+    sim::serialInput(cmd);
+    runFor(100000);
+  }
+#else
+  (void)nodes; (void)seconds;
+#endif
+}
+
+// Bật lọc deadband bằng lệnh setReport của MainHub, deadband như VirtualHub
+void configureReport(std::vector<std::unique_ptr<sim::VirtualNode>>& nodes, int heartbeat) {
+#ifdef SIM_HUB_FIRMWARE
+  char cmd[64];
+  for (auto& node : nodes) {
+    if (!node->registered()) continue;
+    const uint16_t* db = node->kind() == sim::NODE_SOIL ? sim::SOIL_DEADBAND : sim::ATM_DEADBAND;
+    int n = snprintf(cmd, sizeof(cmd), "setReport %s %d", node->id(), heartbeat);
+    for (int i = 0; i < (node->kind() == sim::NODE_SOIL ? 2 : 6); i++) n += snprintf(cmd + n, sizeof(cmd) - n, " %u", db[i]);
+    snprintf(cmd + n, sizeof(cmd) - n, "\n");
+    sim::serialInput(cmd);
+    runFor(100000);
+  }
+#else
+  (void)nodes; (void)heartbeat;
+#endif
+}
+
+// Bật lấy mẫu theo lô bằng lệnh setSampleInterval của MainHub
+void configureSample(std::vector<std::unique_ptr<sim::VirtualNode>>& nodes, int seconds) {
+#ifdef SIM_HUB_FIRMWARE
+  char cmd[48];
+  for (auto& node : nodes) {
+    if (!node->registered()) continue;
+    snprintf(cmd, sizeof(cmd), "setSampleInterval %s %d\n", node->id(), seconds);
+    sim::serialInput(cmd);
+    runFor(100000);
+  }
+#else
+  (void)nodes; (void)seconds;
+#endif
+}
+
+// Cắt liên kết Hub với N Soil Node cuối và cho chúng đi qua chuỗi hops ATM Node: relay k
+// chỉ nghe được relay k-1, node xa chỉ nghe được relay cuối. Node đã đăng ký trong tầm Hub.
+void configureRoutes(std::vector<std::unique_ptr<sim::VirtualNode>>& nodes, int far, int hops) {
+#ifdef SIM_HUB_FIRMWARE
+  std::vector<sim::VirtualNode*> relays, leaves;
+  for (auto& node : nodes) {
+    if (node->kind() == sim::NODE_ATM && (int)relays.size() < hops) relays.push_back(node.get());
+  }
+  for (auto it = nodes.rbegin(); it != nodes.rend() && (int)leaves.size() < far; ++it) {
+    if ((*it)->kind() == sim::NODE_SOIL) leaves.push_back(it->get());
+  }
+  if (relays.empty()) { fprintf(stderr, "[sim] --far needs --atm\n"); return; }
+
+  sim::Air& air = sim::Air::get();
+  char cmd[48];
+  auto route = [&](sim::VirtualNode* node, sim::VirtualNode* relay) {
+    snprintf(cmd, sizeof(cmd), "setRoute %s %s\n", node->id(), relay->id());
+    sim::serialInput(cmd);
+    runFor(200000);
+  };
+  for (size_t k = 1; k < relays.size(); k++) {
+    air.setLinkLoss(radio.simId(), relays[k]->radio().simId(), 1.0);
+    for (size_t j = 0; j + 1 < k; j++) air.setLinkLoss(relays[j]->radio().simId(), relays[k]->radio().simId(), 1.0);
+    route(relays[k], relays[k - 1]);
+  }
+  for (sim::VirtualNode* leaf : leaves) {
+    air.setLinkLoss(radio.simId(), leaf->radio().simId(), 1.0);
+    for (size_t j = 0; j + 1 < relays.size(); j++) air.setLinkLoss(relays[j]->radio().simId(), leaf->radio().simId(), 1.0);
+    route(leaf, relays.back());
+  }
+#else
+  (void)nodes; (void)far; (void)hops;
+#endif
+}
+
+// Đăng ký từng node vào Hub qua đúng lệnh Serial mà App dùng
+void registerAll(std::vector<std::unique_ptr<sim::VirtualNode>>& nodes) {
+  for (auto& node : nodes) {
+    sim::serialInput("registerNewNode\n");
+    node->allowRegister();
+    uint64_t giveUp = sim::now() + 10000000;
+    while (!node->registered() && sim::now() < giveUp) { loop(); sim::advance(sim::callCostUs); }
+    if (!node->registered()) fprintf(stderr, "[sim] %s failed to register\n", node->id());
+    // Chờ Hub thoát chế độ đăng ký (nháy LED 500ms)
+    runFor(1000000);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  sim::Air& air = sim::Air::get();
+  opt.realtime = isatty(STDIN_FILENO);
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--soil" && hasValue) opt.soil = atoi(argv[++i]);
+    else if (a == "--atm" && hasValue) opt.atm = atoi(argv[++i]);
+    else if (a == "--offline" && hasValue) opt.offline = atoi(argv[++i]);
+    else if (a == "--no-register") opt.registerNodes = false;
+    else if (a == "--hub" && hasValue) opt.hubPollMs = atol(argv[++i]);
+    else if (a == "--sleep" && hasValue) opt.sleepS = atoi(argv[++i]);
+    else if (a == "--report" && hasValue) opt.reportS = atoi(argv[++i]);
+    else if (a == "--sample" && hasValue) opt.sampleS = atoi(argv[++i]);
+    else if (a == "--far" && hasValue) opt.far = atoi(argv[++i]);
+    else if (a == "--hops" && hasValue) opt.hops = atoi(argv[++i]);
+    else if (a == "--loss" && hasValue) air.config.loss = atof(argv[++i]);
+    else if (a == "--ack-loss" && hasValue) air.config.ackLoss = atof(argv[++i]);
+    else if (a == "--noise" && hasValue && strchr(argv[i + 1], ':')) {
+      char* value = argv[++i];
+      air.setNoise(atoi(value), atof(strchr(value, ':') + 1));
+    }
+    else if (a == "--margin" && hasValue && strchr(argv[i + 1], ':')) {
+      char* value = argv[++i];
+      opt.margins = true;
+      opt.marginMin = atof(value);
+      opt.marginMax = atof(strchr(value, ':') + 1);
+    }
+    else if (a == "--pulse" && hasValue && strchr(argv[i + 1], ':')) {
+      char* value = argv[++i];
+      opt.pulsePin = atoi(value);
+      opt.pulseHz = atof(strchr(value, ':') + 1);
+    }
+    else if (a == "--latency" && hasValue) air.config.latencyUs = atol(argv[++i]);
+    else if (a == "--no-ack") air.config.autoAck = false;
+    else if (a == "--seed" && hasValue) opt.seed = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--duration" && hasValue) opt.durationMs = atol(argv[++i]);
+    else if (a == "--call-cost" && hasValue) sim::callCostUs = strtoul(argv[++i], nullptr, 10);
+    else if (a == "--realtime") opt.realtime = true;
+    else {
+      usage(argv[0]);
+      return a == "--help" ? 0 : 2;
+    }
+  }
+
+#ifdef SIM_HUB_FIRMWARE
+  if (opt.soil < 0 && opt.atm < 0) { opt.soil = 3; opt.atm = 1; }
+#else
+  if (opt.hubPollMs < 0) opt.hubPollMs = 2000;
+#endif
+  if (opt.soil < 0) opt.soil = 0;
+  if (opt.atm < 0) opt.atm = 0;
+
+  sim::seed(opt.seed);
+  // Giá trị ADC hợp lý cho Soil Node: độ ẩm đất ~55%, LM35 ~29°C
+  sim::setAnalog(A0, 460, 15);
+  sim::setAnalog(A1, 80, 2);
+  fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+  std::vector<std::unique_ptr<sim::VirtualNode>> nodes;
+  char id[11];
+  for (int i = 0; i < opt.soil; i++) {
+    snprintf(id, sizeof(id), "soil%04d", (i + 1) % 10000);
+    nodes.emplace_back(new sim::VirtualNode(sim::NODE_SOIL, id));
+  }
+  for (int i = 0; i < opt.atm; i++) {
+    snprintf(id, sizeof(id), "atm%05d", (i + 1) % 100000);
+    nodes.emplace_back(new sim::VirtualNode(sim::NODE_ATM, id));
+  }
+  std::unique_ptr<sim::VirtualHub> hub;
+  if (opt.hubPollMs > 0) hub.reset(new sim::VirtualHub(opt.hubPollMs, opt.sleepS, opt.reportS, opt.sampleS));
+
+  setup();
+  if (opt.pulsePin >= 0 && opt.pulseHz > 0) schedulePulse(opt.pulsePin, opt.pulseHz);
+
+  // Node đầu xa Hub nhất. Trước khi đăng ký để cả gói REG cũng chịu biên này.
+  for (size_t i = 0; opt.margins && i < nodes.size(); i++) {
+    double t = nodes.size() > 1 ? (double)i / (nodes.size() - 1) : 0;
+    air.setLinkMargin(radio.simId(), nodes[i]->radio().simId(), opt.marginMin + t * (opt.marginMax - opt.marginMin));
+  }
+
+  if (opt.registerNodes) registerAll(nodes);
+  if (opt.far > 0) configureRoutes(nodes, opt.far, opt.hops);
+  if (opt.reportS > 0) configureReport(nodes, opt.reportS);
+  if (opt.sampleS > 0) configureSample(nodes, opt.sampleS);
+  if (opt.sleepS > 0) configureSleep(nodes, opt.sleepS);
+  for (int i = 0; i < opt.offline && i < (int)nodes.size(); i++) nodes[nodes.size() - 1 - i]->setOnline(false);
+
+  uint64_t end = opt.durationMs > 0 ? sim::now() + opt.durationMs * 1000ULL : sim::NEVER;
+  uint64_t wallStart = wallUs(), simStart = sim::now();
+  while (sim::now() < end) {
+    pumpStdin();
+    loop();
+    sim::advance(sim::callCostUs);  // Firmware không gọi millis() khi rảnh vẫn phải tốn thời gian
+    if (opt.realtime) {
+      int64_t ahead = (int64_t)(sim::now() - simStart) - (int64_t)(wallUs() - wallStart);
+      if (ahead > 2000) usleep(ahead);
+    }
+  }
+
+  const sim::AirStats& s = air.stats;
+  fprintf(stderr,
+          "[sim] %.3fs attempts=%llu delivered=%llu acked=%llu lost=%llu collisions=%llu duplicates=%llu air=%.3fs\n",
+          sim::now() / 1e6, (unsigned long long)s.attempts, (unsigned long long)s.delivered,
+          (unsigned long long)s.acked, (unsigned long long)s.lost, (unsigned long long)s.collisions,
+          (unsigned long long)s.duplicates, s.airtimeUs / 1e6);
+  // Thời gian radio ở chế độ nghe quyết định năng lượng của node (RX ~13.5mA, power-down ~1µA)
+  double elapsed = sim::now();
+  for (auto& node : nodes) {
+    fprintf(stderr, "[sim] %s addr=0x%02X gets=%u ack=%u replies=%u oks=%u pushes=%u wakes=%u unchanged=%u rx=%.2f%%",
+            node->id(), node->addr(), node->counters.gets, node->counters.ackReplies, node->counters.replies,
+            node->counters.oks, node->counters.pushes, node->counters.wakes, node->counters.unchanged, 100.0 * node->radio().rxTimeUs() / elapsed);
+    if (node->counters.relayed || node->counters.childLost || node->counters.forwards) {
+      fprintf(stderr, " relayed=%u child_lost=%u forwards=%u", node->counters.relayed, node->counters.childLost, node->counters.forwards);
+    }
+    if (node->counters.channelMoves || node->counters.searches) {
+      fprintf(stderr, " channel=%u moves=%u searches=%u", node->channel(), node->counters.channelMoves, node->counters.searches);
+    }
+    if (node->counters.linkChanges) {
+      fprintf(stderr, " kbps=%u link_changes=%u", nodeproto::rateKbps(node->linkRate()), node->counters.linkChanges);
+    }
+    fprintf(stderr, "\n");
+  }
+  fprintf(stderr, "[sim] firmware radio rx=%.2f%%\n", 100.0 * radio.rxTimeUs() / elapsed);
+  return 0;
+}
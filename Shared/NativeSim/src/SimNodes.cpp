@@ -0,0 +1,1046 @@
+#include "SimNodes.h"
+
+#include <algorithm>
+
+namespace sim {
+
+namespace {
+
+const uint64_t REG_REPLY_TIMEOUT = 500000;
+const uint64_t HUB_REPLY_TIMEOUT = 500000;
+const uint8_t PUSH_MAX_RETRIES = 3;
+const uint64_t WAKE_GRACE_US = 5000000;  // WAKE_GRACE_MS của MainHub
+
+// Hằng số relay của ATM Node
+const size_t RELAY_CHILDREN = 8;
+const uint64_t RELAY_POLL_US = 10000000;
+const uint64_t RELAY_REPLY_US = 100000;
+const uint64_t RELAY_FRAME_GAP_US = 3000;
+const uint8_t RELAY_ATTEMPTS = 3;
+const uint8_t RELAY_MAX_FRAMES = 8;
+const uint8_t RELAY_RX_PIPE = 2;
+const uint8_t SEARCH_RETRIES = 5;
+
+void setupRadio(RF24& radio, uint8_t pa, uint8_t retryDelay) {
+  radio.begin();
+  radio.setPALevel(pa);
+  radio.setDataRate(RF24_250KBPS);
+  radio.setRetries(retryDelay, 15);
+  radio.enableDynamicPayloads();
+  radio.enableAckPayload();
+}
+
+float between(float lo, float hi) { return lo + (float)uniform() * (hi - lo); }
+
+uint8_t protoKind(NodeKind kind) { return kind == NODE_SOIL ? nodeproto::KIND_SOIL : nodeproto::KIND_ATM; }
+
+uint16_t nodeSeconds() { return now() / 1000000; }
+
+} // namespace
+
+// --- NODE ẢO ---
+
+VirtualNode::VirtualNode(NodeKind kind, const char* id)
+    : radio_(0, 0), kind_(kind), responseUs_(2000) {  // ATM Node trả snapshot có sẵn, không chờ DHT/BMP280
+  strncpy(id_, id, 10);
+  id_[10] = '\0';
+  if (kind_ == NODE_SOIL) {
+    base_[0] = (float)(int)between(30, 80);
+    base_[1] = between(25, 32);
+  } else {
+    base_[0] = sensors.airTemp;
+    base_[1] = sensors.airHumid;
+    base_[2] = (float)(rand32() % 101);
+    base_[3] = between(0, 12);
+    base_[4] = between(0, 100);
+    base_[5] = sensors.pressurePa / 100.0f;
+  }
+  setupRadio(radio_, RF24_PA_HIGH, 15);
+  radio_.onReceive([this] {
+    if (state_ == REG_WAIT || state_ == LISTEN || state_ == WAIT_OK || state_ == CHILD_WAIT) wakeIn(0);
+  });
+}
+
+// Hết cửa sổ nghe: tắt radio tới lần thức kế tiếp, giống radio.powerDown() + sleepFor().
+// Chu kỳ BAT ngắn hơn thì thức giữa chừng chỉ để lấy mẫu.
+void VirtualNode::goSleep() {
+  radio_.powerDown();
+  state_ = SLEEP;
+  wakeAt(sampleInterval_ && nextSample_ < nextPush_ ? nextSample_ : nextPush_);
+}
+
+void VirtualNode::allowRegister() {
+  wantRegister_ = true;
+  if (online_ && !registered_ && state_ == IDLE) wakeIn(0);
+}
+
+void VirtualNode::assign(uint8_t addr) {
+  registered_ = true;
+  addr_ = addr;
+  if (online_) enterListen();
+}
+
+void VirtualNode::setOnline(bool online) {
+  if (online == online_) return;
+  online_ = online;
+  if (!online) {
+    radio_.powerDown();
+    state_ = IDLE;
+    wakeAt(NEVER);
+    return;
+  }
+  radio_.powerUp();
+  if (registered_) enterListen();
+  else if (wantRegister_) wakeIn(0);
+}
+
+void VirtualNode::listen(uint64_t pipe) {
+  radio_.setDataRate((rf24_datarate_e)nodeproto::rf24DataRate(linkRate_));
+  radio_.setPALevel(linkPa_);
+  radio_.openReadingPipe(0, nodeproto::CHANNEL_PIPE);
+  radio_.openReadingPipe(1, pipe);
+  radio_.startListening();
+  ackLoaded_ = false;
+}
+
+// preloadReading() của firmware, đọc cảm biến tức thì nên không tốn thời gian ảo.
+// Khung relay đi trước khung batch và số đo của chính node.
+void VirtualNode::preload() {
+  uint8_t frame[32];
+  frame[0] = addr_;
+  uint8_t len;
+  preloadRelay_ = !relayed_.empty();
+  if (preloadRelay_) {
+    len = 1 + relayed_.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), preloadTaken_);
+    preloadFull_ = false;
+  } else if (queued()) {
+    len = 1 + packSamples(frame + 1, sizeof(frame) - 1, preloadTaken_);
+    preloadFull_ = false;
+  } else {
+    preloadTaken_ = 0;
+    len = 1 + makeReading(frame + 1);
+    memcpy(preloaded_, frame + 1, len - 1);
+    preloadFull_ = needsFull(preloaded_);
+    if (!preloadFull_) len = 1;
+  }
+  radio_.flush_tx();
+  ackLoaded_ = radio_.writeAckPayload(1, frame, len);
+}
+
+// --- BATCH: takeSample()/SampleQueue của firmware, hàng đợi theo loại node ---
+
+uint8_t VirtualNode::queued() const { return kind_ == NODE_SOIL ? soilSamples_.size() : atmSamples_.size(); }
+
+uint8_t VirtualNode::packSamples(uint8_t* out, uint8_t room, uint8_t& taken) const {
+  if (kind_ == NODE_SOIL) return soilSamples_.pack(out, room, nodeSeconds(), taken);
+  return atmSamples_.pack(out, room, nodeSeconds(), taken);
+}
+
+void VirtualNode::dropSamples(uint8_t n) {
+  if (kind_ == NODE_SOIL) soilSamples_.drop(n);
+  else atmSamples_.drop(n);
+}
+
+void VirtualNode::takeSample() {
+  nextSample_ = now() + sampleInterval_ * 1000000ULL;
+  uint8_t reading[32];
+  makeReading(reading);
+  if (!needsFull(reading)) return;
+  markSent(reading);
+  if (kind_ == NODE_SOIL) {
+    SoilPayload d;
+    memcpy(&d, reading, sizeof(d));
+    soilSamples_.push(nodeSeconds(), d);
+  } else {
+    AtmPayload d;
+    memcpy(&d, reading, sizeof(d));
+    atmSamples_.push(nodeSeconds(), d);
+  }
+  if (ackMode_ && ackLoaded_) preload();
+}
+
+uint64_t VirtualNode::nextEvent() const {
+  uint64_t t = sampleInterval_ && nextSample_ < nextPush_ ? nextSample_ : nextPush_;
+  if (linkRate_ != nodeproto::RATE_BASE && linkHeard_ + linkLease_ * 1000000ULL < t) t = linkHeard_ + linkLease_ * 1000000ULL;
+  if (children_.empty()) return t;
+  uint64_t relay = relayCursor_ < children_.size() ? now() : nextRelayPoll_;
+  return relay < t ? relay : t;
+}
+
+// needsFull() của firmware: chưa cấu hình RPT, tới heartbeat hoặc một trường vượt deadband
+bool VirtualNode::needsFull(const uint8_t* reading) {
+  if (!heartbeat_ || !hasSent_ || now() - lastSentAt_ >= heartbeat_ * 1000000ULL) return true;
+  uint8_t kind = protoKind(kind_);
+  uint8_t len = kind == nodeproto::KIND_SOIL ? sizeof(SoilPayload) : sizeof(AtmPayload);
+  int32_t v[nodeproto::FIELDS_MAX], last[nodeproto::FIELDS_MAX];
+  nodeproto::decode(kind, reading, len, v);
+  nodeproto::decode(kind, lastSent_, len, last);
+  return nodeproto::anyBeyond(kind, v, last, deadband_);
+}
+
+void VirtualNode::markSent(const uint8_t* reading) {
+  memcpy(lastSent_, reading, sizeof(lastSent_));
+  lastSentAt_ = now();
+  hasSent_ = true;
+}
+
+void VirtualNode::enterListen() {
+  listen(BASE_ADDR_PREFIX | addr_);
+  if (ackMode_) preload();
+  state_ = LISTEN;
+  if (radio_.available()) wakeIn(0);
+  else if (wakePeriod_) wakeAt(windowEnd_);
+  else if (nextEvent() != NEVER) wakeAt(nextEvent());
+}
+
+void VirtualNode::startRegister() {
+  RegisterPacket pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  strcpy(pkt.cmd, "REG");
+  strncpy(pkt.id, id_, 10);
+  setLink(nodeproto::RATE_BASE, RF24_PA_HIGH);
+  uplink();
+  channel_ = nodeproto::CHANNEL_DEFAULT;
+  radio_.setChannel(channel_);
+  radio_.openWritingPipe(REGISTER_PIPE);
+  radio_.beginWrite(&pkt, sizeof(pkt));
+  state_ = REG_TX;
+  wakeAt(radio_.txDoneAt());
+}
+
+void VirtualNode::retryRegister() {
+  state_ = IDLE;
+  wakeIn(100000 + rand32() % 200000);
+}
+
+// Push thường không đổi thì bỏ lượt, lần thức của node ngủ vẫn phát [addr] làm mốc lịch.
+// Hàng đợi còn mẫu thì phát khung batch, PUSH_TX phát tiếp tới khi hết hàng (sendBatch()).
+void VirtualNode::startPush() {
+  uint8_t frame[32];
+  frame[0] = addr_;
+  uint8_t len;
+  txTaken_ = 0;
+  txRelay_ = !relayed_.empty();
+  if (txRelay_) {
+    len = 1 + relayed_.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), txTaken_);
+    txFull_ = false;
+  } else if (queued()) {
+    len = 1 + packSamples(frame + 1, sizeof(frame) - 1, txTaken_);
+    txFull_ = false;
+  } else {
+    len = 1 + makeReading(frame + 1);
+    memcpy(tx_, frame + 1, len - 1);
+    txFull_ = needsFull(tx_);
+  }
+  if (!txFull_ && !txTaken_) {
+    counters.unchanged++;
+    if (!wakePeriod_) {
+      pushFails_ = 0;
+      searched_ = false;
+      nextPush_ = now() + pushInterval_ * 1000000ULL;
+      enterListen();
+      return;
+    }
+    len = 1;
+  }
+  uplink();
+  radio_.openWritingPipe(PUSH_PIPE);
+  radio_.beginWrite(frame, len);
+  state_ = PUSH_TX;
+  wakeAt(radio_.txDoneAt());
+}
+
+uint8_t VirtualNode::makeReading(uint8_t* out) {
+  if (kind_ == NODE_SOIL) {
+    SoilPayload d = nodeproto::makeSoil(nodeproto::toRaw(jitter(base_[0], 0.3f), 10),
+                                        nodeproto::toRaw(jitter(base_[1], 0.2f), 100));
+    memcpy(out, &d, sizeof(d));
+    return sizeof(d);
+  }
+  const uint16_t* scale = nodeproto::ATM_SCALE;
+  float wind = fmaxf(0, jitter(base_[3], 0.8f));
+  int32_t raw[nodeproto::FIELDS_MAX] = {
+    nodeproto::toRaw(jitter(base_[0], 0.3f), scale[0]),
+    nodeproto::toRaw(jitter(base_[1], 1.0f), scale[1]),
+    (int32_t)base_[2],
+    nodeproto::toRaw(wind, scale[3]),
+    nodeproto::toRaw(jitter(base_[4], 2.0f), scale[4]),
+    nodeproto::toRaw(jitter(base_[5], 0.2f), scale[5]),
+    nodeproto::toRaw(wind + fabsf(jitter(0, 1.5f)), scale[6]),  // Gió giật không nhỏ hơn trung bình
+  };
+  AtmPayload d = nodeproto::makeAtm(raw);
+  memcpy(out, &d, sizeof(d));
+  return sizeof(d);
+}
+
+void VirtualNode::handleRx() {
+  uint8_t buf[32];
+  while (radio_.available()) {
+    uint8_t len = radio_.getDynamicPayloadSize();
+    memset(buf, 0, sizeof(buf));
+    radio_.read(buf, len);
+    bool hadPreload = ackLoaded_;
+    ackLoaded_ = false;  // Gói nào tới pipe 1 cũng lấy payload đi
+
+    if (state_ == REG_WAIT) {
+      RegisterAck ack;
+      if (len != sizeof(ack)) continue;
+      memcpy(&ack, buf, sizeof(ack));
+      ack.cmd[6] = '\0';
+      ack.id[10] = '\0';
+      if (strcmp(ack.cmd, "REG_OK") == 0 && strcmp(ack.id, id_) == 0) {
+        registered_ = true;
+        addr_ = ack.addr;
+        wakePeriod_ = 0;
+        heartbeat_ = 0;
+        memset(deadband_, 0, sizeof(deadband_));
+        sampleInterval_ = 0;
+        soilSamples_.clear();
+        atmSamples_.clear();
+        children_.clear();
+        relayed_.clear();
+        relayCursor_ = 0;
+        enterListen();
+        return;
+      }
+    } else if (state_ == WAIT_OK) {
+      // Firmware bỏ mọi gói khác "OK" trong lúc chờ
+      if (strncmp((char*)buf, "OK", 2) == 0) {
+        counters.oks++;
+        enterListen();
+        return;
+      }
+    } else if (state_ == LISTEN) {
+      if (strncmp((char*)buf, "GET", 3) == 0) {
+        counters.gets++;
+        linkHeard_ = now();
+        bool wantAck = buf[3] == 'A';
+        if (wantAck && hadPreload) {
+          counters.ackReplies++;
+          if (preloadRelay_) { relayed_.drop(preloadTaken_); counters.relayed += preloadTaken_; }
+          else if (preloadTaken_) dropSamples(preloadTaken_);
+          else if (preloadFull_) markSent(preloaded_);
+          else counters.unchanged++;
+          preload();
+          continue;
+        }
+        if (ackMode_ && !wantAck) radio_.flush_tx();
+        ackMode_ = wantAck;
+        state_ = SENSE;
+        wakeIn(responseUs_);
+        return;  // Gói còn lại chờ trong FIFO như trên chip thật
+      }
+      if (len == sizeof(ConfigPacket) && strncmp((char*)buf, "CFG", 3) == 0) {
+        ConfigPacket cfg;
+        memcpy(&cfg, buf, sizeof(cfg));
+        pushInterval_ = cfg.pushInterval;
+        if (!wakePeriod_) nextPush_ = pushInterval_ ? now() : NEVER;
+      } else if (len == sizeof(SleepPacket) && strncmp((char*)buf, "SLP", 3) == 0) {
+        SleepPacket slp;
+        memcpy(&slp, buf, sizeof(slp));
+        // Firmware đang luôn nghe thì vòng loop() kế tiếp thức ngay; đang trong cửa sổ thì giữ lịch cũ
+        if (slp.wakePeriod && !wakePeriod_) { nextPush_ = now(); windowEnd_ = 0; }
+        wakePeriod_ = slp.wakePeriod;
+        if (wakePeriod_) setLink(nodeproto::RATE_BASE, RF24_PA_HIGH);  // Node ngủ chỉ nghe sau gói push
+        if (!wakePeriod_) nextPush_ = pushInterval_ ? now() : NEVER;
+      } else if (len == sizeof(ReportPacket) && strncmp((char*)buf, "RPT", 3) == 0) {
+        ReportPacket rpt;
+        memcpy(&rpt, buf, sizeof(rpt));
+        heartbeat_ = rpt.heartbeat;
+        memcpy(deadband_, rpt.deadband, sizeof(deadband_));
+        hasSent_ = false;
+      } else if (len == sizeof(SamplePacket) && strncmp((char*)buf, "BAT", 3) == 0) {
+        SamplePacket bat;
+        memcpy(&bat, buf, sizeof(bat));
+        sampleInterval_ = bat.sampleInterval;
+        nextSample_ = now();
+      } else if (kind_ == NODE_ATM && len == sizeof(RoutePacket) && strncmp((char*)buf, "RTE", 3) == 0) {
+        RoutePacket rte;
+        memcpy(&rte, buf, sizeof(rte));
+        applyRoute(rte);
+      } else if (len == sizeof(LinkPacket) && strncmp((char*)buf, "LNK", 3) == 0) {
+        // applyLink(): ACK của gói này đã đi ở tốc độ cũ
+        LinkPacket lnk;
+        memcpy(&lnk, buf, sizeof(lnk));
+        if (lnk.rate < nodeproto::RATE_COUNT && lnk.pa <= RF24_PA_MAX) {
+          setLink(lnk.rate, lnk.pa);
+          linkLease_ = lnk.lease;
+          linkHeard_ = now();
+          radio_.stopListening();
+          listen(BASE_ADDR_PREFIX | addr_);
+        }
+      } else if (applyChannel(buf, len)) {
+        return;
+      } else if (kind_ == NODE_ATM && len > sizeof(ForwardHeader) && strncmp((char*)buf, "FWD", 3) == 0) {
+        // forwardPacket() của ATM Node: phát lại nguyên gói gốc, gói còn lại chờ trong FIFO
+        ForwardHeader fwd;
+        memcpy(&fwd, buf, sizeof(fwd));
+        fwdLen_ = len - sizeof(fwd);
+        memcpy(fwd_, buf + sizeof(fwd), fwdLen_);
+        uplink();
+        radio_.openWritingPipe(BASE_ADDR_PREFIX | fwd.addr);
+        radio_.beginWrite(fwd_, fwdLen_);
+        state_ = FWD_TX;
+        wakeAt(radio_.txDoneAt());
+        return;
+      }
+    }
+  }
+  if (state_ == LISTEN && ackMode_ && !ackLoaded_) preload();
+}
+
+void VirtualNode::wake() {
+  if (!online_) return;
+  uint64_t t = now();
+
+  switch (state_) {
+    case IDLE:
+      if (wantRegister_ && !registered_) startRegister();
+      return;
+
+    case REG_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (!radio_.txOk()) { retryRegister(); return; }
+      listen(REGISTER_REPLY_PIPE);
+      state_ = REG_WAIT;
+      deadline_ = t + REG_REPLY_TIMEOUT;
+      wakeAt(deadline_);
+      return;
+
+    case REG_WAIT:
+      handleRx();
+      if (state_ != REG_WAIT) return;
+      if (t >= deadline_) retryRegister();
+      else wakeAt(deadline_);
+      return;
+
+    case LISTEN:
+      handleRx();
+      if (state_ != LISTEN) return;
+      if (leaseExpired(t)) {
+        setLink(nodeproto::RATE_BASE, RF24_PA_HIGH);
+        radio_.stopListening();
+        enterListen();
+        return;
+      }
+      if (wakePeriod_) {
+        if (t >= windowEnd_) goSleep();
+        else wakeAt(windowEnd_);
+        return;
+      }
+      if (sampleInterval_ && nextSample_ <= t) takeSample();
+      if (nextPush_ <= t) startPush();
+      else if (relayDue(t)) pollChild();
+      else if (nextEvent() != NEVER) wakeAt(nextEvent());
+      return;
+
+    case FWD_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (radio_.txOk()) counters.forwards++;
+      enterListen();
+      return;
+
+    case CHILD_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      radio_.startListening();
+      if (!radio_.txOk()) { childFailed(); return; }
+      state_ = CHILD_WAIT;  // ACK payload (nếu có) đã nằm ở pipe 0
+      deadline_ = t + RELAY_REPLY_US;
+      wakeIn(0);
+      return;
+
+    case CHILD_WAIT: {
+      // childReply() của ATM Node
+      uint8_t child = children_[relayCursor_];
+      uint8_t pipe, buf[32];
+      while (radio_.available(&pipe)) {
+        if (pipe == 1) { childDone(false); return; }  // Master hỏi/cấu hình relay
+        uint8_t len = radio_.getDynamicPayloadSize();
+        radio_.read(buf, len);
+        if (pipe == 0 && len == sizeof(ChannelPacket) && strncmp((char*)buf, "CHN", 3) == 0) {
+          childDone(false);  // pollChild() dừng lượt rồi mới applyChannel()
+          applyChannel(buf, len);
+          return;
+        }
+        if (pipe == 0 && len >= 1 && buf[0] == child) { childData(buf + 1, len - 1); return; }
+        if (pipe == RELAY_RX_PIPE) {
+          relayed_.add(child, nodeSeconds(), buf, len);  // Trả lời kiểu cũ chỉ có một bản đo
+          uplink();
+          radio_.beginWrite("OK", 3);
+          state_ = CHILD_OK_TX;
+          wakeAt(radio_.txDoneAt());
+          return;
+        }
+      }
+      if (t >= deadline_) childFailed();
+      else wakeAt(deadline_);
+      return;
+    }
+
+    case CHILD_OK_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      childDone(true);
+      return;
+
+    case CHILD_GAP:
+      pollChild();
+      return;
+
+    case CHN_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      forwardChannel();
+      return;
+
+    case SEARCH_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      radio_.setRetries(15, 15);
+      if (!radio_.txOk()) {
+        searchIndex_++;
+        searchNext();
+        return;
+      }
+      channel_ = nodeproto::CHANNELS[searchIndex_];
+      counters.searches++;
+      searched_ = true;
+      startPush();  // Gửi lại số đo thật trên kênh vừa tìm được
+      return;
+
+    case SENSE: {
+      uint8_t len = makeReading(tx_);
+      uplink();
+      radio_.openWritingPipe(BASE_ADDR_PREFIX | addr_);
+      radio_.beginWrite(tx_, len);
+      state_ = REPLY_TX;
+      wakeAt(radio_.txDoneAt());
+      return;
+    }
+
+    case REPLY_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (!radio_.txOk()) {
+        counters.replyFail++;
+        enterListen();
+        return;
+      }
+      counters.replies++;
+      markSent(tx_);  // Trả lời GET luôn đủ số đo
+      listen(BASE_ADDR_PREFIX | addr_);
+      state_ = WAIT_OK;
+      deadline_ = t + (kind_ == NODE_SOIL ? 150000 : 200000);
+      wakeAt(deadline_);
+      return;
+
+    case WAIT_OK:
+      handleRx();
+      if (state_ != WAIT_OK) return;
+      if (t >= deadline_) enterListen();
+      else wakeAt(deadline_);
+      return;
+
+    case WAKE_RETRY:
+      startPush();
+      return;
+
+    case SLEEP:
+      if (sampleInterval_ && nextSample_ <= t) takeSample();
+      if (t < nextPush_) { goSleep(); return; }  // Chỉ thức để lấy mẫu
+      radio_.powerUp();
+      counters.wakes++;
+      cycleStart_ = t;
+      startPush();
+      return;
+
+    case PUSH_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (radio_.txOk() && txTaken_ && txRelay_) {
+        // sendPush(): sau khung relay vẫn gửi số đo của chính node
+        relayed_.drop(txTaken_);
+        counters.relayed += txTaken_;
+        startPush();
+        return;
+      }
+      if (radio_.txOk() && txTaken_) {
+        dropSamples(txTaken_);
+        if (queued()) { startPush(); return; }
+      }
+      if (wakePeriod_) { wakePushDone(t); return; }
+      if (radio_.txOk()) {
+        counters.pushes++;
+        if (!txTaken_) markSent(tx_);  // Push thường chỉ phát khi đủ số đo
+        pushFails_ = 0;
+        searched_ = false;
+        nextPush_ = t + pushInterval_ * 1000000ULL;
+      } else if (++pushFails_ <= PUSH_MAX_RETRIES) {
+        nextPush_ = t + 50000 + rand32() % 250000;
+      } else if (!searched_) {
+        searchIndex_ = 0;
+        searchNext();
+        return;
+      } else {
+        pushGiveUp(t);
+        return;
+      }
+      if (!pushInterval_) nextPush_ = NEVER;
+      enterListen();
+      return;
+  }
+}
+
+// --- RELAY: applyRoute()/pollChild()/serviceRelay() của ATM Node ---
+
+void VirtualNode::applyRoute(const RoutePacket& rte) {
+  if (rte.child == 0xFF || rte.child == addr_) return;
+  children_.erase(std::remove(children_.begin(), children_.end(), rte.child), children_.end());
+  if (rte.add && children_.size() < RELAY_CHILDREN) {
+    children_.push_back(rte.child);
+    nextRelayPoll_ = now();  // Hỏi node con mới ngay
+  }
+  if (relayCursor_ > children_.size()) relayCursor_ = children_.size();
+}
+
+bool VirtualNode::relayDue(uint64_t t) const {
+  return !children_.empty() && (relayCursor_ < children_.size() || t >= nextRelayPoll_);
+}
+
+void VirtualNode::pollChild() {
+  if (relayCursor_ >= children_.size()) {  // Bắt đầu lượt mới
+    relayCursor_ = 0;
+    childFrames_ = childAttempts_ = 0;
+    nextRelayPoll_ = now() + RELAY_POLL_US;
+  }
+  uint64_t addr = BASE_ADDR_PREFIX | children_[relayCursor_];
+  radio_.setRetries(5, 15);
+  radio_.openReadingPipe(RELAY_RX_PIPE, addr);
+  uplink();  // CHILD_TX nghe lại ngay ở tốc độ gốc để nhận node con
+  radio_.openWritingPipe(addr);
+  radio_.beginWrite("GETA", 5);
+  state_ = CHILD_TX;
+  wakeAt(radio_.txDoneAt());
+}
+
+void VirtualNode::childData(const uint8_t* buf, uint8_t len) {
+  relayed_.add(children_[relayCursor_], nodeSeconds(), buf, len);
+  childAttempts_ = 0;
+  if (++childFrames_ < RELAY_MAX_FRAMES && nodeproto::moreFrames(buf, len)) {
+    state_ = CHILD_GAP;
+    wakeIn(RELAY_FRAME_GAP_US);
+    return;
+  }
+  childDone(true);
+}
+
+void VirtualNode::childFailed() {
+  if (++childAttempts_ < RELAY_ATTEMPTS) { pollChild(); return; }
+  if (!childFrames_) {
+    relayed_.lost(children_[relayCursor_], nodeSeconds());
+    counters.childLost++;
+  }
+  childDone(true);
+}
+
+void VirtualNode::childDone(bool advance) {
+  if (advance) relayCursor_++;
+  childFrames_ = childAttempts_ = 0;
+  radio_.closeReadingPipe(RELAY_RX_PIPE);
+  radio_.setRetries(15, 15);
+  enterListen();
+}
+
+// Lần thức của Soil Node: push tối đa 1 + PUSH_MAX_RETRIES lần, có ACK thì nghe WAKE_WINDOW_US
+void VirtualNode::wakePushDone(uint64_t t) {
+  uint64_t nextWake = cycleStart_ + wakePeriod_ * 1000000ULL;
+  if (radio_.txOk()) {
+    counters.pushes++;
+    if (txFull_) markSent(tx_);
+    pushFails_ = 0;
+    searched_ = false;
+    nextPush_ = nextWake;
+    windowEnd_ = t + WAKE_WINDOW_US;
+    enterListen();
+    return;
+  }
+  if (++pushFails_ <= PUSH_MAX_RETRIES) {
+    listen(BASE_ADDR_PREFIX | addr_);
+    state_ = WAKE_RETRY;
+    wakeIn(5000 + rand32() % 25000);  // delay(random(5, 30))
+    return;
+  }
+  if (!searched_) {
+    searchIndex_ = 0;
+    searchNext();
+    return;
+  }
+  pushGiveUp(t);
+}
+
+void VirtualNode::pushGiveUp(uint64_t t) {
+  counters.pushFail++;
+  pushFails_ = 0;
+  searched_ = false;
+  if (wakePeriod_) {
+    nextPush_ = cycleStart_ + wakePeriod_ * 1000000ULL;
+    goSleep();
+    return;
+  }
+  nextPush_ = pushInterval_ ? t + pushInterval_ * 1000000ULL : NEVER;
+  enterListen();
+}
+
+// --- TỐC ĐỘ LIÊN KẾT: beginUplink()/applyLink()/checkLinkLease() của firmware ---
+
+void VirtualNode::uplink() {
+  radio_.stopListening();
+  radio_.setDataRate(RF24_250KBPS);
+  radio_.setPALevel(RF24_PA_HIGH);
+}
+
+void VirtualNode::setLink(uint8_t rate, uint8_t pa) {
+  if (rate != linkRate_) counters.linkChanges++;
+  linkRate_ = rate;
+  linkPa_ = pa;
+}
+
+bool VirtualNode::leaseExpired(uint64_t t) const {
+  return linkRate_ != nodeproto::RATE_BASE && t >= linkHeard_ + linkLease_ * 1000000ULL;
+}
+
+// --- KÊNH RADIO: applyChannel()/searchChannel() của firmware ---
+
+bool VirtualNode::applyChannel(const uint8_t* buf, uint8_t len) {
+  if (len != sizeof(ChannelPacket) || strncmp((const char*)buf, "CHN", 3) != 0) return false;
+  memcpy(&chn_, buf, sizeof(chn_));
+  if (!nodeproto::validChannel(chn_.channel) || chn_.channel == channel_) return false;  // Bản lặp của gói phát chung
+  counters.channelMoves++;
+  chnCursor_ = 0;
+  forwardChannel();
+  return true;
+}
+
+void VirtualNode::forwardChannel() {
+  if (chnCursor_ < children_.size()) {
+    uplink();
+    radio_.openWritingPipe(BASE_ADDR_PREFIX | children_[chnCursor_++]);
+    radio_.beginWrite(&chn_, sizeof(chn_));
+    state_ = CHN_TX;
+    wakeAt(radio_.txDoneAt());
+    return;
+  }
+  channel_ = chn_.channel;
+  radio_.stopListening();
+  radio_.setChannel(channel_);
+  enterListen();
+}
+
+// Gửi [addr] trên từng kênh khác kênh hiện tại, hết kênh thì quay về kênh cũ
+void VirtualNode::searchNext() {
+  while (searchIndex_ < nodeproto::CHANNEL_COUNT && nodeproto::CHANNELS[searchIndex_] == channel_) searchIndex_++;
+  if (searchIndex_ >= nodeproto::CHANNEL_COUNT) {
+    radio_.setChannel(channel_);
+    searched_ = false;
+    pushGiveUp(now());
+    return;
+  }
+  uplink();
+  radio_.setRetries(15, SEARCH_RETRIES);
+  radio_.setChannel(nodeproto::CHANNELS[searchIndex_]);
+  radio_.openWritingPipe(PUSH_PIPE);
+  radio_.beginWrite(&addr_, 1);
+  state_ = SEARCH_TX;
+  wakeAt(radio_.txDoneAt());
+}
+
+// --- HUB ẢO ---
+
+VirtualHub::VirtualHub(uint32_t pollIntervalMs, uint16_t sleepSeconds, uint16_t heartbeat, uint16_t sampleSeconds)
+    : radio_(0, 0), pollMs_(pollIntervalMs), sleepS_(sleepSeconds), heartbeat_(heartbeat), sampleS_(sampleSeconds) {
+  setupRadio(radio_, RF24_PA_LOW, 5);
+  radio_.onReceive([this] {
+    if (state_ == IDLE || state_ == WAIT_DATA) wakeIn(0);
+  });
+  listen();
+  wakeIn(0);
+}
+
+void VirtualHub::listen() {
+  radio_.openReadingPipe(1, PUSH_PIPE);
+  radio_.openReadingPipe(2, REGISTER_PIPE);
+  radio_.startListening();
+}
+
+bool VirtualHub::handleRx(uint8_t* data, uint8_t& len) {
+  uint8_t pipe;
+  uint8_t buf[32];
+  while (radio_.available(&pipe)) {
+    uint8_t n = radio_.getDynamicPayloadSize();
+    memset(buf, 0, sizeof(buf));
+    radio_.read(buf, n);
+
+    if (pipe == 0 && state_ == GET_TX && n >= 1 && buf[0] == nodes_[cursor_].addr) {  // Chỉ addr: không đổi
+      memcpy(data, buf + 1, n - 1);
+      len = n - 1;
+      return true;
+    }
+    if (pipe == 3 && state_ == WAIT_DATA) {
+      memcpy(data, buf, n);
+      len = n;
+      return true;
+    }
+    if (pipe == 2 && n == sizeof(RegisterPacket) && strncmp((char*)buf, "REG", 3) == 0 && state_ == IDLE) {
+      RegisterPacket pkt;
+      memcpy(&pkt, buf, sizeof(pkt));
+      pkt.id[10] = '\0';
+      pending_ = nodes_.size();
+      for (size_t i = 0; i < nodes_.size(); i++) {
+        if (nodes_[i].id == pkt.id) {  // Node xóa RPT/BAT khi nhận REG_OK
+          pending_ = i;
+          nodes_[i].reporting = nodes_[i].sampling = false;
+        }
+      }
+      if (pending_ == nodes_.size()) nodes_.push_back(Known{ pkt.id, nextAddr_++ });
+      state_ = REG_DELAY;
+      wakeIn(50000);  // Node cần thời gian chuyển sang nghe, giống delay(50) trên MainHub
+      return false;
+    }
+    if (pipe == 1 && n >= 1) {
+      for (Known& k : nodes_) {
+        if (k.addr != buf[0]) continue;
+        if (k.sleeping) { k.lastWake = now(); k.late = false; }
+        report(k, buf + 1, n - 1, k.sleeping ? "wake" : "push");
+      }
+    }
+  }
+  return false;
+}
+
+void VirtualHub::next() {
+  radio_.closeReadingPipe(3);
+  listen();
+  state_ = IDLE;
+  if (++cursor_ >= nodes_.size()) {
+    cursor_ = 0;
+    nextPoll_ = now() + pollMs_ * 1000ULL;
+  }
+  wakeIn(0);
+}
+
+namespace {
+
+void printFields(uint8_t kind, const int32_t* raw) {
+  if (kind == nodeproto::KIND_SOIL) {
+    fprintf(stderr, " moisture=%.1f temperature=%.2f\n", raw[0] / 10.0, raw[1] / 100.0);
+  } else {
+    fprintf(stderr, " air_temp=%.2f air_humid=%d rain=%d wind=%.2f light=%d pressure=%.1f", raw[0] / 100.0,
+            (int)raw[1], (int)raw[2], raw[3] / 100.0, (int)raw[4], raw[5] / 10.0);
+    if (raw[nodeproto::ATM_GUST] != nodeproto::NO_VALUE) fprintf(stderr, " gust=%.2f", raw[nodeproto::ATM_GUST] / 100.0);
+    fputc('\n', stderr);
+  }
+}
+
+} // namespace
+
+void VirtualHub::report(const Known& node, const uint8_t* data, uint8_t len, const char* how) {
+  int32_t raw[nodeproto::FIELDS_MAX];
+  if (nodeproto::isBatch(data, len)) {
+    // Loại node theo schema của mẫu: số mẫu Soil và ATM có thể cho cùng kích thước khung
+    uint8_t kind = nodeproto::schemaKind(data[1]);
+    uint8_t n = nodeproto::batchCount(kind, data, len);
+    for (uint8_t i = 0; i < n; i++) {
+      uint16_t age;
+      if (!nodeproto::batchEntry(kind, data, i, age, raw)) continue;
+      readings_++;
+      fprintf(stderr, "[hub] %8.3fs %s %s batch %u/%u%s age=%us", now() / 1e6, node.id.c_str(), how, i + 1, n,
+              nodeproto::batchMore(data) ? "+" : "", age);
+      printFields(kind, raw);
+    }
+    if (!n) fprintf(stderr, "[hub] %8.3fs %s %s batch len=%u\n", now() / 1e6, node.id.c_str(), how, len);
+    return;
+  }
+
+  readings_++;
+  fprintf(stderr, "[hub] %8.3fs %s %s", now() / 1e6, node.id.c_str(), how);
+  // Kích thước Soil và ATM khác nhau nên thử lần lượt hai loại
+  if (nodeproto::decode(nodeproto::KIND_SOIL, data, len, raw)) {
+    printFields(nodeproto::KIND_SOIL, raw);
+  } else if (nodeproto::decode(nodeproto::KIND_ATM, data, len, raw)) {
+    printFields(nodeproto::KIND_ATM, raw);
+  } else if (len == 0) {
+    fprintf(stderr, " unchanged\n");
+  } else {
+    fprintf(stderr, " len=%u\n", len);
+  }
+}
+
+void VirtualHub::wake() {
+  uint64_t t = now();
+  uint8_t data[32];
+  uint8_t len = 0;
+
+  switch (state_) {
+    case IDLE:
+      handleRx(data, len);
+      if (state_ != IDLE) return;
+      if (nodes_.empty() || t < nextPoll_) {
+        if (!nodes_.empty()) wakeAt(nextPoll_);
+        return;
+      }
+      if (nodes_[cursor_].sleeping) {
+        // Node ngủ tự gửi theo lịch, chỉ kiểm tra lỡ lịch như MainHub
+        Known& k = nodes_[cursor_];
+        if (!k.late && t - k.lastWake > sleepS_ * 2000000ULL + WAKE_GRACE_US) {
+          k.late = true;
+          fprintf(stderr, "[hub] %8.3fs %s missed_wake\n", t / 1e6, k.id.c_str());
+        }
+        next();
+        return;
+      }
+      if (heartbeat_ && !nodes_[cursor_].reporting) {
+        ReportPacket rpt;
+        memset(&rpt, 0, sizeof(rpt));
+        strcpy(rpt.cmd, "RPT");
+        rpt.heartbeat = heartbeat_;
+        bool soil = nodes_[cursor_].id.compare(0, 4, "soil") == 0;
+        memcpy(rpt.deadband, soil ? SOIL_DEADBAND : ATM_DEADBAND, sizeof(rpt.deadband));
+        radio_.stopListening();
+        radio_.openWritingPipe(BASE_ADDR_PREFIX | nodes_[cursor_].addr);
+        radio_.beginWrite(&rpt, sizeof(rpt));
+        state_ = RPT_TX;
+        wakeAt(radio_.txDoneAt());
+        return;
+      }
+      if (sampleS_ && !nodes_[cursor_].sampling) {
+        SamplePacket bat;
+        memset(&bat, 0, sizeof(bat));
+        strcpy(bat.cmd, "BAT");
+        bat.sampleInterval = sampleS_;
+        radio_.stopListening();
+        radio_.openWritingPipe(BASE_ADDR_PREFIX | nodes_[cursor_].addr);
+        radio_.beginWrite(&bat, sizeof(bat));
+        state_ = BAT_TX;
+        wakeAt(radio_.txDoneAt());
+        return;
+      }
+      if (sleepS_) {
+        SleepPacket slp;
+        memset(&slp, 0, sizeof(slp));
+        strcpy(slp.cmd, "SLP");
+        slp.wakePeriod = sleepS_;
+        radio_.stopListening();
+        radio_.openWritingPipe(BASE_ADDR_PREFIX | nodes_[cursor_].addr);
+        radio_.beginWrite(&slp, sizeof(slp));
+        state_ = SLP_TX;
+        wakeAt(radio_.txDoneAt());
+        return;
+      }
+      {
+        uint64_t addr = BASE_ADDR_PREFIX | nodes_[cursor_].addr;
+        radio_.openReadingPipe(3, addr);
+        radio_.stopListening();
+        radio_.openWritingPipe(addr);
+        radio_.beginWrite("GETA", 5);
+      }
+      state_ = GET_TX;
+      wakeAt(radio_.txDoneAt());
+      return;
+
+    case REG_DELAY: {
+      RegisterAck ack;
+      memset(&ack, 0, sizeof(ack));
+      strcpy(ack.cmd, "REG_OK");
+      strncpy(ack.id, nodes_[pending_].id.c_str(), 10);
+      ack.addr = nodes_[pending_].addr;
+      radio_.stopListening();
+      radio_.openWritingPipe(REGISTER_REPLY_PIPE);
+      radio_.beginWrite(&ack, sizeof(ack));
+      state_ = REG_REPLY_TX;
+      wakeAt(radio_.txDoneAt());
+      return;
+    }
+
+    case REG_REPLY_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      fprintf(stderr, "[hub] %8.3fs %s %s addr=0x%02X\n", t / 1e6, nodes_[pending_].id.c_str(),
+              radio_.txOk() ? "registered" : "register_reply_failed", nodes_[pending_].addr);
+      listen();
+      state_ = IDLE;
+      wakeIn(0);
+      return;
+
+    case GET_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (!radio_.txOk()) {
+        fprintf(stderr, "[hub] %8.3fs %s offline\n", t / 1e6, nodes_[cursor_].id.c_str());
+        next();
+        return;
+      }
+      listen();
+      if (handleRx(data, len)) {
+        report(nodes_[cursor_], data, len, "ack");
+        if (nodeproto::isBatch(data, len) && nodeproto::batchMore(data)) {
+          // BATCH_MORE: hỏi tiếp node này như MainHub, chờ node nạp khung kế tiếp
+          state_ = IDLE;
+          wakeIn(3000);
+          return;
+        }
+        next();
+        return;
+      }
+      state_ = WAIT_DATA;
+      deadline_ = t + HUB_REPLY_TIMEOUT;
+      wakeAt(deadline_);
+      return;
+
+    case WAIT_DATA:
+      if (handleRx(data, len)) {
+        report(nodes_[cursor_], data, len, "poll");
+        radio_.stopListening();
+        radio_.beginWrite("OK", 3);
+        state_ = OK_TX;
+        wakeAt(radio_.txDoneAt());
+        return;
+      }
+      if (t >= deadline_) {
+        fprintf(stderr, "[hub] %8.3fs %s timeout\n", t / 1e6, nodes_[cursor_].id.c_str());
+        next();
+      } else {
+        wakeAt(deadline_);
+      }
+      return;
+
+    case OK_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      next();
+      return;
+
+    case RPT_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (!radio_.txOk()) { next(); return; }
+      nodes_[cursor_].reporting = true;
+      fprintf(stderr, "[hub] %8.3fs %s heartbeat=%us\n", t / 1e6, nodes_[cursor_].id.c_str(), heartbeat_);
+      listen();
+      state_ = IDLE;
+      wakeIn(0);  // Hỏi luôn node này, không chuyển sang node kế
+      return;
+
+    case BAT_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (!radio_.txOk()) { next(); return; }
+      nodes_[cursor_].sampling = true;
+      fprintf(stderr, "[hub] %8.3fs %s sample=%us\n", t / 1e6, nodes_[cursor_].id.c_str(), sampleS_);
+      listen();
+      state_ = IDLE;
+      wakeIn(0);
+      return;
+
+    case SLP_TX:
+      if (radio_.txBusy()) { wakeAt(radio_.txDoneAt()); return; }
+      if (radio_.txOk()) {
+        nodes_[cursor_].sleeping = true;
+        nodes_[cursor_].lastWake = t;
+        fprintf(stderr, "[hub] %8.3fs %s sleep=%us\n", t / 1e6, nodes_[cursor_].id.c_str(), sleepS_);
+      }
+      next();
+      return;
+  }
+}
+
+} // namespace sim
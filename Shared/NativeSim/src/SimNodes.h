@@ -0,0 +1,171 @@
+/**
+ * SimNodes - Node và Hub ảo chạy theo hành vi của firmware thật
+ *
+ * - VirtualNode: dùng khi firmware chính là MainHub. Đăng ký, trả lời GET,
+ *   chờ OK, nhận CFG/SLP/RPT/BAT, tự Push và ngủ theo chu kỳ giống Soil/ATM Node
+ *   nhưng không chặn. Nhận "GETA" thì nạp sẵn số đo vào ACK payload. Số đo
+ *   dao động nhỏ quanh giá trị riêng của từng node để deadband có tác dụng.
+ *   Có chu kỳ BAT thì xếp hàng mẫu và gửi khung batch như firmware. Node ATM
+ *   nhận RTE thì làm relay: tự hỏi node con bằng GETA, gửi số đo của chúng
+ *   trong khung relay và phát lại gói FWD như ATM Node. Đăng ký ở kênh mặc
+ *   định, theo gói CHN (relay báo node con trước) và dò kênh khi push hỏng.
+ *   Gói LNK đổi tốc độ/PA lúc nghe, gói tự phát luôn ở 250kbps, hết lease thì về gốc.
+ * - VirtualHub: dùng khi firmware chính là một node. Cấp địa chỉ cho REG và
+ *   hỏi dữ liệu định kỳ bằng "GETA", in kết quả ra stderr. Có thể cho node ngủ (SLP) rồi
+ *   theo dõi lịch thức thay vì hỏi, cấu hình deadband (RPT) và chu kỳ lấy mẫu
+ *   (BAT); khung batch có BATCH_MORE thì hỏi tiếp node đó.
+ */
+
+#pragma once
+
+#include <RF24.h>
+
+#include <string>
+#include <vector>
+
+#include "SimProtocol.h"
+#include "SimSensors.h"
+
+namespace sim {
+
+enum NodeKind { NODE_SOIL = 1, NODE_ATM = 2 };
+
+class VirtualNode : public Actor {
+ public:
+  VirtualNode(NodeKind kind, const char* id);
+
+  void allowRegister();              // Bắt đầu gửi REG (giống nhấn giữ nút trên node)
+  void assign(uint8_t addr);         // Bỏ qua đăng ký, dùng địa chỉ có sẵn
+  void setOnline(bool online);
+  void setResponseTime(uint32_t us) { responseUs_ = us; }
+
+  bool registered() const { return registered_; }
+  bool online() const { return online_; }
+  uint8_t addr() const { return addr_; }
+  uint8_t channel() const { return channel_; }
+  uint8_t linkRate() const { return linkRate_; }
+  uint16_t wakePeriod() const { return wakePeriod_; }
+  const char* id() const { return id_; }
+  NodeKind kind() const { return kind_; }
+  RF24& radio() { return radio_; }
+
+  struct Counters {
+    uint32_t gets = 0, replies = 0, replyFail = 0, oks = 0, pushes = 0, pushFail = 0, wakes = 0, ackReplies = 0;
+    uint32_t unchanged = 0;  // Lần gửi chỉ có addr hoặc push bị bỏ nhờ deadband
+    uint32_t relayed = 0, childLost = 0, forwards = 0;  // Vai trò relay
+    uint32_t channelMoves = 0, searches = 0;            // Gói CHN đã theo, lần dò kênh tìm được Master
+    uint32_t linkChanges = 0;                           // Lần đổi tốc độ nghe (LNK hoặc hết lease)
+  } counters;
+
+  void wake() override;
+
+ private:
+  enum State { IDLE, REG_TX, REG_WAIT, LISTEN, SENSE, REPLY_TX, WAIT_OK, PUSH_TX, WAKE_RETRY, SLEEP,
+               FWD_TX, CHILD_TX, CHILD_WAIT, CHILD_OK_TX, CHILD_GAP, CHN_TX, SEARCH_TX };
+
+  void listen(uint64_t pipe);
+  void uplink();                    // beginUplink(): dừng nghe, về tốc độ/PA gốc để tự phát
+  void setLink(uint8_t rate, uint8_t pa);
+  bool leaseExpired(uint64_t t) const;
+  void enterListen();
+  void startRegister();
+  void retryRegister();
+  void handleRx();
+  void startPush();
+  void wakePushDone(uint64_t t);
+  void goSleep();
+  void preload();
+  uint8_t makeReading(uint8_t* out);
+  bool needsFull(const uint8_t* reading);
+  void markSent(const uint8_t* reading);
+  void takeSample();
+  uint64_t nextEvent() const;  // Lần push hoặc lấy mẫu kế tiếp khi luôn nghe
+  uint8_t queued() const;
+  uint8_t packSamples(uint8_t* out, uint8_t room, uint8_t& taken) const;
+  void dropSamples(uint8_t n);
+  void applyRoute(const RoutePacket& rte);
+  bool relayDue(uint64_t t) const;
+  void pollChild();                 // Gửi GETA cho node con ở relayCursor_
+  void childData(const uint8_t* buf, uint8_t len);
+  void childFailed();
+  void childDone(bool advance);     // false: gói của Master chen vào, lượt sau hỏi lại node con này
+  bool applyChannel(const uint8_t* buf, uint8_t len);  // false nếu không phải gói CHN
+  void forwardChannel();            // Báo CHN cho node con kế tiếp, hết thì đổi kênh
+  void searchNext();
+  void pushGiveUp(uint64_t t);      // Hết lần thử và đã dò kênh
+
+  RF24 radio_;
+  NodeKind kind_;
+  char id_[11];
+  State state_ = IDLE;
+  bool online_ = true, registered_ = false, wantRegister_ = false;
+  bool ackMode_ = false, ackLoaded_ = false;
+  uint8_t addr_ = 0;
+  uint32_t responseUs_;
+  uint16_t pushInterval_ = 0, wakePeriod_ = 0;
+  uint8_t pushFails_ = 0;
+  uint64_t deadline_ = 0, nextPush_ = NEVER;  // Ở chế độ ngủ nextPush_ là lần thức kế tiếp
+  uint64_t cycleStart_ = 0, windowEnd_ = 0;
+  float base_[6];                                // Giá trị quanh đó số đo dao động
+  uint16_t heartbeat_ = 0, deadband_[nodeproto::DEADBAND_FIELDS] = {};  // Cấu hình RPT
+  bool hasSent_ = false, preloadFull_ = false, txFull_ = false;
+  uint64_t lastSentAt_ = 0;
+  uint8_t lastSent_[32], preloaded_[32], tx_[32];  // tx_: số đo của lần phát push/trả lời đang chờ
+  uint16_t sampleInterval_ = 0;                  // Cấu hình BAT
+  uint64_t nextSample_ = NEVER;
+  uint8_t preloadTaken_ = 0, txTaken_ = 0;       // Số mẫu của hàng đợi trong ACK payload/push đang phát
+  nodeproto::SampleQueue<SoilPayload, 12> soilSamples_;  // SAMPLE_QUEUE của từng firmware
+  nodeproto::SampleQueue<AtmPayload, 24> atmSamples_;
+  std::vector<uint8_t> children_;                // Node con (gói RTE)
+  nodeproto::RelayQueue<32> relayed_;            // RELAY_QUEUE của ATM Node
+  uint64_t nextRelayPoll_ = NEVER;
+  size_t relayCursor_ = 0;                       // children_.size() = không có lượt dở
+  uint8_t childFrames_ = 0, childAttempts_ = 0;
+  bool preloadRelay_ = false, txRelay_ = false;  // ACK payload/push đang phát là khung relay
+  uint8_t fwd_[32], fwdLen_ = 0;
+  uint8_t channel_ = nodeproto::CHANNEL_DEFAULT;
+  ChannelPacket chn_;
+  size_t chnCursor_ = 0;
+  uint8_t searchIndex_ = 0;
+  bool searched_ = false;                        // Lần push đang thử là lần gửi lại sau khi dò kênh
+  uint8_t linkRate_ = nodeproto::RATE_BASE, linkPa_ = RF24_PA_HIGH;  // Gói LNK
+  uint16_t linkLease_ = 0;
+  uint64_t linkHeard_ = 0;
+};
+
+class VirtualHub : public Actor {
+ public:
+  explicit VirtualHub(uint32_t pollIntervalMs = 2000, uint16_t sleepSeconds = 0, uint16_t heartbeat = 0,
+                      uint16_t sampleSeconds = 0);
+
+  RF24& radio() { return radio_; }
+  uint32_t readings() const { return readings_; }
+
+  void wake() override;
+
+ private:
+  enum State { IDLE, REG_DELAY, REG_REPLY_TX, GET_TX, WAIT_DATA, OK_TX, SLP_TX, RPT_TX, BAT_TX };
+  struct Known {
+    std::string id;
+    uint8_t addr;
+    bool sleeping = false, late = false, reporting = false, sampling = false;
+    uint64_t lastWake = 0;
+  };
+
+  void listen();
+  bool handleRx(uint8_t* data, uint8_t& len);  // true: có dữ liệu trả lời GET (ACK payload hoặc pipe 3)
+  void next();
+  void report(const Known& node, const uint8_t* data, uint8_t len, const char* how);
+
+  RF24 radio_;
+  State state_ = IDLE;
+  uint32_t pollMs_;
+  uint16_t sleepS_, heartbeat_, sampleS_;
+  std::vector<Known> nodes_;
+  size_t cursor_ = 0, pending_ = 0;
+  uint8_t nextAddr_ = 0x10;
+  uint32_t readings_ = 0;
+  uint64_t deadline_ = 0, nextPoll_ = 0;
+};
+
+} // namespace sim
@@ -0,0 +1,75 @@
+/**
+ * SimProtocol - Bản sao hằng số và struct giao thức radio cho node/hub ảo
+ *
+ * Phải khớp với MainHub/src/main.cpp và firmware hai loại node.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <NodeProtocol.h>
+#include <SampleQueue.h>
+#include <RelayQueue.h>
+
+namespace sim {
+
+const uint64_t REGISTER_PIPE = 0xF0F0F0F0E1LL;
+const uint64_t REGISTER_REPLY_PIPE = 0xF0F0F0F0D2LL;
+const uint64_t PUSH_PIPE = 0xF0F0F0F0C3LL;
+const uint64_t BASE_ADDR_PREFIX = 0xF0F0F0F000LL;
+const uint64_t WAKE_WINDOW_US = 50000;  // WAKE_WINDOW_MS của Soil Node
+
+// Payload số đo dùng chung với firmware (Shared/NodeProtocol)
+using nodeproto::SoilPayload;
+using nodeproto::AtmPayload;
+using nodeproto::ChannelPacket;
+using nodeproto::LinkPacket;
+
+struct __attribute__((packed)) RegisterPacket {
+  char cmd[4];
+  char id[11];
+};
+
+struct __attribute__((packed)) ConfigPacket {
+  char cmd[4];
+  uint16_t pushInterval;
+};
+
+struct __attribute__((packed)) SleepPacket {
+  char cmd[4];
+  uint16_t wakePeriod;
+};
+
+struct __attribute__((packed)) SamplePacket {
+  char cmd[4];
+  uint16_t sampleInterval;
+};
+
+struct __attribute__((packed)) ReportPacket {
+  char cmd[4];
+  uint16_t heartbeat;
+  uint16_t deadband[nodeproto::DEADBAND_FIELDS];
+};
+
+struct __attribute__((packed)) RoutePacket {
+  char cmd[4];
+  uint8_t child;
+  uint8_t add;
+};
+
+struct __attribute__((packed)) ForwardHeader {
+  char cmd[4];
+  uint8_t addr;
+};
+
+// Deadband mặc định của --report, phần mười đơn vị theo thứ tự trường trong struct
+const uint16_t SOIL_DEADBAND[6] = { 10, 5 };               // 1% ẩm, 0.5°C
+const uint16_t ATM_DEADBAND[6] = { 5, 20, 50, 10, 50, 5 };  // 0.5°C, 2%, 5 mưa, 1m/s, 5 sáng, 0.5hPa
+
+struct __attribute__((packed)) RegisterAck {
+  char cmd[7];
+  char id[11];
+  uint8_t addr;
+};
+
+} // namespace sim
@@ -0,0 +1,26 @@
+/**
+ * SimSensors - Giá trị môi trường dùng chung cho các cảm biến giả lập
+ *
+ * Cảm biến analog (độ ẩm đất, mưa, ánh sáng) đặt qua sim::setAnalog(), gió qua
+ * sim::triggerInterrupt() trên chân cảm biến gió.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace sim {
+
+struct Sensors {
+  float airTemp = 29.5f;       // °C
+  float airHumid = 72.0f;      // %
+  float pressurePa = 100850.0f;
+  bool dhtFail = false;        // true: DHT trả NAN như khi mất kết nối
+  bool bmpPresent = true;
+};
+
+extern Sensors sensors;
+
+inline float jitter(float value, float amplitude) { return value + (float)((uniform() * 2 - 1) * amplitude); }
+
+} // namespace sim
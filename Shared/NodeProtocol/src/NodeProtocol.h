@@ -0,0 +1,400 @@
+/**
+ * NodeProtocol - Định dạng số đo node gửi lên MainHub qua radio
+ *
+ * Payload bắt đầu bằng byte schema, sau đó là các trường số nguyên đã nhân hệ
+ * số (SOIL_SCALE / ATM_SCALE): Soil 5 byte, ATM 13 byte thay cho 8 và 21 byte
+ * float, đủ chỗ cho addr, nhiều bản đo hoặc header chuyển tiếp trong gói 32 byte.
+ * Node không cần phép tính số thực để đóng gói. ATM V2 thêm gió giật sau các
+ * trường của V1; Master vẫn nhận V1, trường gió giật khi đó là NO_VALUE.
+ *
+ * Struct float cũ (SoilData/AtmData, không có byte schema) vẫn được Master
+ * nhận theo kích thước, và vẫn là định dạng của nhật ký và khung HubLink ra
+ * host; bản đo có gió giật dùng AtmDataV2. Nâng cấp Master trước rồi mới tới node.
+ *
+ * Khung batch (SCHEMA_BATCH) gom nhiều mẫu có tuổi của cùng một node, node
+ * xếp hàng mẫu bằng SampleQueue.h rồi gửi lần lượt từng khung.
+ *
+ * Khung chuyển tiếp (SCHEMA_RELAY) gom số đo của nhiều node con mà ATM Node
+ * làm relay đã hỏi thay Master, xếp hàng bằng RelayQueue.h.
+ *
+ * Danh sách kênh radio và gói CHN dùng chung để Master và node cùng đổi kênh.
+ * Gói LNK chọn tốc độ/công suất riêng cho từng liên kết Master -> node.
+ *
+ * Đổi thứ tự/kiểu trường thì cấp schema mới, không sửa schema đã phát hành.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace nodeproto {
+
+// Loại node, trùng NodeType của MainHub và hublink::NodeKind
+const uint8_t KIND_SOIL = 1;
+const uint8_t KIND_ATM = 2;
+
+enum Schema : uint8_t {
+  SCHEMA_SOIL_V1 = 0x01,
+  SCHEMA_ATM_V1  = 0x02,
+  SCHEMA_ATM_V2  = 0x03,  // V1 + gió giật
+  SCHEMA_BATCH   = 0x10,  // BatchHeader + nhiều mẫu
+  SCHEMA_RELAY   = 0x20,  // RelayHeader + số đo của các node con
+};
+
+const uint8_t FIELDS_MAX = 7;  // Số trường của ATM
+const uint8_t ATM_WIND = 3, ATM_GUST = 6;  // Vị trí trong fields(AtmPayload)
+// Gói RPT và cấu hình Master đã lưu mang 6 deadband (trước khi có gió giật);
+// trường sau đó dùng deadband của ATM_WIND
+const uint8_t DEADBAND_FIELDS = 6;
+const int32_t NO_VALUE = INT32_MIN;  // Trường node không gửi (gió giật của ATM V1 và struct float cũ)
+
+struct __attribute__((packed)) SoilPayload {
+  uint8_t schema;        // SCHEMA_SOIL_V1
+  uint16_t moisture;     // 0.1 %
+  int16_t temperature;   // 0.01 °C
+};
+
+struct __attribute__((packed)) AtmPayload {
+  uint8_t schema;        // SCHEMA_ATM_V2
+  int16_t airTemp;       // 0.01 °C
+  uint8_t airHumid;      // % (DHT11 chỉ cho số nguyên)
+  uint8_t rain;          // 0-100
+  uint16_t wind;         // 0.01 m/s, trung bình 60 giây
+  uint16_t light;        // Giá trị ADC thô
+  uint16_t pressure;     // 0.1 hPa
+  uint16_t gust;         // 0.01 m/s, trung bình 3 giây lớn nhất trong cửa sổ của wind
+};
+
+// ATM FW trước khi có gió giật, Master chỉ còn giải mã
+struct __attribute__((packed)) AtmPayloadV1 {
+  uint8_t schema;        // SCHEMA_ATM_V1
+  int16_t airTemp;
+  uint8_t airHumid;
+  uint8_t rain;
+  uint16_t wind;
+  uint16_t light;
+  uint16_t pressure;
+};
+
+// Định dạng float cũ (FW_V1.2 trở về trước)
+struct __attribute__((packed)) SoilData {
+  float moisture;
+  float temperature;
+};
+
+struct __attribute__((packed)) AtmData {
+  float air_temp;
+  float air_humid;
+  uint8_t rain;
+  float wind;
+  float light;
+  float pressure;
+};
+
+// Struct float của nhật ký/khung HubLink cho bản đo có gió giật. AtmData cộng thêm một float
+// không vừa LogRecord của Master (21 byte payload) nên độ ẩm và ánh sáng, vốn là số nguyên,
+// được thu gọn. 20 byte: host phân biệt với AtmData (21 byte) theo kích thước.
+struct __attribute__((packed)) AtmDataV2 {
+  float air_temp;
+  uint8_t air_humid;
+  uint8_t rain;
+  float wind;
+  uint16_t light;
+  float pressure;
+  float gust;
+};
+
+// Đơn vị thô trên một đơn vị JSON của từng trường, theo thứ tự trong struct
+const uint16_t SOIL_SCALE[2] = { 10, 100 };
+const uint16_t ATM_SCALE[FIELDS_MAX] = { 100, 1, 1, 100, 1, 10, 100 };
+
+inline uint8_t fieldCount(uint8_t kind) { return kind == KIND_SOIL ? 2 : FIELDS_MAX; }
+inline const uint16_t* fieldScale(uint8_t kind) { return kind == KIND_SOIL ? SOIL_SCALE : ATM_SCALE; }
+inline uint8_t deadbandIndex(uint8_t field) { return field < DEADBAND_FIELDS ? field : ATM_WIND; }
+
+// Kích thước payload theo byte schema, 0 nếu schema lạ
+inline uint8_t schemaSize(uint8_t schema) {
+  switch (schema) {
+    case SCHEMA_SOIL_V1: return sizeof(SoilPayload);
+    case SCHEMA_ATM_V1:  return sizeof(AtmPayloadV1);
+    case SCHEMA_ATM_V2:  return sizeof(AtmPayload);
+    default:             return 0;
+  }
+}
+
+inline uint8_t schemaKind(uint8_t schema) {
+  if (schema == SCHEMA_SOIL_V1) return KIND_SOIL;
+  return schema == SCHEMA_ATM_V1 || schema == SCHEMA_ATM_V2 ? KIND_ATM : 0;
+}
+
+// Giá trị thô từng trường theo thứ tự trong struct, không dùng số thực
+inline uint8_t fields(const SoilPayload& p, int32_t* raw) {
+  raw[0] = p.moisture;
+  raw[1] = p.temperature;
+  return 2;
+}
+
+inline uint8_t fields(const AtmPayload& p, int32_t* raw) {
+  raw[0] = p.airTemp;
+  raw[1] = p.airHumid;
+  raw[2] = p.rain;
+  raw[3] = p.wind;
+  raw[4] = p.light;
+  raw[5] = p.pressure;
+  raw[6] = p.gust;
+  return FIELDS_MAX;
+}
+
+inline uint8_t fields(const AtmPayloadV1& p, int32_t* raw) {
+  raw[0] = p.airTemp;
+  raw[1] = p.airHumid;
+  raw[2] = p.rain;
+  raw[3] = p.wind;
+  raw[4] = p.light;
+  raw[5] = p.pressure;
+  raw[6] = NO_VALUE;
+  return FIELDS_MAX;
+}
+
+inline int32_t clampRaw(int32_t v, int32_t lo, int32_t hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+inline SoilPayload makeSoil(int32_t moisture, int32_t temperature) {
+  SoilPayload p;
+  p.schema = SCHEMA_SOIL_V1;
+  p.moisture = clampRaw(moisture, 0, 1000);
+  p.temperature = clampRaw(temperature, INT16_MIN, INT16_MAX);
+  return p;
+}
+
+// Thứ tự tham số như fields(AtmPayload)
+inline AtmPayload makeAtm(const int32_t* raw) {
+  AtmPayload p;
+  p.schema = SCHEMA_ATM_V2;
+  p.airTemp = clampRaw(raw[0], INT16_MIN, INT16_MAX);
+  p.airHumid = clampRaw(raw[1], 0, 100);
+  p.rain = clampRaw(raw[2], 0, 100);
+  p.wind = clampRaw(raw[3], 0, UINT16_MAX);
+  p.light = clampRaw(raw[4], 0, UINT16_MAX);
+  p.pressure = clampRaw(raw[5], 0, UINT16_MAX);
+  p.gust = clampRaw(raw[6], 0, UINT16_MAX);
+  return p;
+}
+
+// Làm tròn số thực sang đơn vị thô, NAN (cảm biến lỗi) thành 0
+inline int32_t toRaw(float value, uint16_t scale) {
+  if (value != value) return 0;
+  float v = value * scale;
+  return (int32_t)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+// Payload nhận qua radio -> giá trị thô, nhận cả struct float cũ; trường không có là NO_VALUE.
+// Trả về số trường, 0 nếu kích thước/schema không khớp loại node.
+inline uint8_t decode(uint8_t kind, const uint8_t* buf, uint8_t len, int32_t* raw) {
+  if (kind == KIND_SOIL) {
+    if (len == sizeof(SoilPayload) && buf[0] == SCHEMA_SOIL_V1) {
+      SoilPayload p;
+      memcpy(&p, buf, sizeof(p));
+      return fields(p, raw);
+    }
+    if (len != sizeof(SoilData)) return 0;
+    SoilData d;
+    memcpy(&d, buf, sizeof(d));
+    raw[0] = toRaw(d.moisture, SOIL_SCALE[0]);
+    raw[1] = toRaw(d.temperature, SOIL_SCALE[1]);
+    return 2;
+  }
+  if (kind != KIND_ATM) return 0;
+  if (len == sizeof(AtmPayload) && buf[0] == SCHEMA_ATM_V2) {
+    AtmPayload p;
+    memcpy(&p, buf, sizeof(p));
+    return fields(p, raw);
+  }
+  if (len == sizeof(AtmPayloadV1) && buf[0] == SCHEMA_ATM_V1) {
+    AtmPayloadV1 p;
+    memcpy(&p, buf, sizeof(p));
+    return fields(p, raw);
+  }
+  if (len != sizeof(AtmData)) return 0;
+  AtmData d;
+  memcpy(&d, buf, sizeof(d));
+  raw[0] = toRaw(d.air_temp, ATM_SCALE[0]);
+  raw[1] = toRaw(d.air_humid, ATM_SCALE[1]);
+  raw[2] = d.rain;
+  raw[3] = toRaw(d.wind, ATM_SCALE[3]);
+  raw[4] = toRaw(d.light, ATM_SCALE[4]);
+  raw[5] = toRaw(d.pressure, ATM_SCALE[5]);
+  raw[6] = NO_VALUE;
+  return FIELDS_MAX;
+}
+
+// Giá trị thô -> struct float (nhật ký, khung HubLink): AtmDataV2 khi có gió giật, trả về số byte
+inline uint8_t toLegacy(uint8_t kind, const int32_t* raw, uint8_t* out) {
+  if (kind == KIND_SOIL) {
+    SoilData d = { (float)raw[0] / SOIL_SCALE[0], (float)raw[1] / SOIL_SCALE[1] };
+    memcpy(out, &d, sizeof(d));
+    return sizeof(d);
+  }
+  if (raw[ATM_GUST] != NO_VALUE) {
+    AtmDataV2 d;
+    d.air_temp = (float)raw[0] / ATM_SCALE[0];
+    d.air_humid = (uint8_t)raw[1];
+    d.rain = (uint8_t)raw[2];
+    d.wind = (float)raw[3] / ATM_SCALE[3];
+    d.light = (uint16_t)raw[4];
+    d.pressure = (float)raw[5] / ATM_SCALE[5];
+    d.gust = (float)raw[6] / ATM_SCALE[6];
+    memcpy(out, &d, sizeof(d));
+    return sizeof(d);
+  }
+  AtmData d;
+  d.air_temp = (float)raw[0] / ATM_SCALE[0];
+  d.air_humid = (float)raw[1];
+  d.rain = (uint8_t)raw[2];
+  d.wind = (float)raw[3] / ATM_SCALE[3];
+  d.light = (float)raw[4];
+  d.pressure = (float)raw[5] / ATM_SCALE[5];
+  memcpy(out, &d, sizeof(d));
+  return sizeof(d);
+}
+
+// deadband: phần mười đơn vị JSON (gói RPT), 0 = mọi thay đổi. Trường có rồi mất (hoặc ngược lại) luôn vượt.
+inline bool beyondDeadband(int32_t raw, int32_t last, uint16_t deadband, uint16_t scale) {
+  if (raw == NO_VALUE || last == NO_VALUE) return raw != last;
+  uint32_t diff = raw > last ? raw - last : last - raw;
+  return deadband ? diff * 10 >= (uint32_t)deadband * scale : diff != 0;
+}
+
+inline bool anyBeyond(uint8_t kind, const int32_t* raw, const int32_t* last, const uint16_t* deadband) {
+  const uint16_t* scale = fieldScale(kind);
+  for (uint8_t i = 0; i < fieldCount(kind); i++) {
+    if (beyondDeadband(raw[i], last[i], deadband[deadbandIndex(i)], scale[i])) return true;
+  }
+  return false;
+}
+
+// --- KHUNG BATCH ---
+// [BatchHeader][mẫu]..., mẫu cũ nhất trước. Mỗi mẫu: uint16_t tuổi (giây, tính tới lúc
+// node nạp khung) + payload bỏ byte schema, schema chung nằm trong header.
+const uint8_t BATCH_MORE = 0x80;   // Node còn mẫu sau khung này, Master hỏi tiếp
+const uint8_t BATCH_COUNT = 0x7F;
+
+struct __attribute__((packed)) BatchHeader {
+  uint8_t schema;      // SCHEMA_BATCH
+  uint8_t itemSchema;  // Schema payload của từng mẫu
+  uint8_t info;        // Số mẫu | BATCH_MORE
+};
+
+inline uint8_t batchEntrySize(uint8_t itemSchema) { return sizeof(uint16_t) + schemaSize(itemSchema) - 1; }
+
+inline bool isBatch(const uint8_t* buf, uint8_t len) { return len >= sizeof(BatchHeader) && buf[0] == SCHEMA_BATCH; }
+inline bool batchMore(const uint8_t* buf) { return buf[2] & BATCH_MORE; }
+
+// Số mẫu trong khung, 0 nếu schema mẫu không khớp loại node hoặc kích thước sai
+inline uint8_t batchCount(uint8_t kind, const uint8_t* buf, uint8_t len) {
+  if (!isBatch(buf, len) || schemaKind(buf[1]) != kind) return 0;
+  uint8_t n = buf[2] & BATCH_COUNT;
+  return len == sizeof(BatchHeader) + n * batchEntrySize(buf[1]) ? n : 0;
+}
+
+// Mẫu thứ i (sau batchCount) -> tuổi (giây) và giá trị thô, false nếu schema lạ
+inline bool batchEntry(uint8_t kind, const uint8_t* buf, uint8_t i, uint16_t& age, int32_t* raw) {
+  uint8_t size = schemaSize(buf[1]);
+  if (!size) return false;
+  uint8_t item[sizeof(AtmPayload)];
+  const uint8_t* entry = buf + sizeof(BatchHeader) + i * batchEntrySize(buf[1]);
+  memcpy(&age, entry, sizeof(age));
+  item[0] = buf[1];
+  memcpy(item + 1, entry + sizeof(age), size - 1);
+  return decode(kind, item, size, raw) != 0;
+}
+
+// --- KHUNG CHUYỂN TIẾP ---
+// [RelayHeader][RelayEntry + data]..., cũ nhất trước. data là đúng một bản đo node con
+// gửi sau byte addr (compact hoặc struct float cũ), len 0 = node con báo không đổi,
+// RELAY_LOST = node con không trả lời relay. Khung relay luôn được theo sau bởi số đo của
+// chính relay nên Master hỏi tiếp như BATCH_MORE.
+const uint8_t RELAY_LOST = 0xFF;
+const uint8_t RELAY_DATA_MAX = sizeof(AtmData);  // Bản đo lớn nhất node con có thể gửi
+
+struct __attribute__((packed)) RelayHeader {
+  uint8_t schema;  // SCHEMA_RELAY
+  uint8_t count;   // Số mục
+};
+
+struct __attribute__((packed)) RelayEntry {
+  uint8_t addr;    // Byte thấp địa chỉ node con
+  uint16_t age;    // Giây từ lúc relay nhận (hoặc node con lấy mẫu) tới lúc nạp khung
+  uint8_t len;     // Số byte data, RELAY_LOST không kèm data
+};
+
+inline bool isRelay(const uint8_t* buf, uint8_t len) { return len >= sizeof(RelayHeader) && buf[0] == SCHEMA_RELAY; }
+
+inline uint8_t relayDataSize(uint8_t len) { return len == RELAY_LOST ? 0 : len; }
+
+// Đọc mục tại offset (bắt đầu từ sizeof(RelayHeader)) rồi dời offset qua mục đó,
+// false khi hết khung hoặc mục bị cắt cụt
+inline bool relayEntry(const uint8_t* buf, uint8_t len, uint8_t& offset, RelayEntry& entry, const uint8_t*& data) {
+  if (offset + sizeof(RelayEntry) > len) return false;
+  memcpy(&entry, buf + offset, sizeof(entry));
+  uint8_t size = relayDataSize(entry.len);
+  if (size > RELAY_DATA_MAX || offset + sizeof(RelayEntry) + size > len) return false;
+  data = buf + offset + sizeof(RelayEntry);
+  offset += sizeof(RelayEntry) + size;
+  return true;
+}
+
+// Khung nào còn khung tiếp theo ngay sau đó: batch có BATCH_MORE hoặc khung relay
+inline bool moreFrames(const uint8_t* buf, uint8_t len) { return isRelay(buf, len) || (isBatch(buf, len) && batchMore(buf)); }
+
+// --- KÊNH RADIO ---
+// Đăng ký luôn ở CHANNEL_DEFAULT (kênh mặc định của thư viện RF24). Master đổi kênh
+// làm việc bằng gói CHN phát chung tới CHANNEL_PIPE (không ACK) hoặc gửi riêng từng node;
+// node mất liên lạc thì dò lần lượt CHANNELS bằng gói push chỉ có addr. Các kênh nằm ở khe
+// giữa Wi-Fi 1/6/11 hoặc trên 2473 MHz, không vượt 2483.5 MHz.
+const uint8_t CHANNEL_DEFAULT = 76;
+const uint8_t CHANNELS[] = { 76, 80, 83, 25, 49, 2 };
+const uint8_t CHANNEL_COUNT = sizeof(CHANNELS);
+const uint64_t CHANNEL_PIPE = 0xF0F0F0F0B4LL;
+
+struct __attribute__((packed)) ChannelPacket {
+  char cmd[4];      // "CHN"
+  uint8_t channel;  // Kênh làm việc mới, một trong CHANNELS
+};
+
+// Vị trí của kênh trong CHANNELS, CHANNEL_COUNT nếu không có (EEPROM trắng/gói hỏng)
+inline uint8_t channelIndex(uint8_t channel) {
+  uint8_t i = 0;
+  while (i < CHANNEL_COUNT && CHANNELS[i] != channel) i++;
+  return i;
+}
+
+inline bool validChannel(uint8_t channel) { return channelIndex(channel) < CHANNEL_COUNT; }
+
+// --- TỐC ĐỘ LIÊN KẾT ---
+// Master chọn tốc độ cho từng node bằng gói LNK. Node nghe ở tốc độ đó (GET của Master và
+// ACK payload trả lời nó), còn mọi gói node tự phát (đăng ký, push, trả lời kiểu cũ, dò kênh,
+// hỏi node con) vẫn ở RATE_BASE vì Master chỉ nghe ở đó. Quá lease giây không nhận GET nào
+// thì node tự quay về RATE_BASE, Master hết cách liên lạc ở tốc độ cao vẫn tìm lại được node.
+enum LinkRate : uint8_t { RATE_250K = 0, RATE_1M, RATE_2M, RATE_COUNT };
+const uint8_t RATE_BASE = RATE_250K;
+
+struct __attribute__((packed)) LinkPacket {
+  char cmd[4];      // "LNK"
+  uint8_t rate;     // LinkRate
+  uint8_t pa;       // rf24_pa_dbm_e node dùng khi nghe ở rate (ACK payload)
+  uint16_t lease;   // Giây
+};
+
+// Giá trị rf24_datarate_e của thư viện RF24 (RF24_1MBPS = 0, RF24_2MBPS = 1, RF24_250KBPS = 2)
+inline uint8_t rf24DataRate(uint8_t rate) {
+  static const uint8_t values[RATE_COUNT] = { 2, 0, 1 };
+  return rate < RATE_COUNT ? values[rate] : values[RATE_BASE];
+}
+
+inline uint16_t rateKbps(uint8_t rate) {
+  static const uint16_t kbps[RATE_COUNT] = { 250, 1000, 2000 };
+  return rate < RATE_COUNT ? kbps[rate] : kbps[RATE_BASE];
+}
+
+} // namespace nodeproto
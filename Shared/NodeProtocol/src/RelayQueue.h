@@ -0,0 +1,114 @@
+/**
+ * RelayQueue - Hàng đợi số đo của các node con trên ATM Node làm relay
+ *
+ * Relay tự hỏi node con (GETA như Master) rồi add() phần dữ liệu sau byte addr:
+ * bản đo đơn, khung batch (tách thành từng mẫu với mốc lùi theo tuổi) hoặc
+ * khung relay của relay con (chép lại từng mục). Mỗi lần Master hỏi hay relay
+ * push, pack() ghi các mục cũ nhất vừa một khung SCHEMA_RELAY; mục chỉ bị xóa
+ * bằng drop() khi Master đã nhận khung. Cùng giao diện pack()/drop() với
+ * SampleQueue nên firmware gửi hai loại hàng bằng cùng một đoạn mã.
+ *
+ * Mốc thời gian là giây của relay như SampleQueue, Master chỉ nhận tuổi.
+ */
+
+#pragma once
+
+#include "NodeProtocol.h"
+
+namespace nodeproto {
+
+template <uint8_t Capacity>
+class RelayQueue {
+ public:
+  static_assert(sizeof(RelayHeader) + sizeof(RelayEntry) + RELAY_DATA_MAX <= 31, "Mục lớn nhất phải vừa một khung");
+
+  // Dữ liệu node con addr gửi sau byte addr, nhận lúc now. false nếu không nhận ra định dạng.
+  bool add(uint8_t addr, uint16_t now, const uint8_t* buf, uint8_t len) {
+    if (isRelay(buf, len)) {
+      uint8_t offset = sizeof(RelayHeader);
+      RelayEntry e;
+      const uint8_t* data;
+      for (uint8_t i = 0; i < buf[1] && relayEntry(buf, len, offset, e, data); i++) {
+        push(e.addr, now - e.age, data, e.len);
+      }
+      return true;
+    }
+    if (isBatch(buf, len)) {
+      uint8_t kind = schemaKind(buf[1]);
+      uint8_t n = kind ? batchCount(kind, buf, len) : 0;
+      uint8_t size = schemaSize(buf[1]);
+      uint8_t item[sizeof(AtmPayload)];
+      item[0] = buf[1];
+      for (uint8_t i = 0; i < n; i++) {
+        const uint8_t* entry = buf + sizeof(BatchHeader) + i * batchEntrySize(buf[1]);
+        uint16_t age;
+        memcpy(&age, entry, sizeof(age));
+        memcpy(item + 1, entry + sizeof(age), size - 1);
+        push(addr, now - age, item, size);
+      }
+      return n != 0;
+    }
+    if (len > RELAY_DATA_MAX) return false;
+    push(addr, now, buf, len);
+    return true;
+  }
+
+  // Node con không trả lời lượt hỏi này
+  void lost(uint8_t addr, uint16_t now) { push(addr, now, nullptr, RELAY_LOST); }
+
+  uint8_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  void clear() { head_ = count_ = 0; }
+
+  // Bỏ n mục cũ nhất (Master đã nhận)
+  void drop(uint8_t n) {
+    if (n > count_) n = count_;
+    head_ = (head_ + n) % Capacity;
+    count_ -= n;
+  }
+
+  // Ghi khung relay vào out (tối đa room byte), now: giây hiện tại của relay.
+  // Trả về số byte, taken = số mục trong khung; 0 nếu hàng rỗng hoặc không đủ chỗ.
+  uint8_t pack(uint8_t* out, uint8_t room, uint16_t now, uint8_t& taken) const {
+    taken = 0;
+    if (room < sizeof(RelayHeader)) return 0;
+    uint8_t* p = out + sizeof(RelayHeader);
+    while (taken < count_) {
+      const Entry& e = entries_[(head_ + taken) % Capacity];
+      uint8_t size = relayDataSize(e.head.len);
+      if (p + sizeof(RelayEntry) + size > out + room) break;
+      RelayEntry head = e.head;
+      head.age = now - e.head.age;  // Trong hàng age giữ mốc nhận, đổi sang tuổi lúc nạp khung
+      memcpy(p, &head, sizeof(head));
+      memcpy(p + sizeof(head), e.data, size);
+      p += sizeof(head) + size;
+      taken++;
+    }
+    if (!taken) return 0;
+    RelayHeader h = { SCHEMA_RELAY, taken };
+    memcpy(out, &h, sizeof(h));
+    return p - out;
+  }
+
+ private:
+  struct __attribute__((packed)) Entry {
+    RelayEntry head;
+    uint8_t data[RELAY_DATA_MAX];
+  };
+
+  // Hàng đầy thì bỏ mục cũ nhất như SampleQueue
+  void push(uint8_t addr, uint16_t at, const uint8_t* data, uint8_t len) {
+    if (count_ == Capacity) drop(1);
+    Entry& e = entries_[(head_ + count_) % Capacity];
+    e.head.addr = addr;
+    e.head.age = at;
+    e.head.len = len;
+    if (data) memcpy(e.data, data, relayDataSize(len));
+    count_++;
+  }
+
+  Entry entries_[Capacity];
+  uint8_t head_ = 0, count_ = 0;
+};
+
+} // namespace nodeproto
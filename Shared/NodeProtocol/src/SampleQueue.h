@@ -0,0 +1,79 @@
+/**
+ * SampleQueue - Hàng đợi mẫu có mốc thời gian của node, đóng gói thành khung batch
+ *
+ * Node lấy mẫu theo chu kỳ riêng (gói BAT) rồi xếp vào đây; mỗi lần trả lời
+ * GETA hoặc push, pack() ghi các mẫu cũ nhất vừa một khung 32 byte. Mẫu chỉ bị
+ * xóa bằng drop() khi Master đã nhận khung chứa nó. Hàng đầy thì mẫu cũ nhất
+ * bị bỏ, Master vẫn có các mẫu mới nhất.
+ *
+ * Mốc thời gian là giây của node (millis() / 1000, tràn sau ~18 giờ), Master
+ * chỉ nhận tuổi của mẫu nên không cần đồng bộ đồng hồ.
+ */
+
+#pragma once
+
+#include "NodeProtocol.h"
+
+namespace nodeproto {
+
+template <typename Payload, uint8_t Capacity>
+class SampleQueue {
+ public:
+  static_assert(Capacity <= BATCH_COUNT, "Số mẫu phải vừa trường info của BatchHeader");
+
+  // Thêm mẫu lấy lúc at (giây của node), true nếu hàng đầy và mẫu cũ nhất bị bỏ
+  bool push(uint16_t at, const Payload& data) {
+    bool dropped = count_ == Capacity;
+    if (dropped) drop(1);
+    Entry& e = entries_[(head_ + count_) % Capacity];
+    e.at = at;
+    e.data = data;
+    count_++;
+    return dropped;
+  }
+
+  uint8_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  void clear() { head_ = count_ = 0; }
+
+  // Bỏ n mẫu cũ nhất (Master đã nhận)
+  void drop(uint8_t n) {
+    if (n > count_) n = count_;
+    head_ = (head_ + n) % Capacity;
+    count_ -= n;
+  }
+
+  // Ghi khung batch vào out (tối đa room byte), now: giây hiện tại của node.
+  // Trả về số byte, taken = số mẫu trong khung; 0 nếu hàng rỗng hoặc không đủ chỗ.
+  uint8_t pack(uint8_t* out, uint8_t room, uint16_t now, uint8_t& taken) const {
+    const uint8_t entrySize = sizeof(uint16_t) + sizeof(Payload) - 1;
+    taken = 0;
+    if (!count_ || room < sizeof(BatchHeader) + entrySize) return 0;
+    uint8_t fit = (room - sizeof(BatchHeader)) / entrySize;
+    taken = count_ < fit ? count_ : fit;
+
+    const Entry& first = entries_[head_];
+    BatchHeader h = { SCHEMA_BATCH, first.data.schema, (uint8_t)(taken | (count_ > taken ? BATCH_MORE : 0)) };
+    memcpy(out, &h, sizeof(h));
+    uint8_t* p = out + sizeof(h);
+    for (uint8_t i = 0; i < taken; i++) {
+      const Entry& e = entries_[(head_ + i) % Capacity];
+      uint16_t age = now - e.at;
+      memcpy(p, &age, sizeof(age));
+      memcpy(p + sizeof(age), (const uint8_t*)&e.data + 1, sizeof(Payload) - 1); // Bỏ byte schema
+      p += entrySize;
+    }
+    return p - out;
+  }
+
+ private:
+  struct __attribute__((packed)) Entry {
+    uint16_t at;
+    Payload data;
+  };
+
+  Entry entries_[Capacity];
+  uint8_t head_ = 0, count_ = 0;
+};
+
+} // namespace nodeproto
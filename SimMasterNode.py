@@ -2,6 +2,8 @@ import serial
 import time
 import json
 import random
+import struct
+import binascii
 import threading
 import sys
 
@@ -17,6 +19,70 @@ VIRTUAL_DEVICES = [
     {"id": "atm00001",  "type": "atm",  "status": "online"}
 ]
 
+# --- KHUNG HUBLINK (khớp Shared/HubLink/src/HubLink.h) ---
+HUBLINK_SOF = 0xA5
+FRAME_READING = 0x01
+FRAME_OFFLINE = 0x02
+FRAME_SWEEP_DONE = 0x03
+FRAME_REPLAY = 0x04
+KIND_SOIL = 1
+KIND_ATM = 2
+
+output_mode = {"bin": False}
+
+# Nhật ký bản đo giống ReadingLog của MainHub: (seq, ts, device, data)
+READING_LOG_SIZE = 512
+reading_log = []
+next_seq = {"value": 1}
+start_time = time.time()
+
+def millis():
+    return int((time.time() - start_time) * 1000) & 0xFFFFFFFF
+
+def encode_frame(body):
+    # CRC-16/CCITT-FALSE trên len + body, ghi LSB trước
+    length = bytes([len(body)])
+    crc = binascii.crc_hqx(length + body, 0xFFFF)
+    return bytes([HUBLINK_SOF]) + length + body + struct.pack('<H', crc)
+
+def binary_reading(index, device, data, seq, ts, frame_type=FRAME_READING):
+    s = data["sensors"]
+    if device["type"] == "soil":
+        payload = struct.pack('<ff', s["soil_moisture"], s["soil_temperature"])
+        kind = KIND_SOIL
+    else:
+        # AtmDataV2: ATM FW có gió giật
+        payload = struct.pack('<fBBfHff', s["air_temperature"], s["air_humidity"], s["rain_intensity"],
+                              s["wind_speed"], s["light_intensity"], s["barometric_pressure"], s["wind_gust"])
+        kind = KIND_ATM
+    return encode_frame(struct.pack('<BIBBI', frame_type, ts, index, kind, seq) + payload)
+
+def log_reading(device, data):
+    seq = next_seq["value"]
+    next_seq["value"] += 1
+    reading_log.append((seq, millis(), device, data))
+    del reading_log[:-READING_LOG_SIZE]
+    return seq
+
+def handle_dump_since(ser, arg):
+    try:
+        start = int(arg)
+    except ValueError:
+        start = 0
+    first = reading_log[0][0] if reading_log else next_seq["value"]
+    start = max(start, first)
+    end = next_seq["value"]
+    begin = json.dumps({"event": "dump_begin", "from": start, "to": end, "now": millis()})
+    ser.write((begin + '\r\n').encode('utf-8'))
+    for seq, ts, device, data in reading_log:
+        if seq < start or device not in VIRTUAL_DEVICES:
+            continue
+        if output_mode["bin"]:
+            ser.write(binary_reading(VIRTUAL_DEVICES.index(device), device, data, seq, ts, FRAME_REPLAY))
+        else:
+            ser.write((json.dumps(dict(data, seq=seq, ts=ts)) + '\r\n').encode('utf-8'))
+    ser.write((json.dumps({"event": "dump_end", "next": end}) + '\r\n').encode('utf-8'))
+
 def open_serial_port():
     port = input(f"Nhập cổng COM (mặc định {DEFAULT_PORT}): ").strip()
     if not port:
@@ -41,14 +107,16 @@ def generate_soil_data(node_id):
     }
 
 def generate_atm_data(node_id):
+    wind = round(random.uniform(0.0, 15.0), 2)
     return {
         "sensors": {
             "air_temperature": round(random.uniform(25.0, 38.0), 2),
-            "air_humidity": round(random.uniform(50.0, 95.0), 1),
+            "air_humidity": random.randint(50, 95),
             "rain_intensity": random.randint(0, 1),
-            "wind_speed": round(random.uniform(0.0, 15.0), 2),
-            "light_intensity": round(random.uniform(100.0, 5000.0), 1),
-            "barometric_pressure": round(random.uniform(990.0, 1015.0), 1)
+            "wind_speed": wind,
+            "light_intensity": random.randint(100, 5000),
+            "barometric_pressure": round(random.uniform(990.0, 1015.0), 1),
+            "wind_gust": round(wind + random.uniform(0.0, 5.0), 2)
         },
         "id": node_id
     }
@@ -59,26 +127,35 @@ def handle_get_data_now(ser):
         ser.write(b'{"event":"data_collection_finished"}\r\n')
         return
 
-    for device in VIRTUAL_DEVICES:
+    for index, device in enumerate(VIRTUAL_DEVICES):
         time.sleep(0.3)
         is_offline = random.random() < 0.05
 
         if is_offline:
             resp = json.dumps({"id": device["id"], "status": "offline"})
+            frame = encode_frame(struct.pack('<BIB', FRAME_OFFLINE, millis(), index))
         else:
             if device["type"] == "soil":
                 data = generate_soil_data(device["id"])
             else:
                 data = generate_atm_data(device["id"])
-            resp = json.dumps(data)
+            seq = log_reading(device, data)
+            resp = json.dumps(dict(data, seq=seq))
+            frame = binary_reading(index, device, data, seq, reading_log[-1][1])
         
         print(f"[SENDING] {resp}")
-        ser.write((resp + '\r\n').encode('utf-8'))
+        if output_mode["bin"]:
+            ser.write(frame)
+        else:
+            ser.write((resp + '\r\n').encode('utf-8'))
     
     time.sleep(0.1)
     end_msg = '{"event":"data_collection_finished"}'
     print(f"[SENDING] {end_msg}")
-    ser.write((end_msg + '\r\n').encode('utf-8'))
+    if output_mode["bin"]:
+        ser.write(encode_frame(struct.pack('<BI', FRAME_SWEEP_DONE, millis())))
+    else:
+        ser.write((end_msg + '\r\n').encode('utf-8'))
 
 def main():
     ser = open_serial_port()
@@ -142,11 +219,25 @@ def main():
                         msg = json.dumps({"event": "deleted", "id": node_id})
                         ser.write((msg + '\r\n').encode('utf-8'))
 
+                    elif cmd in ("setOutput bin", "setOutput json"):
+                        output_mode["bin"] = cmd.endswith("bin")
+                        msg = json.dumps({"event": "output_mode", "mode": "bin" if output_mode["bin"] else "json"})
+                        ser.write((msg + '\r\n').encode('utf-8'))
+
                     elif cmd == "registerNewNode":
                         ser.write(b'{"status":"register_mode_active"}\r\n')
 
                     elif cmd == "cancelRegister":
                         ser.write(b'{"event":"register_cancelled"}\r\n')
+
+                    elif cmd.startswith("dumpSince"):
+                        handle_dump_since(ser, cmd[len("dumpSince"):].strip())
+
+                    elif cmd == "logInfo":
+                        first = reading_log[0][0] if reading_log else next_seq["value"]
+                        msg = json.dumps({"event": "log_info", "first": first, "next": next_seq["value"],
+                                          "capacity": READING_LOG_SIZE})
+                        ser.write((msg + '\r\n').encode('utf-8'))
             time.sleep(0.01)
 
     except KeyboardInterrupt:
@@ -3,11 +3,43 @@
  * - PA Level: HIGH
  * - Debug: In chi tiết quá trình gửi/nhận.
  * - Fix: Thêm __attribute__((packed))
+ * - Push Mode: Tự gửi dữ liệu theo chu kỳ do Master cấu hình (gói CFG).
+ * - Low Power: Master cấu hình chu kỳ thức (gói SLP). Giữa hai lần thức radio
+ *   tắt và MCU ngủ power-down bằng WDT; mỗi lần thức gửi số đo vào PUSH_PIPE
+ *   rồi nghe lệnh trong WAKE_WINDOW_MS. Gói push là mốc lịch để Master biết
+ *   khi nào node nghe, không cần đồng bộ đồng hồ.
+ * - ACK Payload: Master gửi "GETA" thì node nạp sẵn [addr][SoilPayload] làm payload
+ *   của auto-ACK, lần GET sau nhận dữ liệu ngay trong ACK, không phát lại và
+ *   không chờ OK. Master cũ gửi "GET" thì quay lại cách trả lời 3 bước.
+ * - Lọc cảm biến: Timer1 kích ADC 2kHz xen kẽ hai kênh, ISR cộng 16 mẫu thành
+ *   một mẫu 12 bit, lấy trung vị 3 rồi EMA 1/8, toàn bộ bằng số nguyên.
+ *   readSensors() chỉ đổi giá trị đã lọc sang SoilPayload.
+ * - Compact Payload: số đo gửi dạng số nguyên có byte schema (5 byte, xem
+ *   Shared/NodeProtocol), firmware không còn phép tính số thực nào.
+ * - Delta Report: Master cấu hình heartbeat và deadband (gói RPT). Số đo chưa
+ *   đổi quá deadband so với lần gửi đủ gần nhất thì ACK payload/push chỉ mang
+ *   [addr], push thường bị bỏ hẳn; tới heartbeat thì gửi đủ.
+ * - Batch: Master cấu hình chu kỳ lấy mẫu (gói BAT). Mẫu cần gửi được xếp hàng
+ *   kèm mốc giây, ACK payload/push mang khung batch nhiều mẫu (SampleQueue),
+ *   còn mẫu thì khung có cờ BATCH_MORE để Master hỏi tiếp. Khi ngủ node thức
+ *   giữa chừng chỉ để lấy mẫu, radio vẫn tắt tới lần thức kế tiếp.
+ * - Channel: đăng ký ở CHANNEL_DEFAULT, Master đổi kênh làm việc bằng gói CHN
+ *   (phát chung tới CHANNEL_PIPE ở pipe 0 hoặc gửi riêng). Push/lần thức hỏng
+ *   hết số lần thử thì dò các kênh trong nodeproto::CHANNELS bằng gói chỉ có
+ *   addr, kênh nào Master ACK thì ở lại (node ngủ lỡ gói CHN vẫn tìm lại được).
+ * - Link Rate: Master chọn tốc độ/công suất nghe bằng gói LNK (không lưu EEPROM).
+ *   Gói node tự phát luôn ở 250kbps/PA_HIGH, quá lease không có GET thì về 250kbps.
  */
 
 #include <SPI.h>
 #include <RF24.h>
 #include <EEPROM.h>
+#include <NodeProtocol.h>
+#include <SampleQueue.h>
+#ifndef SIM_NODE_FIRMWARE
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#endif
 
 // --- CẤU HÌNH ID ---
 const char* MY_NODE_ID = "soil00001"; 
@@ -20,28 +52,120 @@ const char* MY_NODE_ID = "soil00001";
 #define PIN_SOIL  A0
 #define PIN_TEMP  A1
 
-const float TEMP_OFFSET = -10.0;
+const int16_t TEMP_OFFSET_CENTI = -1000; // -10.0°C
 const int EEPROM_ADDR_FLAG = 0; 
+const int EEPROM_ADDR_NODE = 1;  // Byte địa chỉ do Master cấp
+
+#define REG_LEGACY    1  // Đăng ký với FW cũ: địa chỉ = hash ID
+#define REG_ASSIGNED  2  // Địa chỉ lưu tại EEPROM_ADDR_NODE
+const int EEPROM_ADDR_PUSH = 2;  // uint16_t chu kỳ Push (giây)
+#define PUSH_MAX_RETRIES 3       // Số lần thử lại nhanh khi Master không ACK
+const int EEPROM_ADDR_SLEEP = 4; // uint16_t chu kỳ thức (giây), 0 = luôn nghe
+#define WAKE_WINDOW_MS   50      // Thời gian nghe lệnh sau mỗi lần thức
+#define ACK_REFRESH_MS   1000    // Chu kỳ đọc lại cảm biến cho ACK payload đang chờ
+const int EEPROM_ADDR_REPORT = 6; // ReportConfig (6 byte)
+#define REPORT_FIELDS    2       // moisture, temperature
+#define REPORT_WIRE_FIELDS 6     // Gói RPT luôn mang đủ 6 deadband (số trường của AtmPayload)
+const int EEPROM_ADDR_SAMPLE = 12; // uint16_t chu kỳ lấy mẫu (giây), 0 = không xếp hàng
+#define SAMPLE_QUEUE     12      // Mẫu chờ gửi, 7 byte mỗi mẫu
+const int EEPROM_ADDR_CHANNEL = 14; // Kênh làm việc, 0xFF (EEPROM trắng) = CHANNEL_DEFAULT
+#define SEARCH_RETRIES   5       // Số lần phát lại mỗi kênh khi dò, kênh trống không cần chờ lâu
+
+#define SAMPLE_RATE_HZ   2000    // Tổng hai kênh, mỗi kênh 1kHz
+#define OVERSAMPLE_N     16      // 4^2 mẫu 10 bit -> thêm 2 bit (~16ms mỗi mẫu 12 bit)
+#define MEDIAN_TAPS      3       // Trung vị 3 mẫu 12 bit bỏ gai nhiễu
+#define EMA_SHIFT        3       // alpha = 1/8
+#define FILTER_FULL_SCALE 65472UL // 1023 sau (x16 >> 2) << 4
 
 RF24 radio(PIN_CE, PIN_CSN);
 const uint64_t REGISTER_PIPE = 0xF0F0F0F0E1LL;
+const uint64_t REGISTER_REPLY_PIPE = 0xF0F0F0F0D2LL;
+const uint64_t PUSH_PIPE = 0xF0F0F0F0C3LL;
 const uint64_t BASE_ADDR_PREFIX = 0xF0F0F0F000LL;
 
-struct __attribute__((packed)) SoilData {
-  float moisture;
-  float temperature;
-};
+using nodeproto::SoilPayload;
+using nodeproto::ChannelPacket;
+using nodeproto::LinkPacket;
 
 struct __attribute__((packed)) RegisterPacket {
   char cmd[4];
   char id[11];
 };
 
+struct __attribute__((packed)) ConfigPacket {
+  char cmd[4];            // "CFG"
+  uint16_t pushInterval;  // Giây, 0 = chỉ trả lời GET
+};
+
+struct __attribute__((packed)) SleepPacket {
+  char cmd[4];            // "SLP"
+  uint16_t wakePeriod;    // Giây, 0 = tắt chế độ ngủ
+};
+
+struct __attribute__((packed)) ReportPacket {
+  char cmd[4];                            // "RPT"
+  uint16_t heartbeat;                     // Giây, 0 = luôn gửi đủ
+  uint16_t deadband[REPORT_WIRE_FIELDS];  // Phần mười đơn vị, theo thứ tự trường của SoilPayload
+};
+
+struct __attribute__((packed)) SamplePacket {
+  char cmd[4];              // "BAT"
+  uint16_t sampleInterval;  // Giây, 0 = tắt xếp hàng
+};
+
+struct __attribute__((packed)) RegisterAck {
+  char cmd[7];
+  char id[11];
+  uint8_t addr;
+};
+
+struct ReportConfig {
+  uint16_t heartbeat;
+  uint16_t deadband[REPORT_FIELDS];
+};
+
 bool isRegistered = false;
 uint64_t myAddress;
 unsigned long lastBlink = 0;
 
-uint64_t generateNodeAddress(const char* str) {
+// --- LỌC CẢM BIẾN ---
+struct AnalogFilter {
+  uint16_t acc;                   // Tổng mẫu 10 bit đang cộng dồn
+  uint8_t count;
+  uint16_t window[MEDIAN_TAPS];   // Mẫu 12 bit gần nhất
+  uint8_t filled, pos;
+  uint16_t ema;                   // 12 bit << 4, đọc trong noInterrupts()
+  bool ready;                     // Đã có giá trị EMA đầu tiên
+};
+
+#define FILTER_TEMP 0
+#define FILTER_SOIL 1
+AnalogFilter filters[2];
+uint16_t pushInterval = 0;
+unsigned long nextPush = 0;
+uint8_t pushFails = 0;
+uint16_t wakePeriod = 0;
+bool ackMode = false;            // Master hỗ trợ ACK payload (đã nhận "GETA")
+bool ackLoaded = false;          // FIFO TX đang giữ số đo cho ACK kế tiếp
+unsigned long lastPreload = 0;
+ReportConfig report;             // heartbeat 0 = mọi lần gửi đều đủ số đo
+SoilPayload lastSent;              // Bản đủ gần nhất Master đã nhận, mốc cho deadband
+unsigned long lastSentAt = 0;
+bool hasSent = false;
+bool preloadFull = false;        // ACK payload đang nạp là bản đủ (không phải gói "không đổi")
+SoilPayload preloaded;
+nodeproto::SampleQueue<SoilPayload, SAMPLE_QUEUE> samples;
+uint16_t sampleInterval = 0;
+unsigned long lastSample = 0;
+uint8_t preloadTaken = 0;        // Số mẫu của hàng đợi nằm trong ACK payload đang nạp
+uint8_t radioChannel = nodeproto::CHANNEL_DEFAULT;
+uint8_t linkRate = nodeproto::RATE_BASE;  // Tốc độ nghe do Master chọn, khởi động lại là về gốc
+uint8_t linkPa = RF24_PA_HIGH;
+uint16_t linkLease = 0;          // Giây
+unsigned long linkHeard = 0;     // millis() lần nhận GET gần nhất
+
+// Địa chỉ theo hash của FW cũ, chỉ dùng cho node đã đăng ký trước khi Master cấp địa chỉ
+uint64_t legacyNodeAddress(const char* str) {
     unsigned long hash = 5381;
     int c;
     while ((c = *str++)) hash = ((hash << 5) + hash) + c;
@@ -49,14 +173,26 @@ uint64_t generateNodeAddress(const char* str) {
 }
 
 void registerToMaster();
+void resumeListening();
+void beginUplink();
+void checkLinkLease();
+void preloadReading();
 void listenAndReply();
-void readSensors(SoilData &data);
+void pushReading();
+void takeSample();
+void wakeCycle();
+void readSensors(SoilPayload &data);
+void startSampler();
+void serviceSampler();
+void restartSampler();
+bool samplerReady();
 void handleButton();
 
 void setup() {
   Serial.begin(9600);
   pinMode(PIN_LED, OUTPUT);
   pinMode(PIN_BTN, INPUT_PULLUP);
+  startSampler();
   
   delay(500);
 
@@ -68,21 +204,36 @@ void setup() {
   // CAO NHẤT THEO YÊU CẦU
   radio.setPALevel(RF24_PA_HIGH); 
   radio.setDataRate(RF24_250KBPS);
-  radio.setRetries(5, 15);
+  radio.setRetries(15, 15); // Cửa sổ gửi lại ~60ms, đủ dài để Master phát xong GET cho node khác
   radio.enableDynamicPayloads();
-  
-  myAddress = generateNodeAddress(MY_NODE_ID);
+  radio.enableAckPayload(); // Chỉ nạp payload khi Master gửi "GETA", Master cũ nhận ACK rỗng
   
   Serial.print("Node ID: "); Serial.println(MY_NODE_ID);
-  // In ra địa chỉ của mình để so khớp với log Master nếu cần
-  uint32_t addrLow = (uint32_t)myAddress;
-  Serial.print("My Pipe Address (Low 32bit): "); Serial.println(addrLow, HEX);
   Serial.print("Struct Size: "); Serial.println((unsigned int)sizeof(RegisterPacket));
 
-  if (EEPROM.read(EEPROM_ADDR_FLAG) == 1) {
+  EEPROM.get(EEPROM_ADDR_PUSH, pushInterval);
+  if (pushInterval == 0xFFFF) pushInterval = 0; // EEPROM trắng
+  EEPROM.get(EEPROM_ADDR_SLEEP, wakePeriod);
+  if (wakePeriod == 0xFFFF) wakePeriod = 0;
+  EEPROM.get(EEPROM_ADDR_REPORT, report);
+  if (report.heartbeat == 0xFFFF) memset(&report, 0, sizeof(report));
+  EEPROM.get(EEPROM_ADDR_SAMPLE, sampleInterval);
+  if (sampleInterval == 0xFFFF) sampleInterval = 0;
+  radioChannel = EEPROM.read(EEPROM_ADDR_CHANNEL);
+  if (!nodeproto::validChannel(radioChannel)) radioChannel = nodeproto::CHANNEL_DEFAULT;
+  radio.setChannel(radioChannel);
+
+  uint8_t regFlag = EEPROM.read(EEPROM_ADDR_FLAG);
+  if (regFlag == REG_ASSIGNED || regFlag == REG_LEGACY) {
     isRegistered = true;
+    if (regFlag == REG_ASSIGNED) myAddress = BASE_ADDR_PREFIX | EEPROM.read(EEPROM_ADDR_NODE);
+    else myAddress = legacyNodeAddress(MY_NODE_ID);
+    // In ra địa chỉ của mình để so khớp với log Master nếu cần
+    uint32_t addrLow = (uint32_t)myAddress;
+    Serial.print("My Pipe Address (Low 32bit): "); Serial.println(addrLow, HEX);
     Serial.println("RECOVERED: Already REGISTERED.");
     for(int i=0; i<2; i++) { digitalWrite(PIN_LED, HIGH); delay(200); digitalWrite(PIN_LED, LOW); delay(200); }
+    resumeListening();
   } else {
     Serial.println("System Ready. Waiting to register...");
   }
@@ -90,6 +241,7 @@ void setup() {
 
 void loop() {
   handleButton(); 
+  serviceSampler();
 
   if (!isRegistered) {
     if (millis() - lastBlink > 500) {
@@ -97,7 +249,12 @@ void loop() {
       digitalWrite(PIN_LED, !digitalRead(PIN_LED));
     }
     registerToMaster();
+  } else if (wakePeriod) {
+    wakeCycle();
   } else {
+    if (sampleInterval && millis() - lastSample >= sampleInterval * 1000UL) takeSample();
+    if (pushInterval && (long)(millis() - nextPush) >= 0) pushReading();
+    checkLinkLease();
     listenAndReply();
   }
 }
@@ -109,6 +266,7 @@ void handleButton() {
       Serial.println("Manual RESET Registration...");
       isRegistered = false;
       EEPROM.write(EEPROM_ADDR_FLAG, 0);
+      radio.powerUp(); // Có thể đang tắt sau chu kỳ ngủ
       digitalWrite(PIN_LED, LOW);
       while(digitalRead(PIN_BTN) == LOW);
       delay(1000);
@@ -116,21 +274,112 @@ void handleButton() {
   }
 }
 
-void readSensors(SoilData &data) {
-  data.moisture = 0.0;
-  data.temperature = 0.0;
+// Đổi giá trị đã lọc sang đơn vị của SoilPayload (0.1%, 0.01°C)
+void readSensors(SoilPayload &data) {
+  noInterrupts();
+  uint16_t temp = filters[FILTER_TEMP].ema;
+  uint16_t soil = filters[FILTER_SOIL].ema;
+  interrupts();
 
-  int lm35Raw = analogRead(PIN_TEMP);
-  float voltage = lm35Raw * (5.0 / 1023.0);
-  data.temperature = voltage * 100.0 + TEMP_OFFSET;
+  // LM35 10mV/°C, thang 5V: toàn thang = 500°C
+  int32_t centiC = (int32_t)(temp * 50000UL / FILTER_FULL_SCALE) + TEMP_OFFSET_CENTI;
+  // Cảm biến ẩm: 1023 = khô (0%), 0 = ướt (100%)
+  uint16_t permille = (FILTER_FULL_SCALE - soil) * 1000UL / FILTER_FULL_SCALE; // soil <= FILTER_FULL_SCALE
+  data = nodeproto::makeSoil(permille, centiC);
+}
+
+uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+  if (a > b) { uint16_t t = a; a = b; b = t; }
+  if (b > c) b = c;
+  return a > b ? a : b;
+}
+
+// Gọi trong ISR với mỗi mẫu 10 bit của kênh tương ứng
+void filterPush(AnalogFilter& f, uint16_t sample) {
+  f.acc += sample; // 16 x 1023 vẫn vừa uint16_t
+  if (++f.count < OVERSAMPLE_N) return;
+  uint16_t x = f.acc >> 2;
+  f.acc = 0;
+  f.count = 0;
+
+  f.window[f.pos] = x;
+  if (++f.pos == MEDIAN_TAPS) f.pos = 0;
+  if (f.filled < MEDIAN_TAPS && ++f.filled < MEDIAN_TAPS) return;
+
+  uint16_t q = median3(f.window[0], f.window[1], f.window[2]) << 4;
+  if (!f.ready) { f.ema = q; f.ready = true; return; }
+  f.ema += ((int32_t)q - f.ema) >> EMA_SHIFT;
+}
 
-  int soilRaw = analogRead(PIN_SOIL);
-  int percent = map(soilRaw, 1023, 0, 0, 100);
-  data.moisture = constrain(percent, 0, 100);
+// Sau khi ngủ giá trị cũ đã lỗi thời: bỏ hết, EMA lấy lại mốc từ trung vị đầu tiên
+void restartSampler() {
+  noInterrupts();
+  memset(filters, 0, sizeof(filters));
+  interrupts();
+  startSampler();
 }
 
+bool samplerReady() {
+  noInterrupts();
+  bool ready = filters[FILTER_TEMP].ready && filters[FILTER_SOIL].ready;
+  interrupts();
+  return ready;
+}
+
+#ifdef SIM_NODE_FIRMWARE
+// Bản giả lập không có Timer1/ADC: loop() bù đủ số mẫu theo đồng hồ ảo
+const unsigned long SAMPLE_PERIOD_US = 1000000UL / SAMPLE_RATE_HZ;
+unsigned long lastSampleUs = 0;
+uint8_t nextFilter = FILTER_TEMP;
+
+void startSampler() {
+  lastSampleUs = micros();
+  nextFilter = FILTER_TEMP;
+}
+
+void serviceSampler() {
+  unsigned long now = micros();
+  if (now - lastSampleUs > 100000UL) lastSampleUs = now - 100000UL; // Sau delay()/ngủ chỉ bù 100ms
+  while (now - lastSampleUs >= SAMPLE_PERIOD_US) {
+    lastSampleUs += SAMPLE_PERIOD_US;
+    filterPush(filters[nextFilter], analogRead(nextFilter == FILTER_TEMP ? PIN_TEMP : PIN_SOIL));
+    nextFilter ^= 1;
+  }
+}
+#else
+const uint8_t ADC_CHANNEL[2] = { PIN_TEMP - A0, PIN_SOIL - A0 };
+volatile uint8_t adcFilter = FILTER_TEMP;
+
+// Timer1 CTC, Compare Match B kích ADC (ADTS = 101) nên không có ISR timer và
+// ADC không phải chờ bận như analogRead(). Timer1 không dùng chân 9/10 ở chế độ này.
+void startSampler() {
+  noInterrupts();
+  adcFilter = FILTER_TEMP;
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11);               // CTC, clk/8 = 2MHz
+  OCR1A = F_CPU / 8 / SAMPLE_RATE_HZ - 1;
+  OCR1B = OCR1A;
+  ADMUX = _BV(REFS0) | ADC_CHANNEL[FILTER_TEMP]; // AVcc, giống analogRead() mặc định
+  ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  interrupts();
+}
+
+void serviceSampler() {}
+
+ISR(ADC_vect) {
+  uint16_t sample = ADC;
+  TIFR1 = _BV(OCF1B); // Xóa cờ để lần so khớp sau kích được ADC
+  uint8_t i = adcFilter;
+  adcFilter = i ^ 1;
+  ADMUX = _BV(REFS0) | ADC_CHANNEL[i ^ 1]; // Chuyển kênh trước lần kích kế tiếp
+  filterPush(filters[i], sample);
+}
+#endif
+
 void registerToMaster() {
-  radio.stopListening();
+  beginUplink();
+  radio.setChannel(nodeproto::CHANNEL_DEFAULT); // Master chỉ nghe REG ở kênh mặc định
   radio.openWritingPipe(REGISTER_PIPE);
   
   RegisterPacket pkt;
@@ -141,24 +390,42 @@ void registerToMaster() {
   Serial.print("Sending REG... ");
   if (radio.write(&pkt, sizeof(pkt))) {
     Serial.println("Sent OK. Waiting for ACK...");
-    radio.openReadingPipe(1, myAddress);
+    radio.openReadingPipe(1, REGISTER_REPLY_PIPE);
     radio.startListening();
     
     unsigned long startWait = millis();
     bool received = false;
     while (millis() - startWait < 500) {
       if (radio.available()) {
-        char ack[10] = {0};
+        RegisterAck ack;
+        memset(&ack, 0, sizeof(ack));
         uint8_t len = radio.getDynamicPayloadSize();
+        if (len != sizeof(ack)) { char trash[32]; radio.read(&trash, len); continue; }
         radio.read(&ack, len);
-        Serial.print("Received: "); Serial.println(ack);
+        ack.cmd[6] = '\0'; ack.id[10] = '\0';
+        Serial.print("Received: "); Serial.println(ack.cmd);
         
-        if (strcmp(ack, "REG_OK") == 0) {
+        // Nhiều node có thể cùng đăng ký, chỉ nhận REG_OK mang đúng ID của mình
+        if (strcmp(ack.cmd, "REG_OK") == 0 && strcmp(ack.id, MY_NODE_ID) == 0) {
           isRegistered = true;
-          EEPROM.write(EEPROM_ADDR_FLAG, 1);
+          myAddress = BASE_ADDR_PREFIX | ack.addr;
+          wakePeriod = 0; // Master vừa tạo bản ghi mới, coi node là luôn nghe
+          memset(&report, 0, sizeof(report)); // Master cũng xóa cấu hình RPT khi đăng ký lại
+          sampleInterval = 0;
+          samples.clear();
+          radioChannel = nodeproto::CHANNEL_DEFAULT; // Master báo kênh làm việc ở lượt quét kế tiếp
+          linkRate = nodeproto::RATE_BASE;
+          linkPa = RF24_PA_HIGH;
+          EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+          EEPROM.write(EEPROM_ADDR_NODE, ack.addr);
+          EEPROM.write(EEPROM_ADDR_FLAG, REG_ASSIGNED);
+          EEPROM.put(EEPROM_ADDR_SLEEP, wakePeriod);
+          EEPROM.put(EEPROM_ADDR_REPORT, report);
+          EEPROM.put(EEPROM_ADDR_SAMPLE, sampleInterval);
           digitalWrite(PIN_LED, LOW);
-          Serial.println("REGISTER SUCCESS!");
+          Serial.print("REGISTER SUCCESS! Addr: "); Serial.println(ack.addr, HEX);
           for(int i=0; i<3; i++) { digitalWrite(PIN_LED, HIGH); delay(100); digitalWrite(PIN_LED, LOW); delay(100); }
+          resumeListening();
           return;
         }
       }
@@ -170,28 +437,324 @@ void registerToMaster() {
   delay(2000);
 }
 
-void listenAndReply() {
+// Pipe 1 chỉ cần mở lại sau khi phát, không phải mỗi vòng loop().
+// Pipe 0 nghe gói CHN phát chung, RF24 tự trả lại địa chỉ này sau mỗi lần phát.
+void resumeListening() {
+  radio.setDataRate((rf24_datarate_e)nodeproto::rf24DataRate(linkRate));
+  radio.setPALevel(linkPa);
+  radio.openReadingPipe(0, nodeproto::CHANNEL_PIPE);
   radio.openReadingPipe(1, myAddress);
-  radio.startListening();
-  
+  radio.startListening(); // Xóa FIFO TX khi bật ACK payload
+  ackLoaded = false;
+}
+
+// --- DELTA REPORT ---
+// true: phải gửi đủ số đo (chưa cấu hình, tới heartbeat hoặc có trường vượt deadband)
+bool needsFull(const SoilPayload& data) {
+  if (!report.heartbeat || !hasSent || millis() - lastSentAt >= report.heartbeat * 1000UL) return true;
+  int32_t now[REPORT_FIELDS], last[REPORT_FIELDS];
+  nodeproto::fields(data, now);
+  nodeproto::fields(lastSent, last);
+  return nodeproto::anyBeyond(nodeproto::KIND_SOIL, now, last, report.deadband);
+}
+
+void markSent(const SoilPayload& data) {
+  lastSent = data;
+  lastSentAt = millis();
+  hasSent = true;
+}
+
+// --- BATCH ---
+uint16_t nodeSeconds() { return millis() / 1000; }
+
+// Mẫu theo chu kỳ BAT, chỉ xếp hàng khi Master cần (như needsFull của lần gửi thường)
+void takeSample() {
+  lastSample = millis();
+  SoilPayload data;
+  readSensors(data);
+  if (!needsFull(data)) return;
+  markSent(data); // Mẫu trong hàng tới Master theo thứ tự, làm mốc deadband luôn
+  samples.push(nodeSeconds(), data);
+  if (ackMode && ackLoaded) preloadReading(); // ACK kế tiếp mang luôn mẫu mới
+}
+
+// Gửi liên tiếp các khung batch tới khi hết hàng, khung lỗi giữ lại cho lần sau
+bool sendBatch() {
+  uint8_t frame[32];
+  frame[0] = (uint8_t)myAddress;
+  bool ok = true;
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  while (ok && !samples.empty()) {
+    uint8_t taken;
+    uint8_t len = 1 + samples.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), taken);
+    ok = radio.write(frame, len);
+    if (ok) samples.drop(taken);
+  }
+  resumeListening();
+  return ok;
+}
+
+// Gói nào tới pipe 1 cũng lấy đi payload đang nạp nên mỗi lần nhận phải nạp lại.
+// Hàng đợi còn mẫu thì nạp khung batch, số đo hiện tại chờ lượt mẫu kế tiếp.
+void preloadReading() {
+  uint8_t frame[32];
+  uint8_t len;
+  frame[0] = (uint8_t)myAddress; // Master kiểm tra addr để bỏ payload cũ của lần phát khác
+  if (!samples.empty()) {
+    len = 1 + samples.pack(frame + 1, sizeof(frame) - 1, nodeSeconds(), preloadTaken);
+    preloadFull = false;
+  } else {
+    preloadTaken = 0;
+    readSensors(preloaded);
+    preloadFull = needsFull(preloaded);
+    memcpy(frame + 1, &preloaded, sizeof(preloaded));
+    len = preloadFull ? 1 + sizeof(preloaded) : 1;
+  }
+
+  radio.flush_tx();
+  ackLoaded = radio.writeAckPayload(1, frame, len);
+  lastPreload = millis();
+}
+
+// --- PUSH MODE: gửi dữ liệu không cần GET ---
+// beacon: lần thức của node ngủ luôn phải phát để Master biết cửa sổ nghe, số đo
+// không đổi thì chỉ gửi addr. Push thường không đổi thì bỏ luôn, coi như thành công.
+bool sendPush(bool beacon) {
+  if (!samples.empty()) return sendBatch();
+  uint8_t frame[1 + sizeof(SoilPayload)];
+  SoilPayload data;
+  readSensors(data);
+  bool full = needsFull(data);
+  if (!full && !beacon) return true;
+  frame[0] = (uint8_t)myAddress; // Master tra bảng địa chỉ để biết node nào
+  memcpy(frame + 1, &data, sizeof(data));
+
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  bool ok = radio.write(&frame, full ? sizeof(frame) : 1);
+  resumeListening();
+  if (ok && full) markSent(data);
+  return ok;
+}
+
+// --- KÊNH RADIO ---
+
+// Master không ACK sau mọi lần thử: có thể Master đã đổi kênh trong lúc node ngủ hoặc bận
+// phát. Gửi [addr] (Master coi là "không đổi") trên từng kênh còn lại, có ACK thì ở lại kênh đó.
+bool searchChannel() {
+  uint8_t frame = (uint8_t)myAddress;
+  bool ok = false;
+  beginUplink();
+  radio.openWritingPipe(PUSH_PIPE);
+  radio.setRetries(15, SEARCH_RETRIES);
+  for (uint8_t i = 0; i < nodeproto::CHANNEL_COUNT && !ok; i++) {
+    if (nodeproto::CHANNELS[i] == radioChannel) continue;
+    radio.setChannel(nodeproto::CHANNELS[i]);
+    ok = radio.write(&frame, sizeof(frame));
+    if (ok) radioChannel = nodeproto::CHANNELS[i];
+  }
+  radio.setRetries(15, 15);
+  radio.setChannel(radioChannel);
+  resumeListening();
+  if (!ok) return false;
+  EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+  Serial.print("Channel found: "); Serial.println(radioChannel);
+  return true;
+}
+
+void applyChannel(const ChannelPacket& chn) {
+  if (!nodeproto::validChannel(chn.channel) || chn.channel == radioChannel) return; // Bản lặp của gói phát chung
+  radioChannel = chn.channel;
+  radio.stopListening();
+  radio.setChannel(radioChannel);
+  EEPROM.write(EEPROM_ADDR_CHANNEL, radioChannel);
+  resumeListening();
+  Serial.print("CHN: channel = "); Serial.println(radioChannel);
+}
+
+// --- TỐC ĐỘ LIÊN KẾT ---
+
+// Master chỉ nghe ở tốc độ gốc: gói node tự phát dừng nghe qua đây thay cho stopListening()
+void beginUplink() {
+  radio.stopListening();
+  radio.setDataRate(RF24_250KBPS);
+  radio.setPALevel(RF24_PA_HIGH);
+}
+
+// ACK của chính gói LNK đã đi ở tốc độ cũ, từ gói sau mới nghe ở tốc độ mới
+void applyLink(const LinkPacket& lnk) {
+  if (lnk.rate >= nodeproto::RATE_COUNT || lnk.pa > RF24_PA_MAX) return;
+  linkRate = lnk.rate;
+  linkPa = lnk.pa;
+  linkLease = lnk.lease;
+  linkHeard = millis();
+  radio.stopListening();
+  resumeListening();
+  Serial.print("LNK: kbps = "); Serial.println(nodeproto::rateKbps(linkRate));
+}
+
+// Quá lease không có GET: Master không còn hỏi được ở tốc độ này (liên kết xấu đi, Master
+// khởi động lại) và sẽ thử lại ở tốc độ gốc
+void checkLinkLease() {
+  if (linkRate == nodeproto::RATE_BASE || millis() - linkHeard < linkLease * 1000UL) return;
+  linkRate = nodeproto::RATE_BASE;
+  linkPa = RF24_PA_HIGH;
+  radio.stopListening();
+  resumeListening();
+  Serial.println("LNK: lease expired");
+}
+
+void pushReading() {
+  bool ok = sendPush(false);
+
+  // Master có thể đang bận quét, thử lại sau vài trăm ms thay vì chờ hết chu kỳ
+  if (!ok && ++pushFails <= PUSH_MAX_RETRIES) {
+    nextPush = millis() + random(50, 300);
+    return;
+  }
+  if (!ok && searchChannel()) ok = sendPush(false);
+  Serial.println(ok ? "Push OK." : "Push FAILED.");
+  pushFails = 0;
+  nextPush = millis() + pushInterval * 1000UL;
+}
+
+void applyConfig(const ConfigPacket& cfg) {
+  pushInterval = cfg.pushInterval;
+  EEPROM.put(EEPROM_ADDR_PUSH, pushInterval);
+  nextPush = millis();
+  Serial.print("CFG: push interval = "); Serial.println(pushInterval);
+}
+
+void applySleep(const SleepPacket& slp) {
+  wakePeriod = slp.wakePeriod;
+  EEPROM.put(EEPROM_ADDR_SLEEP, wakePeriod);
+  if (wakePeriod) { linkRate = nodeproto::RATE_BASE; linkPa = RF24_PA_HIGH; } // Node ngủ chỉ nghe sau gói push
+  Serial.print("SLP: wake period = "); Serial.println(wakePeriod);
+}
+
+void applyReport(const ReportPacket& rpt) {
+  report.heartbeat = rpt.heartbeat;
+  memcpy(report.deadband, rpt.deadband, sizeof(report.deadband));
+  EEPROM.put(EEPROM_ADDR_REPORT, report);
+  hasSent = false; // Master cũng chờ một bản đủ làm mốc
+  Serial.print("RPT: heartbeat = "); Serial.println(report.heartbeat);
+}
+
+// Tắt (0) vẫn gửi nốt các mẫu đang xếp hàng
+void applySample(const SamplePacket& bat) {
+  sampleInterval = bat.sampleInterval;
+  EEPROM.put(EEPROM_ADDR_SAMPLE, sampleInterval);
+  lastSample = millis() - sampleInterval * 1000UL; // Mẫu đầu tiên lấy ngay
+  Serial.print("BAT: sample interval = "); Serial.println(sampleInterval);
+}
+
+#ifdef SIM_NODE_FIRMWARE
+// Bản giả lập: đồng hồ ảo vẫn chạy, radio đã tắt nên không nhận được gì
+void sleepFor(unsigned long ms) { delay(ms); }
+#else
+ISR(WDT_vect) {} // Chỉ dùng để đánh thức MCU
+
+extern volatile unsigned long timer0_millis;
+
+// Ngủ power-down theo từng bước WDT 8s..16ms. Timer0 dừng khi ngủ nên cộng bù
+// vào millis(); WDT lệch ~10% nhưng Master chỉ dựa vào gói push nên không sao.
+void sleepFor(unsigned long ms) {
+  static const uint16_t steps[] = { 8000, 4000, 2000, 1000, 500, 250, 125, 64, 32, 16 };
+  Serial.flush();
+  ADCSRA &= ~_BV(ADEN);
+  while (ms >= 16 && digitalRead(PIN_BTN) == HIGH) { // Nhấn nút thì thức ngay sau bước hiện tại
+    uint8_t i = 0;
+    while (steps[i] > ms) i++;
+    uint8_t wdp = 9 - i; // WDP = 9 -> 8s, 0 -> 16ms
+    noInterrupts();
+    MCUSR &= ~_BV(WDRF);
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | ((wdp & 8) ? _BV(WDP3) : 0) | (wdp & 7);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+    wdt_disable();
+    noInterrupts(); timer0_millis += steps[i]; interrupts();
+    ms -= steps[i];
+  }
+  ADCSRA |= _BV(ADEN);
+}
+#endif
+
+// --- LOW POWER: thức, gửi số đo, nghe WAKE_WINDOW_MS rồi ngủ tới hết chu kỳ ---
+void wakeCycle() {
+  unsigned long start = millis();
+  restartSampler();
+  while (!samplerReady()) serviceSampler(); // ~48ms: MEDIAN_TAPS mẫu 12 bit mỗi kênh
+  if (sampleInterval && millis() - lastSample >= sampleInterval * 1000UL) takeSample();
+  radio.powerUp(); // Sau khi lọc xong: CE vẫn cao nên radio vào RX (~13.5mA) ngay
+  bool ok = sendPush(true);
+  for (uint8_t i = 0; !ok && i < PUSH_MAX_RETRIES; i++) {
+    delay(random(5, 30));
+    ok = sendPush(true);
+  }
+  if (!ok && searchChannel()) ok = sendPush(true);
+  Serial.println(ok ? "Wake: push OK." : "Wake: push FAILED.");
+
+  // Master chỉ gửi lệnh (CFG/SLP/GET) sau khi nhận được gói push
+  unsigned long windowStart = millis();
+  while (ok && wakePeriod && millis() - windowStart < WAKE_WINDOW_MS) listenAndReply();
+  if (!wakePeriod) return; // Master tắt chế độ ngủ, radio vẫn đang nghe
+
+  radio.powerDown();
+  unsigned long period = wakePeriod * 1000UL;
+  // Chu kỳ BAT ngắn hơn chu kỳ thức: thức giữa chừng chỉ để lấy mẫu, mẫu chờ lần phát sau
+  while (millis() - start < period && digitalRead(PIN_BTN) == HIGH) {
+    unsigned long left = period - (millis() - start);
+    unsigned long since = millis() - lastSample;
+    unsigned long toSample = since < sampleInterval * 1000UL ? sampleInterval * 1000UL - since : 0;
+    if (!sampleInterval || toSample >= left) { sleepFor(left); break; }
+    sleepFor(toSample);
+    restartSampler();
+    while (!samplerReady()) serviceSampler();
+    takeSample();
+  }
+}
+
+void listenAndReply() {
+  if (ackMode && (!ackLoaded || millis() - lastPreload >= ACK_REFRESH_MS)) preloadReading();
+
   if (radio.available()) {
-    char req[5] = {0};
-    radio.read(&req, sizeof(req)); 
+    char req[32] = {0};
+    uint8_t len = radio.getDynamicPayloadSize();
+    radio.read(&req, len); 
+    bool hadPreload = ackLoaded;
+    ackLoaded = false;
     
     if (strncmp(req, "GET", 3) == 0) {
+      linkHeard = millis();
+      bool wantAck = req[3] == 'A';
+      if (wantAck && hadPreload) {
+        Serial.println("CMD: GET answered in ACK.");
+        if (preloadTaken) samples.drop(preloadTaken);
+        else if (preloadFull) markSent(preloaded);
+        preloadReading();
+        return;
+      }
+      if (ackMode && !wantAck) radio.flush_tx(); // Master cũ, đừng để payload treo trong FIFO
+      ackMode = wantAck;
+
       digitalWrite(PIN_LED, HIGH);
       Serial.println("CMD: GET received.");
       
-      SoilData data;
+      SoilPayload data;
       readSensors(data);
       
-      radio.stopListening();
+      beginUplink();
       radio.openWritingPipe(myAddress);
       
       if (radio.write(&data, sizeof(data))) {
           Serial.println("Data Sent. Waiting for OK...");
-          radio.openReadingPipe(1, myAddress);
-          radio.startListening();
+          markSent(data); // Trả lời GET luôn đủ số đo
+          resumeListening();
           unsigned long waitAck = millis();
           while(millis() - waitAck < 150) { 
              if(radio.available()) {
@@ -205,11 +768,34 @@ void listenAndReply() {
           }
       } else {
           Serial.println("Data Send Failed.");
+          resumeListening();
       }
       
       digitalWrite(PIN_LED, LOW);
-    } else {
-        char trash[32]; radio.read(&trash, sizeof(trash)); 
+    } else if (len == sizeof(ConfigPacket) && strncmp(req, "CFG", 3) == 0) {
+      ConfigPacket cfg;
+      memcpy(&cfg, req, sizeof(cfg));
+      applyConfig(cfg);
+    } else if (len == sizeof(SleepPacket) && strncmp(req, "SLP", 3) == 0) {
+      SleepPacket slp;
+      memcpy(&slp, req, sizeof(slp));
+      applySleep(slp);
+    } else if (len == sizeof(ReportPacket) && strncmp(req, "RPT", 3) == 0) {
+      ReportPacket rpt;
+      memcpy(&rpt, req, sizeof(rpt));
+      applyReport(rpt);
+    } else if (len == sizeof(SamplePacket) && strncmp(req, "BAT", 3) == 0) {
+      SamplePacket bat;
+      memcpy(&bat, req, sizeof(bat));
+      applySample(bat);
+    } else if (len == sizeof(ChannelPacket) && strncmp(req, "CHN", 3) == 0) {
+      ChannelPacket chn;
+      memcpy(&chn, req, sizeof(chn));
+      applyChannel(chn);
+    } else if (len == sizeof(LinkPacket) && strncmp(req, "LNK", 3) == 0) {
+      LinkPacket lnk;
+      memcpy(&lnk, req, sizeof(lnk));
+      applyLink(lnk);
     }
   }
 }
\ No newline at end of file